@@ -15,15 +15,34 @@
 #define MAX_DATA_BLOCK_SIZE 256 // Example value, adjust as needed
 
 //#define CCID_SUPPORTS_SHORT_APDU
-//#define CCID_SUPPORTS_EXTENDED_APDU
+#define CCID_SUPPORTS_EXTENDED_APDU
 
-// Automatically calculate MAX_DATA_SIZE based on settings
-#if defined(CCID_MEMORY_LIMITED) && defined(CCID_SUPPORTS_TPDU_T0)
-    #define MAX_DATA_SIZE 255 
-#elif defined(CCID_SUPPORTS_EXTENDED_APDU)
-    #define MAX_DATA_SIZE 65544
+// Longest command or response APDU, header and trailer included
+#if defined(CCID_SUPPORTS_EXTENDED_APDU)
+    #define MAX_APDU_SIZE 65544
+#else
+    #define MAX_APDU_SIZE 261
+#endif
+
+// MAX_DATA_SIZE is the data of one bulk message. Longer APDUs and responses
+// are chained through it (wLevelParameter/bChainParameter).
+// With CCID_MEMORY_LIMITED commands are taken in one packet at a time and
+// never held whole, so a message can carry a whole APDU at no memory cost.
+#if defined(CCID_MEMORY_LIMITED)
+    #define MAX_DATA_SIZE MAX_APDU_SIZE
 #else // A reasonable default if nothing else is defined
     #define MAX_DATA_SIZE 1024 
 #endif 
 
+// Slots of the reader, each with its own card and command state. A busy
+// slot holds up to two bulk IN requests (response and ZLP), so
+// 2 * CCID_MAX_SLOTS + 1 must not exceed USB_EP_QUEUE_DEPTH.
+#ifndef CCID_MAX_SLOTS
+    #define CCID_MAX_SLOTS 3U
+#endif
+
+// Card backend: uncomment to answer APDUs from the virtual card of
+// xusb_ccid_vcard.c in every slot instead of the default card
+//#define CCID_VIRTUAL_CARD
+
 #endif // CCID_CONFIG_H
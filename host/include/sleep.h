@@ -0,0 +1,19 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sleep.h
+ *
+ * Host stand-in for the standalone BSP delays.
+ *
+ *****************************************************************************/
+
+#ifndef SLEEP_H
+#define SLEEP_H
+
+#include <unistd.h>
+
+#endif  /* SLEEP_H */
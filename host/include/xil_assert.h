@@ -0,0 +1,40 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xil_assert.h
+ *
+ * Host stand-in for the standalone BSP assertions, a failed assertion
+ * aborts the program.
+ *
+ *****************************************************************************/
+
+#ifndef XIL_ASSERT_H
+#define XIL_ASSERT_H
+
+#include "xil_types.h"
+
+void Xil_Assert(const char *File, s32 Line);
+
+#define Xil_AssertVoid(Expression)				\
+	do {							\
+		if (!(Expression)) {				\
+			Xil_Assert(__FILE__, __LINE__);		\
+			return;					\
+		}						\
+	} while (0)
+
+#define Xil_AssertNonvoid(Expression)				\
+	do {							\
+		if (!(Expression)) {				\
+			Xil_Assert(__FILE__, __LINE__);		\
+			return 0;				\
+		}						\
+	} while (0)
+
+#define Xil_AssertVoidAlways()	Xil_Assert(__FILE__, __LINE__)
+
+#endif  /* XIL_ASSERT_H */
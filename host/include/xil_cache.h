@@ -0,0 +1,37 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xil_cache.h
+ *
+ * Host stand-in for the standalone BSP cache maintenance. The host is
+ * cache coherent, the operations do nothing.
+ *
+ *****************************************************************************/
+
+#ifndef XIL_CACHE_H
+#define XIL_CACHE_H
+
+#include "xil_types.h"
+
+static inline void Xil_DCacheFlush(void) { }
+static inline void Xil_DCacheFlushRange(INTPTR Addr, INTPTR Len)
+{
+	(void)Addr;
+	(void)Len;
+}
+static inline void Xil_DCacheInvalidateRange(INTPTR Addr, INTPTR Len)
+{
+	(void)Addr;
+	(void)Len;
+}
+static inline void Xil_ICacheInvalidateRange(INTPTR Addr, INTPTR Len)
+{
+	(void)Addr;
+	(void)Len;
+}
+
+#endif  /* XIL_CACHE_H */
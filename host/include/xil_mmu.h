@@ -0,0 +1,29 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xil_mmu.h
+ *
+ * Host stand-in for the standalone BSP translation table control. Memory
+ * attributes cannot be changed, the calls do nothing.
+ *
+ *****************************************************************************/
+
+#ifndef XIL_MMU_H
+#define XIL_MMU_H
+
+#include "xil_types.h"
+
+#define NORM_WB_CACHE	0x705U
+#define NORM_NONCACHE	0x401U
+
+static inline void Xil_SetTlbAttributes(UINTPTR Addr, u64 Attrib)
+{
+	(void)Addr;
+	(void)Attrib;
+}
+
+#endif  /* XIL_MMU_H */
@@ -0,0 +1,21 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xil_printf.h
+ *
+ * Host stand-in for the standalone BSP console output.
+ *
+ *****************************************************************************/
+
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+#include <stdio.h>
+
+#define xil_printf	printf
+
+#endif  /* XIL_PRINTF_H */
@@ -0,0 +1,28 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xiltimer.h
+ *
+ * Host stand-in for the standalone BSP time stamps, in nanoseconds of
+ * CLOCK_MONOTONIC. UsbSim_TimerSet() models the comparator of the generic
+ * timer, see UsbTimerArm().
+ *
+ *****************************************************************************/
+
+#ifndef XILTIMER_H
+#define XILTIMER_H
+
+#include "xil_types.h"
+
+typedef u64 XTime;
+
+#define COUNTS_PER_SECOND	1000000000U
+
+void XTime_GetTime(XTime *Xtime_Global);
+void UsbSim_TimerSet(u64 Compare, u32 Enable);
+
+#endif  /* XILTIMER_H */
@@ -0,0 +1,21 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xparameters.h
+ *
+ * Host stand-in for the generated hardware parameters.
+ *
+ *****************************************************************************/
+
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+#define XPAR_XUSBPSU_0_DEVICE_ID	0U
+#define XPAR_XUSBPSU_0_BASEADDR		0xFE200000U
+#define XPAR_CPU_ID			0U
+
+#endif  /* XPARAMETERS_H */
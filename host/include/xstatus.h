@@ -0,0 +1,28 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xstatus.h
+ *
+ * Host stand-in for the standalone BSP status codes.
+ *
+ *****************************************************************************/
+
+#ifndef XSTATUS_H
+#define XSTATUS_H
+
+#include "xil_types.h"
+
+#define XST_SUCCESS		0L
+#define XST_FAILURE		1L
+#define XST_DEVICE_NOT_FOUND	2L
+#define XST_NO_DATA		13L
+#define XST_INVALID_PARAM	15L
+#define XST_NO_FEATURE		19L
+#define XST_DEVICE_BUSY		21L
+#define XST_BUFFER_TOO_SMALL	28L
+
+#endif  /* XSTATUS_H */
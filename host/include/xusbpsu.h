@@ -0,0 +1,210 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusbpsu.h
+ *
+ * Host stand-in for the XUsbPsu driver interface, implemented by the
+ * simulated controller in usb_sim.c. Only what xusb_wrapper.c and the
+ * class drivers use is provided. Names and values follow the driver.
+ *
+ *****************************************************************************/
+
+#ifndef XUSBPSU_H
+#define XUSBPSU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+#include "xil_assert.h"
+#include "xparameters.h"
+
+/************************** Constant Definitions ****************************/
+#define ALIGNMENT_CACHELINE		__attribute__ ((aligned(64)))
+
+#define XUSBPSU_ENDPOINTS_NUM		12U
+
+#define XUSBPSU_EP_DIR_IN		1U
+#define XUSBPSU_EP_DIR_OUT		0U
+
+#define XUSBPSU_ENDPOINT_XFER_CONTROL	0U
+#define XUSBPSU_ENDPOINT_XFER_ISOC	1U
+#define XUSBPSU_ENDPOINT_XFER_BULK	2U
+#define XUSBPSU_ENDPOINT_XFER_INT	3U
+
+#define XUSBPSU_EP_ENABLED		0x00000001U
+#define XUSBPSU_EP_STALL		0x00000002U
+#define XUSBPSU_EP_BUSY			0x00000010U
+
+#define XUSBPSU_STATE_ATTACHED		0U
+#define XUSBPSU_STATE_POWERED		1U
+#define XUSBPSU_STATE_DEFAULT		2U
+#define XUSBPSU_STATE_ADDRESS		3U
+#define XUSBPSU_STATE_CONFIGURED	4U
+#define XUSBPSU_STATE_SUSPENDED		5U
+
+#define XUSBPSU_SPEED_UNKNOWN		0U
+#define XUSBPSU_SPEED_LOW		1U
+#define XUSBPSU_SPEED_FULL		2U
+#define XUSBPSU_SPEED_HIGH		3U
+#define XUSBPSU_SPEED_SUPER		4U
+
+#define XUSBPSU_DCFG_SPEED_MASK		7U
+#define XUSBPSU_DCFG_SUPERSPEED		4U
+#define XUSBPSU_DCFG_HIGHSPEED		0U
+#define XUSBPSU_DCFG_FULLSPEED2		1U
+#define XUSBPSU_DCFG_LOWSPEED		2U
+#define XUSBPSU_DCFG_FULLSPEED1		3U
+
+#define XUSBPSU_TEST_J			1U
+#define XUSBPSU_TEST_K			2U
+#define XUSBPSU_TEST_SE0_NAK		3U
+#define XUSBPSU_TEST_PACKET		4U
+#define XUSBPSU_TEST_FORCE_ENABLE	5U
+
+#define XUSBPSU_LPM_MODE		1U
+
+#define XUSBPSU_EVENT_BUFFERS_SIZE	256U
+
+/* Registers modelled by the simulation */
+#define XUSBPSU_GEVNTSIZ(n)		(0x0000C408U + ((n) * 0x10U))
+#define XUSBPSU_GEVNTCOUNT(n)		(0x0000C40CU + ((n) * 0x10U))
+#define XUSBPSU_GEVNTSIZ_INTMASK	0x80000000U
+
+#define XUSBPSU_DEVTEN_VNDRDEVTSTRCVEDEN	0x00001000U
+#define XUSBPSU_DEVTEN_EVNTOVERFLOWEN	0x00000800U
+#define XUSBPSU_DEVTEN_CMDCMPLTEN	0x00000400U
+#define XUSBPSU_DEVTEN_ERRTICERREN	0x00000200U
+#define XUSBPSU_DEVTEN_SOFEN		0x00000080U
+#define XUSBPSU_DEVTEN_EOPFEN		0x00000040U
+#define XUSBPSU_DEVTEN_HIBERNATIONREQEVTEN	0x00000020U
+#define XUSBPSU_DEVTEN_WKUPEVTEN	0x00000010U
+#define XUSBPSU_DEVTEN_ULSTCNGEN	0x00000008U
+#define XUSBPSU_DEVTEN_CONNECTDONEEN	0x00000004U
+#define XUSBPSU_DEVTEN_USBRSTEN		0x00000002U
+#define XUSBPSU_DEVTEN_DISCONNEVTEN	0x00000001U
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u8  bRequestType;
+	u8  bRequest;
+	u16 wValue;
+	u16 wIndex;
+	u16 wLength;
+} __attribute__ ((packed)) SetupPacket;
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	u8 IsCacheCoherent;
+	u8 EnableSuperSpeed;
+} XUsbPsu_Config;
+
+typedef XUsbPsu_Config Usb_Config;
+
+struct Usb_DevData {
+	u8 Speed;
+	u8 State;
+	void *PrivateData;
+};
+
+struct XUsbPsu_EvtBuffer {
+	void *BuffAddr;
+	u32 Offset;
+	u32 Count;
+	u32 Flags;
+};
+
+struct XUsbPsu_Ep {
+	void (*Handler)(void *, u32, u32);
+	u32 EpStatus;
+	u32 RequestedBytes;
+	u32 BytesTxed;
+	u32 Interval;
+	u16 MaxSize;
+	u8 *BufferPtr;
+	u8 PhyEpNum;
+	u8 UsbEpNum;
+	u8 Type;
+	u8 Direction;
+};
+
+struct XUsbPsu {
+	XUsbPsu_Config *ConfigPtr;
+	struct XUsbPsu_Ep eps[XUSBPSU_ENDPOINTS_NUM];
+	struct XUsbPsu_EvtBuffer Evt;
+	SetupPacket SetupData ALIGNMENT_CACHELINE;
+	void (*Chapter9)(struct Usb_DevData *, SetupPacket *);
+	void (*ResetHandler)(struct Usb_DevData *);
+	void (*DisconnectHandler)(struct Usb_DevData *);
+	void *AppData;
+	void *DrvData;
+	u32 DevtenMask;
+	u32 Speed;
+	u8 IsConfigDone;
+	u8 IsHibernated;
+	u8 HasHibernation;
+};
+
+/************************** Function Prototypes ******************************/
+XUsbPsu_Config *XUsbPsu_LookupConfig(u16 DeviceId);
+s32 XUsbPsu_CfgInitialize(struct XUsbPsu *InstancePtr,
+			  XUsbPsu_Config *ConfigPtr, u32 BaseAddress);
+s32 XUsbPsu_Start(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_Stop(struct XUsbPsu *InstancePtr);
+void XUsbPsu_IntrHandler(void *XUsbPsuInstancePtr);
+void XUsbPsu_WakeUpIntrHandler(void *XUsbPsuInstancePtr);
+void XUsbPsu_EnableIntr(struct XUsbPsu *InstancePtr, u32 Mask);
+void XUsbPsu_DisableIntr(struct XUsbPsu *InstancePtr, u32 Mask);
+u32 XUsbPsu_ReadReg(struct XUsbPsu *InstancePtr, u32 Offset);
+void XUsbPsu_WriteReg(struct XUsbPsu *InstancePtr, u32 Offset, u32 Data);
+
+void XUsbPsu_set_ch9handler(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *, SetupPacket *));
+void XUsbPsu_set_rsthandler(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *));
+void XUsbPsu_set_disconnect(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *));
+void *XUsbPsu_get_drvdata(struct XUsbPsu *InstancePtr);
+void XUsbPsu_set_drvdata(struct XUsbPsu *InstancePtr, void *data);
+
+void XUsbPsu_SetEpHandler(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir,
+			  void (*Handler)(void *, u32, u32));
+s32 XUsbPsu_EpEnable(struct XUsbPsu *InstancePtr, u8 UsbEpNum, u8 Dir,
+		     u16 Maxsize, u8 Type, u8 Restore);
+s32 XUsbPsu_EpDisable(struct XUsbPsu *InstancePtr, u8 UsbEpNum, u8 Dir);
+s32 XUsbPsu_EpBufferSend(struct XUsbPsu *InstancePtr, u8 UsbEp,
+			 u8 *BufferPtr, u32 BufferLen);
+s32 XUsbPsu_EpBufferRecv(struct XUsbPsu *InstancePtr, u8 UsbEp,
+			 u8 *BufferPtr, u32 Length);
+void XUsbPsu_EpSetStall(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir);
+void XUsbPsu_EpClearStall(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir);
+s32 XUsbPsu_IsEpStalled(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir);
+void XUsbPsu_Ep0StallRestart(struct XUsbPsu *InstancePtr);
+void XUsbPsu_StopTransfer(struct XUsbPsu *InstancePtr, u8 UsbEpNum,
+			  u8 Dir, u8 Force);
+
+s32 XUsbPsu_SetDeviceAddress(struct XUsbPsu *InstancePtr, u16 Addr);
+void XUsbPsu_SetSpeed(struct XUsbPsu *InstancePtr, u32 Speed);
+s32 XUsbPsu_IsSuperSpeed(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_SetTestMode(struct XUsbPsu *InstancePtr, u32 Mode);
+s32 XUsbPsu_SetU1SleepTimeout(struct XUsbPsu *InstancePtr, u8 Sleep);
+s32 XUsbPsu_SetU2SleepTimeout(struct XUsbPsu *InstancePtr, u8 Sleep);
+s32 XUsbPsu_AcceptU1U2Sleep(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_U1SleepEnable(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_U2SleepEnable(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_U1SleepDisable(struct XUsbPsu *InstancePtr);
+s32 XUsbPsu_U2SleepDisable(struct XUsbPsu *InstancePtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSBPSU_H */
@@ -0,0 +1,146 @@
+# SPDX-License-Identifier: MIT
+#
+# Builds the host simulation in the Debug and Release profiles, runs
+# sim_bench on both and prints the size of sim_bench and the results of
+# each point side by side. Run it through the host build:
+#   cmake --build build-host --target profile_compare
+# or on its own:
+#   cmake -DSOURCE_DIR=host -DBINARY_DIR=build-profiles \
+#	  -P host/profile_compare.cmake
+#
+# USB_SIM_DEFINES are the firmware options of both builds, separated by
+# commas. BENCH_MB is the sim_bench budget per point, -b.
+#
+# The simulation is compiled for the host, so the sizes are those of the
+# host code. --print-memory-usage only reports the regions of lscript.ld
+# and comes with the firmware build, cmake -DUSB_BUILD_PROFILE=Release.
+cmake_minimum_required(VERSION 3.19)
+
+if(NOT DEFINED SOURCE_DIR OR NOT DEFINED BINARY_DIR)
+	message(FATAL_ERROR "SOURCE_DIR and BINARY_DIR are required")
+endif()
+if(NOT DEFINED USB_SIM_DEFINES)
+	set(USB_SIM_DEFINES "USB_TELEMETRY,USB_LATENCY_TRACE")
+endif()
+if(NOT DEFINED BENCH_MB)
+	set(BENCH_MB 32)
+endif()
+string(REPLACE "," ";" Defines "${USB_SIM_DEFINES}")
+find_program(SIZE_TOOL size REQUIRED)
+
+set(Profiles Debug Release)
+
+# Left aligned in Width columns
+function(pad Out Text Width)
+	string(LENGTH "${Text}" Length)
+	while(Length LESS Width)
+		string(APPEND Text " ")
+		math(EXPR Length "${Length} + 1")
+	endwhile()
+	set(${Out} "${Text}" PARENT_SCOPE)
+endfunction()
+
+# Decimal number as an integer scaled by 100, rounded
+function(centi Out Number)
+	if(NOT Number MATCHES "^([0-9]+)(\\.([0-9]*))?$")
+		set(${Out} 0 PARENT_SCOPE)
+		return()
+	endif()
+	set(Fraction "${CMAKE_MATCH_3}000")
+	string(SUBSTRING "${Fraction}" 0 3 Fraction)
+	math(EXPR Value
+	     "(${CMAKE_MATCH_1} * 1000 + 1${Fraction} - 1000 + 5) / 10")
+	set(${Out} ${Value} PARENT_SCOPE)
+endfunction()
+
+# Decimal number with one decimal
+function(fixed Out Number)
+	centi(Value "${Number}")
+	math(EXPR Value "(${Value} + 5) / 10")
+	math(EXPR Whole "${Value} / 10")
+	math(EXPR Fraction "${Value} % 10")
+	set(${Out} "${Whole}.${Fraction}" PARENT_SCOPE)
+endfunction()
+
+# Runs a step of the comparison, its output is only shown if it fails
+function(step)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE Result
+		OUTPUT_VARIABLE Output ERROR_VARIABLE Output)
+	if(NOT Result EQUAL 0)
+		message(FATAL_ERROR "${Output}")
+	endif()
+endfunction()
+
+# Ratio A / B with two decimals
+function(ratio Out A B)
+	centi(A "${A}")
+	centi(B "${B}")
+	if(B EQUAL 0)
+		set(${Out} "-" PARENT_SCOPE)
+		return()
+	endif()
+	math(EXPR Value "(${A} * 100 + ${B} / 2) / ${B}")
+	math(EXPR Whole "${Value} / 100")
+	math(EXPR Fraction "${Value} % 100 + 100")
+	string(SUBSTRING "${Fraction}" 1 2 Fraction)
+	set(${Out} "${Whole}.${Fraction}" PARENT_SCOPE)
+endfunction()
+
+foreach(Profile IN LISTS Profiles)
+	set(Dir ${BINARY_DIR}/${Profile})
+	message(STATUS "${Profile}: building and running sim_bench")
+	step(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${Dir}
+	     -DUSB_BUILD_PROFILE=${Profile} "-DUSB_SIM_DEFINES=${Defines}")
+	step(${CMAKE_COMMAND} --build ${Dir} --target sim_bench)
+	step(${Dir}/sim_bench -b ${BENCH_MB} -o ${Dir}/sim_bench.json)
+	file(READ ${Dir}/sim_bench.json Json_${Profile})
+
+	# text data bss dec hex filename
+	execute_process(COMMAND ${SIZE_TOOL} ${Dir}/sim_bench
+		OUTPUT_VARIABLE Size COMMAND_ERROR_IS_FATAL ANY)
+	string(REGEX MATCH "\n *([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)" Size
+	       "${Size}")
+	set(Text_${Profile} ${CMAKE_MATCH_1})
+	set(Data_${Profile} ${CMAKE_MATCH_2})
+	set(Bss_${Profile} ${CMAKE_MATCH_3})
+endforeach()
+
+pad(Line "sim_bench size" 28)
+message("${Line}Debug         Release       Release/Debug")
+foreach(Section Text Data Bss)
+	string(TOLOWER ${Section} Name)
+	pad(Line "  ${Name}" 28)
+	pad(Column "${${Section}_Debug}" 14)
+	string(APPEND Line "${Column}")
+	pad(Column "${${Section}_Release}" 14)
+	string(APPEND Line "${Column}")
+	ratio(Change "${${Section}_Release}" "${${Section}_Debug}")
+	message("${Line}${Change}")
+endforeach()
+
+message("")
+pad(Line "sim_bench point" 28)
+foreach(Title "MB/s Debug" "Release" "ns/cmd Debug" "Release")
+	pad(Column "${Title}" 14)
+	string(APPEND Line "${Column}")
+endforeach()
+message("${Line}Speedup")
+string(JSON Count LENGTH "${Json_Debug}" results)
+math(EXPR Last "${Count} - 1")
+foreach(Index RANGE ${Last})
+	string(JSON Workload GET "${Json_Debug}" results ${Index} workload)
+	string(JSON Size GET "${Json_Debug}" results ${Index} size)
+	pad(Line "  ${Workload} ${Size}" 28)
+	foreach(Field mb_per_s fw_ns_per_cmd)
+		foreach(Profile IN LISTS Profiles)
+			string(JSON Value GET "${Json_${Profile}}" results
+			       ${Index} ${Field})
+			fixed(Value "${Value}")
+			set(${Field}_${Profile} ${Value})
+			pad(Column "${Value}" 14)
+			string(APPEND Line "${Column}")
+		endforeach()
+	endforeach()
+	ratio(Speedup "${fw_ns_per_cmd_Debug}" "${fw_ns_per_cmd_Release}")
+	message("${Line}${Speedup}")
+endforeach()
@@ -0,0 +1,493 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_bench.c
+ *
+ * Mass storage benchmark on the simulated controller. Generated READ(10) and
+ * WRITE(10) commands go through the bulk-only transport into ParseCBW() and
+ * the bulk endpoint handlers:
+ *
+ *   seq-read, seq-write	consecutive LBAs
+ *   rand-read, rand-write	random LBAs aligned to the transfer size
+ *   mixed			70% reads, random LBAs, sizes log-uniform
+ *				from 512 B to 8 MB
+ *
+ * for transfer sizes from 512 B to 8 MB. Results are written as JSON, one
+ * object per workload and size, to track them from release to release:
+ *
+ *   sim_bench [-b MB per point] [-s seed] [-m moderation ns] [-o out.json]
+ *
+ * Throughput and IOPS are taken over the wall time of the commands, which
+ * includes the copies made by the simulated host. fw_ns_per_cmd and
+ * fw_cycles_per_cmd only count the firmware: interrupt handler and main
+ * loop. Latencies are per command, CBW to CSW.
+ *
+ * Each result reports the interrupts taken, the events per interrupt and
+ * the share of wall time spent in the interrupt handler. Run once without
+ * and once with -m to compare the interrupt load with and without
+ * interrupt moderation, see UsbIntrModeration().
+ *
+ * With VFLASH_DEDUP each result also carries the state of the dedup pool
+ * after the point: chunks stored, the dedup ratio and the memory saved
+ * against a plain disk, and the time spent hashing and committing writes
+ * during the point. Writes rejected because the pool is full fail their
+ * CSW and count as errors.
+ *
+ * With USB_CACHE_MANAGED, built as sim_bench_cache, the output ends with
+ * the bytes the cache manager cleaned, invalidated and skipped over the
+ * whole run. The host caches stay coherent, the maintenance calls do
+ * nothing, so only the bookkeeping shows in the firmware time.
+ *
+ * The bulk-only transport has one command in flight and each phase is one
+ * request, so there is no queue depth to sweep. The profile_compare target
+ * of the host build runs sim_bench built in the Debug and in the Release
+ * profile and prints sizes and results side by side, see
+ * profile_compare.cmake.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "usb_sim_device.h"
+#include "usb_sim_host.h"
+#include "xusb_class_storage.h"
+#include "xusb_event.h"
+#ifdef VFLASH_DEDUP
+#include "xusb_storage_dedup.h"
+#endif
+#ifdef USB_CACHE_MANAGED
+#include "xusb_cache.h"
+#endif
+#include "xiltimer.h"
+
+/************************** Constant Definitions *****************************/
+#define BENCH_VERSION		4U
+
+#define BENCH_MIN_SIZE		512U
+#define BENCH_MAX_SIZE		0x800000U	/* 8MB */
+#define BENCH_MIN_COMMANDS	32U
+#define BENCH_MAX_COMMANDS	8192U
+#define BENCH_READ_PERCENT	70U	/* Of the mixed workload */
+
+#define BENCH_DISK_BLOCKS	(VFLASH_NUM_BLOCKS)
+
+#ifndef USB_BUILD_PROFILE_NAME
+#define USB_BUILD_PROFILE_NAME	"Debug"
+#endif
+
+/**************************** Type Definitions *******************************/
+typedef enum {
+	BENCH_SEQ_READ,
+	BENCH_SEQ_WRITE,
+	BENCH_RAND_READ,
+	BENCH_RAND_WRITE,
+	BENCH_MIXED,
+	BENCH_NUM_WORKLOADS
+} Bench_Workload;
+
+typedef struct {
+	u32 Commands;
+	u32 Errors;
+	u64 Bytes;
+	u64 WallNs;
+	u64 FirmwareNs;
+	u64 FirmwareCycles;
+	u64 *Latency;		/* ns per command, sorted when reported */
+	u32 Interrupts;
+	u32 Events;
+	UsbEvent_Load Load;
+	UsbEvent_Stats EventStats;	/* During the point */
+#ifdef VFLASH_DEDUP
+	VFlashDedup_Stats Dedup;	/* After the point */
+	u64 CommitTicks;		/* During the point */
+	u64 CommitBytes;
+	u32 PoolExhausted;
+#endif
+} Bench_Result;
+
+/************************** Variable Definitions *****************************/
+static const char *WorkloadName[BENCH_NUM_WORKLOADS] = {
+	"seq-read", "seq-write", "rand-read", "rand-write", "mixed"
+};
+
+static const u32 Sizes[] = {
+	512U, 4096U, 0x10000U, 0x100000U, BENCH_MAX_SIZE
+};
+
+/* Written data, and the buffer reads go to so that it stays as it is */
+static u8 Data[BENCH_MAX_SIZE];
+static u8 ReadData[BENCH_MAX_SIZE];
+static u64 Latency[BENCH_MAX_COMMANDS];
+static u64 Seed = 1U;
+static u32 ModerationNs;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static inline u64 NowNs(void)
+{
+	XTime Now;
+
+	XTime_GetTime(&Now);
+	return Now * (1000000000U / COUNTS_PER_SECOND);
+}
+
+static inline u64 Random(void)
+{
+	/* xorshift64*, reproducible for a given seed */
+	Seed ^= Seed >> 12;
+	Seed ^= Seed << 25;
+	Seed ^= Seed >> 27;
+	return Seed * 0x2545F4914F6CDD1DULL;
+}
+
+static int CompareU64(const void *A, const void *B)
+{
+	u64 X = *(const u64 *)A;
+	u64 Y = *(const u64 *)B;
+
+	return (X > Y) - (X < Y);
+}
+
+/*****************************************************************************/
+/**
+* Returns a transfer size for the mixed workload, log-uniform between
+* BENCH_MIN_SIZE and BENCH_MAX_SIZE.
+*
+* @param	None.
+*
+* @return	Size in bytes, a whole number of blocks.
+*
+******************************************************************************/
+static u32 MixedSize(void)
+{
+	u32 Size = BENCH_MIN_SIZE << (Random() % 14U);	/* 2^9 to 2^22 */
+
+	return Size + (u32)(Random() % (Size / VFLASH_BLOCK_SIZE)) *
+	       VFLASH_BLOCK_SIZE;
+}
+
+/*****************************************************************************/
+/**
+* Runs one command and accounts it.
+*
+* @param	Result is the result to update.
+* @param	IsRead is TRUE for READ(10).
+* @param	Lba is the first block.
+* @param	Size is the transfer size in bytes.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunCommand(Bench_Result *Result, u32 IsRead, u32 Lba, u32 Size)
+{
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u16 Blocks = (u16)(Size / VFLASH_BLOCK_SIZE);
+	u8 CswStatus;
+	u64 Start;
+	u64 End;
+	s32 Status;
+
+	UsbSim_GetStats(&Before);
+	Start = NowNs();
+
+	if (IsRead == TRUE) {
+		Status = UsbSimHost_Read10(Lba, Blocks, ReadData, &CswStatus);
+	} else {
+		Status = UsbSimHost_Write10(Lba, Blocks, Data, &CswStatus);
+	}
+
+	End = NowNs();
+	UsbSim_GetStats(&After);
+
+	if (Status != USB_SIM_OK || CswStatus != USB_SIM_HOST_CSW_PASSED) {
+		Result->Errors++;
+	}
+	Result->Latency[Result->Commands] = End - Start;
+	Result->Commands++;
+	Result->Bytes += Size;
+	Result->WallNs += End - Start;
+	Result->FirmwareNs += (After.FirmwareTicks - Before.FirmwareTicks) *
+			      (1000000000U / COUNTS_PER_SECOND);
+	Result->FirmwareCycles += After.FirmwareCycles - Before.FirmwareCycles;
+	Result->Interrupts += After.Interrupts - Before.Interrupts;
+	Result->Events += After.Events - Before.Events;
+}
+
+/*****************************************************************************/
+/**
+* Runs one workload at one transfer size.
+*
+* @param	Workload is the workload.
+* @param	Size is the transfer size, ignored by the mixed workload.
+* @param	Budget is the number of bytes to transfer.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunPoint(Bench_Workload Workload, u32 Size, u64 Budget,
+		     Bench_Result *Result)
+{
+	u64 Commands = Budget / Size;
+	u32 Lba = 0U;
+	u32 Index;
+	u32 IsRead;
+	UsbEvent_Stats EventsBefore;
+#ifdef VFLASH_DEDUP
+	VFlashDedup_Stats Before;
+#endif
+
+	if (Commands < BENCH_MIN_COMMANDS) {
+		Commands = BENCH_MIN_COMMANDS;
+	}
+	if (Commands > BENCH_MAX_COMMANDS) {
+		Commands = BENCH_MAX_COMMANDS;
+	}
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+	UsbEvent_GetLoad(&Result->Load);
+	UsbEvent_GetStats(&EventsBefore);
+#ifdef VFLASH_DEDUP
+	VFlashDedup_GetStats(&Before);
+#endif
+
+	for (Index = 0U; Index < Commands; Index++) {
+		u32 Blocks;
+
+		if (Workload == BENCH_MIXED) {
+			Size = MixedSize();
+		}
+		Blocks = Size / VFLASH_BLOCK_SIZE;
+
+		switch (Workload) {
+			case BENCH_SEQ_READ:
+			case BENCH_SEQ_WRITE:
+				if (Lba + Blocks > BENCH_DISK_BLOCKS) {
+					Lba = 0U;
+				}
+				break;
+			default:
+				Lba = (u32)(Random() % (BENCH_DISK_BLOCKS / Blocks)) *
+				      Blocks;
+				break;
+		}
+
+		if (Workload == BENCH_MIXED) {
+			IsRead = ((Random() % 100U) < BENCH_READ_PERCENT) ?
+				 TRUE : FALSE;
+		} else {
+			IsRead = (Workload == BENCH_SEQ_READ ||
+				  Workload == BENCH_RAND_READ) ? TRUE : FALSE;
+		}
+
+		RunCommand(Result, IsRead, Lba, Size);
+		Lba += Blocks;
+	}
+
+	UsbEvent_GetLoad(&Result->Load);
+	UsbEvent_GetStats(&Result->EventStats);
+	Result->EventStats.ModHolds -= EventsBefore.ModHolds;
+	Result->EventStats.ModEarly -= EventsBefore.ModEarly;
+
+#ifdef VFLASH_DEDUP
+	VFlashDedup_GetStats(&Result->Dedup);
+	Result->CommitTicks = Result->Dedup.CommitTicks - Before.CommitTicks;
+	Result->CommitBytes = Result->Dedup.BytesWritten - Before.BytesWritten;
+	Result->PoolExhausted = Result->Dedup.PoolExhausted -
+				Before.PoolExhausted;
+#endif
+}
+
+static u64 Percentile(const Bench_Result *Result, u32 Permille)
+{
+	u32 Index = (u32)(((u64)Result->Commands * Permille + 999U) / 1000U);
+
+	return Result->Latency[(Index == 0U) ? 0U : Index - 1U];
+}
+
+/*****************************************************************************/
+/**
+* Writes one result as a JSON object.
+*
+* @param	Out is the output.
+* @param	Workload is the workload.
+* @param	Size is the transfer size, 0 for the mixed workload.
+* @param	Result is the result, its latencies are sorted.
+* @param	Last is TRUE for the last object of the array.
+*
+* @return	None.
+*
+******************************************************************************/
+static void Report(FILE *Out, Bench_Workload Workload, u32 Size,
+		   Bench_Result *Result, u32 Last)
+{
+	double Seconds = (double)Result->WallNs / 1e9;
+
+	qsort(Result->Latency, Result->Commands, sizeof(u64), CompareU64);
+
+	fprintf(Out, "    {\"workload\": \"%s\", \"size\": %u, "
+		"\"commands\": %u, \"errors\": %u, "
+		"\"bytes\": %llu, \"seconds\": %.6f,\n",
+		WorkloadName[Workload], Size, Result->Commands, Result->Errors,
+		(unsigned long long)Result->Bytes, Seconds);
+	fprintf(Out, "     \"mb_per_s\": %.2f, \"iops\": %.1f, "
+		"\"fw_ns_per_cmd\": %.1f, \"fw_cycles_per_cmd\": %.1f,\n",
+		(Seconds > 0.0) ? (double)Result->Bytes / 1e6 / Seconds : 0.0,
+		(Seconds > 0.0) ? Result->Commands / Seconds : 0.0,
+		(double)Result->FirmwareNs / Result->Commands,
+		(double)Result->FirmwareCycles / Result->Commands);
+	fprintf(Out, "     \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, "
+		"\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}",
+		Percentile(Result, 500U) / 1e3, Percentile(Result, 900U) / 1e3,
+		Percentile(Result, 990U) / 1e3, Percentile(Result, 999U) / 1e3,
+		Result->Latency[Result->Commands - 1U] / 1e3);
+	fprintf(Out, ",\n     \"irq\": {\"interrupts\": %u, \"per_cmd\": %.2f, "
+		"\"events_per_irq\": %.2f, \"per_s\": %u, "
+		"\"isr_cpu_permille\": %u, \"held\": %u, \"held_early\": %u}",
+		Result->Interrupts, (double)Result->Interrupts / Result->Commands,
+		(Result->Interrupts != 0U) ?
+		(double)Result->Events / Result->Interrupts : 0.0,
+		Result->Load.IrqPerSec, Result->Load.CpuPermille,
+		Result->EventStats.ModHolds, Result->EventStats.ModEarly);
+#ifdef VFLASH_DEDUP
+	{
+		const VFlashDedup_Stats *Dedup = &Result->Dedup;
+		double CommitNs = (double)Result->CommitTicks * 1e9 /
+				  COUNTS_PER_SECOND;
+
+		fprintf(Out, ",\n     \"dedup\": {\"logical_chunks\": %u, "
+			"\"physical_chunks\": %u, \"pool_chunks\": %u, "
+			"\"ratio\": %.3f, \"saved_bytes\": %llu,\n",
+			Dedup->LogicalChunks, Dedup->PhysicalChunks,
+			Dedup->PoolChunks,
+			(Dedup->PhysicalChunks != 0U) ?
+			(double)Dedup->LogicalChunks / Dedup->PhysicalChunks :
+			1.0,
+			(unsigned long long)(Dedup->LogicalChunks -
+					     Dedup->PhysicalChunks) *
+			VFLASH_DEDUP_CHUNK_SIZE);
+		fprintf(Out, "      \"commit_ns_per_mb\": %.1f, "
+			"\"commit_share\": %.4f, \"pool_exhausted\": %u}",
+			(Result->CommitBytes != 0U) ?
+			CommitNs * 1048576.0 / Result->CommitBytes : 0.0,
+			(Result->WallNs != 0U) ? CommitNs / Result->WallNs : 0.0,
+			Result->PoolExhausted);
+	}
+#endif
+	fprintf(Out, "}%s\n", (Last == TRUE) ? "" : ",");
+}
+
+static void ReportBuild(FILE *Out)
+{
+	fprintf(Out, "  \"build\": {\"profile\": \"%s\", \"options\": [",
+		USB_BUILD_PROFILE_NAME);
+	fprintf(Out, "\"USB_HOST_SIM\"");
+#ifdef USB_TELEMETRY
+	fprintf(Out, ", \"USB_TELEMETRY\"");
+#endif
+#ifdef USB_LATENCY_TRACE
+	fprintf(Out, ", \"USB_LATENCY_TRACE\"");
+#endif
+#ifdef USB_DEFERRED_EVENTS
+	fprintf(Out, ", \"USB_DEFERRED_EVENTS\"");
+#endif
+#ifdef VFLASH_DEDUP
+	fprintf(Out, ", \"VFLASH_DEDUP\"");
+#endif
+#ifdef USB_CACHE_MANAGED
+	fprintf(Out, ", \"USB_CACHE_MANAGED\"");
+#endif
+	fprintf(Out, "], \"moderation_ns\": %u},\n", ModerationNs);
+}
+
+int main(int argc, char **argv)
+{
+	Bench_Result Result;
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Stats CacheStats;
+#endif
+	FILE *Out = stdout;
+	u64 Budget = 32U << 20;
+	u32 Workload;
+	u32 Index;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "b:s:m:o:")) != -1) {
+		switch (Opt) {
+			case 'b':
+				Budget = strtoull(optarg, NULL, 0) << 20;
+				break;
+			case 's':
+				Seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'm':
+				ModerationNs = (u32)strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				Out = fopen(optarg, "w");
+				if (Out == NULL) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-b MB per point] [-s seed] "
+					"[-m moderation ns] [-o out.json]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (Seed == 0U) {
+		Seed = 1U;
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS ||
+	    UsbSimHost_Enumerate(XUSBPSU_SPEED_SUPER) != USB_SIM_OK) {
+		fprintf(stderr, "device setup failed\n");
+		return 1;
+	}
+	(void)UsbSimDevice_SetModeration(ModerationNs);
+	for (Index = 0U; Index < sizeof(Data); Index++) {
+		Data[Index] = (u8)Random();
+	}
+
+	fprintf(Out, "{\n  \"tool\": \"sim_bench\", \"version\": %u, "
+		"\"seed\": %llu, \"disk_bytes\": %llu,\n", BENCH_VERSION,
+		(unsigned long long)Seed, (unsigned long long)VFLASH_SIZE);
+	ReportBuild(Out);
+	fprintf(Out, "  \"results\": [\n");
+
+	for (Workload = 0U; Workload < BENCH_MIXED; Workload++) {
+		for (Index = 0U; Index < sizeof(Sizes) / sizeof(Sizes[0]); Index++) {
+			RunPoint((Bench_Workload)Workload, Sizes[Index], Budget,
+				 &Result);
+			Report(Out, (Bench_Workload)Workload, Sizes[Index],
+			       &Result, FALSE);
+		}
+	}
+	RunPoint(BENCH_MIXED, BENCH_MAX_SIZE, Budget, &Result);
+	Report(Out, BENCH_MIXED, 0U, &Result, TRUE);
+
+#ifdef USB_CACHE_MANAGED
+	UsbCache_GetStats(&CacheStats);
+	fprintf(Out, "  ],\n  \"cache\": {\"bytes_flushed\": %llu, "
+		"\"bytes_invalidated\": %llu, \"bytes_skipped\": %llu}\n}\n",
+		(unsigned long long)CacheStats.BytesFlushed,
+		(unsigned long long)CacheStats.BytesInvalidated,
+		(unsigned long long)CacheStats.BytesSkipped);
+#else
+	fprintf(Out, "  ]\n}\n");
+#endif
+	if (Out != stdout) {
+		fclose(Out);
+	}
+
+	return 0;
+}
@@ -0,0 +1,1160 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_ccid.c
+ *
+ * CCID benchmark on the simulated controller, built with USB_CCID. After
+ * PC_to_RDR_IccPowerOn the tool runs back-to-back APDU exchanges with
+ * PC_to_RDR_XfrBlock:
+ *
+ *   xfr		short APDUs to the default card, which answers 90 00
+ *   write		extended UPDATE BINARY with the given amount of data
+ *   read		extended READ BINARY of the given amount of data
+ *   slots		short READ BINARY on 1 to CCID_MAX_SLOTS slots at once
+ *   wtx		short READ BINARY to a card slower than its block waiting
+ *			time, answered with time extensions meanwhile
+ *   abort		short READ BINARY to a card that does not answer, then
+ *			the ABORT class request and PC_to_RDR_Abort, in turn
+ *			in either order, and GetSlotStatus
+ *   unsent		GetSlotStatus to slot 0 and to a slot the reader does
+ *			not have, with the bulk IN endpoint refusing the
+ *			response, each followed by a GetSlotStatus that has
+ *			to be answered
+ *   notify		card insertion or removal on 1 to CCID_MAX_SLOTS slots,
+ *			until the host has read all changes from the interrupt
+ *			endpoint
+ *   vcard		SELECT, READ BINARY, UPDATE BINARY, READ RECORD and
+ *			GET DATA in turn to the virtual card, see
+ *			xusb_ccid_vcard.h, in builds with CCID_VIRTUAL_CARD
+ *
+ * write, read, slots, wtx and abort go to a streaming test card. APDUs and
+ * responses longer than one message are chained. For slots the card takes
+ * the given time to answer, and the host keeps one APDU outstanding on each
+ * slot in use. For wtx slot 0 runs T=1 with BWI 0, a BWT of about 100 ms.
+ * Results are written as JSON, one object per workload, APDU data length
+ * and number of slots:
+ *
+ *   sim_ccid [-n transactions per xfr point] [-b MB per chained point]
+ *	      [-l card latency in us] [-w wtx card latency in ms]
+ *	      [-S high|super] [-o out.json]
+ *
+ * A transaction is one APDU and its response, with all messages of the
+ * chain. For notify it is one round of card changes, messages_per_apdu
+ * then counts the interrupt messages it took. wtx_per_apdu counts the time
+ * extensions received. Like sim_bench, tps and mb_per_s are taken over the
+ * wall time of the transactions, fw_ns_per_cmd and fw_cycles_per_cmd only
+ * count the firmware.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "usb_sim_device.h"
+#include "usb_sim_host.h"
+#include "xusb_class_ccid.h"
+#ifdef CCID_VIRTUAL_CARD
+#include "xusb_ccid_vcard.h"
+#endif
+#include "xiltimer.h"
+
+/************************** Constant Definitions *****************************/
+#define CCID_BENCH_VERSION	9U
+#define CCID_BENCH_MAX_TRANS	1000000U
+#define CCID_BENCH_MAX_DATA	65535U	/* Extended Lc and Le */
+#define CCID_BENCH_EXT_HEADER	7U	/* CLA INS P1 P2 00 Lc/Le */
+#define CCID_BENCH_SLOT_DATA	16U	/* Le of the slots workload */
+#define CCID_BENCH_WTX_TRANS	5U	/* Transactions of the wtx workload */
+#define CCID_BENCH_ABORT_NS	10000000000ULL	/* Card latency for abort */
+
+#define CCID_INS_READ_BINARY	0xB0U
+#define CCID_INS_UPDATE_BINARY	0xD6U
+
+#ifndef USB_BUILD_PROFILE_NAME
+#define USB_BUILD_PROFILE_NAME	"Debug"
+#endif
+
+/**************************** Type Definitions *******************************/
+typedef enum {
+	CCID_BENCH_XFR,
+	CCID_BENCH_WRITE,
+	CCID_BENCH_READ,
+	CCID_BENCH_SLOTS,
+	CCID_BENCH_WTX,
+	CCID_BENCH_ABORT,
+	CCID_BENCH_UNSENT,
+	CCID_BENCH_NOTIFY,
+	CCID_BENCH_VCARD,
+	CCID_BENCH_NUM_WORKLOADS
+} CcidBench_Workload;
+
+typedef struct {
+	u32 Transactions;
+	u32 Errors;
+	u64 Bytes;		/* APDU data moved, either way */
+	u64 Messages;		/* Bulk OUT or interrupt IN messages */
+	u64 Extensions;		/* Time extensions received */
+	u64 WallNs;
+	u64 FirmwareNs;
+	u64 FirmwareCycles;
+	u64 *Latency;		/* ns per transaction, sorted when reported */
+} CcidBench_Result;
+
+typedef struct {
+	u8 Apdu[32];
+	u32 Length;
+	u32 RspLength;		/* Status word included */
+	u8 First;		/* First response byte, if there is data */
+} CcidBench_VCardApdu;
+
+/************************** Function Prototypes ******************************/
+static u32 CardPresent(u8 Slot);
+static u32 CardPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax);
+static void CardPowerOff(u8 Slot);
+static s32 CardXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last);
+static s32 CardXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+		      u32 *MorePtr);
+
+/************************** Variable Definitions *****************************/
+static const char *WorkloadName[CCID_BENCH_NUM_WORKLOADS] = {
+	"xfr", "write", "read", "slots", "wtx", "abort", "unsent", "notify",
+	"vcard"
+};
+
+/* Command APDU lengths: case 1, case 2, SELECT by AID, short case 3/4 */
+static const u32 XfrSizes[] = { 4U, 5U, 12U, 64U, 261U };
+
+/* Data lengths of the chained workloads */
+static const u32 ChainSizes[] = { 1024U, 4096U, 16384U, CCID_BENCH_MAX_DATA };
+
+#ifdef CCID_VIRTUAL_CARD
+/* APDUs of the vcard workload, all answered with 90 00 */
+static const CcidBench_VCardApdu VCardScript[] = {
+	/* SELECT the application by name, FCP */
+	{ { 0x00, 0xA4, 0x04, 0x04, 0x08, 0xF0, 0x58, 0x55, 0x53, 0x42,
+	    0x56, 0x43, 0x01, 0x00 }, 14U, 24U, 0x62 },
+	/* SELECT EF 5001, no response data */
+	{ { 0x00, 0xA4, 0x02, 0x0C, 0x02, 0x50, 0x01 }, 7U, 2U, 0U },
+	/* READ BINARY of 128 bytes at 0100 */
+	{ { 0x00, 0xB0, 0x01, 0x00, 0x80 }, 5U, 130U, 0x01 },
+	/* READ RECORD 3 of SFI 2 */
+	{ { 0x00, 0xB2, 0x03, 0x14, 0x00 }, 5U, 34U, 0x42 },
+	/* GET DATA of the serial number */
+	{ { 0x00, 0xCA, 0x00, 0x5A, 0x00 }, 5U, 10U, 0x58 },
+	/* UPDATE BINARY of 16 bytes at 0 of SFI 3, then READ BINARY */
+	{ { 0x00, 0xD6, 0x83, 0x00, 0x10, 0xA5, 0x01, 0x02, 0x03, 0x04,
+	    0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+	    0x0F }, 21U, 2U, 0U },
+	{ { 0x00, 0xB0, 0x83, 0x00, 0x10 }, 5U, 18U, 0xA5 },
+};
+#endif
+
+static u8 Apdu[CCID_BENCH_EXT_HEADER + CCID_BENCH_MAX_DATA];
+static u8 Response[CCID_BENCH_MAX_DATA + 2U];
+static u64 Latency[CCID_BENCH_MAX_TRANS];
+
+/*
+ * Streaming test card: UPDATE BINARY takes any amount of data, READ BINARY
+ * returns Le bytes of a counting pattern. Nothing is stored.
+ */
+static const Ccid_IccOps BenchCard = {
+	.Present = CardPresent,
+	.PowerOn = CardPowerOn,
+	.PowerOff = CardPowerOff,
+	.Xfr = NULL,
+	.XfrPut = CardXfrPut,
+	.XfrGet = CardXfrGet,
+};
+
+static u8 CardHeader[CCID_MAX_SLOTS][CCID_BENCH_EXT_HEADER];
+static u32 CardIn[CCID_MAX_SLOTS];	/* Command bytes received */
+static u32 CardLe[CCID_MAX_SLOTS];	/* Response data bytes */
+static u32 CardOut[CCID_MAX_SLOTS];	/* Response bytes sent, SW included */
+static u16 CardSw[CCID_MAX_SLOTS];
+static u64 CardReady[CCID_MAX_SLOTS];	/* When the response is there */
+static u64 CardLatencyNs;
+static u8 CardAbsent[CCID_MAX_SLOTS];
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static inline u64 NowNs(void)
+{
+	XTime Now;
+
+	XTime_GetTime(&Now);
+	return Now * (1000000000U / COUNTS_PER_SECOND);
+}
+
+static int CompareU64(const void *A, const void *B)
+{
+	u64 X = *(const u64 *)A;
+	u64 Y = *(const u64 *)B;
+
+	return (X > Y) - (X < Y);
+}
+
+/*****************************************************************************/
+/**
+* The streaming test card.
+*
+******************************************************************************/
+static u32 CardPresent(u8 Slot)
+{
+	return (CardAbsent[Slot] == 0U) ? 1U : 0U;
+}
+
+static u32 CardPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax)
+{
+	/* TS, T0, TD1 (T=0), TD2 (T=1), TCK */
+	static const u8 Atr[] = { 0x3B, 0x80, 0x80, 0x01, 0x01 };
+
+	(void)AtrMax;
+
+	memcpy(AtrPtr, Atr, sizeof(Atr));
+	CardIn[Slot] = 0U;
+	CardLe[Slot] = 0U;
+	CardOut[Slot] = 0U;
+
+	return sizeof(Atr);
+}
+
+static void CardPowerOff(u8 Slot)
+{
+	(void)Slot;
+}
+
+static s32 CardXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last)
+{
+	u8 *HeaderPtr = CardHeader[Slot];
+	u32 Copy;
+	u32 Lc;
+	u16 Sw;
+
+	if (CmdLen == 0U && Last == FALSE) {
+		/* The reader dropped the command */
+		CardIn[Slot] = 0U;
+		CardLe[Slot] = 0U;
+		CardOut[Slot] = 0U;
+		CardSw[Slot] = 0U;
+		return XST_SUCCESS;
+	}
+
+	if (CardIn[Slot] < CCID_BENCH_EXT_HEADER) {
+		Copy = CCID_BENCH_EXT_HEADER - CardIn[Slot];
+		Copy = (CmdLen < Copy) ? CmdLen : Copy;
+		memcpy(&HeaderPtr[CardIn[Slot]], CmdPtr, Copy);
+	}
+	CardIn[Slot] += CmdLen;
+
+	if (Last == FALSE) {
+		return XST_SUCCESS;
+	}
+
+	/* Run the command */
+	Lc = ((u32)HeaderPtr[5] << 8) | HeaderPtr[6];
+	CardLe[Slot] = 0U;
+	CardOut[Slot] = 0U;
+	Sw = 0x9000U;
+	if (CardIn[Slot] < CCID_BENCH_EXT_HEADER || HeaderPtr[4] != 0U) {
+		Sw = 0x6700U;
+	} else if (HeaderPtr[1] == CCID_INS_READ_BINARY) {
+		CardLe[Slot] = (Lc == 0U) ? CCID_BENCH_MAX_DATA : Lc;
+		Sw = (CardIn[Slot] == CCID_BENCH_EXT_HEADER) ? 0x9000U :
+		     0x6700U;
+	} else if (HeaderPtr[1] == CCID_INS_UPDATE_BINARY) {
+		Sw = (CardIn[Slot] == CCID_BENCH_EXT_HEADER + Lc) ? 0x9000U :
+		     0x6700U;
+	} else {
+		Sw = 0x6D00U;
+	}
+	if (Sw != 0x9000U) {
+		CardLe[Slot] = 0U;
+	}
+	CardSw[Slot] = Sw;
+	CardIn[Slot] = 0U;
+	CardReady[Slot] = (CardLatencyNs != 0U) ? NowNs() + CardLatencyNs : 0U;
+
+	return XST_SUCCESS;
+}
+
+static s32 CardXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+		      u32 *MorePtr)
+{
+	u32 Total = CardLe[Slot] + 2U;
+	u32 Length = 0U;
+
+	if (CardReady[Slot] != 0U) {
+		if (NowNs() < CardReady[Slot]) {
+			return XST_DEVICE_BUSY;
+		}
+		CardReady[Slot] = 0U;
+	}
+
+	while (Length < RspMax && CardOut[Slot] < Total) {
+		if (CardOut[Slot] < CardLe[Slot]) {
+			RspPtr[Length] = (u8)CardOut[Slot];
+		} else if (CardOut[Slot] == CardLe[Slot]) {
+			RspPtr[Length] = (u8)(CardSw[Slot] >> 8);
+		} else {
+			RspPtr[Length] = (u8)CardSw[Slot];
+		}
+		Length++;
+		CardOut[Slot]++;
+	}
+
+	*RspLenPtr = Length;
+	*MorePtr = (CardOut[Slot] < Total) ? TRUE : FALSE;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Builds the command APDU of a workload.
+*
+* @param	Workload is the workload.
+* @param	Size is the APDU length for xfr, the data length otherwise.
+*
+* @return	Length of the APDU.
+*
+******************************************************************************/
+static u32 BuildApdu(CcidBench_Workload Workload, u32 Size)
+{
+	u32 Index;
+
+	Apdu[0] = 0x00;		/* CLA */
+	Apdu[2] = 0x00;		/* P1 */
+	Apdu[3] = 0x00;		/* P2 */
+
+	if (Workload == CCID_BENCH_XFR) {
+		Apdu[1] = 0xA4;	/* SELECT by name */
+		Apdu[2] = 0x04;
+		if (Size == 5U) {
+			Apdu[4] = 0x00;	/* Le */
+		} else if (Size > 5U) {
+			Apdu[4] = (u8)(Size - 5U);
+			for (Index = 5U; Index < Size; Index++) {
+				Apdu[Index] = (u8)Index;
+			}
+		}
+		return Size;
+	}
+
+	/* Extended length: 00, then Lc or Le on two bytes */
+	Apdu[1] = (Workload == CCID_BENCH_WRITE) ? CCID_INS_UPDATE_BINARY :
+		  CCID_INS_READ_BINARY;
+	Apdu[4] = 0x00;
+	Apdu[5] = (u8)(Size >> 8);
+	Apdu[6] = (u8)Size;
+	if (Workload != CCID_BENCH_WRITE) {
+		return CCID_BENCH_EXT_HEADER;
+	}
+
+	for (Index = 0U; Index < Size; Index++) {
+		Apdu[CCID_BENCH_EXT_HEADER + Index] = (u8)Index;
+	}
+
+	return CCID_BENCH_EXT_HEADER + Size;
+}
+
+/*****************************************************************************/
+/**
+* Checks the response of a workload.
+*
+* @param	Workload is the workload.
+* @param	Size is the APDU length for xfr, the data length otherwise.
+* @param	ReplyPtr is the reply.
+*
+* @return	TRUE if the response is the expected one.
+*
+******************************************************************************/
+static u32 CheckResponse(CcidBench_Workload Workload, u32 Size,
+			 const UsbSimHost_CcidReply *ReplyPtr)
+{
+	u32 Expected = (Workload == CCID_BENCH_XFR ||
+			Workload == CCID_BENCH_WRITE) ? 2U : Size + 2U;
+	u32 Index;
+
+	if (ReplyPtr->Type != CCID_RDR_TO_PC_DATA_BLOCK ||
+	    ReplyPtr->Status != CCID_ICC_ACTIVE ||
+	    ReplyPtr->Length != Expected ||
+	    Response[Expected - 2U] != 0x90 || Response[Expected - 1U] != 0x00) {
+		return FALSE;
+	}
+
+	if (Expected > 2U) {
+		for (Index = 0U; Index < Size; Index++) {
+			if (Response[Index] != (u8)Index) {
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/*****************************************************************************/
+/**
+* Runs one point: Count exchanges of one workload and size.
+*
+* @param	Workload is the workload.
+* @param	Size is the APDU length for xfr, the data length otherwise.
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunPoint(CcidBench_Workload Workload, u32 Size, u32 Count,
+		     CcidBench_Result *Result)
+{
+	UsbSimHost_CcidReply Reply;
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u32 Length;
+	u64 Start;
+	u64 End;
+	s32 Status;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+	Length = BuildApdu(Workload, Size);
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+
+	while (Result->Transactions < Count) {
+		UsbSim_GetStats(&Before);
+		Start = NowNs();
+
+		Status = UsbSimHost_CcidApdu(0U, Apdu, Length, &Reply);
+
+		End = NowNs();
+		UsbSim_GetStats(&After);
+
+		if (Status != USB_SIM_OK ||
+		    CheckResponse(Workload, Size, &Reply) == FALSE) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = End - Start;
+		Result->Transactions++;
+		Result->Bytes += (Workload == CCID_BENCH_XFR) ? Length : Size;
+		Result->Messages += Reply.Messages;
+		Result->Extensions += Reply.Extensions;
+		Result->WallNs += End - Start;
+		Result->FirmwareNs += (After.FirmwareTicks -
+				       Before.FirmwareTicks) *
+				      (1000000000U / COUNTS_PER_SECOND);
+		Result->FirmwareCycles += After.FirmwareCycles -
+					  Before.FirmwareCycles;
+		if (Status != USB_SIM_OK) {
+			break;
+		}
+	}
+}
+
+/*****************************************************************************/
+/**
+* Runs one point of the slots workload: Count exchanges spread over Slots
+* slots, with one APDU outstanding on each of them. The next APDU of a slot
+* is sent as soon as its response is in.
+*
+* @param	Slots is the number of slots in use.
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunSlots(u32 Slots, u32 Count, CcidBench_Result *Result)
+{
+	static const u8 Params[3] = { 0U, 0U, 0U };
+	u64 Sent[CCID_MAX_SLOTS];
+	UsbSimHost_CcidReply Reply;
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u32 Issued = 0U;
+	u32 Length;
+	u32 Slot;
+	u64 Start;
+	u64 Now;
+	s32 Status = USB_SIM_OK;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+	Length = BuildApdu(CCID_BENCH_SLOTS, CCID_BENCH_SLOT_DATA);
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+
+	UsbSim_GetStats(&Before);
+	Start = NowNs();
+
+	for (Slot = 0U; Slot < Slots && Issued < Count &&
+	     Status == USB_SIM_OK; Slot++) {
+		Sent[Slot] = NowNs();
+		Status = UsbSimHost_CcidSend(CCID_PC_TO_RDR_XFR_BLOCK, (u8)Slot,
+					     Params, Apdu, Length, NULL);
+		Issued++;
+	}
+
+	while (Status == USB_SIM_OK && Result->Transactions < Issued) {
+		Status = UsbSimHost_CcidRecv(&Reply);
+		Now = NowNs();
+		if (Status != USB_SIM_OK || Reply.Type == 0U ||
+		    Reply.Slot >= Slots) {
+			Status = USB_SIM_STALL;
+			break;
+		}
+		if ((Reply.Status & CCID_CMD_STATUS_MASK) ==
+		    CCID_CMD_TIME_EXTENSION) {
+			/* The response is still to come */
+			Result->Extensions++;
+			continue;
+		}
+
+		Slot = Reply.Slot;
+		if (CheckResponse(CCID_BENCH_SLOTS, CCID_BENCH_SLOT_DATA,
+				  &Reply) == FALSE) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = Now - Sent[Slot];
+		Result->Transactions++;
+		Result->Bytes += CCID_BENCH_SLOT_DATA;
+		Result->Messages++;
+
+		if (Issued < Count) {
+			Sent[Slot] = NowNs();
+			Status = UsbSimHost_CcidSend(CCID_PC_TO_RDR_XFR_BLOCK,
+						     (u8)Slot, Params, Apdu,
+						     Length, NULL);
+			Issued++;
+		}
+	}
+
+	if (Status != USB_SIM_OK) {
+		/* The ones that did not come back */
+		Result->Errors += Issued - Result->Transactions;
+		while (Result->Transactions < Issued) {
+			Result->Latency[Result->Transactions] = NowNs() - Start;
+			Result->Transactions++;
+		}
+	}
+
+	Result->WallNs = NowNs() - Start;
+	UsbSim_GetStats(&After);
+	Result->FirmwareNs = (After.FirmwareTicks - Before.FirmwareTicks) *
+			     (1000000000U / COUNTS_PER_SECOND);
+	Result->FirmwareCycles = After.FirmwareCycles - Before.FirmwareCycles;
+}
+
+/*****************************************************************************/
+/**
+* Runs the abort workload on slot 0. Each transaction sends an APDU the card
+* never answers and aborts it, sending the PC_to_RDR_Abort before the class
+* request every other time. The APDU must fail with CCID_ERR_CMD_ABORTED,
+* the Abort must succeed and so must a GetSlotStatus after it.
+*
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunAbort(u32 Count, CcidBench_Result *Result)
+{
+	static const u8 Params[3] = { 0U, 0U, 0U };
+	UsbSimHost_CcidReply Reply;
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u32 Length;
+	u32 Failed;
+	u64 Start;
+	u64 End;
+	u8 Seq;
+	u8 AbortSeq;
+	s32 Status;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+	Length = BuildApdu(CCID_BENCH_SLOTS, CCID_BENCH_SLOT_DATA);
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+
+	while (Result->Transactions < Count) {
+		UsbSim_GetStats(&Before);
+		Start = NowNs();
+		Failed = FALSE;
+
+		Status = UsbSimHost_CcidSend(CCID_PC_TO_RDR_XFR_BLOCK, 0U,
+					     Params, Apdu, Length, &Seq);
+		if (Status == USB_SIM_OK) {
+			Status = UsbSimHost_CcidAbort(0U,
+						      Result->Transactions & 1U,
+						      &AbortSeq);
+		}
+
+		/* The aborted APDU, maybe after time extensions */
+		do {
+			if (Status == USB_SIM_OK) {
+				Status = UsbSimHost_CcidRecv(&Reply);
+			}
+		} while (Status == USB_SIM_OK &&
+			 (Reply.Status & CCID_CMD_STATUS_MASK) ==
+			 CCID_CMD_TIME_EXTENSION);
+		if (Status != USB_SIM_OK || Reply.Seq != Seq ||
+		    (Reply.Status & CCID_CMD_STATUS_MASK) != CCID_CMD_FAILED ||
+		    Reply.Error != CCID_ERR_CMD_ABORTED) {
+			Failed = TRUE;
+		}
+
+		/* The Abort */
+		if (Status == USB_SIM_OK) {
+			Status = UsbSimHost_CcidRecv(&Reply);
+		}
+		if (Status != USB_SIM_OK ||
+		    Reply.Type != CCID_RDR_TO_PC_SLOT_STATUS ||
+		    Reply.Seq != AbortSeq ||
+		    (Reply.Status & CCID_CMD_FAILED) != 0U) {
+			Failed = TRUE;
+		}
+
+		/* The slot takes commands again */
+		if (Status == USB_SIM_OK) {
+			Status = UsbSimHost_Ccid(CCID_PC_TO_RDR_GET_SLOT_STATUS,
+						 0U, NULL, NULL, 0U, &Reply);
+		}
+		if (Status != USB_SIM_OK ||
+		    Reply.Type != CCID_RDR_TO_PC_SLOT_STATUS ||
+		    (Reply.Status & CCID_CMD_FAILED) != 0U) {
+			Failed = TRUE;
+		}
+
+		End = NowNs();
+		UsbSim_GetStats(&After);
+
+		if (Failed == TRUE) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = End - Start;
+		Result->Transactions++;
+		Result->Messages += 3U;
+		Result->WallNs += End - Start;
+		Result->FirmwareNs += (After.FirmwareTicks -
+				       Before.FirmwareTicks) *
+				      (1000000000U / COUNTS_PER_SECOND);
+		Result->FirmwareCycles += After.FirmwareCycles -
+					  Before.FirmwareCycles;
+		if (Status != USB_SIM_OK) {
+			break;
+		}
+	}
+}
+
+/*****************************************************************************/
+/**
+* Runs the unsent workload. Each transaction makes the bulk IN endpoint
+* refuse the response to a GetSlotStatus, first of slot 0 and then of a
+* slot the reader does not have, which the reader answers itself. The slot
+* has to be idle again and the reader has to take the next command, so the
+* GetSlotStatus after each must succeed. Ccid_Stats.Unsent has to count
+* both responses.
+*
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunUnsent(u32 Count, CcidBench_Result *Result)
+{
+	static const u8 Lost[2] = { 0U, CCID_MAX_SLOTS };
+	UsbSimHost_CcidReply Reply;
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	Ccid_Stats CcidBefore;
+	Ccid_Stats CcidAfter;
+	u32 Index;
+	u32 Failed;
+	u64 Start;
+	u64 End;
+	u8 Seq;
+	s32 Status = USB_SIM_OK;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+
+	while (Result->Transactions < Count && Status == USB_SIM_OK) {
+		UsbSim_GetStats(&Before);
+		Ccid_GetStats(&CcidBefore);
+		Start = NowNs();
+		Failed = FALSE;
+
+		for (Index = 0U; Index < 2U && Status == USB_SIM_OK; Index++) {
+			UsbSim_FailStart(1U, XUSBPSU_EP_DIR_IN, 1U);
+			Status = UsbSimHost_CcidSend(
+					CCID_PC_TO_RDR_GET_SLOT_STATUS,
+					Lost[Index], NULL, NULL, 0U, &Seq);
+			if (Status == USB_SIM_OK) {
+				Status = UsbSimHost_Ccid(
+						CCID_PC_TO_RDR_GET_SLOT_STATUS,
+						0U, NULL, NULL, 0U, &Reply);
+			}
+			if (Status != USB_SIM_OK || Reply.Seq == Seq ||
+			    Reply.Type != CCID_RDR_TO_PC_SLOT_STATUS ||
+			    (Reply.Status & CCID_CMD_FAILED) != 0U) {
+				Failed = TRUE;
+			}
+		}
+		UsbSim_FailStart(1U, XUSBPSU_EP_DIR_IN, 0U);
+
+		End = NowNs();
+		UsbSim_GetStats(&After);
+		Ccid_GetStats(&CcidAfter);
+
+		if (Failed == TRUE ||
+		    CcidAfter.Unsent - CcidBefore.Unsent != 2U) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = End - Start;
+		Result->Transactions++;
+		Result->Messages += 4U;
+		Result->WallNs += End - Start;
+		Result->FirmwareNs += (After.FirmwareTicks -
+				       Before.FirmwareTicks) *
+				      (1000000000U / COUNTS_PER_SECOND);
+		Result->FirmwareCycles += After.FirmwareCycles -
+					  Before.FirmwareCycles;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Runs one point of the notify workload. Each transaction inserts or removes
+* the cards of Slots slots and reads NotifySlotChange messages until all
+* changes are seen, with the state of the slots after the change.
+*
+* @param	Slots is the number of slots changed per transaction.
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunNotify(u32 Slots, u32 Count, CcidBench_Result *Result)
+{
+	u8 Message[CCID_NOTIFY_PACKET_SIZE];
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u32 Actual;
+	u32 Seen;
+	u32 Bits;
+	u32 Slot;
+	u64 Start;
+	u64 End;
+	s32 Status = USB_SIM_OK;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+
+	/* Drop what is left from the configuration */
+	while (UsbSimHost_CcidNotify(Message, sizeof(Message), &Actual) ==
+	       USB_SIM_OK) {
+	}
+
+	while (Result->Transactions < Count && Status == USB_SIM_OK) {
+		UsbSim_GetStats(&Before);
+		Start = NowNs();
+
+		for (Slot = 0U; Slot < Slots; Slot++) {
+			CardAbsent[Slot] ^= 1U;
+			Ccid_SlotChange((u8)Slot);
+		}
+
+		Seen = 0U;
+		while (Seen != (1U << Slots) - 1U) {
+			Status = UsbSimHost_CcidNotify(Message, sizeof(Message),
+						       &Actual);
+			if (Status != USB_SIM_OK) {
+				break;
+			}
+			Result->Messages++;
+			if (Actual != 1U + CCID_NOTIFY_BITMAP_SIZE ||
+			    Message[0] != CCID_RDR_TO_PC_NOTIFY_SLOT_CHANGE) {
+				Result->Errors++;
+				continue;
+			}
+			for (Slot = 0U; Slot < CCID_MAX_SLOTS; Slot++) {
+				Bits = (Message[1U + Slot / 4U] >>
+					((Slot % 4U) * 2U)) & 3U;
+				if ((Bits & CCID_SLOT_ICC_CHANGED) == 0U) {
+					continue;
+				}
+				if (Slot >= Slots ||
+				    (Bits & CCID_SLOT_ICC_PRESENT) !=
+				    CardPresent((u8)Slot)) {
+					Result->Errors++;
+				}
+				Seen |= 1U << Slot;
+			}
+		}
+
+		End = NowNs();
+		UsbSim_GetStats(&After);
+
+		if (Status != USB_SIM_OK) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = End - Start;
+		Result->Transactions++;
+		Result->WallNs += End - Start;
+		Result->FirmwareNs += (After.FirmwareTicks -
+				       Before.FirmwareTicks) *
+				      (1000000000U / COUNTS_PER_SECOND);
+		Result->FirmwareCycles += After.FirmwareCycles -
+					  Before.FirmwareCycles;
+	}
+}
+
+#ifdef CCID_VIRTUAL_CARD
+/*****************************************************************************/
+/**
+* Runs the vcard workload: Count exchanges with the virtual card on slot 0,
+* going through VCardScript[] in turn.
+*
+* @param	Count is the number of transactions.
+* @param	Result returns the result.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunVCard(u32 Count, CcidBench_Result *Result)
+{
+	const CcidBench_VCardApdu *CmdPtr;
+	UsbSimHost_CcidReply Reply;
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u32 Index = 0U;
+	u64 Start;
+	u64 End;
+	s32 Status;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Latency = Latency;
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+
+	while (Result->Transactions < Count) {
+		CmdPtr = &VCardScript[Index];
+		Index = (Index + 1U) % (sizeof(VCardScript) /
+					sizeof(VCardScript[0]));
+
+		UsbSim_GetStats(&Before);
+		Start = NowNs();
+
+		Status = UsbSimHost_CcidApdu(0U, CmdPtr->Apdu, CmdPtr->Length,
+					     &Reply);
+
+		End = NowNs();
+		UsbSim_GetStats(&After);
+
+		if (Status != USB_SIM_OK ||
+		    Reply.Type != CCID_RDR_TO_PC_DATA_BLOCK ||
+		    Reply.Length != CmdPtr->RspLength ||
+		    Response[Reply.Length - 2U] != 0x90 ||
+		    Response[Reply.Length - 1U] != 0x00 ||
+		    (Reply.Length > 2U && Response[0] != CmdPtr->First)) {
+			Result->Errors++;
+		}
+		Result->Latency[Result->Transactions] = End - Start;
+		Result->Transactions++;
+		Result->Bytes += CmdPtr->Length + CmdPtr->RspLength;
+		Result->Messages += Reply.Messages;
+		Result->WallNs += End - Start;
+		Result->FirmwareNs += (After.FirmwareTicks -
+				       Before.FirmwareTicks) *
+				      (1000000000U / COUNTS_PER_SECOND);
+		Result->FirmwareCycles += After.FirmwareCycles -
+					  Before.FirmwareCycles;
+		if (Status != USB_SIM_OK) {
+			break;
+		}
+	}
+}
+#endif
+
+static u64 Percentile(const CcidBench_Result *Result, u32 Permille)
+{
+	u32 Index = (u32)(((u64)Result->Transactions * Permille + 999U) /
+			  1000U);
+
+	return Result->Latency[(Index == 0U) ? 0U : Index - 1U];
+}
+
+/*****************************************************************************/
+/**
+* Writes one result as a JSON object.
+*
+* @param	Out is the output.
+* @param	Workload is the workload.
+* @param	Size is the APDU length for xfr, the data length otherwise.
+* @param	Slots is the number of slots in use.
+* @param	Result is the result, its latencies are sorted.
+* @param	Last is TRUE for the last object of the array.
+*
+* @return	None.
+*
+******************************************************************************/
+static void Report(FILE *Out, CcidBench_Workload Workload, u32 Size,
+		   u32 Slots, CcidBench_Result *Result, u32 Last)
+{
+	double Seconds = (double)Result->WallNs / 1e9;
+
+	qsort(Result->Latency, Result->Transactions, sizeof(u64), CompareU64);
+
+	fprintf(Out, "    {\"workload\": \"%s\", \"apdu_bytes\": %u, "
+		"\"slots\": %u, \"transactions\": %u, \"errors\": %u, "
+		"\"seconds\": %.6f,\n",
+		WorkloadName[Workload], Size, Slots, Result->Transactions,
+		Result->Errors, Seconds);
+	fprintf(Out, "     \"tps\": %.1f, \"mb_per_s\": %.2f, "
+		"\"messages_per_apdu\": %.2f, \"wtx_per_apdu\": %.2f, "
+		"\"fw_ns_per_cmd\": %.1f, \"fw_cycles_per_cmd\": %.1f,\n",
+		(Seconds > 0.0) ? Result->Transactions / Seconds : 0.0,
+		(Seconds > 0.0) ? (double)Result->Bytes / 1e6 / Seconds : 0.0,
+		(double)Result->Messages / Result->Transactions,
+		(double)Result->Extensions / Result->Transactions,
+		(double)Result->FirmwareNs / Result->Transactions,
+		(double)Result->FirmwareCycles / Result->Transactions);
+	fprintf(Out, "     \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, "
+		"\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}%s\n",
+		Percentile(Result, 500U) / 1e3, Percentile(Result, 900U) / 1e3,
+		Percentile(Result, 990U) / 1e3, Percentile(Result, 999U) / 1e3,
+		Result->Latency[Result->Transactions - 1U] / 1e3,
+		(Last == TRUE) ? "" : ",");
+}
+
+static s32 PowerOn(u8 Slot)
+{
+	UsbSimHost_CcidReply Reply;
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+	if (UsbSimHost_Ccid(CCID_PC_TO_RDR_ICC_POWER_ON, Slot, NULL, NULL, 0U,
+			    &Reply) != USB_SIM_OK ||
+	    Reply.Type != CCID_RDR_TO_PC_DATA_BLOCK ||
+	    Reply.Status != CCID_ICC_ACTIVE) {
+		return XST_FAILURE;
+	}
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Switches a slot to T=1 with the shortest block waiting time, BWI 0.
+*
+* @param	Slot is the slot number.
+*
+* @return	XST_SUCCESS if the reader took the parameters.
+*
+******************************************************************************/
+static s32 SetShortBwt(u8 Slot)
+{
+	/* Fi 372 Di 1, LRC, BWI 0 CWI 5, IFSC 254 */
+	static const u8 T1[] = { 0x11, 0x10, 0x00, 0x05, 0x00, 0xFE, 0x00 };
+	static const u8 Params[3] = { CCID_PROTOCOL_T1, 0U, 0U };
+	UsbSimHost_CcidReply Reply;
+
+	Reply.DataPtr = Response;
+	Reply.DataMax = sizeof(Response);
+	if (UsbSimHost_Ccid(CCID_PC_TO_RDR_SET_PARAMETERS, Slot, Params, T1,
+			    sizeof(T1), &Reply) != USB_SIM_OK ||
+	    Reply.Type != CCID_RDR_TO_PC_PARAMETERS ||
+	    (Reply.Status & CCID_CMD_FAILED) != 0U) {
+		return XST_FAILURE;
+	}
+
+	return XST_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	CcidBench_Result Result;
+	FILE *Out = stdout;
+	u32 Speed = XUSBPSU_SPEED_SUPER;
+	u32 Count = 100000U;
+	u64 Budget = 16U << 20;
+	u64 CardLatency = 100U;
+	u64 WtxLatency = 200U;
+	u64 Chained;
+	u32 Workload;
+	u32 Index;
+	u32 Slots;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "n:b:l:w:S:o:")) != -1) {
+		switch (Opt) {
+			case 'n':
+				Count = (u32)strtoul(optarg, NULL, 0);
+				break;
+			case 'b':
+				Budget = strtoull(optarg, NULL, 0) << 20;
+				break;
+			case 'l':
+				CardLatency = strtoull(optarg, NULL, 0);
+				break;
+			case 'w':
+				WtxLatency = strtoull(optarg, NULL, 0);
+				break;
+			case 'S':
+				Speed = (strcmp(optarg, "high") == 0) ?
+					XUSBPSU_SPEED_HIGH :
+					XUSBPSU_SPEED_SUPER;
+				break;
+			case 'o':
+				Out = fopen(optarg, "w");
+				if (Out == NULL) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n transactions] "
+					"[-b MB per chained point] "
+					"[-l card latency us] "
+					"[-w wtx card latency ms] "
+					"[-S high|super] [-o out.json]\n",
+					argv[0]);
+				return 2;
+		}
+	}
+	if (Count == 0U || Count > CCID_BENCH_MAX_TRANS) {
+		Count = CCID_BENCH_MAX_TRANS;
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS ||
+	    UsbSimHost_Enumerate(Speed) != USB_SIM_OK ||
+	    PowerOn(0U) != XST_SUCCESS) {
+		fprintf(stderr, "device setup failed\n");
+		return 1;
+	}
+
+	fprintf(Out, "{\n  \"tool\": \"sim_ccid\", \"version\": %u, "
+		"\"speed\": \"%s\",\n", CCID_BENCH_VERSION,
+		(Speed == XUSBPSU_SPEED_HIGH) ? "high" : "super");
+	fprintf(Out, "  \"build\": {\"profile\": \"%s\", "
+		"\"max_message\": %u, \"max_apdu\": %u, "
+		"\"bulk_buffers\": %u, \"max_slots\": %u},\n",
+		USB_BUILD_PROFILE_NAME, (u32)CCID_MAX_MESSAGE_SIZE,
+		(u32)MAX_APDU_SIZE,
+		(u32)(CCID_BULK_OUT_SIZE + CCID_MAX_SLOTS * CCID_BULK_IN_SIZE),
+		(u32)CCID_MAX_SLOTS);
+	fprintf(Out, "  \"card_latency_us\": %llu, "
+		"\"wtx_card_latency_ms\": %llu,\n",
+		(unsigned long long)CardLatency,
+		(unsigned long long)WtxLatency);
+	fprintf(Out, "  \"results\": [\n");
+
+	for (Index = 0U; Index < sizeof(XfrSizes) / sizeof(XfrSizes[0]);
+	     Index++) {
+		RunPoint(CCID_BENCH_XFR, XfrSizes[Index], Count, &Result);
+		Report(Out, CCID_BENCH_XFR, XfrSizes[Index], 1U, &Result,
+		       FALSE);
+	}
+
+	/* Chained exchanges with the streaming card */
+	Ccid_SetIcc(&BenchCard);
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		if (PowerOn((u8)Index) != XST_SUCCESS) {
+			fprintf(stderr, "IccPowerOn of the test card failed\n");
+			return 1;
+		}
+	}
+	for (Workload = CCID_BENCH_WRITE; Workload <= CCID_BENCH_READ;
+	     Workload++) {
+		for (Index = 0U; Index < sizeof(ChainSizes) / sizeof(ChainSizes[0]);
+		     Index++) {
+			if (CCID_BENCH_EXT_HEADER + ChainSizes[Index] >
+			    MAX_APDU_SIZE) {
+				continue;
+			}
+			Chained = Budget / ChainSizes[Index];
+			Chained = (Chained == 0U) ? 1U :
+				  (Chained > CCID_BENCH_MAX_TRANS) ?
+				  CCID_BENCH_MAX_TRANS : Chained;
+			RunPoint((CcidBench_Workload)Workload, ChainSizes[Index],
+				 (u32)Chained, &Result);
+			Report(Out, (CcidBench_Workload)Workload,
+			       ChainSizes[Index], 1U, &Result, FALSE);
+		}
+	}
+
+	/* Slow cards, answered in the order they finish */
+	CardLatencyNs = CardLatency * 1000U;
+	for (Slots = 1U; Slots <= CCID_MAX_SLOTS; Slots++) {
+		RunSlots(Slots, Count, &Result);
+		Report(Out, CCID_BENCH_SLOTS, CCID_BENCH_SLOT_DATA, Slots,
+		       &Result, FALSE);
+	}
+
+	/* A card slower than its BWT, kept alive by time extensions */
+	CardLatencyNs = WtxLatency * 1000000U;
+	if (SetShortBwt(0U) != XST_SUCCESS) {
+		fprintf(stderr, "SetParameters failed\n");
+		return 1;
+	}
+	RunPoint(CCID_BENCH_WTX, CCID_BENCH_SLOT_DATA, CCID_BENCH_WTX_TRANS,
+		 &Result);
+	Report(Out, CCID_BENCH_WTX, CCID_BENCH_SLOT_DATA, 1U, &Result, FALSE);
+
+	/* A card that does not answer, aborted by the host */
+	CardLatencyNs = CCID_BENCH_ABORT_NS;
+	RunAbort(Count, &Result);
+	Report(Out, CCID_BENCH_ABORT, CCID_BENCH_SLOT_DATA, 1U, &Result,
+	       FALSE);
+	CardLatencyNs = 0U;
+
+	/* Responses the controller does not take */
+	RunUnsent(Count, &Result);
+	Report(Out, CCID_BENCH_UNSENT, 0U, 1U, &Result, FALSE);
+
+	/* Card changes, reported on the interrupt endpoint */
+	for (Slots = 1U; Slots <= CCID_MAX_SLOTS; Slots++) {
+		RunNotify(Slots, Count, &Result);
+#ifdef CCID_VIRTUAL_CARD
+		Report(Out, CCID_BENCH_NOTIFY, 0U, Slots, &Result, FALSE);
+#else
+		Report(Out, CCID_BENCH_NOTIFY, 0U, Slots, &Result,
+		       (Slots == CCID_MAX_SLOTS) ? TRUE : FALSE);
+#endif
+	}
+
+#ifdef CCID_VIRTUAL_CARD
+	/* File system APDUs, answered by the firmware itself */
+	Ccid_SetIcc(CcidVCard_Init());
+	if (PowerOn(0U) != XST_SUCCESS) {
+		fprintf(stderr, "IccPowerOn of the virtual card failed\n");
+		return 1;
+	}
+	RunVCard(Count, &Result);
+	Report(Out, CCID_BENCH_VCARD, 0U, 1U, &Result, TRUE);
+#endif
+
+	fprintf(Out, "  ]\n}\n");
+	if (Out != stdout) {
+		fclose(Out);
+	}
+
+	return 0;
+}
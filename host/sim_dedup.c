@@ -0,0 +1,219 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_dedup.c
+ *
+ * Data check of the dedup backend on the simulated controller, built with
+ * VFLASH_DEDUP. READ data goes out gathered from the chunks of the pool,
+ * see VFlashDedup_ReadV(), so the tool compares every byte the host reads
+ * with a model of the disk:
+ *
+ *   sim_dedup [-n commands] [-s seed] [-S high|super] [-o out.json]
+ *
+ * Each WRITE(10) is made of 4 KB pieces that are unique, copies of a few
+ * shared patterns or all zero, so that a read crosses private, shared and
+ * unmapped chunks. Half of the commands start on a chunk boundary, the
+ * others on any block. READ(10) lengths go from one block to 1 MB, at any
+ * block. errors counts the commands that failed and the reads that do not
+ * match the model, the tool exits with 1 if there are any.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "usb_sim_device.h"
+#include "usb_sim_host.h"
+#include "xusb_storage_dedup.h"
+
+/************************** Constant Definitions *****************************/
+#define DEDUP_SIM_VERSION	1U
+#define DEDUP_SIM_SPAN		(16U << 20)	/* Part of the disk used */
+#define DEDUP_SIM_MAX_BLOCKS	2048U		/* 1 MB per command */
+#define DEDUP_SIM_PATTERNS	4U		/* Shared 4 KB patterns */
+#define DEDUP_SIM_CHUNK_BLOCKS	(VFLASH_DEDUP_CHUNK_SIZE / VFLASH_BLOCK_SIZE)
+
+/************************** Variable Definitions *****************************/
+static u8 Model[DEDUP_SIM_SPAN];
+static u8 Patterns[DEDUP_SIM_PATTERNS][VFLASH_DEDUP_CHUNK_SIZE];
+static u8 Data[DEDUP_SIM_MAX_BLOCKS * VFLASH_BLOCK_SIZE];
+
+/*****************************************************************************/
+/**
+* Picks the blocks of a command inside DEDUP_SIM_SPAN.
+*
+* @param	LbaPtr receives the first block.
+* @param	BlocksPtr receives the number of blocks.
+*
+* @return	None.
+*
+******************************************************************************/
+static void PickRange(u32 *LbaPtr, u32 *BlocksPtr)
+{
+	u32 Span = DEDUP_SIM_SPAN / VFLASH_BLOCK_SIZE;
+	u32 Blocks = 1U + (u32)rand() % DEDUP_SIM_MAX_BLOCKS;
+	u32 Lba = (u32)rand() % (Span - Blocks + 1U);
+
+	if ((rand() & 1) != 0) {
+		Lba -= Lba % DEDUP_SIM_CHUNK_BLOCKS;
+	}
+	*LbaPtr = Lba;
+	*BlocksPtr = Blocks;
+}
+
+/*****************************************************************************/
+/**
+* Fills a WRITE(10) buffer with unique, shared and zero 4 KB pieces.
+*
+* @param	Length is the number of bytes.
+*
+* @return	None.
+*
+******************************************************************************/
+static void FillData(u32 Length)
+{
+	u32 Offset;
+	u32 Piece;
+	u32 Index;
+	int Kind;
+
+	for (Offset = 0U; Offset < Length; Offset += Piece) {
+		Piece = Length - Offset;
+		if (Piece > VFLASH_DEDUP_CHUNK_SIZE) {
+			Piece = VFLASH_DEDUP_CHUNK_SIZE;
+		}
+		Kind = rand() % 3;
+		if (Kind == 0) {
+			for (Index = 0U; Index < Piece; Index++) {
+				Data[Offset + Index] = (u8)rand();
+			}
+		} else if (Kind == 1) {
+			Index = (u32)rand() % DEDUP_SIM_PATTERNS;
+			memcpy(&Data[Offset], Patterns[Index], Piece);
+		} else {
+			memset(&Data[Offset], 0, Piece);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	VFlashDedup_Stats Stats;
+	FILE *Out = stdout;
+	u32 Speed = XUSBPSU_SPEED_SUPER;
+	u32 Commands = 2000U;
+	u32 Seed = 1U;
+	u32 Reads = 0U;
+	u32 Writes = 0U;
+	u32 Errors = 0U;
+	u64 BytesRead = 0U;
+	u32 Command;
+	u32 Blocks;
+	u32 Index;
+	u32 Lba;
+	u8 CswStatus;
+	s32 Status;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "n:s:S:o:")) != -1) {
+		switch (Opt) {
+			case 'n':
+				Commands = (u32)strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				Seed = (u32)strtoul(optarg, NULL, 0);
+				break;
+			case 'S':
+				Speed = (strcmp(optarg, "high") == 0) ?
+					XUSBPSU_SPEED_HIGH :
+					XUSBPSU_SPEED_SUPER;
+				break;
+			case 'o':
+				Out = fopen(optarg, "w");
+				if (Out == NULL) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n commands] "
+					"[-s seed] [-S high|super] "
+					"[-o out.json]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	srand(Seed);
+	for (Index = 0U; Index < sizeof(Patterns); Index++) {
+		Patterns[Index / VFLASH_DEDUP_CHUNK_SIZE]
+			[Index % VFLASH_DEDUP_CHUNK_SIZE] = (u8)rand();
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS ||
+	    UsbSimHost_Enumerate(Speed) != USB_SIM_OK) {
+		fprintf(stderr, "device setup failed\n");
+		return 1;
+	}
+
+	for (Command = 0U; Command < Commands; Command++) {
+		PickRange(&Lba, &Blocks);
+
+		if ((rand() & 1) != 0) {
+			FillData(Blocks * VFLASH_BLOCK_SIZE);
+			Status = UsbSimHost_Write10(Lba, (u16)Blocks, Data,
+						    &CswStatus);
+			if (Status == USB_SIM_OK &&
+			    CswStatus == USB_SIM_HOST_CSW_PASSED) {
+				memcpy(&Model[Lba * VFLASH_BLOCK_SIZE], Data,
+				       Blocks * VFLASH_BLOCK_SIZE);
+			} else {
+				fprintf(stderr, "WRITE(10) at %u, %u blocks "
+					"failed\n", Lba, Blocks);
+				Errors++;
+			}
+			Writes++;
+			continue;
+		}
+
+		memset(Data, 0xA5, Blocks * VFLASH_BLOCK_SIZE);
+		Status = UsbSimHost_Read10(Lba, (u16)Blocks, Data, &CswStatus);
+		if (Status != USB_SIM_OK ||
+		    CswStatus != USB_SIM_HOST_CSW_PASSED) {
+			fprintf(stderr, "READ(10) at %u, %u blocks failed\n",
+				Lba, Blocks);
+			Errors++;
+		} else if (memcmp(Data, &Model[Lba * VFLASH_BLOCK_SIZE],
+				  Blocks * VFLASH_BLOCK_SIZE) != 0) {
+			fprintf(stderr, "READ(10) at %u, %u blocks "
+				"miscompares\n", Lba, Blocks);
+			Errors++;
+		}
+		Reads++;
+		BytesRead += Blocks * VFLASH_BLOCK_SIZE;
+	}
+
+	VFlashDedup_GetStats(&Stats);
+
+	fprintf(Out, "{\n  \"tool\": \"sim_dedup\", \"version\": %u, "
+		"\"speed\": \"%s\", \"seed\": %u,\n", DEDUP_SIM_VERSION,
+		(Speed == XUSBPSU_SPEED_HIGH) ? "high" : "super", Seed);
+	fprintf(Out, "  \"reads\": %u, \"writes\": %u, \"errors\": %u, "
+		"\"bytes_read\": %llu, \"bytes_gathered\": %llu,\n",
+		Reads, Writes, Errors, (unsigned long long)BytesRead,
+		(unsigned long long)Stats.BytesGathered);
+	fprintf(Out, "  \"dedup\": {\"logical_chunks\": %u, "
+		"\"physical_chunks\": %u, \"pool_exhausted\": %u}\n}\n",
+		Stats.LogicalChunks, Stats.PhysicalChunks,
+		Stats.PoolExhausted);
+	if (Out != stdout) {
+		fclose(Out);
+	}
+
+	return (Errors != 0U) ? 1 : 0;
+}
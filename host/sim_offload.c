@@ -0,0 +1,214 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_offload.c
+ *
+ * Offload scaling on the simulated controller, built with USB_OFFLOAD. The
+ * worker cores are threads, see usb_sim_device.c. For job sizes from 4 KB
+ * to 1 MB the tool runs UsbOffload_Benchmark() with 0 to
+ * USB_OFFLOAD_WORKERS workers, that is the CRC32C of a buffer on one to
+ * four cores, and checks the CRC of every job against the one computed on
+ * the USB core. Results are written as JSON, one object per job size and
+ * number of workers:
+ *
+ *   sim_offload [-b MB of data] [-r runs per point] [-o out.json]
+ *
+ * mb_per_s is the best of the runs. The threads share the CPUs of the
+ * host, "cpus" in the output, so the scaling cannot exceed the number of
+ * CPUs, and with a single CPU the workers only add switching.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "usb_sim_device.h"
+#include "xusb_offload.h"
+
+/************************** Constant Definitions *****************************/
+#define OFFLOAD_BENCH_VERSION	1U
+#define OFFLOAD_BENCH_MAX_JOBS	4096U
+
+#ifndef USB_BUILD_PROFILE_NAME
+#define USB_BUILD_PROFILE_NAME	"Debug"
+#endif
+
+/************************** Variable Definitions *****************************/
+static const u32 JobSizes[] = { 4096U, 65536U, 1048576U };
+
+static u32 Expected[OFFLOAD_BENCH_MAX_JOBS];
+static u32 Crc[OFFLOAD_BENCH_MAX_JOBS];
+static u32 Collected;
+
+static void CheckDone(void *Context, u32 Result, s32 Status)
+{
+	u32 *CrcPtr = (u32 *)Context;
+
+	*CrcPtr = (Status == XST_SUCCESS) ? Result : ~Result;
+	Collected++;
+}
+
+/*****************************************************************************/
+/**
+* Computes the CRC32C of every job of a buffer with the given number of
+* workers.
+*
+* @param	BufferPtr is the data.
+* @param	Jobs is the number of jobs.
+* @param	JobSize is the number of bytes per job.
+* @param	Workers is the number of workers, 0 runs the jobs inline.
+* @param	CrcPtr receives one CRC per job.
+*
+* @return	None.
+*
+******************************************************************************/
+static void RunJobs(const u8 *BufferPtr, u32 Jobs, u32 JobSize, u32 Workers,
+		    u32 *CrcPtr)
+{
+	u32 Index;
+
+	UsbOffload_SetWorkers(Workers);
+	Collected = 0U;
+	for (Index = 0U; Index < Jobs; Index++) {
+		(void)UsbOffload_Submit(USB_OFFLOAD_OP_CRC32C,
+					BufferPtr + Index * JobSize, NULL,
+					JobSize, CheckDone, &CrcPtr[Index]);
+		(void)UsbOffload_Poll();
+	}
+	while (Collected != Jobs) {
+		(void)UsbOffload_Poll();
+	}
+	UsbOffload_SetWorkers(USB_OFFLOAD_WORKERS);
+}
+
+int main(int argc, char **argv)
+{
+	UsbOffload_Stats Before;
+	UsbOffload_Stats After;
+	FILE *Out = stdout;
+	u8 *BufferPtr;
+	u32 Length = 64U << 20;
+	u32 Runs = 3U;
+	u32 Index;
+	u32 Workers;
+	u32 Worker;
+	u32 Jobs;
+	u32 Errors;
+	u32 Run;
+	u64 Best;
+	u64 Rate;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "b:r:o:")) != -1) {
+		switch (Opt) {
+			case 'b':
+				Length = (u32)strtoul(optarg, NULL, 0) << 20;
+				break;
+			case 'r':
+				Runs = (u32)strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				Out = fopen(optarg, "w");
+				if (Out == NULL) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-b MB of data] "
+					"[-r runs per point] [-o out.json]\n",
+					argv[0]);
+				return 2;
+		}
+	}
+	if (Length == 0U || Length > (1024U << 20)) {
+		Length = 1024U << 20;
+	}
+	if (Runs == 0U) {
+		Runs = 1U;
+	}
+
+	BufferPtr = malloc(Length);
+	if (BufferPtr == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	srand(1U);
+	for (Index = 0U; Index < Length; Index++) {
+		BufferPtr[Index] = (u8)rand();
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS) {
+		fprintf(stderr, "firmware initialization failed\n");
+		return 1;
+	}
+
+	fprintf(Out, "{\n  \"tool\": \"sim_offload\", \"version\": %u, "
+		"\"bytes\": %u, \"runs\": %u, \"cpus\": %ld,\n",
+		OFFLOAD_BENCH_VERSION, Length, Runs,
+		sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(Out, "  \"build\": {\"profile\": \"%s\", "
+		"\"workers\": %u, \"ring_slots\": %u},\n",
+		USB_BUILD_PROFILE_NAME, (u32)USB_OFFLOAD_WORKERS,
+		(u32)USB_OFFLOAD_RING_SLOTS);
+	fprintf(Out, "  \"results\": [\n");
+
+	for (Index = 0U; Index < sizeof(JobSizes) / sizeof(JobSizes[0]);
+	     Index++) {
+		Jobs = Length / JobSizes[Index];
+		if (Jobs > OFFLOAD_BENCH_MAX_JOBS) {
+			Jobs = OFFLOAD_BENCH_MAX_JOBS;
+		}
+		RunJobs(BufferPtr, Jobs, JobSizes[Index], 0U, Expected);
+
+		for (Workers = 0U; Workers <= USB_OFFLOAD_WORKERS; Workers++) {
+			UsbOffload_GetStats(&Before);
+			Best = 0U;
+			for (Run = 0U; Run < Runs; Run++) {
+				Rate = UsbOffload_Benchmark(BufferPtr, Length,
+							    JobSizes[Index],
+							    Workers);
+				Best = (Rate > Best) ? Rate : Best;
+			}
+			UsbOffload_GetStats(&After);
+
+			RunJobs(BufferPtr, Jobs, JobSizes[Index], Workers, Crc);
+			Errors = 0U;
+			for (Run = 0U; Run < Jobs; Run++) {
+				Errors += (Crc[Run] != Expected[Run]) ? 1U : 0U;
+			}
+
+			fprintf(Out, "    {\"job_bytes\": %u, \"workers\": %u, "
+				"\"cores\": %u, \"mb_per_s\": %.1f, "
+				"\"errors\": %u,\n", JobSizes[Index], Workers,
+				Workers + 1U, (double)Best / 1e6, Errors);
+			fprintf(Out, "     \"inline_jobs\": %u, "
+				"\"worker_jobs\": [",
+				After.Inline - Before.Inline);
+			for (Worker = 0U; Worker < USB_OFFLOAD_WORKERS;
+			     Worker++) {
+				fprintf(Out, "%s%u", (Worker == 0U) ? "" : ", ",
+					After.Worker[Worker].Jobs -
+					Before.Worker[Worker].Jobs);
+			}
+			fprintf(Out, "]}%s\n",
+				(Index == sizeof(JobSizes) /
+				 sizeof(JobSizes[0]) - 1U &&
+				 Workers == USB_OFFLOAD_WORKERS) ? "" : ",");
+		}
+	}
+
+	fprintf(Out, "  ]\n}\n");
+	if (Out != stdout) {
+		fclose(Out);
+	}
+	free(BufferPtr);
+
+	return 0;
+}
@@ -0,0 +1,375 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_replay.c
+ *
+ * Replays captured USB traffic against the firmware on the simulated
+ * controller, for example:
+ *
+ *   cat /sys/kernel/debug/usb/usbmon/1u > slow.txt
+ *   sim_replay slow.txt
+ *   sim_replay -d 1:5 -q capture.pcapng
+ *
+ * The device is enumerated, then the control, bulk and interrupt transfers
+ * of one device are run in the order they completed in the capture. Each
+ * transfer prints the firmware time it took and is compared with the
+ * recorded device response: stalls, reply length and the captured reply
+ * data. Isochronous and unlinked transfers are skipped.
+ *
+ * Usage: sim_replay [-d bus:dev] [-S high|super] [-q] [-t slowest] capture
+ *
+ * Without -d the device with the most bulk transfers is replayed. The exit
+ * status is 1 if any transfer diverged.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "usb_capture.h"
+#include "usb_sim_device.h"
+#include "usb_sim_host.h"
+#include "xiltimer.h"
+
+/************************** Constant Definitions *****************************/
+#define REPLAY_MAX_LENGTH	0x1000000U	/* Largest transfer replayed */
+#define REPLAY_SLOWEST		10U
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u32 Index;		/* In the capture */
+	u64 FirmwareNs;
+} Replay_Time;
+
+/************************** Variable Definitions *****************************/
+static u8 Buffer[REPLAY_MAX_LENGTH];
+static char Detail[256];
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static const char *TypeName(u8 Type)
+{
+	switch (Type) {
+		case USB_CAPTURE_CONTROL:
+			return "ctrl";
+		case USB_CAPTURE_BULK:
+			return "bulk";
+		case USB_CAPTURE_INT:
+			return "int";
+		default:
+			return "iso";
+	}
+}
+
+static int CompareTime(const void *A, const void *B)
+{
+	const Replay_Time *X = (const Replay_Time *)A;
+	const Replay_Time *Y = (const Replay_Time *)B;
+
+	return (X->FirmwareNs < Y->FirmwareNs) - (X->FirmwareNs > Y->FirmwareNs);
+}
+
+/*****************************************************************************/
+/**
+* Picks the device with the most bulk transfers.
+*
+* @param	CapturePtr is the capture.
+* @param	BusPtr returns the bus.
+* @param	DevicePtr returns the device address.
+*
+* @return	None.
+*
+******************************************************************************/
+static void PickDevice(const UsbCapture *CapturePtr, u32 *BusPtr,
+		       u32 *DevicePtr)
+{
+	u32 Count[128];
+	u32 Best = 0U;
+	u32 Index;
+	u32 Bus = 0U;
+
+	memset(Count, 0, sizeof(Count));
+	for (Index = 0U; Index < CapturePtr->Count; Index++) {
+		const UsbCapture_Urb *UrbPtr = &CapturePtr->Urb[Index];
+
+		if (Bus == 0U) {
+			Bus = UrbPtr->Bus;
+		}
+		if (UrbPtr->Bus == Bus && UrbPtr->Device < 128U) {
+			Count[UrbPtr->Device] += (UrbPtr->Type == USB_CAPTURE_BULK) ?
+						 1024U : 1U;
+		}
+	}
+	for (Index = 1U; Index < 128U; Index++) {
+		if (Count[Index] > Count[Best]) {
+			Best = Index;
+		}
+	}
+
+	*BusPtr = Bus;
+	*DevicePtr = Best;
+}
+
+/*****************************************************************************/
+/**
+* Runs one captured transfer and compares the result with the capture.
+*
+* @param	UrbPtr is the transfer.
+* @param	FirmwareNs returns the firmware time of the transfer.
+*
+* @return	TRUE if the response diverged, described in Detail.
+*
+******************************************************************************/
+static u32 Replay(const UsbCapture_Urb *UrbPtr, u64 *FirmwareNs)
+{
+	UsbSim_Stats Before;
+	UsbSim_Stats After;
+	u8 Ep = UrbPtr->Ep & ~USB_CAPTURE_DIR_IN;
+	u32 IsIn = ((UrbPtr->Ep & USB_CAPTURE_DIR_IN) != 0U) ? TRUE : FALSE;
+	u32 Length = UrbPtr->Length;
+	u32 Actual = 0U;
+	u32 Index;
+	s32 Status;
+
+	Detail[0] = '\0';
+
+	if (UrbPtr->HasSetup == TRUE) {
+		Length = UrbPtr->Setup.wLength;
+	}
+	if (Length > REPLAY_MAX_LENGTH) {
+		snprintf(Detail, sizeof(Detail), "%u bytes not replayed", Length);
+		*FirmwareNs = 0U;
+		return TRUE;
+	}
+
+	memset(Buffer, 0, Length);
+	if (IsIn == FALSE && UrbPtr->Data != NULL) {
+		memcpy(Buffer, UrbPtr->Data,
+		       (UrbPtr->DataCaptured < Length) ? UrbPtr->DataCaptured :
+		       Length);
+	}
+
+	UsbSim_GetStats(&Before);
+	if (UrbPtr->Type == USB_CAPTURE_CONTROL) {
+		Status = UsbSim_Control(&UrbPtr->Setup, Buffer, &Actual);
+	} else if (IsIn == TRUE) {
+		Status = UsbSim_BulkIn(Ep, Buffer, Length, &Actual);
+	} else {
+		Status = UsbSim_BulkOut(Ep, Buffer, Length);
+		Actual = (Status == USB_SIM_OK) ? Length : 0U;
+	}
+	UsbSim_GetStats(&After);
+	*FirmwareNs = (After.FirmwareTicks - Before.FirmwareTicks) *
+		      (1000000000U / COUNTS_PER_SECOND);
+
+	if (UrbPtr->Status == USB_CAPTURE_EPIPE) {
+		if (Status != USB_SIM_STALL) {
+			snprintf(Detail, sizeof(Detail), "recorded stall, replay %s",
+				 (Status == USB_SIM_OK) ? "completed" : "timed out");
+			return TRUE;
+		}
+		return FALSE;
+	}
+	if (Status == USB_SIM_STALL) {
+		snprintf(Detail, sizeof(Detail), "replay stalled, recorded %s %d",
+			 (UrbPtr->Status == 0) ? "status" : "error",
+			 UrbPtr->Status);
+		return TRUE;
+	}
+	if (Status == USB_SIM_TIMEOUT) {
+		snprintf(Detail, sizeof(Detail),
+			 "firmware did not serve the transfer");
+		return TRUE;
+	}
+	if (UrbPtr->Status != 0) {
+		snprintf(Detail, sizeof(Detail),
+			 "recorded error %d, replay completed", UrbPtr->Status);
+		return TRUE;
+	}
+
+	if (IsIn == FALSE) {
+		return FALSE;
+	}
+	if (Actual != UrbPtr->Actual) {
+		snprintf(Detail, sizeof(Detail), "length %u, recorded %u", Actual,
+			 UrbPtr->Actual);
+		return TRUE;
+	}
+	for (Index = 0U; Index < UrbPtr->DataCaptured && Index < Actual;
+	     Index++) {
+		if (Buffer[Index] != UrbPtr->Data[Index]) {
+			snprintf(Detail, sizeof(Detail),
+				 "data at %u is %02x, recorded %02x", Index,
+				 Buffer[Index], UrbPtr->Data[Index]);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void PrintUrb(u32 Index, const UsbCapture_Urb *UrbPtr, u64 StartUs,
+		     u64 FirmwareNs, u32 Diverged)
+{
+	char Request[32] = "";
+
+	if (UrbPtr->HasSetup == TRUE) {
+		snprintf(Request, sizeof(Request), "%02x %02x %04x %04x %04x",
+			 UrbPtr->Setup.bRequestType, UrbPtr->Setup.bRequest,
+			 UrbPtr->Setup.wValue, UrbPtr->Setup.wIndex,
+			 UrbPtr->Setup.wLength);
+	}
+
+	printf("%6u %12.6f %-4s %2u%-3s %8u %8u %5d %10.2f %-24s %s\n", Index,
+	       (double)(UrbPtr->TimeUs - StartUs) / 1e6, TypeName(UrbPtr->Type),
+	       UrbPtr->Ep & ~USB_CAPTURE_DIR_IN,
+	       ((UrbPtr->Ep & USB_CAPTURE_DIR_IN) != 0U) ? "in" : "out",
+	       UrbPtr->Length, UrbPtr->Actual, UrbPtr->Status,
+	       (double)FirmwareNs / 1e3, Request,
+	       (Diverged == TRUE) ? Detail : "ok");
+}
+
+int main(int argc, char **argv)
+{
+	UsbCapture Capture;
+	Replay_Time *Times;
+	u32 Speed = XUSBPSU_SPEED_SUPER;
+	u32 Bus = 0U;
+	u32 Device = 0U;
+	u32 Quiet = FALSE;
+	u32 Slowest = REPLAY_SLOWEST;
+	u32 Replayed = 0U;
+	u32 Skipped = 0U;
+	u32 Diverged = 0U;
+	u32 FirstDiverged = 0U;
+	u64 TotalNs = 0U;
+	u64 StartUs = 0U;
+	u64 FirmwareNs;
+	u32 Index;
+	u32 Result;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "d:S:qt:")) != -1) {
+		switch (Opt) {
+			case 'd':
+				if (sscanf(optarg, "%u:%u", &Bus, &Device) != 2) {
+					Bus = 0U;
+				}
+				break;
+			case 'S':
+				Speed = (strcmp(optarg, "high") == 0) ?
+					XUSBPSU_SPEED_HIGH : XUSBPSU_SPEED_SUPER;
+				break;
+			case 'q':
+				Quiet = TRUE;
+				break;
+			case 't':
+				Slowest = (u32)strtoul(optarg, NULL, 0);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-d bus:dev] [-S high|super] [-q] "
+			"[-t slowest] capture\n", argv[0]);
+		return 2;
+	}
+
+	if (UsbCapture_Load(argv[optind], &Capture) != XST_SUCCESS) {
+		return 2;
+	}
+	if (Bus == 0U) {
+		PickDevice(&Capture, &Bus, &Device);
+	}
+	Times = calloc(Capture.Count + 1U, sizeof(*Times));
+	if (Times == NULL) {
+		return 2;
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS ||
+	    UsbSimHost_Enumerate(Speed) != USB_SIM_OK) {
+		fprintf(stderr, "device setup failed\n");
+		return 2;
+	}
+
+	if (Quiet == FALSE) {
+		printf("%6s %12s %-4s %5s %8s %8s %5s %10s %-24s %s\n", "urb",
+		       "time s", "type", "ep", "length", "actual", "stat",
+		       "fw us", "setup", "result");
+	}
+
+	for (Index = 0U; Index < Capture.Count; Index++) {
+		const UsbCapture_Urb *UrbPtr = &Capture.Urb[Index];
+
+		if (UrbPtr->Bus != Bus || UrbPtr->Device != Device) {
+			continue;
+		}
+		if (UrbPtr->Type == USB_CAPTURE_ISO ||
+		    UrbPtr->Status == USB_CAPTURE_ENOENT ||
+		    UrbPtr->Status == USB_CAPTURE_ECONNRESET ||
+		    UrbPtr->Status == USB_CAPTURE_ESHUTDOWN) {
+			Skipped++;
+			continue;
+		}
+		if (StartUs == 0U) {
+			StartUs = UrbPtr->TimeUs;
+		}
+
+		Result = Replay(UrbPtr, &FirmwareNs);
+		Times[Replayed].Index = Index;
+		Times[Replayed].FirmwareNs = FirmwareNs;
+		Replayed++;
+		TotalNs += FirmwareNs;
+		if (Result == TRUE) {
+			if (Diverged == 0U) {
+				FirstDiverged = Index;
+			}
+			Diverged++;
+		}
+
+		if (Quiet == FALSE || Result == TRUE) {
+			PrintUrb(Index, UrbPtr, StartUs, FirmwareNs, Result);
+		}
+	}
+
+	printf("\ndevice %u:%u: %u transfers replayed, %u skipped, %u not "
+	       "completed in the capture\n", Bus, Device, Replayed, Skipped,
+	       Capture.Incomplete);
+	printf("firmware time %.3f ms, %.2f us per transfer\n",
+	       (double)TotalNs / 1e6,
+	       (Replayed != 0U) ? (double)TotalNs / 1e3 / Replayed : 0.0);
+	if (Diverged != 0U) {
+		printf("%u transfers diverged, first at urb %u\n", Diverged,
+		       FirstDiverged);
+	} else {
+		printf("no divergence\n");
+	}
+
+	qsort(Times, Replayed, sizeof(*Times), CompareTime);
+	if (Slowest > Replayed) {
+		Slowest = Replayed;
+	}
+	if (Slowest != 0U) {
+		printf("\nslowest transfers:\n");
+	}
+	for (Index = 0U; Index < Slowest; Index++) {
+		const UsbCapture_Urb *UrbPtr = &Capture.Urb[Times[Index].Index];
+
+		printf("%6u %-4s %2u%-3s %8u %10.2f us\n", Times[Index].Index,
+		       TypeName(UrbPtr->Type), UrbPtr->Ep & ~USB_CAPTURE_DIR_IN,
+		       ((UrbPtr->Ep & USB_CAPTURE_DIR_IN) != 0U) ? "in" : "out",
+		       UrbPtr->Length, (double)Times[Index].FirmwareNs / 1e3);
+	}
+
+	free(Times);
+	UsbCapture_Free(&Capture);
+
+	return (Diverged != 0U) ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file sim_telemetry.c
+ *
+ * Runs the mass storage firmware on the simulated controller: enumerates
+ * it, runs a few SCSI commands and writes the telemetry block, for example:
+ *
+ *   sim_telemetry | telemetry_decode -
+ *   sim_telemetry block.bin
+ *
+ * A summary of the simulation goes to stderr.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <string.h>
+#include "usb_sim_device.h"
+#include "usb_sim_host.h"
+#include "xusb_telemetry.h"
+#include "xiltimer.h"
+
+/************************** Constant Definitions *****************************/
+#define IO_BLOCKS		128U	/* 64KB per READ(10)/WRITE(10) */
+#define IO_COMMANDS		64U
+
+/************************** Variable Definitions *****************************/
+static u8 Data[IO_BLOCKS * 512U];
+static u8 Check[IO_BLOCKS * 512U];
+static u8 Block[USB_TELEMETRY_MAX_SIZE];
+
+/*****************************************************************************/
+/**
+* Runs INQUIRY, READ CAPACITY(10) and a write and read back of
+* IO_COMMANDS * IO_BLOCKS blocks.
+*
+* @param	None.
+*
+* @return	0 if all commands passed and the data read back matches.
+*
+******************************************************************************/
+static int RunCommands(void)
+{
+	static const u8 Inquiry[6] = { 0x12U, 0U, 0U, 0U, 36U, 0U };
+	static const u8 Capacity[10] = { 0x25U };
+	u8 Reply[36];
+	u8 CswStatus;
+	u32 Index;
+	u32 Lba;
+
+	if (UsbSimHost_Scsi(Inquiry, sizeof(Inquiry), USB_SIM_HOST_DIR_IN,
+			    Reply, 36U, NULL, &CswStatus) != USB_SIM_OK ||
+	    CswStatus != USB_SIM_HOST_CSW_PASSED) {
+		fprintf(stderr, "INQUIRY failed\n");
+		return 1;
+	}
+	if (UsbSimHost_Scsi(Capacity, sizeof(Capacity), USB_SIM_HOST_DIR_IN,
+			    Reply, 8U, NULL, &CswStatus) != USB_SIM_OK ||
+	    CswStatus != USB_SIM_HOST_CSW_PASSED) {
+		fprintf(stderr, "READ CAPACITY failed\n");
+		return 1;
+	}
+
+	for (Index = 0U; Index < IO_COMMANDS; Index++) {
+		Lba = Index * IO_BLOCKS;
+		memset(Data, (int)(Index + 1U), sizeof(Data));
+		if (UsbSimHost_Write10(Lba, IO_BLOCKS, Data,
+				       &CswStatus) != USB_SIM_OK ||
+		    CswStatus != USB_SIM_HOST_CSW_PASSED) {
+			fprintf(stderr, "WRITE(10) at %u failed\n", Lba);
+			return 1;
+		}
+	}
+
+	for (Index = 0U; Index < IO_COMMANDS; Index++) {
+		Lba = Index * IO_BLOCKS;
+		memset(Data, (int)(Index + 1U), sizeof(Data));
+		if (UsbSimHost_Read10(Lba, IO_BLOCKS, Check,
+				      &CswStatus) != USB_SIM_OK ||
+		    CswStatus != USB_SIM_HOST_CSW_PASSED) {
+			fprintf(stderr, "READ(10) at %u failed\n", Lba);
+			return 1;
+		}
+		if (memcmp(Data, Check, sizeof(Data)) != 0) {
+			fprintf(stderr, "READ(10) at %u miscompares\n", Lba);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	UsbSim_Stats Stats;
+	FILE *Out = stdout;
+	u32 Length;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [block.bin]\n", argv[0]);
+		return 2;
+	}
+
+	if (UsbSimDevice_Init() != XST_SUCCESS) {
+		fprintf(stderr, "firmware initialization failed\n");
+		return 1;
+	}
+	if (UsbSimHost_Enumerate(XUSBPSU_SPEED_SUPER) != USB_SIM_OK) {
+		fprintf(stderr, "enumeration failed\n");
+		return 1;
+	}
+	if (RunCommands() != 0) {
+		return 1;
+	}
+
+	if (UsbSimHost_Telemetry(Block, sizeof(Block), &Length) != USB_SIM_OK) {
+		fprintf(stderr, "telemetry not available\n");
+		return 1;
+	}
+
+	UsbSim_GetStats(&Stats);
+	fprintf(stderr, "%u steps, %u interrupts, %u events, %u setups, "
+		"%llu bytes out, %llu bytes in, %.3f ms in firmware\n",
+		Stats.Steps, Stats.Interrupts, Stats.Events, Stats.Setups,
+		(unsigned long long)Stats.BytesOut,
+		(unsigned long long)Stats.BytesIn,
+		(double)Stats.FirmwareTicks * 1000.0 / COUNTS_PER_SECOND);
+
+	if (argc == 2) {
+		Out = fopen(argv[1], "wb");
+		if (Out == NULL) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	if (fwrite(Block, 1U, Length, Out) != Length) {
+		perror("write");
+		return 1;
+	}
+	if (Out != stdout) {
+		fclose(Out);
+	}
+
+	return 0;
+}
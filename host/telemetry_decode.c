@@ -0,0 +1,386 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file telemetry_decode.c
+ *
+ * Prints a telemetry block read with the USB_TELEMETRY_REQ_SNAPSHOT and
+ * USB_TELEMETRY_REQ_READ vendor requests, for example:
+ *
+ *   telemetry_decode block.bin
+ *   telemetry_decode - < block.bin
+ *
+ * The block is little endian, like the host this runs on.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <string.h>
+#include "xusb_telemetry.h"
+#include "xusb_trace.h"
+
+/************************** Constant Definitions *****************************/
+#define MAX_BLOCK_SIZE		0x100000U
+
+static const char *SpanName[USB_TRACE_NUM_SPANS] = {
+	"command", "data", "status", "total"
+};
+
+static const char *LatencyName[] = {
+	"setup-reply", "cbw-data"
+};
+
+/************************** Variable Definitions *****************************/
+static u8 Block[MAX_BLOCK_SIZE];
+
+/*****************************************************************************/
+/**
+* Returns the upper bound of the bucket holding the given quantile of a log2
+* histogram.
+*
+* @param	Hist is the histogram.
+* @param	Permille is the quantile, 500 for the median.
+*
+* @return	Upper bound in counter units, 0 for an empty histogram.
+*
+******************************************************************************/
+static u64 HistQuantile(const u32 *Hist, u32 Permille)
+{
+	u64 Total = 0U;
+	u64 Seen = 0U;
+	u32 Index;
+
+	for (Index = 0U; Index < USB_TRACE_BUCKETS; Index++) {
+		Total += Hist[Index];
+	}
+	if (Total == 0U) {
+		return 0U;
+	}
+
+	for (Index = 0U; Index < USB_TRACE_BUCKETS; Index++) {
+		Seen += Hist[Index];
+		if (Seen * 1000U >= Total * Permille) {
+			break;
+		}
+	}
+
+	return ((u64)2U << Index) - 1U;
+}
+
+static double ToUs(u64 Count, u32 PerSecond)
+{
+	return PerSecond ? (double)Count * 1e6 / PerSecond : 0.0;
+}
+
+static void PrintDevice(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_Device Device;
+
+	if (Size < sizeof(Device)) {
+		return;
+	}
+	memcpy(&Device, Data, sizeof(Device));
+	printf("device: resets %u, telemetry requests %u\n",
+	       Device.Resets, Device.VendorRequests);
+}
+
+static void PrintEndpoints(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_Endpoint Ep;
+	u32 Count;
+	u32 Index;
+
+	if (Size < sizeof(Count)) {
+		return;
+	}
+	memcpy(&Count, Data, sizeof(Count));
+	printf("endpoints:\n");
+	printf("  %-5s %10s %10s %6s %6s %6s %6s %14s %10s\n", "ep", "queued",
+	       "done", "failed", "full", "depth", "stalls", "bytes", "busy %");
+
+	for (Index = 0U; Index < Count; Index++) {
+		u64 Total;
+
+		if (sizeof(Count) + (Index + 1U) * sizeof(Ep) > Size) {
+			break;
+		}
+		memcpy(&Ep, Data + sizeof(Count) + Index * sizeof(Ep), sizeof(Ep));
+		Total = Ep.BusyTicks + Ep.IdleTicks;
+		printf("  %2u%-3s %10u %10u %6u %6u %6u %6u %14llu %9.1f%%\n",
+		       Ep.Ep, Ep.Dir ? "in" : "out", Ep.Queued, Ep.Completed,
+		       Ep.Failed, Ep.QueueFull, Ep.MaxDepth, Ep.Stalls,
+		       (unsigned long long)Ep.Bytes,
+		       Total ? 100.0 * Ep.BusyTicks / Total : 0.0);
+	}
+}
+
+static void PrintEvents(const u8 *Data, u32 Size, u32 TicksPerSecond)
+{
+	UsbTelemetry_Events Ev;
+
+	if (Size < sizeof(Ev)) {
+		return;
+	}
+	memcpy(&Ev, Data, sizeof(Ev));
+	printf("events: %u interrupts, %u events (%.2f per interrupt), "
+	       "isr avg %.2f us max %.2f us\n", Ev.IsrCount, Ev.Events,
+	       Ev.IsrCount ? (double)Ev.Events / Ev.IsrCount : 0.0,
+	       Ev.IsrCount ? ToUs(Ev.IsrTicksTotal, TicksPerSecond) /
+	       Ev.IsrCount : 0.0, ToUs(Ev.IsrTicksMax, TicksPerSecond));
+	printf("  posted %u, dispatched %u, inline %u, backlog max %u, "
+	       "dispatch max %.2f us, polls %u (%u events)\n", Ev.Posted,
+	       Ev.Dispatched, Ev.Inline, Ev.BacklogMax,
+	       ToUs(Ev.DispatchTicksMax, TicksPerSecond), Ev.Polls,
+	       Ev.PolledEvents);
+}
+
+static void PrintCache(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_Cache Cache;
+	u64 Total;
+
+	if (Size < sizeof(Cache)) {
+		return;
+	}
+	memcpy(&Cache, Data, sizeof(Cache));
+	Total = Cache.BytesFlushed + Cache.BytesInvalidated + Cache.BytesSkipped;
+	printf("cache: flushed %llu, invalidated %llu, skipped %llu bytes, "
+	       "%.1f%% of DMA bytes without maintenance\n",
+	       (unsigned long long)Cache.BytesFlushed,
+	       (unsigned long long)Cache.BytesInvalidated,
+	       (unsigned long long)Cache.BytesSkipped,
+	       Total ? 100.0 * Cache.BytesSkipped / Total : 0.0);
+}
+
+static void PrintPool(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_PoolClass Class;
+	u32 Count;
+	u32 Index;
+
+	if (Size < sizeof(Count)) {
+		return;
+	}
+	memcpy(&Count, Data, sizeof(Count));
+	printf("pool:\n");
+	for (Index = 0U; Index < Count; Index++) {
+		if (sizeof(Count) + (Index + 1U) * sizeof(Class) > Size) {
+			break;
+		}
+		memcpy(&Class, Data + sizeof(Count) + Index * sizeof(Class),
+		       sizeof(Class));
+		printf("  %6u B: %u/%u in use, high %u, allocs %u, "
+		       "fallbacks %u, failures %u\n", Class.BlockSize, Class.InUse,
+		       Class.Blocks, Class.HighWater, Class.Allocs,
+		       Class.Fallbacks, Class.Failures);
+	}
+}
+
+static void PrintScsi(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_Opcode Op;
+	u32 Count;
+	u32 Index;
+
+	if (Size < sizeof(Count)) {
+		return;
+	}
+	memcpy(&Count, Data, sizeof(Count));
+	printf("scsi:");
+	for (Index = 0U; Index < Count; Index++) {
+		if (sizeof(Count) + (Index + 1U) * sizeof(Op) > Size) {
+			break;
+		}
+		memcpy(&Op, Data + sizeof(Count) + Index * sizeof(Op), sizeof(Op));
+		printf(" %02x:%u", Op.Opcode, Op.Count);
+	}
+	printf("\n");
+}
+
+static void PrintLatency(const u8 *Data, u32 Size, u32 TicksPerSecond)
+{
+	UsbTelemetry_Latency Lat;
+	u32 Count;
+	u32 Index;
+
+	if (Size < sizeof(Count)) {
+		return;
+	}
+	memcpy(&Count, Data, sizeof(Count));
+	printf("latency:\n");
+	for (Index = 0U; Index < Count; Index++) {
+		if (sizeof(Count) + (Index + 1U) * sizeof(Lat) > Size) {
+			break;
+		}
+		memcpy(&Lat, Data + sizeof(Count) + Index * sizeof(Lat),
+		       sizeof(Lat));
+		printf("  %-12s %8u min %.2f avg %.2f max %.2f us\n",
+		       Lat.Path < 2U ? LatencyName[Lat.Path] : "?", Lat.Count,
+		       ToUs(Lat.TicksMin, TicksPerSecond),
+		       Lat.Count ? ToUs(Lat.TicksTotal, TicksPerSecond) /
+		       Lat.Count : 0.0, ToUs(Lat.TicksMax, TicksPerSecond));
+	}
+}
+
+static void PrintTrace(const u8 *Data, u32 Size)
+{
+	static UsbTrace_Entry Entry;
+	UsbTelemetry_Trace Trace;
+	u32 Index;
+	u32 Span;
+
+	if (Size < sizeof(Trace)) {
+		return;
+	}
+	memcpy(&Trace, Data, sizeof(Trace));
+	printf("trace: %u entries, %u dropped, %u cycles per hook\n",
+	       Trace.Count, Trace.Dropped, Trace.HookCycles);
+
+	for (Index = 0U; Index < Trace.Count; Index++) {
+		if (sizeof(Trace) + (Index + 1U) * sizeof(Entry) > Size) {
+			break;
+		}
+		memcpy(&Entry, Data + sizeof(Trace) + Index * sizeof(Entry),
+		       sizeof(Entry));
+		if (Entry.Key & USB_TRACE_KEY_CONTROL) {
+			printf("  ctrl %u/%02x", (Entry.Key >> 8) & 0xFU,
+			       Entry.Key & 0xFFU);
+		} else {
+			printf("  scsi %02x   ", Entry.Key);
+		}
+		printf(" %8u", Entry.Count);
+		for (Span = 0U; Span < USB_TRACE_NUM_SPANS; Span++) {
+			u64 P50 = HistQuantile(Entry.Hist[Span], 500U);
+			u64 P99 = HistQuantile(Entry.Hist[Span], 990U);
+
+			if (P50 == 0U) {
+				continue;
+			}
+			printf("  %s p50<%.2f p99<%.2f us", SpanName[Span],
+			       ToUs(P50, Trace.CyclesPerSecond),
+			       ToUs(P99, Trace.CyclesPerSecond));
+		}
+		printf("\n");
+	}
+}
+
+static void PrintDedup(const u8 *Data, u32 Size)
+{
+	UsbTelemetry_Dedup Dedup;
+
+	if (Size < sizeof(Dedup)) {
+		return;
+	}
+	memcpy(&Dedup, Data, sizeof(Dedup));
+	printf("dedup: %u logical, %u/%u physical chunks, %u hits, "
+	       "%u copies, %u zero, %u rejected, %llu bytes\n",
+	       Dedup.LogicalChunks, Dedup.PhysicalChunks, Dedup.PoolChunks,
+	       Dedup.DedupHits, Dedup.CowCopies, Dedup.ZeroChunks,
+	       Dedup.PoolExhausted, (unsigned long long)Dedup.BytesWritten);
+}
+
+int main(int argc, char **argv)
+{
+	UsbTelemetry_Header Header;
+	UsbTelemetry_Section Section;
+	FILE *File = stdin;
+	size_t Length;
+	u32 Offset;
+	u32 Index;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [block.bin|-]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 2 && strcmp(argv[1], "-") != 0) {
+		File = fopen(argv[1], "rb");
+		if (File == NULL) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	Length = fread(Block, 1U, sizeof(Block), File);
+	if (File != stdin) {
+		fclose(File);
+	}
+
+	if (Length < sizeof(Header)) {
+		fprintf(stderr, "short block, %zu bytes\n", Length);
+		return 1;
+	}
+	memcpy(&Header, Block, sizeof(Header));
+	if (Header.Magic != USB_TELEMETRY_MAGIC) {
+		fprintf(stderr, "bad magic %08x\n", Header.Magic);
+		return 1;
+	}
+	if (Header.TotalSize > Length) {
+		fprintf(stderr, "truncated block, %zu of %u bytes\n", Length,
+			Header.TotalSize);
+		return 1;
+	}
+
+	printf("telemetry v%u, snapshot %u at %.6f s, %u bytes, %u sections\n",
+	       Header.Version, Header.Sequence,
+	       Header.TicksPerSecond ? (double)Header.Timestamp /
+	       Header.TicksPerSecond : 0.0, Header.TotalSize,
+	       Header.SectionCount);
+
+	Offset = Header.HeaderSize;
+	for (Index = 0U; Index < Header.SectionCount; Index++) {
+		const u8 *Data;
+
+		if (Offset + sizeof(Section) > Header.TotalSize) {
+			break;
+		}
+		memcpy(&Section, Block + Offset, sizeof(Section));
+		Offset += sizeof(Section);
+		if (Offset + Section.Size > Header.TotalSize) {
+			fprintf(stderr, "section %u overruns the block\n", Section.Id);
+			return 1;
+		}
+		Data = Block + Offset;
+
+		switch (Section.Id) {
+			case USB_TELEMETRY_SEC_DEVICE:
+				PrintDevice(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_ENDPOINTS:
+				PrintEndpoints(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_EVENTS:
+				PrintEvents(Data, Section.Size, Header.TicksPerSecond);
+				break;
+			case USB_TELEMETRY_SEC_CACHE:
+				PrintCache(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_POOL:
+				PrintPool(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_SCSI:
+				PrintScsi(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_LATENCY:
+				PrintLatency(Data, Section.Size,
+					     Header.TicksPerSecond);
+				break;
+			case USB_TELEMETRY_SEC_TRACE:
+				PrintTrace(Data, Section.Size);
+				break;
+			case USB_TELEMETRY_SEC_DEDUP:
+				PrintDedup(Data, Section.Size);
+				break;
+			default:
+				printf("section %u v%u, %u bytes skipped\n", Section.Id,
+				       Section.Version, Section.Size);
+				break;
+		}
+
+		Offset += (Section.Size + 7U) & ~7U;
+	}
+
+	return 0;
+}
@@ -0,0 +1,547 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_capture.c
+ *
+ * This file implements the reader for captured USB traffic, see
+ * usb_capture.h.
+ *
+ * The usbmon text format is described in Documentation/usb/usbmon.rst of
+ * the Linux kernel, the binary header in the same file and in the libpcap
+ * documentation of LINKTYPE_USB_LINUX (189) and LINKTYPE_USB_LINUX_MMAPPED
+ * (220). Only little endian captures are read.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_capture.h"
+
+/************************** Constant Definitions *****************************/
+#define PCAP_MAGIC_US		0xA1B2C3D4U
+#define PCAP_MAGIC_NS		0xA1B23C4DU
+#define PCAPNG_SHB		0x0A0D0D0AU
+#define PCAPNG_IDB		0x00000001U
+#define PCAPNG_SPB		0x00000003U
+#define PCAPNG_EPB		0x00000006U
+#define PCAPNG_BYTE_ORDER	0x1A2B3C4DU
+
+#define LINKTYPE_USB_LINUX	189U
+#define LINKTYPE_USB_LINUX_MMAPPED	220U
+
+#define USBMON_HDR_LEN		48U
+#define USBMON_HDR_LEN_MMAPPED	64U
+
+#define CAPTURE_MAX_INTERFACES	16U
+#define CAPTURE_MAX_TOKENS	64U
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u64 Tag;		/* URB tag of the capture */
+	UsbCapture_Urb Urb;
+} Capture_Pending;
+
+/* One submission, completion or error as read from the capture */
+typedef struct {
+	u64 Tag;
+	u64 TimeUs;
+	char Event;		/* 'S', 'C' or 'E' */
+	u8 Type;
+	u8 Ep;
+	u8 Device;
+	u16 Bus;
+	u8 HasSetup;
+	SetupPacket Setup;
+	s32 Status;
+	u32 Length;
+	const u8 *Data;
+	u32 DataCaptured;
+} Capture_Event;
+
+/************************** Variable Definitions *****************************/
+static Capture_Pending *Pending;
+static u32 PendingCount;
+static u32 PendingSize;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static inline u16 Le16(const u8 *Ptr)
+{
+	return (u16)(Ptr[0] | (Ptr[1] << 8));
+}
+
+static inline u32 Le32(const u8 *Ptr)
+{
+	return (u32)Ptr[0] | ((u32)Ptr[1] << 8) | ((u32)Ptr[2] << 16) |
+	       ((u32)Ptr[3] << 24);
+}
+
+static inline u64 Le64(const u8 *Ptr)
+{
+	return (u64)Le32(Ptr) | ((u64)Le32(Ptr + 4) << 32);
+}
+
+static void *Grow(void *Array, u32 *SizePtr, u32 Count, size_t Element)
+{
+	void *New;
+	u32 Size;
+
+	if (Count < *SizePtr) {
+		return Array;
+	}
+
+	Size = (*SizePtr == 0U) ? 256U : *SizePtr * 2U;
+	New = realloc(Array, (size_t)Size * Element);
+	if (New == NULL) {
+		fprintf(stderr, "usb_capture: out of memory\n");
+		exit(1);
+	}
+	*SizePtr = Size;
+
+	return New;
+}
+
+static u8 *CopyData(const u8 *Data, u32 Length)
+{
+	u8 *Copy;
+
+	if (Length == 0U) {
+		return NULL;
+	}
+
+	Copy = malloc(Length);
+	if (Copy == NULL) {
+		fprintf(stderr, "usb_capture: out of memory\n");
+		exit(1);
+	}
+	memcpy(Copy, Data, Length);
+
+	return Copy;
+}
+
+/*****************************************************************************/
+/**
+* Pairs a capture event with the URB it belongs to. Submissions are kept
+* until their completion, completed URBs are appended to the capture.
+*
+* @param	CapturePtr is the capture.
+* @param	Event is the event.
+* @param	UrbSize is the allocated size of the URB list.
+*
+* @return	None.
+*
+* @note		A completion without submission, from a capture started in
+*		the middle of a transfer, is dropped.
+*
+******************************************************************************/
+static void CaptureEvent(UsbCapture *CapturePtr, const Capture_Event *Event,
+			 u32 *UrbSize)
+{
+	UsbCapture_Urb *UrbPtr;
+	u32 Index;
+
+	if (Event->Event == 'S') {
+		Pending = Grow(Pending, &PendingSize, PendingCount,
+			       sizeof(*Pending));
+		UrbPtr = &Pending[PendingCount].Urb;
+		Pending[PendingCount].Tag = Event->Tag;
+		PendingCount++;
+
+		memset(UrbPtr, 0, sizeof(*UrbPtr));
+		UrbPtr->Bus = Event->Bus;
+		UrbPtr->Device = Event->Device;
+		UrbPtr->Ep = Event->Ep;
+		UrbPtr->Type = Event->Type;
+		UrbPtr->HasSetup = Event->HasSetup;
+		UrbPtr->Setup = Event->Setup;
+		UrbPtr->Length = Event->Length;
+		if ((Event->Ep & USB_CAPTURE_DIR_IN) == 0U) {
+			UrbPtr->Data = CopyData(Event->Data, Event->DataCaptured);
+			UrbPtr->DataCaptured = Event->DataCaptured;
+		}
+		return;
+	}
+
+	/* Tags may be reused once completed, the latest submission wins */
+	for (Index = PendingCount; Index > 0U; Index--) {
+		if (Pending[Index - 1U].Tag == Event->Tag) {
+			break;
+		}
+	}
+	if (Index == 0U) {
+		return;
+	}
+	Index--;
+
+	CapturePtr->Urb = Grow(CapturePtr->Urb, UrbSize, CapturePtr->Count,
+			       sizeof(*CapturePtr->Urb));
+	UrbPtr = &CapturePtr->Urb[CapturePtr->Count++];
+	*UrbPtr = Pending[Index].Urb;
+	memmove(&Pending[Index], &Pending[Index + 1U],
+		(PendingCount - Index - 1U) * sizeof(*Pending));
+	PendingCount--;
+
+	UrbPtr->TimeUs = Event->TimeUs;
+	UrbPtr->Status = Event->Status;
+	UrbPtr->Actual = (Event->Event == 'E') ? 0U : Event->Length;
+	if ((UrbPtr->Ep & USB_CAPTURE_DIR_IN) != 0U) {
+		UrbPtr->Data = CopyData(Event->Data, Event->DataCaptured);
+		UrbPtr->DataCaptured = Event->DataCaptured;
+	} else if (UrbPtr->DataCaptured > UrbPtr->Length) {
+		UrbPtr->DataCaptured = UrbPtr->Length;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Reads one usbmon binary record.
+*
+* @param	Packet is the record.
+* @param	Length is the captured length of the record.
+* @param	HeaderLen is USBMON_HDR_LEN or USBMON_HDR_LEN_MMAPPED.
+* @param	Event returns the event.
+*
+* @return	XST_SUCCESS, or XST_FAILURE for a truncated record.
+*
+******************************************************************************/
+static s32 ReadBinary(const u8 *Packet, u32 Length, u32 HeaderLen,
+		      Capture_Event *Event)
+{
+	u32 Captured;
+
+	if (Length < HeaderLen) {
+		return XST_FAILURE;
+	}
+
+	memset(Event, 0, sizeof(*Event));
+	Event->Tag = Le64(&Packet[0]);
+	Event->Event = (char)Packet[8];
+	Event->Type = Packet[9];
+	Event->Ep = Packet[10];
+	Event->Device = Packet[11];
+	Event->Bus = Le16(&Packet[12]);
+	Event->TimeUs = Le64(&Packet[16]) * 1000000U + Le32(&Packet[24]);
+	Event->Status = (s32)Le32(&Packet[28]);
+	Event->Length = Le32(&Packet[32]);
+	Captured = Le32(&Packet[36]);
+
+	if (Event->Event == 'S' && Packet[14] == 0U) {
+		Event->HasSetup = TRUE;
+		Event->Setup.bRequestType = Packet[40];
+		Event->Setup.bRequest = Packet[41];
+		Event->Setup.wValue = Le16(&Packet[42]);
+		Event->Setup.wIndex = Le16(&Packet[44]);
+		Event->Setup.wLength = Le16(&Packet[46]);
+	}
+
+	if (Captured > Length - HeaderLen) {
+		Captured = Length - HeaderLen;
+	}
+	if (Event->Type != USB_CAPTURE_ISO) {
+		Event->Data = &Packet[HeaderLen];
+		Event->DataCaptured = Captured;
+	}
+
+	return XST_SUCCESS;
+}
+
+static u32 HeaderLength(u32 LinkType)
+{
+	switch (LinkType) {
+		case LINKTYPE_USB_LINUX:
+			return USBMON_HDR_LEN;
+		case LINKTYPE_USB_LINUX_MMAPPED:
+			return USBMON_HDR_LEN_MMAPPED;
+		default:
+			return 0U;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Reads a pcap or pcapng file.
+*
+* @param	File is the file contents.
+* @param	Size is the file size.
+* @param	CapturePtr is the capture to fill.
+* @param	UrbSize is the allocated size of the URB list.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if no interface has a usbmon link
+*		type or the file is not readable.
+*
+******************************************************************************/
+static s32 ReadPcap(const u8 *File, size_t Size, UsbCapture *CapturePtr,
+		    u32 *UrbSize)
+{
+	u32 HeaderLen[CAPTURE_MAX_INTERFACES];
+	u32 Interfaces = 0U;
+	Capture_Event Event;
+	size_t Offset;
+	u32 Interface;
+	u32 Captured;
+	u32 Type;
+	u32 Length;
+	const u8 *Packet;
+
+	if (Le32(File) == PCAP_MAGIC_US || Le32(File) == PCAP_MAGIC_NS) {
+		if (Size < 24U || HeaderLength(Le32(&File[20])) == 0U) {
+			return XST_FAILURE;
+		}
+		HeaderLen[0] = HeaderLength(Le32(&File[20]));
+
+		for (Offset = 24U; Offset + 16U <= Size;
+		     Offset += 16U + Captured) {
+			Captured = Le32(&File[Offset + 8U]);
+			if (Offset + 16U + Captured > Size) {
+				break;
+			}
+			if (ReadBinary(&File[Offset + 16U], Captured, HeaderLen[0],
+				       &Event) == XST_SUCCESS) {
+				CaptureEvent(CapturePtr, &Event, UrbSize);
+			}
+		}
+		return XST_SUCCESS;
+	}
+
+	for (Offset = 0U; Offset + 12U <= Size; Offset += Length) {
+		Type = Le32(&File[Offset]);
+		Length = Le32(&File[Offset + 4U]);
+		if (Length < 12U || Offset + Length > Size) {
+			break;
+		}
+
+		switch (Type) {
+			case PCAPNG_SHB:
+				if (Le32(&File[Offset + 8U]) != PCAPNG_BYTE_ORDER) {
+					fprintf(stderr, "usb_capture: big endian "
+						"capture not supported\n");
+					return XST_FAILURE;
+				}
+				Interfaces = 0U;
+				break;
+
+			case PCAPNG_IDB:
+				if (Interfaces < CAPTURE_MAX_INTERFACES) {
+					HeaderLen[Interfaces++] =
+						HeaderLength(Le16(&File[Offset + 8U]));
+				}
+				break;
+
+			case PCAPNG_EPB:
+			case PCAPNG_SPB:
+				if (Type == PCAPNG_EPB) {
+					Interface = Le32(&File[Offset + 8U]);
+					Captured = Le32(&File[Offset + 20U]);
+					Packet = &File[Offset + 28U];
+				} else {
+					Interface = 0U;
+					Captured = Le32(&File[Offset + 8U]);
+					Packet = &File[Offset + 12U];
+				}
+				if (Interface >= Interfaces ||
+				    HeaderLen[Interface] == 0U ||
+				    Packet + Captured > &File[Offset + Length]) {
+					break;
+				}
+				if (ReadBinary(Packet, Captured, HeaderLen[Interface],
+					       &Event) == XST_SUCCESS) {
+					CaptureEvent(CapturePtr, &Event, UrbSize);
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Reads one line of the usbmon text format, for example
+*
+*   d5ea89a0 3575914555 S Ci:1:001:0 s a3 00 0000 0003 0004 4 <
+*   d5ea89a0 3575914560 C Ci:1:001:0 0 4 = 01050000
+*
+* @param	Line is the line, it is modified.
+* @param	Event returns the event.
+* @param	Data is a buffer for the data words.
+* @param	DataSize is the size of the buffer.
+*
+* @return	XST_SUCCESS, or XST_FAILURE for a line not describing an URB.
+*
+******************************************************************************/
+static s32 ReadText(char *Line, Capture_Event *Event, u8 *Data, u32 DataSize)
+{
+	char *Token[CAPTURE_MAX_TOKENS];
+	u32 Count = 0U;
+	u32 Index;
+	char *Word;
+	char *Save;
+	u32 Bus;
+	u32 Device;
+	u32 Ep;
+	char Type;
+	char Dir;
+
+	for (Word = strtok_r(Line, " \t\r\n", &Save);
+	     Word != NULL && Count < CAPTURE_MAX_TOKENS;
+	     Word = strtok_r(NULL, " \t\r\n", &Save)) {
+		Token[Count++] = Word;
+	}
+	if (Count < 5U || strlen(Token[2]) != 1U ||
+	    sscanf(Token[3], "%c%c:%u:%u:%u", &Type, &Dir, &Bus, &Device,
+		   &Ep) != 5) {
+		return XST_FAILURE;
+	}
+
+	memset(Event, 0, sizeof(*Event));
+	Event->Tag = strtoull(Token[0], NULL, 16);
+	Event->TimeUs = strtoull(Token[1], NULL, 10);
+	Event->Event = Token[2][0];
+	Event->Bus = (u16)Bus;
+	Event->Device = (u8)Device;
+	Event->Ep = (u8)(Ep | ((Dir == 'i') ? USB_CAPTURE_DIR_IN : 0U));
+
+	switch (Type) {
+		case 'C':
+			Event->Type = USB_CAPTURE_CONTROL;
+			break;
+		case 'B':
+			Event->Type = USB_CAPTURE_BULK;
+			break;
+		case 'I':
+			Event->Type = USB_CAPTURE_INT;
+			break;
+		default:
+			/* Isochronous lines carry frame descriptors, not read */
+			Event->Type = USB_CAPTURE_ISO;
+			return XST_SUCCESS;
+	}
+
+	Index = 4U;
+	if (strcmp(Token[Index], "s") == 0) {
+		if (Count < Index + 6U) {
+			return XST_FAILURE;
+		}
+		Event->HasSetup = TRUE;
+		Event->Setup.bRequestType = (u8)strtoul(Token[5], NULL, 16);
+		Event->Setup.bRequest = (u8)strtoul(Token[6], NULL, 16);
+		Event->Setup.wValue = (u16)strtoul(Token[7], NULL, 16);
+		Event->Setup.wIndex = (u16)strtoul(Token[8], NULL, 16);
+		Event->Setup.wLength = (u16)strtoul(Token[9], NULL, 16);
+		Index = 10U;
+	} else {
+		/* Status, with ":interval" for interrupt transfers */
+		Event->Status = (s32)strtol(Token[Index], NULL, 10);
+		Index++;
+	}
+
+	if (Event->Event == 'E' || Index >= Count) {
+		return XST_SUCCESS;
+	}
+
+	Event->Length = (u32)strtoul(Token[Index++], NULL, 10);
+	if (Index < Count && strcmp(Token[Index], "=") == 0) {
+		for (Index++; Index < Count; Index++) {
+			for (Word = Token[Index]; Word[0] != '\0' && Word[1] != '\0' &&
+			     Event->DataCaptured < DataSize; Word += 2) {
+				char Byte[3] = { Word[0], Word[1], '\0' };
+
+				Data[Event->DataCaptured++] =
+					(u8)strtoul(Byte, NULL, 16);
+			}
+		}
+		Event->Data = Data;
+	}
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Loads a capture. The format is detected from the file contents.
+*
+* @param	Path is the file, "-" for stdin.
+* @param	CapturePtr returns the URBs, release with UsbCapture_Free().
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the file could not be read.
+*
+******************************************************************************/
+s32 UsbCapture_Load(const char *Path, UsbCapture *CapturePtr)
+{
+	FILE *In = stdin;
+	u8 *File = NULL;
+	size_t Size = 0U;
+	size_t Read;
+	u32 FileSize = 0U;
+	u32 UrbSize = 0U;
+	s32 Status = XST_SUCCESS;
+
+	memset(CapturePtr, 0, sizeof(*CapturePtr));
+
+	if (strcmp(Path, "-") != 0) {
+		In = fopen(Path, "rb");
+		if (In == NULL) {
+			perror(Path);
+			return XST_FAILURE;
+		}
+	}
+
+	do {
+		File = Grow(File, &FileSize, (u32)Size + 1U, 1U);
+		Read = fread(&File[Size], 1U, FileSize - Size - 1U, In);
+		Size += Read;
+	} while (Read != 0U);
+	File[Size] = '\0';
+	if (In != stdin) {
+		fclose(In);
+	}
+
+	if (Size >= 4U && (Le32(File) == PCAPNG_SHB ||
+			   Le32(File) == PCAP_MAGIC_US ||
+			   Le32(File) == PCAP_MAGIC_NS)) {
+		Status = ReadPcap(File, Size, CapturePtr, &UrbSize);
+	} else {
+		Capture_Event Event;
+		u8 Data[1024];
+		char *Line;
+		char *Next;
+
+		for (Line = (char *)File; Line != NULL; Line = Next) {
+			Next = strchr(Line, '\n');
+			if (Next != NULL) {
+				*Next++ = '\0';
+			}
+			if (ReadText(Line, &Event, Data, sizeof(Data)) ==
+			    XST_SUCCESS) {
+				CaptureEvent(CapturePtr, &Event, &UrbSize);
+			}
+		}
+	}
+
+	CapturePtr->Incomplete = PendingCount;
+	while (PendingCount != 0U) {
+		free(Pending[--PendingCount].Urb.Data);
+	}
+	free(File);
+
+	return Status;
+}
+
+void UsbCapture_Free(UsbCapture *CapturePtr)
+{
+	u32 Index;
+
+	for (Index = 0U; Index < CapturePtr->Count; Index++) {
+		free(CapturePtr->Urb[Index].Data);
+	}
+	free(CapturePtr->Urb);
+	memset(CapturePtr, 0, sizeof(*CapturePtr));
+}
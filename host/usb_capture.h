@@ -0,0 +1,76 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_capture.h
+ *
+ * This file contains the reader for captured USB traffic, see
+ * usb_capture.c. Captures of the Linux usbmon interface are read in its
+ * text format (/sys/kernel/debug/usb/usbmon/<bus>u) or as pcapng or pcap
+ * files with the usbmon link types written by Wireshark and tcpdump.
+ *
+ * Submissions and completions are paired into URBs, listed in the order
+ * they completed. The text format only keeps the first 32 data bytes of a
+ * transfer, DataCaptured tells how much of the data is known.
+ *
+ *****************************************************************************/
+
+#ifndef USB_CAPTURE_H
+#define USB_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xusbpsu.h"
+
+/************************** Constant Definitions ****************************/
+/* Transfer types, as in the usbmon binary header */
+#define USB_CAPTURE_ISO		0U
+#define USB_CAPTURE_INT		1U
+#define USB_CAPTURE_CONTROL	2U
+#define USB_CAPTURE_BULK	3U
+
+#define USB_CAPTURE_DIR_IN	0x80U	/* In Ep */
+
+/* URB status values of interest, negative errno */
+#define USB_CAPTURE_EPIPE	(-32)	/* Stall */
+#define USB_CAPTURE_ENOENT	(-2)	/* Unlinked */
+#define USB_CAPTURE_ECONNRESET	(-104)	/* Unlinked */
+#define USB_CAPTURE_ESHUTDOWN	(-108)	/* Device gone */
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u64 TimeUs;		/* Completion time stamp */
+	u16 Bus;
+	u8 Device;
+	u8 Ep;			/* Number, USB_CAPTURE_DIR_IN for IN */
+	u8 Type;		/* USB_CAPTURE_* */
+	u8 HasSetup;
+	SetupPacket Setup;
+	u32 Length;		/* Requested length */
+	s32 Status;		/* Completion status, 0 or negative errno */
+	u32 Actual;		/* Bytes transferred */
+	u8 *Data;		/* OUT: submitted data, IN: received data */
+	u32 DataCaptured;	/* Valid bytes at Data */
+} UsbCapture_Urb;
+
+typedef struct {
+	UsbCapture_Urb *Urb;
+	u32 Count;
+	u32 Incomplete;		/* Submissions without completion */
+} UsbCapture;
+
+/************************** Function Prototypes ******************************/
+s32 UsbCapture_Load(const char *Path, UsbCapture *CapturePtr);
+void UsbCapture_Free(UsbCapture *CapturePtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* USB_CAPTURE_H */
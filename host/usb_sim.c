@@ -0,0 +1,991 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim.c
+ *
+ * This file contains the simulated USB controller, see usb_sim.h.
+ *
+ * An endpoint holds at most one transfer, like a single TRB. The host side
+ * copies data between its buffer and the transfer and posts a completion
+ * event with the number of bytes moved. A transfer ends when it is full or
+ * when the host transfer ends, which models a short packet. Setup packets,
+ * bus resets and disconnects are events too. The events are counted in
+ * GEVNTCOUNT(0) so the interrupt and poll code of xusb_event.c sees them as
+ * it would on the controller. Each event is also written to the event
+ * buffer in the controller format, endpoint events carry the physical
+ * endpoint number and setup packets show up as EP0 OUT events.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+#include "usb_sim.h"
+#include "xiltimer.h"
+
+/************************** Constant Definitions *****************************/
+#define SIM_EVENT_SLOTS		(XUSBPSU_EVENT_BUFFERS_SIZE / 4U)
+
+#define SIM_EVENT_EP		0U
+#define SIM_EVENT_SETUP		1U
+#define SIM_EVENT_RESET		2U
+#define SIM_EVENT_DISCONNECT	3U
+
+/* Event buffer entries */
+#define SIM_EVT_DEVICE		0x01U
+#define SIM_EVT_EPNUM_SHIFT	1U
+#define SIM_EVT_DEV_DISCONNECT	0x0000U
+#define SIM_EVT_DEV_RESET	0x0100U
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u32 Type;
+	u32 PhyEpNum;
+	u32 RequestedBytes;
+	u32 BytesTxed;
+	SetupPacket Setup;
+} SimEvent;
+
+/************************** Variable Definitions *****************************/
+static XUsbPsu_Config Config = {
+	.DeviceId = XPAR_XUSBPSU_0_DEVICE_ID,
+	.BaseAddress = XPAR_XUSBPSU_0_BASEADDR,
+	.IsCacheCoherent = 1U,
+	.EnableSuperSpeed = 1U,
+};
+
+#ifdef USB_CACHE_MANAGED
+/*
+ * Bounds of the .usb_noncache section of lscript.ld. Host memory keeps its
+ * attributes, so the section is empty and UsbCache_Init() remaps nothing.
+ */
+u8 __usb_noncache_start[1];
+extern u8 __usb_noncache_end[1]
+	__attribute__ ((alias ("__usb_noncache_start")));
+#endif
+
+static struct XUsbPsu *Instance;
+
+static SimEvent Event[SIM_EVENT_SLOTS];
+static u32 EventWord[SIM_EVENT_SLOTS];	/* Event buffer */
+static u32 EventHead;
+static u32 EventCount;
+
+static u32 GevntSiz;
+static u8 Running;
+static u8 Ep0Stalled;		/* Current control transfer stalled */
+
+static void (*IntrHandler)(void *);
+static void *IntrRef;
+static u32 (*Loop)(void);
+
+/* Comparator of the generic timer, see UsbSim_TimerSet() */
+static void (*TimerHandler)(void *);
+static void *TimerRef;
+static u64 TimerCompare;
+static u8 TimerEnabled;
+
+/* Transfer starts to fail per endpoint, see UsbSim_FailStart() */
+static u32 FailStarts[XUSBPSU_ENDPOINTS_NUM];
+
+static UsbSim_Stats Stats;
+
+/*****************************************************************************/
+/**
+* Queues an event for the interrupt handler.
+*
+* @param	EventPtr is the event, it is copied.
+*
+* @return	None.
+*
+* @note		The event is dropped when the buffer is full, the controller
+*		would report an overflow.
+*
+******************************************************************************/
+static void SimPost(const SimEvent *EventPtr)
+{
+	u32 Slot;
+
+	if (EventCount == SIM_EVENT_SLOTS) {
+		fprintf(stderr, "usb_sim: event buffer overflow\n");
+		return;
+	}
+
+	Slot = (EventHead + EventCount) % SIM_EVENT_SLOTS;
+	Event[Slot] = *EventPtr;
+	switch (EventPtr->Type) {
+		case SIM_EVENT_EP:
+			EventWord[Slot] = EventPtr->PhyEpNum << SIM_EVT_EPNUM_SHIFT;
+			break;
+		case SIM_EVENT_SETUP:
+			EventWord[Slot] = 0U;
+			break;
+		case SIM_EVENT_RESET:
+			EventWord[Slot] = SIM_EVT_DEV_RESET | SIM_EVT_DEVICE;
+			break;
+		default:
+			EventWord[Slot] = SIM_EVT_DEV_DISCONNECT | SIM_EVT_DEVICE;
+			break;
+	}
+	EventCount++;
+}
+
+static void SimPostEp(u32 PhyEpNum, u32 RequestedBytes, u32 BytesTxed)
+{
+	SimEvent Ev;
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.Type = SIM_EVENT_EP;
+	Ev.PhyEpNum = PhyEpNum;
+	Ev.RequestedBytes = RequestedBytes;
+	Ev.BytesTxed = BytesTxed;
+	SimPost(&Ev);
+}
+
+static inline u64 SimCycles(void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+	return __rdtsc();
+#else
+	return 0U;
+#endif
+}
+
+static struct XUsbPsu_Ep *SimEp(u8 UsbEp, u8 Dir)
+{
+	u32 PhyEpNum = ((u32)UsbEp << 1) | Dir;
+
+	if (Instance == NULL || PhyEpNum >= XUSBPSU_ENDPOINTS_NUM) {
+		return NULL;
+	}
+
+	return &Instance->eps[PhyEpNum];
+}
+
+static void SimEpReset(struct XUsbPsu *InstancePtr)
+{
+	u32 Index;
+
+	for (Index = 0U; Index < XUSBPSU_ENDPOINTS_NUM; Index++) {
+		struct XUsbPsu_Ep *Ept = &InstancePtr->eps[Index];
+
+		Ept->EpStatus &= ~(XUSBPSU_EP_BUSY | XUSBPSU_EP_STALL);
+		if (Index > 1U) {
+			Ept->EpStatus &= ~XUSBPSU_EP_ENABLED;
+		}
+	}
+}
+
+/*****************************************************************************/
+/**
+* Delivers one event the way the driver event handlers do.
+*
+* @param	InstancePtr is the controller.
+* @param	EventPtr is the event.
+*
+* @return	None.
+*
+******************************************************************************/
+static void SimDeliver(struct XUsbPsu *InstancePtr, const SimEvent *EventPtr)
+{
+	struct Usb_DevData *AppData = (struct Usb_DevData *)InstancePtr->AppData;
+	struct XUsbPsu_Ep *Ept;
+
+	switch (EventPtr->Type) {
+		case SIM_EVENT_EP:
+			Ept = &InstancePtr->eps[EventPtr->PhyEpNum];
+			Ept->RequestedBytes = EventPtr->RequestedBytes;
+			Ept->BytesTxed = EventPtr->BytesTxed;
+			if (Ept->Handler != NULL) {
+				Ept->Handler(AppData, Ept->RequestedBytes, Ept->BytesTxed);
+			}
+			break;
+
+		case SIM_EVENT_SETUP:
+			InstancePtr->SetupData = EventPtr->Setup;
+			if (InstancePtr->Chapter9 != NULL) {
+				InstancePtr->Chapter9(AppData, &InstancePtr->SetupData);
+			}
+			break;
+
+		case SIM_EVENT_RESET:
+			SimEpReset(InstancePtr);
+			InstancePtr->IsConfigDone = 0U;
+			AppData->State = XUSBPSU_STATE_DEFAULT;
+			AppData->Speed = (u8)InstancePtr->Speed;
+			if (InstancePtr->ResetHandler != NULL) {
+				InstancePtr->ResetHandler(AppData);
+			}
+			break;
+
+		default:
+			SimEpReset(InstancePtr);
+			InstancePtr->IsConfigDone = 0U;
+			AppData->State = XUSBPSU_STATE_ATTACHED;
+			if (InstancePtr->DisconnectHandler != NULL) {
+				InstancePtr->DisconnectHandler(AppData);
+			}
+			break;
+	}
+}
+
+/************************** Driver Functions *********************************/
+
+XUsbPsu_Config *XUsbPsu_LookupConfig(u16 DeviceId)
+{
+	return (DeviceId == Config.DeviceId) ? &Config : NULL;
+}
+
+s32 XUsbPsu_CfgInitialize(struct XUsbPsu *InstancePtr,
+			  XUsbPsu_Config *ConfigPtr, u32 BaseAddress)
+{
+	u32 Index;
+
+	(void)BaseAddress;
+
+	InstancePtr->ConfigPtr = ConfigPtr;
+	for (Index = 0U; Index < XUSBPSU_ENDPOINTS_NUM; Index++) {
+		struct XUsbPsu_Ep *Ept = &InstancePtr->eps[Index];
+
+		memset(Ept, 0, sizeof(*Ept));
+		Ept->PhyEpNum = (u8)Index;
+		Ept->UsbEpNum = (u8)(Index >> 1);
+		Ept->Direction = (u8)(Index & 1U);
+	}
+	InstancePtr->Speed = XUSBPSU_SPEED_HIGH;
+
+	InstancePtr->Evt.BuffAddr = EventWord;
+	InstancePtr->Evt.Offset = 0U;
+
+	Instance = InstancePtr;
+	EventHead = 0U;
+	EventCount = 0U;
+	GevntSiz = 0U;
+	Running = FALSE;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_Start(struct XUsbPsu *InstancePtr)
+{
+	u32 Dir;
+
+	for (Dir = 0U; Dir < 2U; Dir++) {
+		InstancePtr->eps[Dir].EpStatus = XUSBPSU_EP_ENABLED;
+		InstancePtr->eps[Dir].MaxSize = 64U;
+		InstancePtr->eps[Dir].Type = XUSBPSU_ENDPOINT_XFER_CONTROL;
+	}
+	Running = TRUE;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_Stop(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+	Running = FALSE;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Handles all pending events, called from the interrupt handler or from the
+* poll loop.
+*
+* @param	XUsbPsuInstancePtr is the controller.
+*
+* @return	None.
+*
+* @note		Events posted while handling, by a host transfer started from a
+*		callback, are handled in the same call.
+*
+******************************************************************************/
+void XUsbPsu_IntrHandler(void *XUsbPsuInstancePtr)
+{
+	struct XUsbPsu *InstancePtr = (struct XUsbPsu *)XUsbPsuInstancePtr;
+
+	while (EventCount != 0U) {
+		SimEvent Ev = Event[EventHead];
+
+		EventHead = (EventHead + 1U) % SIM_EVENT_SLOTS;
+		EventCount--;
+		InstancePtr->Evt.Offset = EventHead * 4U;
+		Stats.Events++;
+		SimDeliver(InstancePtr, &Ev);
+	}
+}
+
+void XUsbPsu_WakeUpIntrHandler(void *XUsbPsuInstancePtr)
+{
+	(void)XUsbPsuInstancePtr;
+}
+
+void XUsbPsu_EnableIntr(struct XUsbPsu *InstancePtr, u32 Mask)
+{
+	InstancePtr->DevtenMask |= Mask;
+}
+
+void XUsbPsu_DisableIntr(struct XUsbPsu *InstancePtr, u32 Mask)
+{
+	InstancePtr->DevtenMask &= ~Mask;
+}
+
+u32 XUsbPsu_ReadReg(struct XUsbPsu *InstancePtr, u32 Offset)
+{
+	(void)InstancePtr;
+
+	switch (Offset) {
+		case XUSBPSU_GEVNTCOUNT(0):
+			return EventCount * 4U;
+		case XUSBPSU_GEVNTSIZ(0):
+			return GevntSiz;
+		default:
+			return 0U;
+	}
+}
+
+void XUsbPsu_WriteReg(struct XUsbPsu *InstancePtr, u32 Offset, u32 Data)
+{
+	(void)InstancePtr;
+
+	switch (Offset) {
+		case XUSBPSU_GEVNTSIZ(0):
+			GevntSiz = Data;
+			break;
+		default:
+			/* Event counts are consumed by XUsbPsu_IntrHandler() */
+			break;
+	}
+}
+
+void XUsbPsu_set_ch9handler(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *, SetupPacket *))
+{
+	InstancePtr->Chapter9 = func;
+}
+
+void XUsbPsu_set_rsthandler(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *))
+{
+	InstancePtr->ResetHandler = func;
+}
+
+void XUsbPsu_set_disconnect(struct XUsbPsu *InstancePtr,
+			    void (*func)(struct Usb_DevData *))
+{
+	InstancePtr->DisconnectHandler = func;
+}
+
+void *XUsbPsu_get_drvdata(struct XUsbPsu *InstancePtr)
+{
+	return InstancePtr->DrvData;
+}
+
+void XUsbPsu_set_drvdata(struct XUsbPsu *InstancePtr, void *data)
+{
+	InstancePtr->DrvData = data;
+}
+
+void XUsbPsu_SetEpHandler(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir,
+			  void (*Handler)(void *, u32, u32))
+{
+	InstancePtr->eps[((u32)Epnum << 1) | Dir].Handler = Handler;
+}
+
+s32 XUsbPsu_EpEnable(struct XUsbPsu *InstancePtr, u8 UsbEpNum, u8 Dir,
+		     u16 Maxsize, u8 Type, u8 Restore)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(UsbEpNum, Dir);
+
+	(void)InstancePtr;
+	(void)Restore;
+
+	if (Ept == NULL) {
+		return XST_INVALID_PARAM;
+	}
+
+	Ept->MaxSize = Maxsize;
+	Ept->Type = Type;
+	Ept->EpStatus |= XUSBPSU_EP_ENABLED;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_EpDisable(struct XUsbPsu *InstancePtr, u8 UsbEpNum, u8 Dir)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(UsbEpNum, Dir);
+
+	(void)InstancePtr;
+
+	if (Ept == NULL) {
+		return XST_INVALID_PARAM;
+	}
+
+	Ept->EpStatus = 0U;
+
+	return XST_SUCCESS;
+}
+
+static s32 SimEpStart(u8 UsbEp, u8 Dir, u8 *BufferPtr, u32 Length)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(UsbEp, Dir);
+
+	if (Ept == NULL || (Ept->EpStatus & XUSBPSU_EP_ENABLED) == 0U ||
+	    (Ept->EpStatus & XUSBPSU_EP_BUSY) != 0U) {
+		return XST_FAILURE;
+	}
+	if (FailStarts[Ept->PhyEpNum] != 0U) {
+		FailStarts[Ept->PhyEpNum]--;
+		return XST_FAILURE;
+	}
+
+	Ept->BufferPtr = BufferPtr;
+	Ept->RequestedBytes = Length;
+	Ept->BytesTxed = 0U;
+	Ept->EpStatus |= XUSBPSU_EP_BUSY;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_EpBufferSend(struct XUsbPsu *InstancePtr, u8 UsbEp,
+			 u8 *BufferPtr, u32 BufferLen)
+{
+	(void)InstancePtr;
+
+	return SimEpStart(UsbEp, XUSBPSU_EP_DIR_IN, BufferPtr, BufferLen);
+}
+
+s32 XUsbPsu_EpBufferRecv(struct XUsbPsu *InstancePtr, u8 UsbEp,
+			 u8 *BufferPtr, u32 Length)
+{
+	(void)InstancePtr;
+
+	return SimEpStart(UsbEp, XUSBPSU_EP_DIR_OUT, BufferPtr, Length);
+}
+
+void XUsbPsu_EpSetStall(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(Epnum, Dir);
+
+	(void)InstancePtr;
+
+	if (Ept != NULL) {
+		Ept->EpStatus |= XUSBPSU_EP_STALL;
+	}
+}
+
+void XUsbPsu_EpClearStall(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(Epnum, Dir);
+
+	(void)InstancePtr;
+
+	if (Ept != NULL) {
+		Ept->EpStatus &= ~XUSBPSU_EP_STALL;
+	}
+}
+
+s32 XUsbPsu_IsEpStalled(struct XUsbPsu *InstancePtr, u8 Epnum, u8 Dir)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(Epnum, Dir);
+
+	(void)InstancePtr;
+
+	return (Ept != NULL && (Ept->EpStatus & XUSBPSU_EP_STALL) != 0U) ?
+	       TRUE : FALSE;
+}
+
+void XUsbPsu_Ep0StallRestart(struct XUsbPsu *InstancePtr)
+{
+	/* The stall ends the control transfer, endpoint 0 waits for a setup */
+	InstancePtr->eps[0].EpStatus &= ~XUSBPSU_EP_BUSY;
+	InstancePtr->eps[1].EpStatus &= ~XUSBPSU_EP_BUSY;
+	Ep0Stalled = TRUE;
+}
+
+void XUsbPsu_StopTransfer(struct XUsbPsu *InstancePtr, u8 UsbEpNum,
+			  u8 Dir, u8 Force)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(UsbEpNum, Dir);
+
+	(void)InstancePtr;
+	(void)Force;
+
+	if (Ept != NULL) {
+		Ept->EpStatus &= ~XUSBPSU_EP_BUSY;
+	}
+}
+
+s32 XUsbPsu_SetDeviceAddress(struct XUsbPsu *InstancePtr, u16 Addr)
+{
+	struct Usb_DevData *AppData = (struct Usb_DevData *)InstancePtr->AppData;
+
+	if (Addr > 0x7FU || AppData->State == XUSBPSU_STATE_CONFIGURED) {
+		return XST_FAILURE;
+	}
+
+	AppData->State = (Addr != 0U) ? XUSBPSU_STATE_ADDRESS :
+			 XUSBPSU_STATE_DEFAULT;
+
+	return XST_SUCCESS;
+}
+
+void XUsbPsu_SetSpeed(struct XUsbPsu *InstancePtr, u32 Speed)
+{
+	(void)InstancePtr;
+	(void)Speed;
+}
+
+s32 XUsbPsu_IsSuperSpeed(struct XUsbPsu *InstancePtr)
+{
+	return (InstancePtr->Speed == XUSBPSU_SPEED_SUPER) ? TRUE : FALSE;
+}
+
+s32 XUsbPsu_SetTestMode(struct XUsbPsu *InstancePtr, u32 Mode)
+{
+	(void)InstancePtr;
+	(void)Mode;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_SetU1SleepTimeout(struct XUsbPsu *InstancePtr, u8 Sleep)
+{
+	(void)InstancePtr;
+	(void)Sleep;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_SetU2SleepTimeout(struct XUsbPsu *InstancePtr, u8 Sleep)
+{
+	(void)InstancePtr;
+	(void)Sleep;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_AcceptU1U2Sleep(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_U1SleepEnable(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_U2SleepEnable(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_U1SleepDisable(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+
+	return XST_SUCCESS;
+}
+
+s32 XUsbPsu_U2SleepDisable(struct XUsbPsu *InstancePtr)
+{
+	(void)InstancePtr;
+
+	return XST_SUCCESS;
+}
+
+/************************** BSP Functions ************************************/
+
+void XTime_GetTime(XTime *Xtime_Global)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	*Xtime_Global = (XTime)Now.tv_sec * 1000000000U + (XTime)Now.tv_nsec;
+}
+
+void UsbSim_TimerSet(u64 Compare, u32 Enable)
+{
+	TimerCompare = Compare;
+	TimerEnabled = (Enable != FALSE) ? TRUE : FALSE;
+}
+
+void Xil_Assert(const char *File, s32 Line)
+{
+	fprintf(stderr, "assertion failed at %s:%d\n", File, Line);
+	abort();
+}
+
+/************************** Simulation Functions *****************************/
+
+/*****************************************************************************/
+/**
+* Registers the interrupt handler of the controller, it is called by
+* UsbSim_Step() while events are pending and the interrupt is not masked.
+*
+* @param	Handler is the interrupt handler, usually UsbIntrHandler().
+* @param	CallBackRef is passed to the handler.
+*
+* @return	None.
+*
+******************************************************************************/
+void UsbSim_SetIntrHandler(void (*Handler)(void *), void *CallBackRef)
+{
+	IntrHandler = Handler;
+	IntrRef = CallBackRef;
+}
+
+/*****************************************************************************/
+/**
+* Registers the handler of the timer interrupt, it is called by UsbSim_Step()
+* once the time armed with UsbSim_TimerSet() has passed.
+*
+* @param	Handler is the interrupt handler, usually UsbTimerIntrHandler().
+* @param	CallBackRef is passed to the handler.
+*
+* @return	None.
+*
+******************************************************************************/
+void UsbSim_SetTimerHandler(void (*Handler)(void *), void *CallBackRef)
+{
+	TimerHandler = Handler;
+	TimerRef = CallBackRef;
+}
+
+/*****************************************************************************/
+/**
+* Registers one pass of the firmware main loop.
+*
+* @param	LoopFunc returns the amount of work it did, 0 when idle.
+*
+* @return	None.
+*
+******************************************************************************/
+void UsbSim_SetLoop(u32 (*LoopFunc)(void))
+{
+	Loop = LoopFunc;
+}
+
+/*****************************************************************************/
+/**
+* Runs the firmware once: the interrupt handler if events are pending, the
+* timer interrupt handler if the timer has expired, then one pass of the
+* main loop.
+*
+* @param	None.
+*
+* @return	Events pending before the call, the timer interrupt and the
+*		work reported by the loop, 0 when the firmware had nothing
+*		to do.
+*
+******************************************************************************/
+u32 UsbSim_Step(void)
+{
+	u32 Work = EventCount;
+	u64 Cycles = SimCycles();
+	XTime Start;
+	XTime End;
+
+	XTime_GetTime(&Start);
+
+	if (EventCount != 0U && IntrHandler != NULL &&
+	    (GevntSiz & XUSBPSU_GEVNTSIZ_INTMASK) == 0U) {
+		Stats.Interrupts++;
+		IntrHandler(IntrRef);
+	}
+	if (TimerEnabled == TRUE && TimerHandler != NULL &&
+	    Start >= TimerCompare) {
+		Stats.Timers++;
+		Work++;
+		TimerHandler(TimerRef);
+	}
+	if (Loop != NULL) {
+		Work += Loop();
+	}
+
+	XTime_GetTime(&End);
+	Stats.FirmwareCycles += SimCycles() - Cycles;
+	Stats.FirmwareTicks += End - Start;
+	Stats.Steps++;
+
+	return Work;
+}
+
+/*****************************************************************************/
+/**
+* Runs the firmware until it is idle.
+*
+* @param	None.
+*
+* @return	None.
+*
+******************************************************************************/
+static void SimSettle(void)
+{
+	u32 Steps;
+
+	for (Steps = 0U; Steps < USB_SIM_MAX_IDLE_STEPS; Steps++) {
+		if (UsbSim_Step() == 0U) {
+			return;
+		}
+	}
+}
+
+/*****************************************************************************/
+/**
+* Drives a bus reset followed by a connection at the given speed.
+*
+* @param	Speed is XUSBPSU_SPEED_HIGH or XUSBPSU_SPEED_SUPER.
+*
+* @return	None.
+*
+******************************************************************************/
+void UsbSim_Reset(u32 Speed)
+{
+	SimEvent Ev;
+
+	if (Instance == NULL || Running == FALSE) {
+		return;
+	}
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.Type = SIM_EVENT_RESET;
+	Instance->Speed = Speed;
+	Instance->eps[0].MaxSize = (Speed == XUSBPSU_SPEED_SUPER) ? 512U : 64U;
+	Instance->eps[1].MaxSize = Instance->eps[0].MaxSize;
+	Ep0Stalled = FALSE;
+	SimPost(&Ev);
+	SimSettle();
+}
+
+void UsbSim_Disconnect(void)
+{
+	SimEvent Ev;
+
+	if (Instance == NULL) {
+		return;
+	}
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.Type = SIM_EVENT_DISCONNECT;
+	SimPost(&Ev);
+	SimSettle();
+}
+
+/*****************************************************************************/
+/**
+* Moves data of a host transfer through one endpoint. Device transfers are
+* filled or drained in turn until the host transfer is done.
+*
+* @param	Ept is the endpoint.
+* @param	DataPtr is the host buffer.
+* @param	Length is the length of the host transfer.
+* @param	ActualPtr returns the number of bytes moved.
+* @param	Ep0 is TRUE for the data stage of a control transfer.
+*
+* @return	USB_SIM_OK, USB_SIM_STALL or USB_SIM_TIMEOUT.
+*
+* @note		An IN transfer shorter than its device buffer or not a multiple
+*		of the packet size ends the host transfer, like a short packet.
+*
+******************************************************************************/
+static s32 SimTransfer(struct XUsbPsu_Ep *Ept, u8 *DataPtr, u32 Length,
+		       u32 *ActualPtr, u32 Ep0)
+{
+	u32 Done = 0U;
+	u32 Idle = 0U;
+	u32 Count;
+	u32 Short;
+
+	*ActualPtr = 0U;
+
+	while (Done < Length) {
+		if ((Ept->EpStatus & XUSBPSU_EP_STALL) != 0U ||
+		    (Ep0 == TRUE && Ep0Stalled == TRUE)) {
+			return USB_SIM_STALL;
+		}
+
+		if ((Ept->EpStatus & XUSBPSU_EP_BUSY) == 0U) {
+			if (UsbSim_Step() == 0U && ++Idle > USB_SIM_MAX_IDLE_STEPS) {
+				return USB_SIM_TIMEOUT;
+			}
+			continue;
+		}
+
+		Count = Length - Done;
+		if (Count > Ept->RequestedBytes) {
+			Count = Ept->RequestedBytes;
+		}
+		if (Ept->Direction == XUSBPSU_EP_DIR_IN) {
+			memcpy(DataPtr + Done, Ept->BufferPtr, Count);
+			Stats.BytesIn += Count;
+			Short = (Count < Ept->RequestedBytes ||
+				 Ept->MaxSize == 0U ||
+				 (Count % Ept->MaxSize) != 0U) ? TRUE : FALSE;
+		} else {
+			memcpy(Ept->BufferPtr, DataPtr + Done, Count);
+			Stats.BytesOut += Count;
+			Short = FALSE;
+		}
+		Done += Count;
+		*ActualPtr = Done;
+		Idle = 0U;
+
+		Ept->EpStatus &= ~XUSBPSU_EP_BUSY;
+		SimPostEp(Ept->PhyEpNum, Ept->RequestedBytes, Count);
+		(void)UsbSim_Step();
+
+		if (Short == TRUE || Count == 0U) {
+			break;
+		}
+	}
+
+	SimSettle();
+
+	return USB_SIM_OK;
+}
+
+/*****************************************************************************/
+/**
+* Runs a control transfer on endpoint 0.
+*
+* @param	SetupPtr is the setup packet.
+* @param	DataPtr is the data stage buffer of wLength bytes.
+* @param	ActualPtr returns the length of the data stage, may be NULL.
+*
+* @return	USB_SIM_OK, USB_SIM_STALL or USB_SIM_TIMEOUT.
+*
+******************************************************************************/
+s32 UsbSim_Control(const SetupPacket *SetupPtr, u8 *DataPtr, u32 *ActualPtr)
+{
+	SimEvent Ev;
+	u32 Actual = 0U;
+	s32 Status = USB_SIM_OK;
+	u8 Dir = (SetupPtr->bRequestType & 0x80U) ? XUSBPSU_EP_DIR_IN :
+		 XUSBPSU_EP_DIR_OUT;
+
+	if (Instance == NULL || Running == FALSE) {
+		return USB_SIM_TIMEOUT;
+	}
+
+	/* A setup packet ends whatever endpoint 0 was doing */
+	Instance->eps[0].EpStatus &= ~(XUSBPSU_EP_BUSY | XUSBPSU_EP_STALL);
+	Instance->eps[1].EpStatus &= ~(XUSBPSU_EP_BUSY | XUSBPSU_EP_STALL);
+	Ep0Stalled = FALSE;
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.Type = SIM_EVENT_SETUP;
+	Ev.Setup = *SetupPtr;
+	SimPost(&Ev);
+	Stats.Setups++;
+
+	if (SetupPtr->wLength != 0U) {
+		Status = SimTransfer(&Instance->eps[Dir], DataPtr, SetupPtr->wLength,
+				     &Actual, TRUE);
+	} else {
+		SimSettle();
+	}
+
+	if (Status == USB_SIM_OK && Ep0Stalled == TRUE) {
+		Status = USB_SIM_STALL;
+	}
+	if (ActualPtr != NULL) {
+		*ActualPtr = Actual;
+	}
+
+	return Status;
+}
+
+/*****************************************************************************/
+/**
+* Runs a bulk or interrupt OUT transfer.
+*
+* @param	Ep is the endpoint number.
+* @param	DataPtr is the data.
+* @param	Length is the length of the data.
+*
+* @return	USB_SIM_OK, USB_SIM_STALL or USB_SIM_TIMEOUT.
+*
+******************************************************************************/
+s32 UsbSim_BulkOut(u8 Ep, const u8 *DataPtr, u32 Length)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(Ep, XUSBPSU_EP_DIR_OUT);
+	u32 Actual;
+
+	if (Ept == NULL || Ep == 0U) {
+		return USB_SIM_TIMEOUT;
+	}
+
+	return SimTransfer(Ept, (u8 *)DataPtr, Length, &Actual, FALSE);
+}
+
+/*****************************************************************************/
+/**
+* Runs a bulk or interrupt IN transfer.
+*
+* @param	Ep is the endpoint number.
+* @param	DataPtr is the buffer.
+* @param	Length is the length of the buffer.
+* @param	ActualPtr returns the number of bytes received.
+*
+* @return	USB_SIM_OK, USB_SIM_STALL or USB_SIM_TIMEOUT.
+*
+******************************************************************************/
+s32 UsbSim_BulkIn(u8 Ep, u8 *DataPtr, u32 Length, u32 *ActualPtr)
+{
+	struct XUsbPsu_Ep *Ept = SimEp(Ep, XUSBPSU_EP_DIR_IN);
+
+	if (Ept == NULL || Ep == 0U) {
+		*ActualPtr = 0U;
+		return USB_SIM_TIMEOUT;
+	}
+
+	return SimTransfer(Ept, DataPtr, Length, ActualPtr, FALSE);
+}
+
+/*****************************************************************************/
+/**
+* Makes the next transfer starts on an endpoint fail, like the controller
+* refusing the Start Transfer command.
+*
+* @param	Ep is the endpoint number.
+* @param	Dir is XUSBPSU_EP_DIR_IN or XUSBPSU_EP_DIR_OUT.
+* @param	Count is the number of starts to fail, 0 to stop failing.
+*
+* @return	None.
+*
+******************************************************************************/
+void UsbSim_FailStart(u8 Ep, u8 Dir, u32 Count)
+{
+	u32 PhyEpNum = ((u32)Ep << 1) | Dir;
+
+	if (PhyEpNum < XUSBPSU_ENDPOINTS_NUM) {
+		FailStarts[PhyEpNum] = Count;
+	}
+}
+
+void UsbSim_GetStats(UsbSim_Stats *StatsPtr)
+{
+	*StatsPtr = Stats;
+}
+
+void UsbSim_ClearStats(void)
+{
+	memset(&Stats, 0, sizeof(Stats));
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim.h
+ *
+ * This file contains declarations for the simulated USB controller and the
+ * host on the other end of the cable.
+ *
+ * usb_sim.c implements the XUsbPsu driver calls made by xusb_wrapper.c, so
+ * the wrapper and the class drivers build unchanged for Linux. Transfers
+ * handed to an endpoint wait until the simulated host moves data through
+ * that endpoint. Each finished transfer and each setup packet is an event,
+ * events are delivered by calling the interrupt handler registered with
+ * UsbSim_SetIntrHandler() like the interrupt controller would.
+ *
+ * Everything runs in the calling thread, except the offload workers of
+ * USB_OFFLOAD builds, see usb_sim_device.c. The host side calls run the
+ * firmware with UsbSim_Step() until the transfer they model has finished,
+ * so a given sequence of host calls always produces the same firmware
+ * activity, apart from when offloaded jobs complete.
+ *
+ *****************************************************************************/
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xusbpsu.h"
+
+/************************** Constant Definitions ****************************/
+/* Results of the host side calls */
+#define USB_SIM_OK		0	/* Transfer completed */
+#define USB_SIM_STALL		1	/* Endpoint stalled */
+#define USB_SIM_TIMEOUT		2	/* Firmware did not arm the endpoint */
+
+/* Steps without progress before a host transfer times out */
+#ifndef USB_SIM_MAX_IDLE_STEPS
+#define USB_SIM_MAX_IDLE_STEPS	64U
+#endif
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u32 Steps;		/* UsbSim_Step() calls */
+	u32 Interrupts;		/* Calls of the interrupt handler */
+	u32 Timers;		/* Calls of the timer interrupt handler */
+	u32 Events;		/* Events delivered */
+	u32 Setups;		/* Setup packets */
+	u64 BytesOut;		/* Bulk and control data, host to device */
+	u64 BytesIn;		/* Bulk and control data, device to host */
+	u64 FirmwareTicks;	/* Time spent in the interrupt handler and loop */
+	u64 FirmwareCycles;	/* The same in CPU cycles, 0 if not available */
+} UsbSim_Stats;
+
+/************************** Function Prototypes ******************************/
+/* Device side, in place of the interrupt controller and main() */
+void UsbSim_SetIntrHandler(void (*Handler)(void *), void *CallBackRef);
+void UsbSim_SetTimerHandler(void (*Handler)(void *), void *CallBackRef);
+void UsbSim_SetLoop(u32 (*Loop)(void));
+
+/* Host side */
+void UsbSim_Reset(u32 Speed);
+void UsbSim_Disconnect(void);
+u32 UsbSim_Step(void);
+s32 UsbSim_Control(const SetupPacket *SetupPtr, u8 *DataPtr, u32 *ActualPtr);
+s32 UsbSim_BulkOut(u8 Ep, const u8 *DataPtr, u32 Length);
+s32 UsbSim_BulkIn(u8 Ep, u8 *DataPtr, u32 Length, u32 *ActualPtr);
+void UsbSim_FailStart(u8 Ep, u8 Dir, u32 Count);
+void UsbSim_GetStats(UsbSim_Stats *StatsPtr);
+void UsbSim_ClearStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* USB_SIM_H */
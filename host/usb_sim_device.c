@@ -0,0 +1,274 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim_device.c
+ *
+ * This file brings up the mass storage firmware, or the CCID firmware when
+ * built with USB_CCID, on the simulated controller.
+ * It takes the place of main() in xusb_intr_example.c: the same globals,
+ * the same chapter 9 hooks and the same initialization order, with the
+ * interrupt controller and the main loop replaced by usb_sim.c.
+ *
+ * With USB_OFFLOAD every worker core is a thread running
+ * UsbOffload_WorkerMain(), so offloaded jobs run in parallel with the
+ * firmware like on the other A53 cores.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#ifdef USB_OFFLOAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "usb_sim.h"
+#include "usb_sim_device.h"
+#ifdef USB_CCID
+#include "xusb_ch9_ccid.h"
+#include "xusb_class_ccid.h"
+#else
+#include "xusb_ch9_storage.h"
+#include "xusb_class_storage.h"
+#endif
+#include "xusb_wrapper.h"
+#include "xusb_event.h"
+#include "xusb_trace.h"
+#ifdef USB_OFFLOAD
+#include "xusb_offload.h"
+#endif
+#ifdef VFLASH_DEDUP
+#include "xusb_storage_dedup.h"
+#endif
+
+/************************** Constant Definitions *****************************/
+#define MEMORY_SIZE (64 * 1024)
+
+/************************** Variable Definitions *****************************/
+/* Globals shared with the class driver, as defined by the example */
+u8 Buffer[MEMORY_SIZE] ALIGNMENT_CACHELINE;
+#ifndef USB_CCID
+u8 VirtFlash[VFLASH_BACKING_SIZE] ALIGNMENT_CACHELINE;
+USB_CBW CBW ALIGNMENT_CACHELINE;
+USB_CSW CSW ALIGNMENT_CACHELINE;
+u8 Phase;
+#endif
+
+struct Usb_DevData UsbInstance;
+
+Usb_Config *UsbConfigPtr;
+
+#ifdef USB_CCID
+static USBCH9_DATA ccid_data = {
+	.ch9_func = {
+		.Usb_Ch9SetupDevDescReply = Ccid_Ch9SetupDevDescReply,
+		.Usb_Ch9SetupCfgDescReply = Ccid_Ch9SetupCfgDescReply,
+		.Usb_Ch9SetupBosDescReply = Ccid_Ch9SetupBosDescReply,
+		.Usb_Ch9SetupStrDescReply = Ccid_Ch9SetupStrDescReply,
+		.Usb_SetConfiguration = Ccid_SetConfiguration,
+		.Usb_SetConfigurationApp = Ccid_SetConfigurationApp,
+		.Usb_SetInterfaceHandler = NULL,
+		.Usb_ClassReq = CcidClassReq,
+		.Usb_GetDescReply = NULL,
+	},
+	.data_ptr = (void *)NULL,
+};
+#else
+static USBCH9_DATA storage_data = {
+	.ch9_func = {
+		.Usb_Ch9SetupDevDescReply = Usb_Ch9SetupDevDescReply,
+		.Usb_Ch9SetupCfgDescReply = Usb_Ch9SetupCfgDescReply,
+		.Usb_Ch9SetupBosDescReply = Usb_Ch9SetupBosDescReply,
+		.Usb_Ch9SetupStrDescReply = Usb_Ch9SetupStrDescReply,
+		.Usb_SetConfiguration = Usb_SetConfiguration,
+		.Usb_SetConfigurationApp = Usb_SetConfigurationApp,
+		.Usb_SetInterfaceHandler = NULL,
+		.Usb_ClassReq = ClassReq,
+		.Usb_GetDescReply = NULL,
+	},
+	.data_ptr = (void *)NULL,
+};
+#endif
+
+/*****************************************************************************/
+/**
+* One pass of the firmware main loop.
+*
+* @param	None.
+*
+* @return	Amount of work done, 0 when idle.
+*
+******************************************************************************/
+static u32 DeviceLoop(void)
+{
+#ifdef USB_OFFLOAD
+	UsbOffload_Stats Offload;
+#endif
+	u32 Work;
+
+	Work = UsbPollService(UsbInstance.PrivateData);
+	Work += UsbEventDispatch();
+#ifdef USB_CCID
+	Work += Ccid_Poll();
+#endif
+#ifdef USB_OFFLOAD
+	/* Jobs still running on a worker thread keep the firmware busy */
+	Work += UsbOffload_Poll();
+	UsbOffload_GetStats(&Offload);
+	Work += Offload.Submitted - Offload.Completed;
+#endif
+
+	return Work;
+}
+
+#ifdef USB_OFFLOAD
+static void *WorkerThread(void *Arg)
+{
+	UsbOffload_WorkerMain((u32)(UINTPTR)Arg);
+
+	return NULL;
+}
+
+/*****************************************************************************/
+/**
+* Starts one thread per worker core and waits until every worker takes
+* jobs, like the worker images booting on cores 1 to 3.
+*
+* @param	None.
+*
+* @return	XST_SUCCESS else XST_FAILURE.
+*
+* @note		The threads run until the process exits.
+*
+******************************************************************************/
+static s32 StartWorkers(void)
+{
+	UsbOffload_Stats Offload;
+	pthread_t Thread;
+	u32 Worker;
+	u32 Running;
+
+	for (Worker = 0U; Worker < USB_OFFLOAD_WORKERS; Worker++) {
+		if (pthread_create(&Thread, NULL, WorkerThread,
+				   (void *)(UINTPTR)Worker) != 0) {
+			return XST_FAILURE;
+		}
+		(void)pthread_detach(Thread);
+	}
+
+	do {
+		/* Publishes the rings again for workers that started late */
+		(void)UsbOffload_Poll();
+		UsbOffload_GetStats(&Offload);
+		Running = 0U;
+		for (Worker = 0U; Worker < USB_OFFLOAD_WORKERS; Worker++) {
+			Running += (Offload.Worker[Worker].Running == TRUE) ?
+				   1U : 0U;
+		}
+		(void)sched_yield();
+	} while (Running != USB_OFFLOAD_WORKERS);
+
+	return XST_SUCCESS;
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Initializes the firmware and starts the simulated controller.
+*
+* @param	None.
+*
+* @return	XST_SUCCESS if successful, otherwise XST_FAILURE.
+*
+* @note		Call once, before the first UsbSim_Reset().
+*
+******************************************************************************/
+s32 UsbSimDevice_Init(void)
+{
+	s32 Status;
+
+	UsbConfigPtr = LookupConfig(USB_DEVICE_ID);
+	if (NULL == UsbConfigPtr) {
+		return XST_FAILURE;
+	}
+
+	CacheInit();
+	UsbEvent_Init();
+#ifdef USB_OFFLOAD
+	UsbOffload_Init(USB_OFFLOAD_WORKERS);
+	if (StartWorkers() != XST_SUCCESS) {
+		return XST_FAILURE;
+	}
+#endif
+#ifdef USB_LATENCY_TRACE
+	UsbTrace_Init();
+#endif
+#ifdef USB_CCID
+	CcidCacheRegister();
+#else
+	StorageCacheRegister();
+	(void)StorageDiskInit();
+
+#ifdef VFLASH_DEDUP
+	VFlashDedup_Init(VirtFlash);
+#endif
+#endif
+
+	Status = CfgInitialize(&UsbInstance, UsbConfigPtr,
+			       UsbConfigPtr->BaseAddress);
+	if (XST_SUCCESS != Status) {
+		return XST_FAILURE;
+	}
+
+	Set_Ch9Handler(UsbInstance.PrivateData, Ch9Handler);
+#ifdef USB_CCID
+	Set_DrvData(UsbInstance.PrivateData, &ccid_data);
+#else
+	Set_DrvData(UsbInstance.PrivateData, &storage_data);
+#endif
+
+	EpConfigure(UsbInstance.PrivateData, 1, USB_EP_DIR_OUT,
+		    USB_EP_TYPE_BULK);
+	EpConfigure(UsbInstance.PrivateData, 1, USB_EP_DIR_IN,
+		    USB_EP_TYPE_BULK);
+
+	Status = ConfigureDevice(UsbInstance.PrivateData, &Buffer[0],
+				 MEMORY_SIZE);
+	if (XST_SUCCESS != Status) {
+		return XST_FAILURE;
+	}
+
+	UsbSim_SetIntrHandler(UsbIntrHandler, UsbInstance.PrivateData);
+	UsbSim_SetTimerHandler(UsbTimerIntrHandler, NULL);
+	UsbSim_SetLoop(DeviceLoop);
+
+	XUsbPsu_EnableIntr(UsbInstance.PrivateData,
+			   XUSBPSU_DEVTEN_EVNTOVERFLOWEN |
+			   XUSBPSU_DEVTEN_WKUPEVTEN |
+			   XUSBPSU_DEVTEN_ULSTCNGEN |
+			   XUSBPSU_DEVTEN_CONNECTDONEEN |
+			   XUSBPSU_DEVTEN_USBRSTEN |
+			   XUSBPSU_DEVTEN_DISCONNEVTEN);
+
+#ifdef USB_IMOD_INTERVAL_NS
+	(void)UsbIntrModeration(UsbInstance.PrivateData, USB_IMOD_INTERVAL_NS);
+#endif
+
+	return Usb_Start(UsbInstance.PrivateData);
+}
+
+/*****************************************************************************/
+/**
+* Sets the interrupt moderation interval of the running firmware.
+*
+* @param	IntervalNs is the interval, 0 disables moderation.
+*
+* @return	XST_SUCCESS else XST_FAILURE.
+*
+******************************************************************************/
+s32 UsbSimDevice_SetModeration(u32 IntervalNs)
+{
+	return UsbIntrModeration(UsbInstance.PrivateData, IntervalNs);
+}
@@ -0,0 +1,33 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim_device.h
+ *
+ * This file contains the bring-up of the mass storage firmware on the
+ * simulated controller, see usb_sim_device.c.
+ *
+ *****************************************************************************/
+
+#ifndef USB_SIM_DEVICE_H
+#define USB_SIM_DEVICE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+
+/************************** Function Prototypes ******************************/
+s32 UsbSimDevice_Init(void);
+s32 UsbSimDevice_SetModeration(u32 IntervalNs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* USB_SIM_DEVICE_H */
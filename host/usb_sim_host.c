@@ -0,0 +1,581 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim_host.c
+ *
+ * This file implements the host side of the simulation, see usb_sim_host.h.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <string.h>
+#include "usb_sim_host.h"
+#include "xusb_telemetry.h"
+#include "xusb_class_ccid.h"
+
+/************************** Constant Definitions *****************************/
+#define CBW_SIGNATURE		0x43425355U
+#define CSW_SIGNATURE		0x53425355U
+#define CBW_LENGTH		31U
+#define CSW_LENGTH		13U
+
+#define SCSI_READ_10		0x28U
+#define SCSI_WRITE_10		0x2AU
+#define SCSI_BLOCK_SIZE		512U
+
+/************************** Variable Definitions *****************************/
+static u32 Tag;
+static u8 CcidSeq;
+static u8 CcidMsg[CCID_MAX_MESSAGE_SIZE];
+static u8 CcidRsp[CCID_BULK_IN_SIZE + 1024U];	/* Room for the ZLP */
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static void PutLe32(u8 *Ptr, u32 Value)
+{
+	Ptr[0] = (u8)Value;
+	Ptr[1] = (u8)(Value >> 8);
+	Ptr[2] = (u8)(Value >> 16);
+	Ptr[3] = (u8)(Value >> 24);
+}
+
+static u32 GetLe32(const u8 *Ptr)
+{
+	return (u32)Ptr[0] | ((u32)Ptr[1] << 8) | ((u32)Ptr[2] << 16) |
+	       ((u32)Ptr[3] << 24);
+}
+
+static void Setup(SetupPacket *SetupPtr, u8 RequestType, u8 Request,
+		  u16 Value, u16 Index, u16 Length)
+{
+	SetupPtr->bRequestType = RequestType;
+	SetupPtr->bRequest = Request;
+	SetupPtr->wValue = Value;
+	SetupPtr->wIndex = Index;
+	SetupPtr->wLength = Length;
+}
+
+/*****************************************************************************/
+/**
+* Resets the bus and enumerates the device: device descriptor, address,
+* configuration descriptor and SET_CONFIGURATION 1.
+*
+* @param	Speed is XUSBPSU_SPEED_HIGH or XUSBPSU_SPEED_SUPER.
+*
+* @return	USB_SIM_OK, or the result of the first failing request.
+*
+******************************************************************************/
+s32 UsbSimHost_Enumerate(u32 Speed)
+{
+	SetupPacket Req;
+	u8 Desc[256];
+	u32 Actual;
+	s32 Status;
+
+	UsbSim_Reset(Speed);
+
+	Setup(&Req, 0x80U, 0x06U, 0x0100U, 0U, 18U);
+	Status = UsbSim_Control(&Req, Desc, &Actual);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	Setup(&Req, 0x00U, 0x05U, USB_SIM_HOST_ADDRESS, 0U, 0U);
+	Status = UsbSim_Control(&Req, NULL, NULL);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	Setup(&Req, 0x80U, 0x06U, 0x0200U, 0U, sizeof(Desc));
+	Status = UsbSim_Control(&Req, Desc, &Actual);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	Setup(&Req, 0x00U, 0x09U, 1U, 0U, 0U);
+
+	return UsbSim_Control(&Req, NULL, NULL);
+}
+
+/*****************************************************************************/
+/**
+* Runs one SCSI command with the bulk-only transport: CBW, optional data
+* stage and CSW.
+*
+* @param	Cdb is the command block.
+* @param	CdbLength is the length of the command block, 1 to 16.
+* @param	Dir is USB_SIM_HOST_DIR_IN or USB_SIM_HOST_DIR_OUT.
+* @param	DataPtr is the data stage buffer.
+* @param	Length is the length of the data stage, 0 for none.
+* @param	ResiduePtr returns dCSWDataResidue, may be NULL.
+* @param	StatusPtr returns bCSWStatus or USB_SIM_HOST_CSW_PHASE when
+*		the CSW is not valid.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+******************************************************************************/
+s32 UsbSimHost_Scsi(const u8 *Cdb, u8 CdbLength, u8 Dir, u8 *DataPtr,
+		    u32 Length, u32 *ResiduePtr, u8 *StatusPtr)
+{
+	u8 Cbw[CBW_LENGTH];
+	u8 Csw[CSW_LENGTH];
+	u32 Actual;
+	s32 Status;
+
+	*StatusPtr = USB_SIM_HOST_CSW_PHASE;
+
+	memset(Cbw, 0, sizeof(Cbw));
+	Tag++;
+	PutLe32(&Cbw[0], CBW_SIGNATURE);
+	PutLe32(&Cbw[4], Tag);
+	PutLe32(&Cbw[8], Length);
+	Cbw[12] = (Dir == USB_SIM_HOST_DIR_IN) ? 0x80U : 0x00U;
+	Cbw[14] = CdbLength;
+	memcpy(&Cbw[15], Cdb, CdbLength);
+
+	Status = UsbSim_BulkOut(USB_SIM_HOST_BULK_EP, Cbw, sizeof(Cbw));
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	if (Length != 0U) {
+		if (Dir == USB_SIM_HOST_DIR_IN) {
+			Status = UsbSim_BulkIn(USB_SIM_HOST_BULK_EP, DataPtr,
+					       Length, &Actual);
+		} else {
+			Status = UsbSim_BulkOut(USB_SIM_HOST_BULK_EP, DataPtr,
+						Length);
+		}
+		if (Status != USB_SIM_OK) {
+			return Status;
+		}
+	}
+
+	Status = UsbSim_BulkIn(USB_SIM_HOST_BULK_EP, Csw, sizeof(Csw), &Actual);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	if (Actual == CSW_LENGTH && GetLe32(&Csw[0]) == CSW_SIGNATURE &&
+	    GetLe32(&Csw[4]) == Tag) {
+		*StatusPtr = Csw[12];
+		if (ResiduePtr != NULL) {
+			*ResiduePtr = GetLe32(&Csw[8]);
+		}
+	}
+
+	return USB_SIM_OK;
+}
+
+static s32 ReadWrite10(u8 OpCode, u32 Lba, u16 Blocks, u8 *DataPtr,
+		       u8 *StatusPtr)
+{
+	u8 Cdb[10];
+
+	memset(Cdb, 0, sizeof(Cdb));
+	Cdb[0] = OpCode;
+	Cdb[2] = (u8)(Lba >> 24);
+	Cdb[3] = (u8)(Lba >> 16);
+	Cdb[4] = (u8)(Lba >> 8);
+	Cdb[5] = (u8)Lba;
+	Cdb[7] = (u8)(Blocks >> 8);
+	Cdb[8] = (u8)Blocks;
+
+	return UsbSimHost_Scsi(Cdb, sizeof(Cdb),
+			       (OpCode == SCSI_READ_10) ? USB_SIM_HOST_DIR_IN :
+			       USB_SIM_HOST_DIR_OUT, DataPtr,
+			       (u32)Blocks * SCSI_BLOCK_SIZE, NULL, StatusPtr);
+}
+
+s32 UsbSimHost_Read10(u32 Lba, u16 Blocks, u8 *DataPtr, u8 *StatusPtr)
+{
+	return ReadWrite10(SCSI_READ_10, Lba, Blocks, DataPtr, StatusPtr);
+}
+
+s32 UsbSimHost_Write10(u32 Lba, u16 Blocks, const u8 *DataPtr, u8 *StatusPtr)
+{
+	return ReadWrite10(SCSI_WRITE_10, Lba, Blocks, (u8 *)DataPtr,
+			   StatusPtr);
+}
+
+/*****************************************************************************/
+/**
+* Runs a device to host vendor request.
+*
+* @param	Request is bRequest.
+* @param	Value is wValue.
+* @param	Index is wIndex.
+* @param	DataPtr is the data stage buffer.
+* @param	Length is wLength.
+* @param	ActualPtr returns the length of the reply.
+*
+* @return	USB_SIM_OK, USB_SIM_STALL or USB_SIM_TIMEOUT.
+*
+******************************************************************************/
+s32 UsbSimHost_Vendor(u8 Request, u16 Value, u16 Index, u8 *DataPtr,
+		      u16 Length, u32 *ActualPtr)
+{
+	SetupPacket Req;
+
+	Setup(&Req, 0xC0U, Request, Value, Index, Length);
+
+	return UsbSim_Control(&Req, DataPtr, ActualPtr);
+}
+
+/*****************************************************************************/
+/**
+* Takes a telemetry snapshot and reads it page by page.
+*
+* @param	BlockPtr is the buffer for the block.
+* @param	Size is the size of the buffer.
+* @param	LengthPtr returns the length of the block.
+*
+* @return	USB_SIM_OK, or USB_SIM_STALL also when the buffer is too
+*		small.
+*
+******************************************************************************/
+s32 UsbSimHost_Telemetry(u8 *BlockPtr, u32 Size, u32 *LengthPtr)
+{
+	UsbTelemetry_Info Info;
+	u32 Offset;
+	u32 Actual;
+	u16 Page;
+	s32 Status;
+
+	*LengthPtr = 0U;
+
+	Status = UsbSimHost_Vendor(USB_TELEMETRY_REQ_SNAPSHOT, 0U, 0U,
+				   (u8 *)&Info, sizeof(Info), &Actual);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+	if (Actual != sizeof(Info) || Info.TotalSize > Size ||
+	    Info.PageSize == 0U) {
+		return USB_SIM_STALL;
+	}
+
+	for (Offset = 0U, Page = 0U; Offset < Info.TotalSize; Page++) {
+		Status = UsbSimHost_Vendor(USB_TELEMETRY_REQ_READ, 0U, Page,
+					   BlockPtr + Offset, Info.PageSize,
+					   &Actual);
+		if (Status != USB_SIM_OK) {
+			return Status;
+		}
+		if (Actual == 0U) {
+			break;
+		}
+		Offset += Actual;
+	}
+
+	*LengthPtr = Offset;
+
+	return USB_SIM_OK;
+}
+
+/*****************************************************************************/
+/**
+* Sends one CCID message on the bulk OUT endpoint, without waiting for the
+* reply.
+*
+* @param	Type is bMessageType.
+* @param	Slot is bSlot.
+* @param	Params are the 3 message specific header bytes, may be NULL.
+* @param	DataPtr is the message data.
+* @param	Length is the length of the message data.
+* @param	SeqPtr returns bSeq of the message, may be NULL.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+******************************************************************************/
+s32 UsbSimHost_CcidSend(u8 Type, u8 Slot, const u8 *Params, const u8 *DataPtr,
+			u32 Length, u8 *SeqPtr)
+{
+	if (Length > sizeof(CcidMsg) - CCID_HEADER_SIZE) {
+		return USB_SIM_STALL;
+	}
+
+	CcidSeq++;
+	CcidMsg[0] = Type;
+	PutLe32(&CcidMsg[1], Length);
+	CcidMsg[5] = Slot;
+	CcidMsg[6] = CcidSeq;
+	if (Params != NULL) {
+		memcpy(&CcidMsg[7], Params, 3U);
+	} else {
+		memset(&CcidMsg[7], 0, 3U);
+	}
+	if (Length != 0U) {
+		memcpy(&CcidMsg[CCID_HEADER_SIZE], DataPtr, Length);
+	}
+
+	if (SeqPtr != NULL) {
+		*SeqPtr = CcidSeq;
+	}
+
+	return UsbSim_BulkOut(USB_SIM_HOST_BULK_EP, CcidMsg,
+			      CCID_HEADER_SIZE + Length);
+}
+
+/*****************************************************************************/
+/**
+* Reads the next CCID message from the bulk IN endpoint. With several slots
+* busy the replies come in the order the cards finish.
+*
+* @param	ReplyPtr returns the reply, its data is copied to DataPtr up
+*		to DataMax bytes.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+******************************************************************************/
+s32 UsbSimHost_CcidRecv(UsbSimHost_CcidReply *ReplyPtr)
+{
+	u32 Actual;
+	u32 Copy;
+	s32 Status;
+
+	ReplyPtr->Type = 0U;
+	ReplyPtr->Length = 0U;
+	ReplyPtr->Messages = 1U;
+	ReplyPtr->Extensions = 0U;
+
+	Status = UsbSim_BulkIn(USB_SIM_HOST_BULK_EP, CcidRsp, sizeof(CcidRsp),
+			       &Actual);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	if (Actual < CCID_HEADER_SIZE ||
+	    GetLe32(&CcidRsp[1]) != Actual - CCID_HEADER_SIZE) {
+		return USB_SIM_OK;
+	}
+
+	ReplyPtr->Type = CcidRsp[0];
+	ReplyPtr->Slot = CcidRsp[5];
+	ReplyPtr->Seq = CcidRsp[6];
+	ReplyPtr->Status = CcidRsp[7];
+	ReplyPtr->Error = CcidRsp[8];
+	ReplyPtr->Specific = CcidRsp[9];
+	ReplyPtr->Length = Actual - CCID_HEADER_SIZE;
+	if (ReplyPtr->DataPtr != NULL) {
+		Copy = (ReplyPtr->Length < ReplyPtr->DataMax) ?
+		       ReplyPtr->Length : ReplyPtr->DataMax;
+		memcpy(ReplyPtr->DataPtr, &CcidRsp[CCID_HEADER_SIZE], Copy);
+	}
+
+	return USB_SIM_OK;
+}
+
+/*****************************************************************************/
+/**
+* Sends one CCID message on the bulk OUT endpoint and reads the reply from
+* the bulk IN endpoint.
+*
+* @param	Type is bMessageType.
+* @param	Slot is bSlot.
+* @param	Params are the 3 message specific header bytes, may be NULL.
+* @param	DataPtr is the message data.
+* @param	Length is the length of the message data.
+* @param	ReplyPtr returns the reply, its data is copied to DataPtr up
+*		to DataMax bytes. Type is 0 when the reply is not the one to
+*		the message.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+* @note		Time extensions are counted and the host keeps waiting, the
+*		way a host driver stretches its timeout.
+*
+******************************************************************************/
+s32 UsbSimHost_Ccid(u8 Type, u8 Slot, const u8 *Params, const u8 *DataPtr,
+		    u32 Length, UsbSimHost_CcidReply *ReplyPtr)
+{
+	u32 Extensions = 0U;
+	u8 Seq;
+	s32 Status;
+
+	ReplyPtr->Type = 0U;
+	ReplyPtr->Length = 0U;
+	ReplyPtr->Messages = 1U;
+	ReplyPtr->Extensions = 0U;
+
+	Status = UsbSimHost_CcidSend(Type, Slot, Params, DataPtr, Length, &Seq);
+
+	while (Status == USB_SIM_OK) {
+		Status = UsbSimHost_CcidRecv(ReplyPtr);
+		if (Status != USB_SIM_OK) {
+			break;
+		}
+		if (ReplyPtr->Slot != Slot || ReplyPtr->Seq != Seq) {
+			ReplyPtr->Type = 0U;
+			break;
+		}
+		if ((ReplyPtr->Status & CCID_CMD_STATUS_MASK) !=
+		    CCID_CMD_TIME_EXTENSION) {
+			break;
+		}
+		Extensions++;
+	}
+	ReplyPtr->Extensions = Extensions;
+
+	return Status;
+}
+
+/*****************************************************************************/
+/**
+* Aborts the command a slot runs: sends the ABORT class request and the
+* PC_to_RDR_Abort of the pair, without waiting for the replies. The reply to
+* the aborted command, if it was still running, comes before the reply to
+* the Abort.
+*
+* @param	Slot is bSlot.
+* @param	MessageFirst is TRUE to send the PC_to_RDR_Abort before the
+*		class request, the order the reader may see them in.
+* @param	SeqPtr returns bSeq of the Abort, may be NULL.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+******************************************************************************/
+s32 UsbSimHost_CcidAbort(u8 Slot, u32 MessageFirst, u8 *SeqPtr)
+{
+	SetupPacket Req;
+	u8 Seq = (u8)(CcidSeq + 1U);
+	s32 Status;
+
+	if (SeqPtr != NULL) {
+		*SeqPtr = Seq;
+	}
+
+	/* Interface 0, wValue is bSeq << 8 | bSlot */
+	Setup(&Req, 0x21U, USB_CLASSREQ_CCID_ABORT, (u16)((Seq << 8) | Slot),
+	      0U, 0U);
+
+	if (MessageFirst == TRUE) {
+		Status = UsbSimHost_CcidSend(CCID_PC_TO_RDR_ABORT, Slot, NULL,
+					     NULL, 0U, NULL);
+		if (Status != USB_SIM_OK) {
+			return Status;
+		}
+		return UsbSim_Control(&Req, NULL, NULL);
+	}
+
+	Status = UsbSim_Control(&Req, NULL, NULL);
+	if (Status != USB_SIM_OK) {
+		return Status;
+	}
+
+	return UsbSimHost_CcidSend(CCID_PC_TO_RDR_ABORT, Slot, NULL, NULL, 0U,
+				   NULL);
+}
+
+/*****************************************************************************/
+/**
+* Reads the next CCID notification from the interrupt IN endpoint, the way
+* the host polls it once per bInterval.
+*
+* @param	DataPtr is the buffer for the message.
+* @param	Length is the size of the buffer.
+* @param	ActualPtr returns the length of the message.
+*
+* @return	USB_SIM_OK, USB_SIM_TIMEOUT when there is no notification.
+*
+******************************************************************************/
+s32 UsbSimHost_CcidNotify(u8 *DataPtr, u32 Length, u32 *ActualPtr)
+{
+	return UsbSim_BulkIn(USB_SIM_HOST_NOTIFY_EP, DataPtr, Length,
+			     ActualPtr);
+}
+
+/*****************************************************************************/
+/**
+* Exchanges one APDU with XfrBlock. APDUs longer than MAX_DATA_SIZE are sent
+* in parts with wLevelParameter, responses in parts are collected until
+* bChainParameter ends the chain.
+*
+* @param	Slot is bSlot.
+* @param	ApduPtr is the command APDU.
+* @param	Length is the length of the command APDU.
+* @param	ReplyPtr returns the last reply, with the whole response at
+*		DataPtr and its length in Length. Type is 0 when the chain
+*		was not followed by the reader.
+*
+* @return	USB_SIM_OK, or the result of the failing transfer.
+*
+******************************************************************************/
+s32 UsbSimHost_CcidApdu(u8 Slot, const u8 *ApduPtr, u32 Length,
+			UsbSimHost_CcidReply *ReplyPtr)
+{
+	UsbSimHost_CcidReply Part;
+	u8 Params[3] = { 0U, 0U, 0U };
+	u32 Offset = 0U;
+	u32 Total = 0U;
+	u32 Messages = 0U;
+	u32 Extensions = 0U;
+	u32 Size;
+	u16 Level;
+	s32 Status;
+
+	Part.DataPtr = ReplyPtr->DataPtr;
+	Part.DataMax = ReplyPtr->DataMax;
+
+	do {
+		Size = Length - Offset;
+		if (Size > MAX_DATA_SIZE) {
+			Size = MAX_DATA_SIZE;
+		}
+		if (Offset == 0U) {
+			Level = (Size == Length) ? CCID_LEVEL_SINGLE :
+				CCID_LEVEL_BEGIN;
+		} else {
+			Level = (Offset + Size == Length) ? CCID_LEVEL_END :
+				CCID_LEVEL_CONTINUE;
+		}
+		Params[1] = (u8)Level;
+		Params[2] = (u8)(Level >> 8);
+
+		Status = UsbSimHost_Ccid(CCID_PC_TO_RDR_XFR_BLOCK, Slot, Params,
+					 ApduPtr + Offset, Size, &Part);
+		Messages++;
+		Extensions += Part.Extensions;
+		Offset += Size;
+		if (Status != USB_SIM_OK || Part.Type == 0U ||
+		    (Part.Status & CCID_CMD_FAILED) != 0U) {
+			break;
+		}
+		if (Offset < Length && Part.Specific != CCID_CHAIN_NEXT_COMMAND) {
+			Part.Type = 0U;
+			break;
+		}
+	} while (Offset < Length);
+
+	while (Status == USB_SIM_OK && Part.Type != 0U &&
+	       (Part.Status & CCID_CMD_FAILED) == 0U) {
+		Total += Part.Length;
+		if (Part.Specific != CCID_CHAIN_BEGIN &&
+		    Part.Specific != CCID_CHAIN_CONTINUE) {
+			break;
+		}
+
+		Part.DataPtr = (ReplyPtr->DataPtr != NULL) ?
+			       ReplyPtr->DataPtr + Total : NULL;
+		Part.DataMax = (Total < ReplyPtr->DataMax) ?
+			       ReplyPtr->DataMax - Total : 0U;
+		Params[1] = (u8)CCID_LEVEL_NEXT_RESPONSE;
+		Params[2] = 0U;
+		Status = UsbSimHost_Ccid(CCID_PC_TO_RDR_XFR_BLOCK, Slot, Params,
+					 NULL, 0U, &Part);
+		Messages++;
+		Extensions += Part.Extensions;
+	}
+
+	ReplyPtr->Type = Part.Type;
+	ReplyPtr->Status = Part.Status;
+	ReplyPtr->Error = Part.Error;
+	ReplyPtr->Specific = Part.Specific;
+	ReplyPtr->Length = Total;
+	ReplyPtr->Messages = Messages;
+	ReplyPtr->Extensions = Extensions;
+
+	return Status;
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file usb_sim_host.h
+ *
+ * This file contains the host side of the simulation: enumeration, the
+ * bulk-only transport and the telemetry vendor requests, built on the
+ * transfers of usb_sim.h.
+ *
+ *****************************************************************************/
+
+#ifndef USB_SIM_HOST_H
+#define USB_SIM_HOST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "usb_sim.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_SIM_HOST_ADDRESS	1U	/* Address given on enumeration */
+#define USB_SIM_HOST_BULK_EP	1U	/* Mass storage and CCID bulk endpoints */
+#define USB_SIM_HOST_NOTIFY_EP	2U	/* CCID interrupt IN endpoint */
+
+#define USB_SIM_HOST_DIR_OUT	0U
+#define USB_SIM_HOST_DIR_IN	1U
+
+/* bCSWStatus, plus a phase error the host detects itself */
+#define USB_SIM_HOST_CSW_PASSED	0x00U
+#define USB_SIM_HOST_CSW_FAILED	0x01U
+#define USB_SIM_HOST_CSW_PHASE	0x02U
+
+/**************************** Type Definitions ******************************/
+/* Reply to a CCID message, Type is 0 when the reply was not valid */
+typedef struct {
+	u8 Type;		/* bMessageType */
+	u8 Slot;		/* bSlot */
+	u8 Seq;			/* bSeq */
+	u8 Status;		/* bStatus */
+	u8 Error;		/* bError */
+	u8 Specific;		/* bChainParameter, bClockStatus, ... */
+	u8 *DataPtr;		/* Buffer for the reply data, may be NULL */
+	u32 DataMax;		/* Size of the buffer */
+	u32 Length;		/* dwLength of the reply */
+	u32 Messages;		/* Bulk OUT messages sent */
+	u32 Extensions;		/* Time extensions before the reply */
+} UsbSimHost_CcidReply;
+
+/************************** Function Prototypes ******************************/
+s32 UsbSimHost_Enumerate(u32 Speed);
+s32 UsbSimHost_Scsi(const u8 *Cdb, u8 CdbLength, u8 Dir, u8 *DataPtr,
+		    u32 Length, u32 *ResiduePtr, u8 *StatusPtr);
+s32 UsbSimHost_Read10(u32 Lba, u16 Blocks, u8 *DataPtr, u8 *StatusPtr);
+s32 UsbSimHost_Write10(u32 Lba, u16 Blocks, const u8 *DataPtr,
+		       u8 *StatusPtr);
+s32 UsbSimHost_Vendor(u8 Request, u16 Value, u16 Index, u8 *DataPtr,
+		      u16 Length, u32 *ActualPtr);
+s32 UsbSimHost_Telemetry(u8 *BlockPtr, u32 Size, u32 *LengthPtr);
+s32 UsbSimHost_CcidSend(u8 Type, u8 Slot, const u8 *Params, const u8 *DataPtr,
+			u32 Length, u8 *SeqPtr);
+s32 UsbSimHost_CcidRecv(UsbSimHost_CcidReply *ReplyPtr);
+s32 UsbSimHost_Ccid(u8 Type, u8 Slot, const u8 *Params, const u8 *DataPtr,
+		    u32 Length, UsbSimHost_CcidReply *ReplyPtr);
+s32 UsbSimHost_CcidAbort(u8 Slot, u32 MessageFirst, u8 *SeqPtr);
+s32 UsbSimHost_CcidNotify(u8 *DataPtr, u32 Length, u32 *ActualPtr);
+s32 UsbSimHost_CcidApdu(u8 Slot, const u8 *ApduPtr, u32 Length,
+			UsbSimHost_CcidReply *ReplyPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* USB_SIM_HOST_H */
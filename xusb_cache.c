@@ -0,0 +1,640 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_cache.c
+ *
+ * This file contains the implementation of the D-cache maintenance manager
+ * for USB DMA buffers.
+ *
+ * Every registered region carries three flags describing what the cache may
+ * hold for it: dirty lines written by the CPU, clean lines read by the CPU
+ * and stale lines because the controller wrote memory behind the cache.
+ * Maintenance is only issued when a flag says it is needed. A flag is only
+ * cleared when an operation covers the whole region, so partial accesses to
+ * large regions stay correct at the cost of some extra maintenance.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include "xusb_cache.h"
+#include "xusb_wrapper.h"
+#include "xil_cache.h"
+#if !defined (__MICROBLAZE__)
+#include "xil_mmu.h"
+#endif
+
+/************************** Constant Definitions *****************************/
+/* Per region cache state */
+#define REGION_DIRTY		0x01U	/* CPU may hold dirty lines */
+#define REGION_CACHED		0x02U	/* CPU may hold clean lines */
+#define REGION_STALE		0x04U	/* Memory written by DMA since */
+
+#define NONCACHE_BLOCK_SIZE	0x200000U
+#define BLOCK_MASK		((UINTPTR)NONCACHE_BLOCK_SIZE - 1U)
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	UINTPTR Start;
+	UINTPTR End;
+	u8 Flags;
+	volatile u8 State;
+} UsbCache_Region;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define LineDown(Addr)	((UINTPTR)(Addr) & ~((UINTPTR)USB_CACHE_LINE_SIZE - 1U))
+#define LineUp(Addr)	LineDown((UINTPTR)(Addr) + USB_CACHE_LINE_SIZE - 1U)
+
+/************************** Variable Definitions *****************************/
+#ifdef USB_CACHE_MANAGED
+extern u8 __usb_noncache_start[];
+extern u8 __usb_noncache_end[];
+#endif
+
+static UsbCache_Region Regions[USB_CACHE_MAX_REGIONS];
+static u32 NumRegions;
+
+static UsbCache_Stats Stats;
+static UsbCache_Stats LastStats;
+static u64 LastTicks;
+
+/*****************************************************************************/
+/**
+* Finds the registered region containing a buffer.
+*
+* @param	Ptr is the start of the buffer.
+* @param	Length is the length of the buffer.
+*
+* @return	Pointer to the region or NULL if the buffer is not tracked.
+*
+* @note		None.
+*
+******************************************************************************/
+static UsbCache_Region *RegionLookup(const void *Ptr, u32 Length)
+{
+	UINTPTR Start = (UINTPTR)Ptr;
+	u32 Index;
+
+	for (Index = 0; Index < NumRegions; Index++) {
+		if (Start >= Regions[Index].Start &&
+		    Start + Length <= Regions[Index].End) {
+			return &Regions[Index];
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef USB_CACHE_MANAGED
+static u32 RegionCovered(const UsbCache_Region *Region, const void *Ptr,
+			 u32 Length)
+{
+	return (LineDown(Ptr) <= Region->Start &&
+		LineUp((UINTPTR)Ptr + Length) >= Region->End) ? TRUE : FALSE;
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Issues one maintenance operation on a cache line aligned range without a
+* trailing barrier.
+*
+* @param	Range is the range and operation.
+*
+* @return	None.
+*
+* @note		Invalidation only discards whole lines owned by the range, the
+*		caller widens partial lines to clean+invalidate.
+*
+******************************************************************************/
+static void RangeIssue(const UsbCache_Range *Range)
+{
+#if defined (__aarch64__) && !defined (USB_HOST_SIM)
+	UINTPTR Addr;
+
+	for (Addr = Range->Start; Addr < Range->End;
+	     Addr += USB_CACHE_LINE_SIZE) {
+		switch (Range->Op) {
+			case USB_CACHE_OP_CLEAN:
+				__asm__ __volatile__("dc cvac, %0" : : "r" (Addr) : "memory");
+				break;
+			case USB_CACHE_OP_CLEAN_INV:
+				__asm__ __volatile__("dc civac, %0" : : "r" (Addr) : "memory");
+				break;
+			default:
+				__asm__ __volatile__("dc ivac, %0" : : "r" (Addr) : "memory");
+				break;
+		}
+	}
+#else
+	if (Range->Op == USB_CACHE_OP_INV) {
+		Xil_DCacheInvalidateRange((INTPTR)Range->Start,
+					  (INTPTR)(Range->End - Range->Start));
+	} else {
+		Xil_DCacheFlushRange((INTPTR)Range->Start,
+				     (INTPTR)(Range->End - Range->Start));
+	}
+#endif
+}
+
+#ifdef USB_CACHE_MANAGED
+/*****************************************************************************/
+/**
+* Adds an operation to a batch. Ranges are widened to whole cache lines and
+* merged with overlapping or adjacent ranges of the same operation.
+*
+* @param	Batch is the batch to add to.
+* @param	Ptr is the start of the buffer.
+* @param	Length is the length of the buffer.
+* @param	Op is one of USB_CACHE_OP_*.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void BatchAdd(UsbCache_Batch *Batch, const void *Ptr, u32 Length, u8 Op)
+{
+	UINTPTR Start = LineDown(Ptr);
+	UINTPTR End = LineUp((UINTPTR)Ptr + Length);
+	u32 Index;
+
+	if (Length == 0U) {
+		return;
+	}
+
+	if (Op == USB_CACHE_OP_INV) {
+		Stats.BytesInvalidated += End - Start;
+		/* Never discard neighbouring data sharing a partial line */
+		if (Start != (UINTPTR)Ptr || End != (UINTPTR)Ptr + Length) {
+			Op = USB_CACHE_OP_CLEAN_INV;
+		}
+	} else {
+		Stats.BytesFlushed += End - Start;
+		if (Op == USB_CACHE_OP_CLEAN_INV) {
+			Stats.BytesInvalidated += End - Start;
+		}
+	}
+
+	for (Index = 0; Index < Batch->Count; Index++) {
+		UsbCache_Range *Range = &Batch->Range[Index];
+
+		if (Range->Op == Op && Start <= Range->End && End >= Range->Start) {
+			Range->Start = Start < Range->Start ? Start : Range->Start;
+			Range->End = End > Range->End ? End : Range->End;
+			return;
+		}
+	}
+
+	if (Batch->Count == USB_CACHE_BATCH_MAX) {
+		UsbCache_BatchSync(Batch);
+	}
+
+	Batch->Range[Batch->Count].Start = Start;
+	Batch->Range[Batch->Count].End = End;
+	Batch->Range[Batch->Count].Op = Op;
+	Batch->Count++;
+}
+
+static void RangeNow(const void *Ptr, u32 Length, u8 Op)
+{
+	UsbCache_Batch Batch;
+
+	UsbCache_BatchInit(&Batch);
+	BatchAdd(&Batch, Ptr, Length, Op);
+	UsbCache_BatchSync(&Batch);
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Initializes the cache manager. In USB_CACHE_MANAGED mode the section
+* holding the driver control structures is remapped non-cacheable.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Must be called before the controller is initialized.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void UsbCache_Init(void)
+{
+#if defined (USB_CACHE_MANAGED) && !defined (__MICROBLAZE__)
+	UINTPTR Addr;
+
+	for (Addr = (UINTPTR)__usb_noncache_start;
+	     Addr < (UINTPTR)__usb_noncache_end;
+	     Addr += NONCACHE_BLOCK_SIZE) {
+		Xil_SetTlbAttributes(Addr, NORM_NONCACHE);
+	}
+#endif
+
+	NumRegions = 0U;
+	LastTicks = UsbGetTicks();
+}
+
+/*****************************************************************************/
+/**
+* Maps a memory range with 2MB block descriptors and the given memory type.
+* The whole data cache is cleaned and invalidated first so no dirty line of
+* the range survives a switch to non-cacheable.
+*
+* @param	Ptr is the start of the range, 2MB aligned.
+* @param	Length is the length of the range, a multiple of 2MB.
+* @param	Attr is USB_CACHE_MAP_WRITEBACK or USB_CACHE_MAP_NONCACHEABLE.
+*
+* @return	XST_SUCCESS, XST_INVALID_PARAM for a misaligned range or an
+*		unknown type, XST_NO_FEATURE without an MMU.
+*
+* @note		Nothing else may live in the range, the blocks are remapped
+*		as a whole. The range must not be in use by DMA.
+*
+******************************************************************************/
+USB_COLD_TEXT
+s32 UsbCache_MapBlocks(void *Ptr, u64 Length, u32 Attr)
+{
+#if !defined (__MICROBLAZE__)
+	UINTPTR Addr = (UINTPTR)Ptr;
+	UINTPTR End = Addr + (UINTPTR)Length;
+	u64 TlbAttr;
+
+	if ((Addr & BLOCK_MASK) != 0U || (Length & BLOCK_MASK) != 0U) {
+		return XST_INVALID_PARAM;
+	}
+
+	switch (Attr) {
+		case USB_CACHE_MAP_WRITEBACK:
+			TlbAttr = NORM_WB_CACHE;
+			break;
+		case USB_CACHE_MAP_NONCACHEABLE:
+			TlbAttr = NORM_NONCACHE;
+			break;
+		default:
+			return XST_INVALID_PARAM;
+	}
+
+	Xil_DCacheFlush();
+	for (; Addr < End; Addr += NONCACHE_BLOCK_SIZE) {
+		Xil_SetTlbAttributes(Addr, TlbAttr);
+	}
+
+	return XST_SUCCESS;
+#else
+	(void)Ptr;
+	(void)Length;
+	(void)Attr;
+
+	return XST_NO_FEATURE;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Tells whether the wrappers are responsible for data buffer maintenance.
+*
+* @param	None.
+*
+* @return	TRUE in USB_CACHE_MANAGED mode, FALSE otherwise.
+*
+* @note		None.
+*
+******************************************************************************/
+u32 UsbCache_IsManaged(void)
+{
+#ifdef USB_CACHE_MANAGED
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Registers a DMA region whose cache state is tracked. The region starts
+* clean, the caller must not hold dirty lines for it at this point.
+*
+* @param	Ptr is the start of the region, cache line aligned.
+* @param	Length is the length of the region.
+* @param	Flags is a combination of USB_CACHE_REGION_* flags.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the region table is full.
+*
+* @note		None.
+*
+******************************************************************************/
+s32 UsbCache_RegisterRegion(void *Ptr, u32 Length, u32 Flags)
+{
+	UsbCache_Region *Region;
+
+	if (RegionLookup(Ptr, Length) != NULL) {
+		return XST_SUCCESS;
+	}
+
+	if (NumRegions == USB_CACHE_MAX_REGIONS) {
+		return XST_FAILURE;
+	}
+
+	Region = &Regions[NumRegions];
+	Region->Start = LineDown(Ptr);
+	Region->End = LineUp((UINTPTR)Ptr + Length);
+	Region->Flags = (u8)Flags;
+	Region->State = 0U;
+	NumRegions++;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Prepares a DMA buffer to be written by the CPU. Lines left stale by the
+* controller are dropped so they cannot be merged with the new data.
+*
+* @param	Ptr is the start of the data about to be written.
+* @param	Length is the length of the data about to be written.
+*
+* @return	None.
+*
+* @note		Must be called before the CPU fills a buffer the controller
+*		may have written since it was last read.
+*
+******************************************************************************/
+void UsbCache_CpuPrepareWrite(const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Region *Region = RegionLookup(Ptr, Length);
+
+	if (Region == NULL ||
+	    (Region->Flags & USB_CACHE_REGION_NONCACHEABLE) != 0U) {
+		return;
+	}
+
+	if ((Region->State & REGION_STALE) != 0U) {
+		RangeNow(Ptr, Length, USB_CACHE_OP_INV);
+		if (RegionCovered(Region, Ptr, Length) == TRUE) {
+			Region->State &= (u8)~REGION_STALE;
+		}
+	}
+#else
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Announces that the CPU has written to a DMA buffer.
+*
+* @param	Ptr is the start of the written data.
+* @param	Length is the length of the written data.
+*
+* @return	None.
+*
+* @note		If the region is still stale the written lines are cleaned
+*		and invalidated at once, the data is kept. Partial lines may
+*		then carry stale bytes back to memory, use
+*		UsbCache_CpuPrepareWrite() before filling such buffers.
+*
+******************************************************************************/
+void UsbCache_CpuWrite(const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Region *Region = RegionLookup(Ptr, Length);
+
+	if (Region == NULL ||
+	    (Region->Flags & USB_CACHE_REGION_NONCACHEABLE) != 0U) {
+		return;
+	}
+
+	if ((Region->State & REGION_STALE) != 0U) {
+		/* Write the new data back, only the stale lines are lost */
+		RangeNow(Ptr, Length, USB_CACHE_OP_CLEAN_INV);
+		if (RegionCovered(Region, Ptr, Length) == TRUE) {
+			Region->State &= (u8)~REGION_STALE;
+		}
+	}
+	Region->State |= REGION_DIRTY | REGION_CACHED;
+#else
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Prepares a DMA buffer to be read by the CPU.
+*
+* @param	Ptr is the start of the data to read.
+* @param	Length is the length of the data to read.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbCache_CpuRead(const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Region *Region = RegionLookup(Ptr, Length);
+
+	if (Region == NULL) {
+		return;
+	}
+
+	if ((Region->Flags & USB_CACHE_REGION_NONCACHEABLE) != 0U) {
+		return;
+	}
+
+	if ((Region->State & REGION_STALE) != 0U) {
+		RangeNow(Ptr, Length, USB_CACHE_OP_INV);
+		if (RegionCovered(Region, Ptr, Length) == TRUE) {
+			Region->State &= (u8)~REGION_STALE;
+		}
+	}
+	Region->State |= REGION_CACHED;
+#else
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+void UsbCache_BatchInit(UsbCache_Batch *Batch)
+{
+	Batch->Count = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Adds the maintenance needed before the controller reads a buffer.
+*
+* @param	Batch is the batch collecting the maintenance.
+* @param	Ptr is the start of the buffer.
+* @param	Length is the length of the buffer.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbCache_ToDevice(UsbCache_Batch *Batch, const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Region *Region = RegionLookup(Ptr, Length);
+
+	if (Region == NULL) {
+		BatchAdd(Batch, Ptr, Length, USB_CACHE_OP_CLEAN);
+		return;
+	}
+
+	if ((Region->State & REGION_DIRTY) == 0U ||
+	    (Region->Flags & USB_CACHE_REGION_NONCACHEABLE) != 0U) {
+		Stats.BytesSkipped += Length;
+		return;
+	}
+
+	BatchAdd(Batch, Ptr, Length, USB_CACHE_OP_CLEAN);
+	if (RegionCovered(Region, Ptr, Length) == TRUE) {
+		Region->State &= (u8)~REGION_DIRTY;
+	}
+#else
+	(void)Batch;
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Adds the maintenance needed before the controller writes a buffer.
+*
+* @param	Batch is the batch collecting the maintenance.
+* @param	Ptr is the start of the buffer.
+* @param	Length is the length of the buffer.
+*
+* @return	None.
+*
+* @note		Clean lines are left alone, they are dropped by the next
+*		UsbCache_CpuRead() of the region.
+*
+******************************************************************************/
+void UsbCache_FromDevice(UsbCache_Batch *Batch, const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Region *Region = RegionLookup(Ptr, Length);
+
+	if (Region == NULL) {
+		BatchAdd(Batch, Ptr, Length, USB_CACHE_OP_CLEAN_INV);
+		return;
+	}
+
+	if ((Region->Flags & USB_CACHE_REGION_NONCACHEABLE) != 0U) {
+		Stats.BytesSkipped += Length;
+		return;
+	}
+
+	if ((Region->State & REGION_DIRTY) != 0U) {
+		BatchAdd(Batch, Ptr, Length, USB_CACHE_OP_CLEAN_INV);
+		if (RegionCovered(Region, Ptr, Length) == TRUE) {
+			Region->State &= (u8)~(REGION_DIRTY | REGION_CACHED);
+		}
+	} else {
+		Stats.BytesSkipped += Length;
+	}
+	Region->State |= REGION_STALE;
+#else
+	(void)Batch;
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Issues all operations of a batch followed by a single barrier.
+*
+* @param	Batch is the batch to issue, it is empty afterwards.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbCache_BatchSync(UsbCache_Batch *Batch)
+{
+	u32 Index;
+
+	if (Batch->Count == 0U) {
+		return;
+	}
+
+	for (Index = 0; Index < Batch->Count; Index++) {
+		RangeIssue(&Batch->Range[Index]);
+	}
+#if defined (__aarch64__) && !defined (USB_HOST_SIM)
+	__asm__ __volatile__("dsb sy" : : : "memory");
+#endif
+
+	Batch->Count = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Called when the controller has finished writing a buffer.
+*
+* @param	Ptr is the start of the buffer.
+* @param	Length is the number of bytes written by the controller.
+*
+* @return	None.
+*
+* @note		Tracked regions are invalidated lazily on UsbCache_CpuRead(),
+*		untracked buffers are invalidated here.
+*
+******************************************************************************/
+void UsbCache_FromDeviceDone(const void *Ptr, u32 Length)
+{
+#ifdef USB_CACHE_MANAGED
+	if (RegionLookup(Ptr, Length) == NULL) {
+		RangeNow(Ptr, Length, USB_CACHE_OP_INV);
+	}
+#else
+	(void)Ptr;
+	(void)Length;
+#endif
+}
+
+/*****************************************************************************/
+/**
+* Returns the maintenance counters and the rates since the previous call.
+*
+* @param	StatsPtr is filled with the counters.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbCache_GetStats(UsbCache_Stats *StatsPtr)
+{
+	u64 Now = UsbGetTicks();
+	u64 Elapsed = Now - LastTicks;
+
+	if (Elapsed != 0U) {
+		Stats.FlushedPerSec = (u32)(((Stats.BytesFlushed -
+					      LastStats.BytesFlushed) *
+					     USB_TICKS_PER_SECOND) / Elapsed);
+		Stats.InvalidatedPerSec = (u32)(((Stats.BytesInvalidated -
+						  LastStats.BytesInvalidated) *
+						 USB_TICKS_PER_SECOND) / Elapsed);
+		Stats.SkippedPerSec = (u32)(((Stats.BytesSkipped -
+					      LastStats.BytesSkipped) *
+					     USB_TICKS_PER_SECOND) / Elapsed);
+	}
+
+	LastStats = Stats;
+	LastTicks = Now;
+	*StatsPtr = Stats;
+}
@@ -0,0 +1,101 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_cache.h
+ *
+ * This file contains declarations for the D-cache maintenance manager used by
+ * the USB wrappers for DMA buffers.
+ *
+ * Three modes are supported:
+ *  - default: the USBPSU driver performs full range maintenance itself.
+ *  - USB_CACHE_MANAGED: the driver control structures (TRBs, event buffer,
+ *    setup packet) are placed in a non-cacheable section and the driver is
+ *    told the controller is coherent. The manager then tracks the state of
+ *    registered DMA regions and only cleans or invalidates what the CPU has
+ *    touched since the last DMA.
+ *  - USB_CACHE_HW_COHERENT: the controller is hardware coherent through the
+ *    CCI (snooping and outer shareable memory configured by the platform) and
+ *    no maintenance is done at all.
+ *
+ * CPU accesses to a registered region must be announced with
+ * UsbCache_CpuWrite() after writing and UsbCache_CpuRead() before reading
+ * data received by DMA. A buffer the controller may have written is
+ * prepared with UsbCache_CpuPrepareWrite() before the CPU refills it.
+ * Unregistered buffers are always maintained.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_CACHE_H
+#define XUSB_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_CACHE_LINE_SIZE		64U
+#define USB_CACHE_MAX_REGIONS		16U
+#define USB_CACHE_BATCH_MAX		8U
+
+/* Region flags */
+#define USB_CACHE_REGION_NONCACHEABLE	0x01U	/* Mapped non-cacheable */
+
+/* Memory types for UsbCache_MapBlocks() */
+#define USB_CACHE_MAP_WRITEBACK		0U	/* Normal write-back */
+#define USB_CACHE_MAP_NONCACHEABLE	1U	/* Normal non-cacheable */
+
+/* Maintenance operations */
+#define USB_CACHE_OP_CLEAN		0U	/* Write back dirty lines */
+#define USB_CACHE_OP_CLEAN_INV		1U	/* Write back and invalidate */
+#define USB_CACHE_OP_INV		2U	/* Discard lines */
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	UINTPTR Start;		/* Cache line aligned */
+	UINTPTR End;		/* Cache line aligned, exclusive */
+	u8 Op;
+} UsbCache_Range;
+
+/* Maintenance collected for one transfer and issued with one barrier */
+typedef struct {
+	UsbCache_Range Range[USB_CACHE_BATCH_MAX];
+	u32 Count;
+} UsbCache_Batch;
+
+typedef struct {
+	u64 BytesFlushed;	/* Bytes cleaned to memory */
+	u64 BytesInvalidated;	/* Bytes invalidated */
+	u64 BytesSkipped;	/* DMA bytes needing no maintenance */
+	u32 FlushedPerSec;	/* Rates since the previous call */
+	u32 InvalidatedPerSec;
+	u32 SkippedPerSec;
+} UsbCache_Stats;
+
+/************************** Function Prototypes ******************************/
+void UsbCache_Init(void);
+u32 UsbCache_IsManaged(void);
+s32 UsbCache_RegisterRegion(void *Ptr, u32 Length, u32 Flags);
+s32 UsbCache_MapBlocks(void *Ptr, u64 Length, u32 Attr);
+void UsbCache_CpuPrepareWrite(const void *Ptr, u32 Length);
+void UsbCache_CpuWrite(const void *Ptr, u32 Length);
+void UsbCache_CpuRead(const void *Ptr, u32 Length);
+void UsbCache_BatchInit(UsbCache_Batch *Batch);
+void UsbCache_ToDevice(UsbCache_Batch *Batch, const void *Ptr, u32 Length);
+void UsbCache_FromDevice(UsbCache_Batch *Batch, const void *Ptr, u32 Length);
+void UsbCache_BatchSync(UsbCache_Batch *Batch);
+void UsbCache_FromDeviceDone(const void *Ptr, u32 Length);
+void UsbCache_GetStats(UsbCache_Stats *StatsPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_CACHE_H */
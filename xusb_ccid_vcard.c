@@ -0,0 +1,1101 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_ccid_vcard.c
+ *
+ * This file contains the implementation of the virtual smart card used as
+ * the card of every CCID slot when CCID_VIRTUAL_CARD is defined.
+ *
+ * The files are described by Files[], their contents are kept per slot in
+ * Data[]. Files are looked up by parent DF and FID, by parent DF and SFI
+ * and by DF name through hash tables built by CcidVCard_Init(), chained
+ * through FidNext[], SfiNext[] and AidNext[]. A slot only keeps its
+ * current DF and EF.
+ *
+ * Commands are taken with CLA 00 and short or extended Lc/Le fields:
+ *
+ * <pre>
+ * SELECT         A4  P1 00 FID (3F00 or empty for the MF), 01 DF, 02 EF,
+ *                    03 parent DF, 04 DF name, 08 path from the MF,
+ *                    09 path from the current DF. P2 00 or 04 returns the
+ *                    FCP template when Le is present, 0C returns nothing.
+ * READ BINARY    B0  P1-P2 offset, or SFI in P1 and offset in P2
+ * UPDATE BINARY  D6  as READ BINARY, EF 5003 only
+ * READ RECORD    B2  P1 record number, P2 SFI << 3 | 04
+ * GET DATA       CA  P1-P2 tag, see CCID_VCARD_DO_*
+ * </pre>
+ *
+ * Reads shorter than Le at the end of a file end with 6282. A record or
+ * data object longer than Le is answered with 6Cxx. Le is capped at the
+ * longest response the card keeps, all of EF 5001 or 256 bytes with
+ * CCID_MEMORY_LIMITED.
+ *
+ * The reader streams the APDUs, they are collected in Cmd[] of the slot
+ * and the response is returned from Rsp[].
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <string.h>
+#include "xusb_ccid_vcard.h"
+#include "xusb_wrapper.h"
+
+#ifdef CCID_VIRTUAL_CARD
+
+/************************** Constant Definitions *****************************/
+#define VCARD_NONE		0xFFU
+
+/* Files[].Type */
+#define VCARD_DF		0U
+#define VCARD_EF_BINARY		1U
+#define VCARD_EF_RECORD		2U
+
+/* Files[].Flags */
+#define VCARD_WRITABLE		0x01U
+
+/* Files[] indexes referred to by the code */
+#define VCARD_FILE_MF		0U
+#define VCARD_FILE_SERIAL	2U
+
+#define VCARD_DIR_RECORD_LEN	21U
+#define VCARD_SERIAL_SIZE	8U
+#define VCARD_BINARY_SIZE	1024U
+#define VCARD_RECORD_LEN	32U
+#define VCARD_RECORDS		8U
+#define VCARD_WRITABLE_SIZE	256U
+
+#define VCARD_DATA_SIZE		(VCARD_DIR_RECORD_LEN + VCARD_SERIAL_SIZE + \
+				 VCARD_BINARY_SIZE + \
+				 VCARD_RECORD_LEN * VCARD_RECORDS + \
+				 VCARD_WRITABLE_SIZE)
+
+#define VCARD_HASH_BITS		4U
+#define VCARD_HASH_BUCKETS	(1U << VCARD_HASH_BITS)
+
+/* Longest APDU the card takes: extended Lc, 256 bytes and extended Le */
+#define VCARD_APDU_SIZE		265U
+
+/* Longest response, the data and the status word */
+#ifdef CCID_MEMORY_LIMITED
+#define VCARD_RSP_SIZE		258U
+#else
+#define VCARD_RSP_SIZE		(VCARD_BINARY_SIZE + 2U)
+#endif
+
+#define VCARD_FCP_SIZE		48U
+
+#define VCARD_HISTORICAL	4U	/* Offset in VCardAtr[] */
+#define VCARD_HISTORICAL_LEN	7U
+
+/* Status words */
+#define SW_OK			0x9000U
+#define SW_END_OF_FILE		0x6282U
+#define SW_WRONG_LENGTH		0x6700U
+#define SW_INCOMPATIBLE_FILE	0x6981U
+#define SW_SECURITY_STATUS	0x6982U
+#define SW_NO_CURRENT_EF	0x6986U
+#define SW_FILE_NOT_FOUND	0x6A82U
+#define SW_RECORD_NOT_FOUND	0x6A83U
+#define SW_WRONG_P1P2		0x6A86U
+#define SW_DATA_NOT_FOUND	0x6A88U
+#define SW_WRONG_OFFSET		0x6B00U
+#define SW_WRONG_LE		0x6C00U
+#define SW_INS_NOT_SUPPORTED	0x6D00U
+#define SW_CLA_NOT_SUPPORTED	0x6E00U
+
+/* Instructions */
+#define VCARD_INS_SELECT	0xA4U
+#define VCARD_INS_READ_BINARY	0xB0U
+#define VCARD_INS_UPDATE_BINARY	0xD6U
+#define VCARD_INS_READ_RECORD	0xB2U
+#define VCARD_INS_GET_DATA	0xCAU
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define FileData(Slot, Idx)	(&Data[Slot][FileOffset[Idx]])
+#define FileSize(Idx)		((Files[Idx].Type == VCARD_EF_RECORD) ?	\
+				 (u32)Files[Idx].RecLen * Files[Idx].NumRecs :\
+				 (u32)Files[Idx].Size)
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u16 Fid;
+	u8 Parent;		/* Index of the parent DF, VCARD_NONE for MF */
+	u8 Type;		/* VCARD_DF, _EF_BINARY or _EF_RECORD */
+	u8 Sfi;			/* 0 if none */
+	u8 Flags;
+	u8 RecLen;
+	u8 NumRecs;
+	u16 Size;		/* Of transparent EFs */
+	const u8 *Init;		/* NULL for the counting pattern */
+	const u8 *Aid;		/* DF name, NULL if none */
+	u8 AidLen;
+} VCardFile;
+
+typedef struct {
+	u8 Cla;
+	u8 Ins;
+	u8 P1;
+	u8 P2;
+	u32 Lc;
+	const u8 *DataPtr;
+	u32 Ne;			/* Bytes expected, 0 without Le */
+} VCardApdu;
+
+typedef struct {
+	u8 CurDf;
+	u8 CurEf;		/* VCARD_NONE if none */
+	u32 CmdLen;		/* Above VCARD_APDU_SIZE once too long */
+	u32 RspLen;
+	u32 RspOffset;
+	u8 Cmd[VCARD_APDU_SIZE];
+	u8 Rsp[VCARD_RSP_SIZE];
+} VCardSlot;
+
+/************************** Function Prototypes ******************************/
+static u32 VCardPresent(u8 Slot);
+static u32 VCardPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax);
+static void VCardPowerOff(u8 Slot);
+static s32 VCardXfr(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+		    u32 RspMax, u32 *RspLenPtr);
+static s32 VCardXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last);
+static s32 VCardXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+		       u32 *MorePtr);
+
+/************************** Variable Definitions *****************************/
+/*
+ * TS, T0 (7 historical bytes), TD1 (T=0), TD2 (T=1), historical bytes, TCK.
+ * The card capabilities announce extended Lc and Le fields.
+ */
+static const u8 VCardAtr[] = {
+	0x3B, 0x87, 0x80, 0x01,
+	0x80, 0x31, 0xA0, 0x73, 0xB6, 0x21, 0x40,
+	0xB3
+};
+
+static const u8 VCardAid[CCID_VCARD_AID_LEN] = CCID_VCARD_AID;
+
+/* Application template: the DF name and the label "VIRTUAL" */
+static const u8 VCardDirRecord[VCARD_DIR_RECORD_LEN] = {
+	0x61, 0x13,
+	0x4F, 0x08, 0xF0, 0x58, 0x55, 0x53, 0x42, 0x56, 0x43, 0x01,
+	0x50, 0x07, 0x56, 0x49, 0x52, 0x54, 0x55, 0x41, 0x4C
+};
+
+/* "XUSBVC", two zeros and the slot number in the last byte */
+static const u8 VCardSerial[VCARD_SERIAL_SIZE] = {
+	0x58, 0x55, 0x53, 0x42, 0x56, 0x43, 0x00, 0x00
+};
+
+static const VCardFile Files[] = {
+	/* Fid  Parent  Type  Sfi  Flags  RecLen  NumRecs  Size  Init  Aid */
+	{ 0x3F00U, VCARD_NONE, VCARD_DF, 0U, 0U, 0U, 0U, 0U,
+	  NULL, NULL, 0U },
+	{ 0x2F00U, 0U, VCARD_EF_RECORD, 30U, 0U, VCARD_DIR_RECORD_LEN, 1U, 0U,
+	  VCardDirRecord, NULL, 0U },
+	{ 0x2F02U, 0U, VCARD_EF_BINARY, 2U, 0U, 0U, 0U, VCARD_SERIAL_SIZE,
+	  VCardSerial, NULL, 0U },
+	{ 0x5000U, 0U, VCARD_DF, 0U, 0U, 0U, 0U, 0U,
+	  NULL, VCardAid, CCID_VCARD_AID_LEN },
+	{ 0x5001U, 3U, VCARD_EF_BINARY, 1U, 0U, 0U, 0U, VCARD_BINARY_SIZE,
+	  NULL, NULL, 0U },
+	{ 0x5002U, 3U, VCARD_EF_RECORD, 2U, 0U, VCARD_RECORD_LEN,
+	  VCARD_RECORDS, 0U, NULL, NULL, 0U },
+	{ 0x5003U, 3U, VCARD_EF_BINARY, 3U, VCARD_WRITABLE, 0U, 0U,
+	  VCARD_WRITABLE_SIZE, NULL, NULL, 0U },
+};
+
+#define VCARD_NUM_FILES		(sizeof(Files) / sizeof(Files[0]))
+
+static u16 FileOffset[VCARD_NUM_FILES];
+static u8 FidHead[VCARD_HASH_BUCKETS];
+static u8 FidNext[VCARD_NUM_FILES];
+static u8 SfiHead[VCARD_HASH_BUCKETS];
+static u8 SfiNext[VCARD_NUM_FILES];
+static u8 AidHead[VCARD_HASH_BUCKETS];
+static u8 AidNext[VCARD_NUM_FILES];
+
+static u8 Data[CCID_MAX_SLOTS][VCARD_DATA_SIZE];
+static VCardSlot Cards[CCID_MAX_SLOTS];
+
+static const Ccid_IccOps VCardIcc = {
+	.Present = VCardPresent,
+	.PowerOn = VCardPowerOn,
+	.PowerOff = VCardPowerOff,
+	.Xfr = VCardXfr,
+	.XfrPut = VCardXfrPut,
+	.XfrGet = VCardXfrGet,
+};
+
+/*****************************************************************************/
+/**
+* Hashes a file key, the parent DF in the upper half and the FID or SFI in
+* the lower one.
+*
+* @param	Key is the key to hash.
+*
+* @return	Bucket of the key.
+*
+* @note		None.
+*
+******************************************************************************/
+static u32 VCardHash(u32 Key)
+{
+	return (Key * 0x9E3779B1U) >> (32U - VCARD_HASH_BITS);
+}
+
+/*****************************************************************************/
+/**
+* Hashes a DF name with FNV-1a.
+*
+* @param	AidPtr is a pointer to the name.
+* @param	AidLen is its length.
+*
+* @return	Bucket of the name.
+*
+* @note		None.
+*
+******************************************************************************/
+static u32 VCardAidHash(const u8 *AidPtr, u32 AidLen)
+{
+	u32 Hash = 0x811C9DC5U;
+	u32 Index;
+
+	for (Index = 0U; Index < AidLen; Index++) {
+		Hash = (Hash ^ AidPtr[Index]) * 0x01000193U;
+	}
+
+	return Hash & (VCARD_HASH_BUCKETS - 1U);
+}
+
+/*****************************************************************************/
+/**
+* Looks up a file by its FID in a DF.
+*
+* @param	Parent is the index of the DF, VCARD_NONE for the MF itself.
+* @param	Fid is the file identifier.
+*
+* @return	Index of the file in Files[], VCARD_NONE if not found.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u8 VCardFindFid(u8 Parent, u16 Fid)
+{
+	u8 Index;
+
+	for (Index = FidHead[VCardHash(((u32)Parent << 16) | Fid)];
+	     Index != VCARD_NONE; Index = FidNext[Index]) {
+		if (Files[Index].Parent == Parent && Files[Index].Fid == Fid) {
+			break;
+		}
+	}
+
+	return Index;
+}
+
+/*****************************************************************************/
+/**
+* Looks up an EF by its short identifier in a DF.
+*
+* @param	Parent is the index of the DF.
+* @param	Sfi is the short EF identifier, 1 to 30.
+*
+* @return	Index of the EF in Files[], VCARD_NONE if not found.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u8 VCardFindSfi(u8 Parent, u8 Sfi)
+{
+	u8 Index;
+
+	for (Index = SfiHead[VCardHash(((u32)Parent << 16) | Sfi)];
+	     Index != VCARD_NONE; Index = SfiNext[Index]) {
+		if (Files[Index].Parent == Parent && Files[Index].Sfi == Sfi) {
+			break;
+		}
+	}
+
+	return Index;
+}
+
+/*****************************************************************************/
+/**
+* Looks up a DF by its name.
+*
+* @param	AidPtr is a pointer to the name.
+* @param	AidLen is its length.
+*
+* @return	Index of the DF in Files[], VCARD_NONE if not found.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u8 VCardFindAid(const u8 *AidPtr, u32 AidLen)
+{
+	u8 Index;
+
+	for (Index = AidHead[VCardAidHash(AidPtr, AidLen)];
+	     Index != VCARD_NONE; Index = AidNext[Index]) {
+		if (Files[Index].AidLen == AidLen &&
+		    memcmp(Files[Index].Aid, AidPtr, AidLen) == 0) {
+			break;
+		}
+	}
+
+	return Index;
+}
+
+/*****************************************************************************/
+/**
+* Returns a data object if Le allows for all of it.
+*
+* @param	SrcPtr is a pointer to the data.
+* @param	Len is its length.
+* @param	Ne is the number of bytes expected.
+* @param	RspPtr is a pointer to the response data.
+* @param	RspLenPtr is set to the length of the response data.
+*
+* @return	SW_OK, or SW_WRONG_LE with the length of the data.
+*
+* @note		None.
+*
+******************************************************************************/
+static u16 VCardPutData(const u8 *SrcPtr, u32 Len, u32 Ne, u8 *RspPtr,
+			u32 *RspLenPtr)
+{
+	if (Ne < Len) {
+		return (u16)(SW_WRONG_LE | (Len & 0xFFU));
+	}
+
+	memcpy(RspPtr, SrcPtr, Len);
+	*RspLenPtr = Len;
+
+	return SW_OK;
+}
+
+/*****************************************************************************/
+/**
+* Builds the FCP template of a file.
+*
+* @param	Index is the file in Files[].
+* @param	FcpPtr is a pointer to VCARD_FCP_SIZE bytes.
+*
+* @return	Length of the template.
+*
+* @note		None.
+*
+******************************************************************************/
+static u32 VCardFcp(u8 Index, u8 *FcpPtr)
+{
+	const VCardFile *FilePtr = &Files[Index];
+	u32 Len = 2U;
+	u32 Size;
+
+	/* File descriptor */
+	FcpPtr[Len++] = 0x82;
+	if (FilePtr->Type == VCARD_DF) {
+		FcpPtr[Len++] = 0x01;
+		FcpPtr[Len++] = 0x38;
+	} else if (FilePtr->Type == VCARD_EF_BINARY) {
+		FcpPtr[Len++] = 0x01;
+		FcpPtr[Len++] = 0x01;
+	} else {
+		FcpPtr[Len++] = 0x05;
+		FcpPtr[Len++] = 0x02;
+		FcpPtr[Len++] = 0x21;
+		FcpPtr[Len++] = 0x00;
+		FcpPtr[Len++] = FilePtr->RecLen;
+		FcpPtr[Len++] = FilePtr->NumRecs;
+	}
+
+	FcpPtr[Len++] = 0x83;
+	FcpPtr[Len++] = 0x02;
+	FcpPtr[Len++] = (u8)(FilePtr->Fid >> 8);
+	FcpPtr[Len++] = (u8)FilePtr->Fid;
+
+	if (FilePtr->Aid != NULL) {
+		FcpPtr[Len++] = 0x84;
+		FcpPtr[Len++] = FilePtr->AidLen;
+		memcpy(&FcpPtr[Len], FilePtr->Aid, FilePtr->AidLen);
+		Len += FilePtr->AidLen;
+	}
+
+	if (FilePtr->Type != VCARD_DF) {
+		Size = FileSize(Index);
+		FcpPtr[Len++] = 0x80;
+		FcpPtr[Len++] = 0x02;
+		FcpPtr[Len++] = (u8)(Size >> 8);
+		FcpPtr[Len++] = (u8)Size;
+		if (FilePtr->Sfi != 0U) {
+			FcpPtr[Len++] = 0x88;
+			FcpPtr[Len++] = 0x01;
+			FcpPtr[Len++] = (u8)(FilePtr->Sfi << 3);
+		}
+	}
+
+	/* Life cycle status: operational, activated */
+	FcpPtr[Len++] = 0x8A;
+	FcpPtr[Len++] = 0x01;
+	FcpPtr[Len++] = 0x05;
+
+	FcpPtr[0] = 0x62;
+	FcpPtr[1] = (u8)(Len - 2U);
+
+	return Len;
+}
+
+/*****************************************************************************/
+/**
+* Runs SELECT.
+*
+* @param	CardPtr is the card of the slot.
+* @param	ApduPtr is the decoded command.
+* @param	RspPtr is a pointer to the response data.
+* @param	RspLenPtr is set to the length of the response data.
+*
+* @return	Status word.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u16 VCardSelect(VCardSlot *CardPtr, const VCardApdu *ApduPtr,
+		       u8 *RspPtr, u32 *RspLenPtr)
+{
+	const u8 *DataPtr = ApduPtr->DataPtr;
+	u8 Fcp[VCARD_FCP_SIZE];
+	u8 Index = VCARD_NONE;
+	u8 Parent;
+	u16 Fid = 0U;
+	u32 Offset;
+
+	if (ApduPtr->P2 != 0x00U && ApduPtr->P2 != 0x04U &&
+	    ApduPtr->P2 != 0x0CU) {
+		return SW_WRONG_P1P2;
+	}
+
+	if (ApduPtr->P1 <= 0x02U && ApduPtr->Lc != 0U) {
+		if (ApduPtr->Lc != 2U) {
+			return SW_WRONG_LENGTH;
+		}
+		Fid = (u16)((DataPtr[0] << 8) | DataPtr[1]);
+	}
+
+	switch (ApduPtr->P1) {
+		case 0x00U:
+			if (ApduPtr->Lc == 0U || Fid == CCID_VCARD_FID_MF) {
+				Index = VCARD_FILE_MF;
+			} else if (Fid == Files[CardPtr->CurDf].Fid) {
+				Index = CardPtr->CurDf;
+			} else {
+				Index = VCardFindFid(CardPtr->CurDf, Fid);
+				Parent = Files[CardPtr->CurDf].Parent;
+				if (Index == VCARD_NONE &&
+				    Parent != VCARD_NONE) {
+					Index = VCardFindFid(Parent, Fid);
+				}
+			}
+			break;
+
+		case 0x01U:
+		case 0x02U:
+			if (ApduPtr->Lc == 0U) {
+				return SW_WRONG_LENGTH;
+			}
+			Index = VCardFindFid(CardPtr->CurDf, Fid);
+			if (Index != VCARD_NONE &&
+			    (Files[Index].Type == VCARD_DF) !=
+			    (ApduPtr->P1 == 0x01U)) {
+				Index = VCARD_NONE;
+			}
+			break;
+
+		case 0x03U:
+			if (ApduPtr->Lc != 0U) {
+				return SW_WRONG_LENGTH;
+			}
+			Index = Files[CardPtr->CurDf].Parent;
+			break;
+
+		case 0x04U:
+			if (ApduPtr->Lc == 0U || ApduPtr->Lc > 16U) {
+				return SW_WRONG_LENGTH;
+			}
+			Index = VCardFindAid(DataPtr, ApduPtr->Lc);
+			break;
+
+		case 0x08U:
+		case 0x09U:
+			if (ApduPtr->Lc == 0U || (ApduPtr->Lc & 1U) != 0U) {
+				return SW_WRONG_LENGTH;
+			}
+			Index = (ApduPtr->P1 == 0x08U) ? VCARD_FILE_MF :
+				CardPtr->CurDf;
+			for (Offset = 0U; Offset < ApduPtr->Lc &&
+			     Index != VCARD_NONE; Offset += 2U) {
+				if (Files[Index].Type != VCARD_DF) {
+					Index = VCARD_NONE;
+					break;
+				}
+				Fid = (u16)((DataPtr[Offset] << 8) |
+					    DataPtr[Offset + 1U]);
+				Index = VCardFindFid(Index, Fid);
+			}
+			break;
+
+		default:
+			return SW_WRONG_P1P2;
+	}
+
+	if (Index == VCARD_NONE) {
+		return SW_FILE_NOT_FOUND;
+	}
+
+	if (Files[Index].Type == VCARD_DF) {
+		CardPtr->CurDf = Index;
+		CardPtr->CurEf = VCARD_NONE;
+	} else {
+		CardPtr->CurDf = Files[Index].Parent;
+		CardPtr->CurEf = Index;
+	}
+
+	if (ApduPtr->P2 == 0x0CU || ApduPtr->Ne == 0U) {
+		return SW_OK;
+	}
+
+	return VCardPutData(Fcp, VCardFcp(Index, Fcp), ApduPtr->Ne, RspPtr,
+			    RspLenPtr);
+}
+
+/*****************************************************************************/
+/**
+* Finds the EF and offset of READ BINARY or UPDATE BINARY. An EF given by
+* its SFI becomes the current EF.
+*
+* @param	CardPtr is the card of the slot.
+* @param	ApduPtr is the decoded command.
+* @param	IndexPtr is set to the EF in Files[].
+* @param	OffsetPtr is set to the offset in the EF.
+*
+* @return	SW_OK or the status word of the failure.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u16 VCardBinaryTarget(VCardSlot *CardPtr, const VCardApdu *ApduPtr,
+			     u8 *IndexPtr, u32 *OffsetPtr)
+{
+	u8 Index;
+
+	if ((ApduPtr->P1 & 0x80U) != 0U) {
+		if ((ApduPtr->P1 & 0x60U) != 0U) {
+			return SW_WRONG_P1P2;
+		}
+		Index = VCardFindSfi(CardPtr->CurDf, ApduPtr->P1 & 0x1FU);
+		if (Index == VCARD_NONE) {
+			return SW_FILE_NOT_FOUND;
+		}
+		*OffsetPtr = ApduPtr->P2;
+	} else {
+		Index = CardPtr->CurEf;
+		if (Index == VCARD_NONE) {
+			return SW_NO_CURRENT_EF;
+		}
+		*OffsetPtr = ((u32)ApduPtr->P1 << 8) | ApduPtr->P2;
+	}
+
+	if (Files[Index].Type != VCARD_EF_BINARY) {
+		return SW_INCOMPATIBLE_FILE;
+	}
+
+	CardPtr->CurEf = Index;
+	*IndexPtr = Index;
+
+	if (*OffsetPtr > Files[Index].Size) {
+		return SW_WRONG_OFFSET;
+	}
+
+	return SW_OK;
+}
+
+/*****************************************************************************/
+/**
+* Runs READ BINARY and UPDATE BINARY.
+*
+* @param	CardPtr is the card of the slot.
+* @param	Slot is the slot number.
+* @param	ApduPtr is the decoded command.
+* @param	RspPtr is a pointer to the response data.
+* @param	RspLenPtr is set to the length of the response data.
+*
+* @return	Status word.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u16 VCardBinary(VCardSlot *CardPtr, u8 Slot, const VCardApdu *ApduPtr,
+		       u8 *RspPtr, u32 *RspLenPtr)
+{
+	u32 Offset;
+	u32 Len;
+	u16 Sw;
+	u8 Index;
+
+	if (ApduPtr->Ins == VCARD_INS_READ_BINARY) {
+		if (ApduPtr->Lc != 0U || ApduPtr->Ne == 0U) {
+			return SW_WRONG_LENGTH;
+		}
+	} else if (ApduPtr->Lc == 0U) {
+		return SW_WRONG_LENGTH;
+	}
+
+	Sw = VCardBinaryTarget(CardPtr, ApduPtr, &Index, &Offset);
+	if (Sw != SW_OK) {
+		return Sw;
+	}
+
+	if (ApduPtr->Ins == VCARD_INS_UPDATE_BINARY) {
+		if ((Files[Index].Flags & VCARD_WRITABLE) == 0U) {
+			return SW_SECURITY_STATUS;
+		}
+		if (Offset + ApduPtr->Lc > Files[Index].Size) {
+			return SW_WRONG_LENGTH;
+		}
+		memcpy(FileData(Slot, Index) + Offset, ApduPtr->DataPtr,
+		       ApduPtr->Lc);
+		return SW_OK;
+	}
+
+	Len = Files[Index].Size - Offset;
+	if (Len > ApduPtr->Ne) {
+		Len = ApduPtr->Ne;
+	}
+
+	memcpy(RspPtr, FileData(Slot, Index) + Offset, Len);
+	*RspLenPtr = Len;
+
+	return (Len < ApduPtr->Ne) ? SW_END_OF_FILE : SW_OK;
+}
+
+/*****************************************************************************/
+/**
+* Runs READ RECORD for a record given by its number.
+*
+* @param	CardPtr is the card of the slot.
+* @param	Slot is the slot number.
+* @param	ApduPtr is the decoded command.
+* @param	RspPtr is a pointer to the response data.
+* @param	RspLenPtr is set to the length of the response data.
+*
+* @return	Status word.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u16 VCardReadRecord(VCardSlot *CardPtr, u8 Slot,
+			   const VCardApdu *ApduPtr, u8 *RspPtr,
+			   u32 *RspLenPtr)
+{
+	u8 Sfi = ApduPtr->P2 >> 3;
+	u8 Index;
+
+	if (ApduPtr->Lc != 0U || ApduPtr->Ne == 0U) {
+		return SW_WRONG_LENGTH;
+	}
+
+	if ((ApduPtr->P2 & 0x07U) != 0x04U || Sfi == 0x1FU) {
+		return SW_WRONG_P1P2;
+	}
+
+	if (Sfi != 0U) {
+		Index = VCardFindSfi(CardPtr->CurDf, Sfi);
+		if (Index == VCARD_NONE) {
+			return SW_FILE_NOT_FOUND;
+		}
+	} else {
+		Index = CardPtr->CurEf;
+		if (Index == VCARD_NONE) {
+			return SW_NO_CURRENT_EF;
+		}
+	}
+
+	if (Files[Index].Type != VCARD_EF_RECORD) {
+		return SW_INCOMPATIBLE_FILE;
+	}
+
+	CardPtr->CurEf = Index;
+
+	if (ApduPtr->P1 == 0U || ApduPtr->P1 > Files[Index].NumRecs) {
+		return SW_RECORD_NOT_FOUND;
+	}
+
+	return VCardPutData(FileData(Slot, Index) +
+			    (u32)(ApduPtr->P1 - 1U) * Files[Index].RecLen,
+			    Files[Index].RecLen, ApduPtr->Ne, RspPtr,
+			    RspLenPtr);
+}
+
+/*****************************************************************************/
+/**
+* Runs GET DATA.
+*
+* @param	CardPtr is the card of the slot.
+* @param	Slot is the slot number.
+* @param	ApduPtr is the decoded command.
+* @param	RspPtr is a pointer to the response data.
+* @param	RspLenPtr is set to the length of the response data.
+*
+* @return	Status word.
+*
+* @note		The value of the data object is returned, without its tag
+*		and length.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u16 VCardGetData(VCardSlot *CardPtr, u8 Slot,
+			const VCardApdu *ApduPtr, u8 *RspPtr, u32 *RspLenPtr)
+{
+	const VCardFile *DfPtr = &Files[CardPtr->CurDf];
+
+	if (ApduPtr->Lc != 0U || ApduPtr->Ne == 0U) {
+		return SW_WRONG_LENGTH;
+	}
+
+	switch (((u32)ApduPtr->P1 << 8) | ApduPtr->P2) {
+		case CCID_VCARD_DO_AID:
+			if (DfPtr->Aid == NULL) {
+				return SW_DATA_NOT_FOUND;
+			}
+			return VCardPutData(DfPtr->Aid, DfPtr->AidLen,
+					    ApduPtr->Ne, RspPtr, RspLenPtr);
+
+		case CCID_VCARD_DO_SERIAL:
+			return VCardPutData(FileData(Slot, VCARD_FILE_SERIAL),
+					    VCARD_SERIAL_SIZE, ApduPtr->Ne,
+					    RspPtr, RspLenPtr);
+
+		case CCID_VCARD_DO_HISTORICAL:
+			return VCardPutData(&VCardAtr[VCARD_HISTORICAL],
+					    VCARD_HISTORICAL_LEN, ApduPtr->Ne,
+					    RspPtr, RspLenPtr);
+
+		default:
+			return SW_DATA_NOT_FOUND;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Decodes and runs one command APDU.
+*
+* @param	Slot is the slot number.
+* @param	CmdPtr is a pointer to the command APDU.
+* @param	CmdLen is its length.
+* @param	RspPtr is a pointer to the response buffer.
+* @param	RspMax is its size, at least 2.
+*
+* @return	Length of the response APDU, status word included.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static u32 VCardExchange(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+			 u32 RspMax)
+{
+	VCardSlot *CardPtr = &Cards[Slot];
+	VCardApdu Apdu;
+	u32 RspLen = 0U;
+	u16 Sw;
+
+	Apdu.Lc = 0U;
+	Apdu.Ne = 0U;
+	Apdu.DataPtr = NULL;
+
+	if (CmdLen < 4U) {
+		Sw = SW_WRONG_LENGTH;
+	} else {
+		Apdu.Cla = CmdPtr[0];
+		Apdu.Ins = CmdPtr[1];
+		Apdu.P1 = CmdPtr[2];
+		Apdu.P2 = CmdPtr[3];
+		Sw = SW_OK;
+
+		if (CmdLen == 5U) {
+			Apdu.Ne = (CmdPtr[4] != 0U) ? CmdPtr[4] : 256U;
+		} else if (CmdLen > 5U && CmdPtr[4] != 0U) {
+			Apdu.Lc = CmdPtr[4];
+			Apdu.DataPtr = &CmdPtr[5];
+			if (CmdLen == 6U + Apdu.Lc) {
+				Apdu.Ne = (CmdPtr[CmdLen - 1U] != 0U) ?
+					  CmdPtr[CmdLen - 1U] : 256U;
+			} else if (CmdLen != 5U + Apdu.Lc) {
+				Sw = SW_WRONG_LENGTH;
+			}
+		} else if (CmdLen == 7U) {
+			/* Extended Le only, after a zero byte */
+			Apdu.Ne = ((u32)CmdPtr[5] << 8) | CmdPtr[6];
+			Apdu.Ne = (Apdu.Ne != 0U) ? Apdu.Ne : 65536U;
+		} else if (CmdLen > 7U) {
+			/* Extended Lc, the data and maybe an extended Le */
+			Apdu.Lc = ((u32)CmdPtr[5] << 8) | CmdPtr[6];
+			Apdu.DataPtr = &CmdPtr[7];
+			if (Apdu.Lc == 0U) {
+				Sw = SW_WRONG_LENGTH;
+			} else if (CmdLen == 9U + Apdu.Lc) {
+				Apdu.Ne = ((u32)CmdPtr[CmdLen - 2U] << 8) |
+					  CmdPtr[CmdLen - 1U];
+				Apdu.Ne = (Apdu.Ne != 0U) ? Apdu.Ne : 65536U;
+			} else if (CmdLen != 7U + Apdu.Lc) {
+				Sw = SW_WRONG_LENGTH;
+			}
+		} else if (CmdLen == 6U) {
+			Sw = SW_WRONG_LENGTH;
+		}
+
+		if (Apdu.Ne > RspMax - 2U) {
+			Apdu.Ne = RspMax - 2U;
+		}
+	}
+
+	if (Sw == SW_OK && Apdu.Cla != 0x00U) {
+		Sw = SW_CLA_NOT_SUPPORTED;
+	}
+
+	if (Sw == SW_OK) {
+		switch (Apdu.Ins) {
+			case VCARD_INS_SELECT:
+				Sw = VCardSelect(CardPtr, &Apdu, RspPtr,
+						 &RspLen);
+				break;
+			case VCARD_INS_READ_BINARY:
+			case VCARD_INS_UPDATE_BINARY:
+				Sw = VCardBinary(CardPtr, Slot, &Apdu, RspPtr,
+						 &RspLen);
+				break;
+			case VCARD_INS_READ_RECORD:
+				Sw = VCardReadRecord(CardPtr, Slot, &Apdu,
+						     RspPtr, &RspLen);
+				break;
+			case VCARD_INS_GET_DATA:
+				Sw = VCardGetData(CardPtr, Slot, &Apdu, RspPtr,
+						  &RspLen);
+				break;
+			default:
+				Sw = SW_INS_NOT_SUPPORTED;
+				break;
+		}
+	}
+
+	RspPtr[RspLen++] = (u8)(Sw >> 8);
+	RspPtr[RspLen++] = (u8)Sw;
+
+	return RspLen;
+}
+
+/*****************************************************************************/
+/**
+* Resets the selection and the APDU in progress of a card.
+*
+* @param	Slot is the slot number.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void VCardReset(u8 Slot)
+{
+	VCardSlot *CardPtr = &Cards[Slot];
+
+	CardPtr->CurDf = VCARD_FILE_MF;
+	CardPtr->CurEf = VCARD_NONE;
+	CardPtr->CmdLen = 0U;
+	CardPtr->RspLen = 0U;
+	CardPtr->RspOffset = 0U;
+}
+
+/****************************************************************************/
+/**
+* Card backend, see Ccid_IccOps.
+*
+*****************************************************************************/
+static u32 VCardPresent(u8 Slot)
+{
+	(void)Slot;
+
+	return 1U;
+}
+
+static u32 VCardPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax)
+{
+	if (AtrMax < sizeof(VCardAtr)) {
+		return 0U;
+	}
+
+	VCardReset(Slot);
+	memcpy(AtrPtr, VCardAtr, sizeof(VCardAtr));
+
+	return sizeof(VCardAtr);
+}
+
+static void VCardPowerOff(u8 Slot)
+{
+	VCardReset(Slot);
+}
+
+USB_HOT_TEXT
+static s32 VCardXfr(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+		    u32 RspMax, u32 *RspLenPtr)
+{
+	if (RspMax < 2U) {
+		return XST_FAILURE;
+	}
+
+	*RspLenPtr = VCardExchange(Slot, CmdPtr, CmdLen, RspPtr, RspMax);
+
+	return XST_SUCCESS;
+}
+
+USB_HOT_TEXT
+static s32 VCardXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last)
+{
+	VCardSlot *CardPtr = &Cards[Slot];
+
+	if (CmdLen == 0U && Last == FALSE) {
+		CardPtr->CmdLen = 0U;
+		CardPtr->RspLen = 0U;
+		CardPtr->RspOffset = 0U;
+		return XST_SUCCESS;
+	}
+
+	if (CardPtr->CmdLen + CmdLen <= VCARD_APDU_SIZE) {
+		memcpy(&CardPtr->Cmd[CardPtr->CmdLen], CmdPtr, CmdLen);
+		CardPtr->CmdLen += CmdLen;
+	} else {
+		CardPtr->CmdLen = VCARD_APDU_SIZE + 1U;
+	}
+
+	if (Last == FALSE) {
+		return XST_SUCCESS;
+	}
+
+	if (CardPtr->CmdLen > VCARD_APDU_SIZE) {
+		CardPtr->Rsp[0] = (u8)(SW_WRONG_LENGTH >> 8);
+		CardPtr->Rsp[1] = (u8)SW_WRONG_LENGTH;
+		CardPtr->RspLen = 2U;
+	} else {
+		CardPtr->RspLen = VCardExchange(Slot, CardPtr->Cmd,
+						CardPtr->CmdLen, CardPtr->Rsp,
+						VCARD_RSP_SIZE);
+	}
+	CardPtr->CmdLen = 0U;
+	CardPtr->RspOffset = 0U;
+
+	return XST_SUCCESS;
+}
+
+USB_HOT_TEXT
+static s32 VCardXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+		       u32 *MorePtr)
+{
+	VCardSlot *CardPtr = &Cards[Slot];
+	u32 Len = CardPtr->RspLen - CardPtr->RspOffset;
+
+	if (Len > RspMax) {
+		Len = RspMax;
+	}
+
+	memcpy(RspPtr, &CardPtr->Rsp[CardPtr->RspOffset], Len);
+	CardPtr->RspOffset += Len;
+	*RspLenPtr = Len;
+	*MorePtr = (CardPtr->RspOffset < CardPtr->RspLen) ? TRUE : FALSE;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Sets up the cards of all slots with their initial file contents and
+* builds the lookup tables.
+*
+* @param	None.
+*
+* @return	The backend, for Ccid_SetIcc().
+*
+* @note		Call before the first command is received. Cards are powered
+*		off and files written by UPDATE BINARY are restored.
+*
+******************************************************************************/
+const Ccid_IccOps *CcidVCard_Init(void)
+{
+	const VCardFile *FilePtr;
+	u32 Offset = 0U;
+	u32 Bucket;
+	u32 Slot;
+	u32 Index;
+	u32 Byte;
+	u8 *DstPtr;
+
+	memset(FidHead, VCARD_NONE, sizeof(FidHead));
+	memset(SfiHead, VCARD_NONE, sizeof(SfiHead));
+	memset(AidHead, VCARD_NONE, sizeof(AidHead));
+	memset(SfiNext, VCARD_NONE, sizeof(SfiNext));
+	memset(AidNext, VCARD_NONE, sizeof(AidNext));
+
+	for (Index = 0U; Index < VCARD_NUM_FILES; Index++) {
+		FilePtr = &Files[Index];
+		FileOffset[Index] = (u16)Offset;
+
+		for (Slot = 0U; Slot < CCID_MAX_SLOTS; Slot++) {
+			DstPtr = FileData(Slot, Index);
+			if (FilePtr->Init != NULL) {
+				memcpy(DstPtr, FilePtr->Init, FileSize(Index));
+				continue;
+			}
+			for (Byte = 0U; Byte < FileSize(Index); Byte++) {
+				DstPtr[Byte] = (u8)(Byte + FilePtr->Fid);
+			}
+		}
+		Offset += FileSize(Index);
+
+		Bucket = VCardHash(((u32)FilePtr->Parent << 16) |
+				   FilePtr->Fid);
+		FidNext[Index] = FidHead[Bucket];
+		FidHead[Bucket] = (u8)Index;
+
+		if (FilePtr->Sfi != 0U) {
+			Bucket = VCardHash(((u32)FilePtr->Parent << 16) |
+					   FilePtr->Sfi);
+			SfiNext[Index] = SfiHead[Bucket];
+			SfiHead[Bucket] = (u8)Index;
+		}
+
+		if (FilePtr->Aid != NULL) {
+			Bucket = VCardAidHash(FilePtr->Aid, FilePtr->AidLen);
+			AidNext[Index] = AidHead[Bucket];
+			AidHead[Bucket] = (u8)Index;
+		}
+	}
+
+	for (Slot = 0U; Slot < CCID_MAX_SLOTS; Slot++) {
+		FileData(Slot, VCARD_FILE_SERIAL)[VCARD_SERIAL_SIZE - 1U] =
+			(u8)Slot;
+		VCardReset((u8)Slot);
+	}
+
+	return &VCardIcc;
+}
+
+#endif /* CCID_VIRTUAL_CARD */
@@ -0,0 +1,73 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_ccid_vcard.h
+ *
+ * This file contains definitions for the virtual smart card, a Ccid_IccOps
+ * backend answering ISO 7816-4 APDUs from a file system held in memory.
+ *
+ * Every slot holds its own card with the following files:
+ *
+ * <pre>
+ * 3F00 MF
+ *   2F00 EF.DIR, linear fixed, one record for the application (SFI 30)
+ *   2F02 Serial number, transparent, 8 bytes ending in the slot (SFI 2)
+ *   5000 Application DF, named CCID_VCARD_AID
+ *     5001 Transparent, 1024 bytes (SFI 1)
+ *     5002 Linear fixed, 8 records of 32 bytes (SFI 2)
+ *     5003 Transparent, 256 bytes, writable (SFI 3)
+ * </pre>
+ *
+ * Files 5001 to 5003 start with byte i holding (i + FID) & 0xFF, records
+ * are numbered through the file. The cards take SELECT by FID, DF name and
+ * path, READ BINARY, UPDATE BINARY, READ RECORD and GET DATA with short
+ * and extended APDUs, see xusb_ccid_vcard.c. Each answer is computed at
+ * once, the card is never busy.
+ *
+ * The backend is enabled by defining CCID_VIRTUAL_CARD.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_CCID_VCARD_H
+#define XUSB_CCID_VCARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files *********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+#include "xusb_class_ccid.h"
+
+/************************** Constant Definitions *****************************/
+#define CCID_VCARD_FID_MF		0x3F00U
+#define CCID_VCARD_FID_DIR		0x2F00U
+#define CCID_VCARD_FID_SERIAL		0x2F02U
+#define CCID_VCARD_FID_APP		0x5000U
+#define CCID_VCARD_FID_BINARY		0x5001U
+#define CCID_VCARD_FID_RECORD		0x5002U
+#define CCID_VCARD_FID_WRITABLE		0x5003U
+
+/* DF name of the application, a proprietary AID */
+#define CCID_VCARD_AID		{ 0xF0, 0x58, 0x55, 0x53, 0x42, 0x56, 0x43, \
+				  0x01 }
+#define CCID_VCARD_AID_LEN	8U
+
+/* GET DATA objects, P1-P2 */
+#define CCID_VCARD_DO_AID		0x004FU	/* Name of the current DF */
+#define CCID_VCARD_DO_SERIAL		0x005AU	/* Contents of EF 2F02 */
+#define CCID_VCARD_DO_HISTORICAL	0x5F52U	/* Historical bytes */
+
+/************************** Function Prototypes ******************************/
+const Ccid_IccOps *CcidVCard_Init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XUSB_CCID_VCARD_H */
@@ -30,6 +30,9 @@
 
 /***************************** Include Files *********************************/
 #include "xusb_ch9.h"
+#include "xusb_dma_pool.h"
+#include "xusb_trace.h"
+#include "xusb_telemetry.h"
 #include "xil_cache.h"
 #include "sleep.h"
 
@@ -58,6 +61,7 @@ static void Usb_StdDevReq(struct Usb_DevData *InstancePtr,
 * @note		None.
 *
 ******************************************************************************/
+USB_HOT_TEXT
 void Ch9Handler(struct Usb_DevData *InstancePtr,
 		SetupPacket *SetupData)
 {
@@ -67,6 +71,8 @@ void Ch9Handler(struct Usb_DevData *InstancePtr,
 #ifdef CH9_DEBUG
 	printf("Handle setup packet\n");
 #endif
+	USB_TRACE_SETUP(SetupData->bRequestType, SetupData->bRequest);
+
 	switch (SetupData->bRequestType & USB_REQ_TYPE_MASK) {
 		case USB_CMD_STDREQ:
 			Usb_StdDevReq(InstancePtr, SetupData);
@@ -80,6 +86,16 @@ void Ch9Handler(struct Usb_DevData *InstancePtr,
 
 #ifdef CH9_DEBUG
 			printf("vendor request %x\n", SetupData->bRequest);
+#endif
+#ifdef USB_TELEMETRY
+			if ((SetupData->bRequestType & USB_ENDPOINT_DIR_MASK) &&
+			    UsbTelemetry_VendorReq(InstancePtr->PrivateData,
+						   SetupData->bRequest,
+						   SetupData->wIndex,
+						   SetupData->wLength) == XST_SUCCESS) {
+				break;
+			}
+			EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
 #endif
 			break;
 
@@ -92,6 +108,7 @@ void Ch9Handler(struct Usb_DevData *InstancePtr,
 			break;
 	}
 
+	USB_TRACE_SETUP_DONE();
 }
 
 /*****************************************************************************/
@@ -107,25 +124,13 @@ void Ch9Handler(struct Usb_DevData *InstancePtr,
 * @note		None.
 *
 ******************************************************************************/
+USB_HOT_TEXT
 static void Usb_StdDevReq(struct Usb_DevData *InstancePtr,
 			  SetupPacket *SetupData)
 {
-#ifdef __ICCARM__
-#if defined (PLATFORM_ZYNQMP) || defined (versal)
-#pragma data_alignment = 64
-	static u8 Reply[USB_REQ_REPLY_LEN];
-#pragma data_alignment = 64
-	static u8 TmpBuffer[10];
-#else
-#pragma data_alignment = 32
-	static u8 Reply[USB_REQ_REPLY_LEN];
-#pragma data_alignment = 32
-	static u8 TmpBuffer[10];
-#endif
-#else
-	static u8 Reply[USB_REQ_REPLY_LEN] ALIGNMENT_CACHELINE;
-	static u8 TmpBuffer[10] ALIGNMENT_CACHELINE;
-#endif
+	/* Allocated once from the DMA buffer pool */
+	static u8 *Reply;
+	static u8 *TmpBuffer;
 
 	s32 Status;
 	u8 Error = 0;
@@ -145,6 +150,20 @@ static void Usb_StdDevReq(struct Usb_DevData *InstancePtr,
 		return;
 	}
 
+	if (Reply == NULL) {
+		Reply = UsbPool_Alloc(USB_REQ_REPLY_LEN);
+		TmpBuffer = UsbPool_Alloc(10);
+		if (Reply == NULL || TmpBuffer == NULL) {
+			UsbPool_Free(Reply);
+			UsbPool_Free(TmpBuffer);
+			Reply = NULL;
+			TmpBuffer = NULL;
+			/* No buffer for the reply, fail the request at once */
+			EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
+			return;
+		}
+	}
+
 #ifdef CH9_DEBUG
 	printf("bmRequestType 0x%x\r\n", SetupData->bRequestType);
 	printf("bRequest 0x%x\r\n", SetupData->bRequest);
@@ -7,9 +7,9 @@
 /*****************************************************************************/
 /**
  *
- * @file xusb_ch9_storage.c
+ * @file xusb_ch9_ccid.c
  *
- * This file contains the implementation of the Mass Storage specific chapter 9
+ * This file contains the implementation of the CCID specific chapter 9
  * code for the example.
  *
  *<pre>
@@ -28,10 +28,39 @@
 
 /***************************** Include Files *********************************/
 #include <string.h>
-#include "xparameters.h" /* XPAR parameters */
-#include "xusb_class_storage.h"
+#include "xparameters.h"		/* XPAR parameters */
+#include "xusb_ch9_ccid.h"
+#include "xusb_class_ccid.h"
 
 /************************** Constant Definitions *****************************/
+/* dwProtocols, from ccid_config.h */
+#if defined (CCID_SUPPORTS_TPDU_T0) && defined (CCID_SUPPORTS_TPDU_T1)
+#define CCID_PROTOCOLS		0x00000003U
+#elif defined (CCID_SUPPORTS_TPDU_T1)
+#define CCID_PROTOCOLS		0x00000002U
+#else
+#define CCID_PROTOCOLS		0x00000001U
+#endif
+
+/*
+ * Exchange level. Extended APDUs are chained by the host and need a card
+ * backend with XfrPut and XfrGet, see Ccid_IccOps.
+ */
+#ifdef CCID_SUPPORTS_EXTENDED_APDU
+#define CCID_EXCHANGE_LEVEL	CCID_FEATURE_EXTENDED_APDU
+#else
+#define CCID_EXCHANGE_LEVEL	CCID_FEATURE_SHORT_APDU
+#endif
+
+#define CCID_FEATURES		(CCID_FEATURE_AUTO_PARAM_ATR |	\
+				 CCID_FEATURE_AUTO_VOLTAGE |	\
+				 CCID_FEATURE_AUTO_CLOCK |	\
+				 CCID_FEATURE_AUTO_BAUD |	\
+				 CCID_FEATURE_AUTO_PPS |	\
+				 CCID_EXCHANGE_LEVEL)
+
+/* bInterval of the interrupt IN endpoint, 2^(4-1) x 125 us = 1 ms */
+#define CCID_NOTIFY_INTERVAL	0x04
 
 /***************** Macros (Inline Functions) Definitions *********************/
 
@@ -40,254 +69,294 @@
 /************************** Function Prototypes ******************************/
 
 /************************** Variable Definitions *****************************/
-extern USB_CBW CBW;
-extern u8 Phase;
+
+/*
+ * Smart card class descriptor, the same at all speeds
+ */
+#define CCID_CLASS_DESC_INIT						\
+	{								\
+		sizeof(USB_CCID_CLASS_DESC),	/* bLength */		\
+		USB_TYPE_CCID_CLASS_DESC,	/* bDescriptorType */	\
+		0x0110,				/* bcdCCID 1.1 */	\
+		CCID_MAX_SLOTS - 1U,		/* bMaxSlotIndex */	\
+		0x07,				/* bVoltageSupport */	\
+		CCID_PROTOCOLS,			/* dwProtocols */	\
+		CCID_DEFAULT_CLOCK,		/* dwDefaultClock */	\
+		CCID_DEFAULT_CLOCK,		/* dwMaximumClock */	\
+		0x01,			/* bNumClockSupported */	\
+		CCID_DEFAULT_DATA_RATE,		/* dwDataRate */	\
+		CCID_DEFAULT_DATA_RATE,		/* dwMaxDataRate */	\
+		0x01,			/* bNumDataRatesSupported */	\
+		0x000000FE,			/* dwMaxIFSD */		\
+		0x00000000,			/* dwSynchProtocols */	\
+		0x00000000,			/* dwMechanical */	\
+		CCID_FEATURES,			/* dwFeatures */	\
+		CCID_MAX_MESSAGE_SIZE,	/* dwMaxCCIDMessageLength */	\
+		0xFF,				/* bClassGetResponse */	\
+		0xFF,				/* bClassEnvelope */	\
+		0x0000,				/* wLcdLayout */	\
+		0x00,				/* bPINSupport */	\
+		CCID_MAX_SLOTS			/* bMaxCCIDBusySlots */	\
+	}
 
 /*
  * Device Descriptors
  */
-#ifdef __ICCARM__
+#ifdef  __ICCARM__
 #pragma data_alignment = 16
 #endif
 
 #ifdef __ICCARM__
-USB_STD_DEV_DESC deviceDesc[] = {
+static USB_STD_DEV_DESC deviceDesc[] = {
 #else
-USB_STD_DEV_DESC __attribute__((aligned(16))) deviceDesc[] = {
+static USB_STD_DEV_DESC __attribute__ ((aligned(16))) deviceDesc[] = {
 #endif
-	{
-		/*
+	{/*
 		 * USB 2.0
 		 */
-		sizeof(USB_STD_DEV_DESC), /* bLength */
-		USB_TYPE_DEVICE_DESC,	  /* bDescriptorType */
-		0x0200,					  /* bcdUSB 2.0 */
-		0x00,					  /* bDeviceClass */
-		0x00,					  /* bDeviceSubClass */
-		0x00,					  /* bDeviceProtocol */
-		0x40,					  /* bMaxPackedSize0 */
-		0x03Fd,					  /* idVendor */
-		0x0500,					  /* idProduct */
-		0x0100,					  /* bcdDevice */
-		0x01,					  /* iManufacturer */
-		0x02,					  /* iProduct */
-		0x03,					  /* iSerialNumber */
-		0x01					  /* bNumConfigurations */
+		sizeof(USB_STD_DEV_DESC),	/* bLength */
+		USB_TYPE_DEVICE_DESC,	/* bDescriptorType */
+		0x0200,					/* bcdUSB 2.0 */
+		0x00,					/* bDeviceClass */
+		0x00,					/* bDeviceSubClass */
+		0x00,					/* bDeviceProtocol */
+		0x40,					/* bMaxPackedSize0 */
+		0x03Fd,					/* idVendor */
+		0x0501,					/* idProduct */
+		0x0100,					/* bcdDevice */
+		0x01,					/* iManufacturer */
+		0x02,					/* iProduct */
+		0x03,					/* iSerialNumber */
+		0x01					/* bNumConfigurations */
 	},
-	{
-		/*
+	{/*
 		 * USB 3.0
 		 */
-		sizeof(USB_STD_DEV_DESC), /* bLength */
-		USB_TYPE_DEVICE_DESC,	  /* bDescriptorType */
-		0x0300,					  /* bcdUSB 3.0 */
-		0x00,					  /* bDeviceClass */
-		0x00,					  /* bDeviceSubClass */
-		0x00,					  /* bDeviceProtocol */
-		0x09,					  /* bMaxPackedSize0 */
-		0x0525,					  /* idVendor */
-		0xA4A5,					  /* idProduct */
-		0x0404,					  /* bcdDevice */
-		0x03,					  /* iManufacturer */
-		0x04,					  /* iProduct */
-		0x05,					  /* iSerialNumber */
-		0x01					  /* bNumConfigurations */
-	}};
+		sizeof(USB_STD_DEV_DESC),	/* bLength */
+		USB_TYPE_DEVICE_DESC,	/* bDescriptorType */
+		0x0300,					/* bcdUSB 3.0 */
+		0x00,					/* bDeviceClass */
+		0x00,					/* bDeviceSubClass */
+		0x00,					/* bDeviceProtocol */
+		0x09,					/* bMaxPackedSize0 */
+		0x03Fd,					/* idVendor */
+		0x0501,					/* idProduct */
+		0x0100,					/* bcdDevice */
+		0x01,					/* iManufacturer */
+		0x02,					/* iProduct */
+		0x03,					/* iSerialNumber */
+		0x01					/* bNumConfigurations */
+	}
+};
 
 /*
  * Configuration Descriptors
  */
 #ifdef __ICCARM__
-USB30_CONFIG config3 = {
+static USB30_CCID_CONFIG config3 = {
 #else
-USB30_CONFIG __attribute__((aligned(16))) config3 = {
+static USB30_CCID_CONFIG __attribute__ ((aligned(16))) config3 = {
 #endif
-	{
-		/*
+	{/*
 		 * Std Config
 		 */
-		sizeof(USB_STD_CFG_DESC), /* bLength */
-		USB_TYPE_CONFIG_DESC,	  /* bDescriptorType */
-		sizeof(USB30_CONFIG),	  /* wTotalLength */
-		0x01,					  /* bNumInterfaces */
-		0x01,					  /* bConfigurationValue */
-		0x00,					  /* iConfiguration */
-		0xc0,					  /* bmAttribute */
-		0x00					  /* bMaxPower  */
+		sizeof(USB_STD_CFG_DESC),	/* bLength */
+		USB_TYPE_CONFIG_DESC,	/* bDescriptorType */
+		sizeof(USB30_CCID_CONFIG),	/* wTotalLength */
+		0x01,					/* bNumInterfaces */
+		0x01,					/* bConfigurationValue */
+		0x00,					/* iConfiguration */
+		0xc0,					/* bmAttribute */
+		0x00					/* bMaxPower  */
 	},
-	{
-		/*
+	{/*
 		 * CCID Standard Interface Descriptor
 		 */
-		sizeof(USB_STD_IF_DESC), /* bLength */
-		USB_TYPE_INTERFACE_DESC, /* bDescriptorType */
-		0x00,					 /* bInterfaceNumber */
-		0x00,					 /* bAlternateSetting */
-		0x02,					 /* bNumEndPoints */
-		USB_CLASS_CCID,			 /* bInterfaceClass */
-		0x00,					 /* bInterfaceSubClass */
-		0x00,					 /* bInterfaceProtocol */
-		0x01					 /* iInterface */
+		sizeof(USB_STD_IF_DESC),	/* bLength */
+		USB_TYPE_INTERFACE_DESC,	/* bDescriptorType */
+		0x00,					/* bInterfaceNumber */
+		0x00,					/* bAlternateSetting */
+		0x03,					/* bNumEndPoints */
+		USB_CLASS_CCID,			/* bInterfaceClass */
+		0x00,					/* bInterfaceSubClass */
+		0x00,					/* bInterfaceProtocol */
+		0x04					/* iInterface */
 	},
-	{
-		/*
+	CCID_CLASS_DESC_INIT,
+	{/*
 		 * Bulk In Endpoint Config
 		 */
 		sizeof(USB_STD_EP_DESC),	/* bLength */
-		USB_TYPE_ENDPOINT_CFG_DESC, /* bDescriptorType */
-		USB_EP1_IN,					/* bEndpointAddress */
-		0x02,						/* bmAttribute  */
-		0x00,						/* wMaxPacketSize - LSB */
-		0x04,						/* wMaxPacketSize - MSB */
-		0x00						/* bInterval */
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP1_IN,				/* bEndpointAddress */
+		0x02,					/* bmAttribute  */
+		0x00,					/* wMaxPacketSize - LSB */
+		0x04,					/* wMaxPacketSize - MSB */
+		0x00					/* bInterval */
 	},
-	{
-		/*
+	{/*
 		 * SS Endpoint companion
 		 */
-		sizeof(USB_STD_EP_SS_COMP_DESC), /* bLength */
-		0x30,							 /* bDescriptorType */
-		0x0F,							 /* bMaxBurst */
-		0x00,							 /* bmAttributes */
-		0x00							 /* wBytesPerInterval */
+		sizeof(USB_STD_EP_SS_COMP_DESC),	/* bLength */
+		0x30, 					/* bDescriptorType */
+		0x00,					/* bMaxBurst */
+		0x00,					/* bmAttributes */
+		0x00					/* wBytesPerInterval */
 	},
-	{
-		/*
+	{/*
 		 * Bulk Out Endpoint Config
 		 */
 		sizeof(USB_STD_EP_DESC),	/* bLength */
-		USB_TYPE_ENDPOINT_CFG_DESC, /* bDescriptorType */
-		USB_EP1_OUT,				/* bEndpointAddress */
-		0x02,						/* bmAttribute */
-		0x00,						/* wMaxPacketSize - LSB */
-		0x04,						/* wMaxPacketSize - MSB */
-		0x00						/* bInterval */
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP1_OUT,			/* bEndpointAddress */
+		0x02,					/* bmAttribute */
+		0x00,					/* wMaxPacketSize - LSB */
+		0x04,					/* wMaxPacketSize - MSB */
+		0x00					/* bInterval */
 	},
-	{
-		/*
+	{/*
 		 * SS Endpoint companion
 		 */
-		sizeof(USB_STD_EP_SS_COMP_DESC), /* bLength */
-		0x30,							 /* bDescriptorType */
-		0x0F,							 /* bMaxBurst */
-		0x00,							 /* bmAttributes */
-		0x00							 /* wBytesPerInterval */
-	}};
+		sizeof(USB_STD_EP_SS_COMP_DESC),	/* bLength */
+		0x30, 					/* bDescriptorType */
+		0x00,					/* bMaxBurst */
+		0x00,					/* bmAttributes */
+		0x00					/* wBytesPerInterval */
+	},
+	{/*
+		 * Interrupt In Endpoint Config
+		 */
+		sizeof(USB_STD_EP_DESC),	/* bLength */
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP2_IN,				/* bEndpointAddress */
+		0x03,					/* bmAttribute */
+		CCID_NOTIFY_PACKET_SIZE,	/* wMaxPacketSize - LSB */
+		0x00,					/* wMaxPacketSize - MSB */
+		CCID_NOTIFY_INTERVAL	/* bInterval */
+	},
+	{/*
+		 * SS Endpoint companion
+		 */
+		sizeof(USB_STD_EP_SS_COMP_DESC),	/* bLength */
+		0x30, 					/* bDescriptorType */
+		0x00,					/* bMaxBurst */
+		0x00,					/* bmAttributes */
+		CCID_NOTIFY_PACKET_SIZE	/* wBytesPerInterval */
+	}
+};
 
 #ifdef __ICCARM__
-USB_CONFIG config2 = {
+static USB_CCID_CONFIG config2 = {
 #else
-USB_CONFIG __attribute__((aligned(16))) config2 = {
+static USB_CCID_CONFIG __attribute__ ((aligned(16))) config2 = {
 #endif
-	{
-		/*
+	{/*
 		 * Std Config
 		 */
-		sizeof(USB_STD_CFG_DESC), /* bLength */
-		USB_TYPE_CONFIG_DESC,	  /* bDescriptorType */
-		sizeof(USB_CONFIG),		  /* wTotalLength */
-		0x01,					  /* bNumInterfaces */
-		0x01,					  /* bConfigurationValue */
-		0x00,					  /* iConfiguration */
-		0xc0,					  /* bmAttribute */
-		0x00					  /* bMaxPower  */
+		sizeof(USB_STD_CFG_DESC),	/* bLength */
+		USB_TYPE_CONFIG_DESC,	/* bDescriptorType */
+		sizeof(USB_CCID_CONFIG),	/* wTotalLength */
+		0x01,					/* bNumInterfaces */
+		0x01,					/* bConfigurationValue */
+		0x00,					/* iConfiguration */
+		0xc0,					/* bmAttribute */
+		0x00					/* bMaxPower  */
 	},
-	{
-		/*
-		 * Mass Storage Standard Interface Descriptor
+	{/*
+		 * CCID Standard Interface Descriptor
 		 */
-		sizeof(USB_STD_IF_DESC), /* bLength */
-		USB_TYPE_INTERFACE_DESC, /* bDescriptorType */
-		0x00,					 /* bInterfaceNumber */
-		0x00,					 /* bAlternateSetting */
-		0x02,					 /* bNumEndPoints */
-		USB_CLASS_CCID,			 /* bInterfaceClass */
-		0x00,					 /* bInterfaceSubClass */
-		0x00,					 /* bInterfaceProtocol */
-		0x01					 /* iInterface */
+		sizeof(USB_STD_IF_DESC),	/* bLength */
+		USB_TYPE_INTERFACE_DESC,	/* bDescriptorType */
+		0x00,					/* bInterfaceNumber */
+		0x00,					/* bAlternateSetting */
+		0x03,					/* bNumEndPoints */
+		USB_CLASS_CCID,			/* bInterfaceClass */
+		0x00,					/* bInterfaceSubClass */
+		0x00,					/* bInterfaceProtocol */
+		0x04					/* iInterface */
 	},
-	{
-		/*
+	CCID_CLASS_DESC_INIT,
+	{/*
 		 * Bulk In Endpoint Config
 		 */
 		sizeof(USB_STD_EP_DESC),	/* bLength */
-		USB_TYPE_ENDPOINT_CFG_DESC, /* bDescriptorType */
-		USB_EP1_IN,					/* bEndpointAddress */
-		0x02,						/* bmAttribute  */
-		0x00,						/* wMaxPacketSize - LSB */
-		0x02,						/* wMaxPacketSize - MSB */
-		0x00						/* bInterval */
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP1_IN,				/* bEndpointAddress */
+		0x02,					/* bmAttribute  */
+		0x00,					/* wMaxPacketSize - LSB */
+		0x02,					/* wMaxPacketSize - MSB */
+		0x00					/* bInterval */
 	},
-	{
-		/*
+	{/*
 		 * Bulk Out Endpoint Config
 		 */
 		sizeof(USB_STD_EP_DESC),	/* bLength */
-		USB_TYPE_ENDPOINT_CFG_DESC, /* bDescriptorType */
-		USB_EP1_OUT,				/* bEndpointAddress */
-		0x02,						/* bmAttribute  */
-		0x00,						/* wMaxPacketSize - LSB */
-		0x02,						/* wMaxPacketSize - MSB */
-		0x00						/* bInterval */
-	}};
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP1_OUT,			/* bEndpointAddress */
+		0x02,					/* bmAttribute  */
+		0x00,					/* wMaxPacketSize - LSB */
+		0x02,					/* wMaxPacketSize - MSB */
+		0x00					/* bInterval */
+	},
+	{/*
+		 * Interrupt In Endpoint Config
+		 */
+		sizeof(USB_STD_EP_DESC),	/* bLength */
+		USB_TYPE_ENDPOINT_CFG_DESC,	/* bDescriptorType */
+		USB_EP2_IN,				/* bEndpointAddress */
+		0x03,					/* bmAttribute */
+		CCID_NOTIFY_PACKET_SIZE,	/* wMaxPacketSize - LSB */
+		0x00,					/* wMaxPacketSize - MSB */
+		CCID_NOTIFY_INTERVAL	/* bInterval */
+	}
+};
 
 /*
  * String Descriptors
  */
-static u8 StringList[2][6][128] = {
-	{"Xilinx standalone",
-	 "Mass Storage",
-	 "USB 2.0 Flash Drive Disk Emulation",
-	 "2A49876D9CC1AA4",
-	 "Mass Storage Gadget",
-	 "Default Interface"},
-	{"Xilinx standalone",
-	 "Mass Storage",
-	 "2A49876D9CC1AA4",
-	 "USB 3.0 Flash Drive Disk Emulation",
-	 "Mass Storage Gadget",
-	 "7ABC7ABC7ABC7ABC7ABC7ABC"}};
+static const char *StringList[] = {
+	"",				/* Index 0 is the language table */
+	"Xilinx standalone",
+	"CCID Smart Card Reader",
+	"2A49876D9CC1AA4",
+	"Smart Card Interface"
+};
 
 /*****************************************************************************/
 /**
- *
- * This function returns the device descriptor for the device.
- *
- * @param	InstancePtr is a pointer to the Usb_DevData instance.
- * @param	BufPtr is pointer to the buffer that is to be filled
- *			with the descriptor.
- * @param	BufLen is the size of the provided buffer.
- *
- * @return 	Length of the descriptor in the buffer on success.
- *			0 on error.
- *
- ******************************************************************************/
-u32 Usb_Ch9SetupDevDescReply(struct Usb_DevData *InstancePtr,
-							 u8 *BufPtr, u32 BufLen)
+*
+* This function returns the device descriptor for the device.
+*
+* @param	InstancePtr is a pointer to the Usb_DevData instance.
+* @param	BufPtr is pointer to the buffer that is to be filled
+*			with the descriptor.
+* @param	BufLen is the size of the provided buffer.
+*
+* @return 	Length of the descriptor in the buffer on success.
+*			0 on error.
+*
+******************************************************************************/
+u32 Ccid_Ch9SetupDevDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen)
 {
 	u8 Index;
 	s32 Status;
 
 	Status = IsSuperSpeed(InstancePtr);
-	if (Status != XST_SUCCESS)
-	{
+	if (Status != XST_SUCCESS) {
 		/* USB 2.0 */
 		Index = 0;
-	}
-	else
-	{
+	} else {
 		/* USB 3.0 */
 		Index = 1;
 	}
 
 	/* Check buffer pointer is there and buffer is big enough. */
-	if (!BufPtr)
-	{
+	if (!BufPtr) {
 		return 0;
 	}
 
-	if (BufLen < sizeof(USB_STD_DEV_DESC))
-	{
+	if (BufLen < sizeof(USB_STD_DEV_DESC)) {
 		return 0;
 	}
 
@@ -298,47 +367,43 @@ u32 Usb_Ch9SetupDevDescReply(struct Usb_DevData *InstancePtr,
 
 /*****************************************************************************/
 /**
- *
- * This function returns the configuration descriptor for the device.
- *
- * @param	InstancePtr is a pointer to the Usb_DevData instance.
- * @param	BufPtr is the pointer to the buffer that is to be filled with
- *			the descriptor.
- * @param	BufLen is the size of the provided buffer.
- *
- * @return 	Length of the descriptor in the buffer on success.
- *			0 on error.
- *
- ******************************************************************************/
-u32 Usb_Ch9SetupCfgDescReply(struct Usb_DevData *InstancePtr,
-							 u8 *BufPtr, u32 BufLen)
+*
+* This function returns the configuration descriptor for the device, with
+* the smart card class descriptor after the interface descriptor.
+*
+* @param	InstancePtr is a pointer to the Usb_DevData instance.
+* @param	BufPtr is the pointer to the buffer that is to be filled with
+*			the descriptor.
+* @param	BufLen is the size of the provided buffer.
+*
+* @return 	Length of the descriptor in the buffer on success.
+*			0 on error.
+*
+******************************************************************************/
+u32 Ccid_Ch9SetupCfgDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen)
 {
 	s32 Status;
 	u8 *config;
 	u32 CfgDescLen;
 
 	Status = IsSuperSpeed(InstancePtr);
-	if (Status != XST_SUCCESS)
-	{
+	if (Status != XST_SUCCESS) {
 		/* USB 2.0 */
 		config = (u8 *)&config2;
-		CfgDescLen = sizeof(USB_CONFIG);
-	}
-	else
-	{
+		CfgDescLen  = sizeof(USB_CCID_CONFIG);
+	} else {
 		/* USB 3.0 */
 		config = (u8 *)&config3;
-		CfgDescLen = sizeof(USB30_CONFIG);
+		CfgDescLen  = sizeof(USB30_CCID_CONFIG);
 	}
 
 	/* Check buffer pointer is OK and buffer is big enough. */
-	if (!BufPtr)
-	{
+	if (!BufPtr) {
 		return 0;
 	}
 
-	if (BufLen < sizeof(USB_STD_CFG_DESC))
-	{
+	if (BufLen < CfgDescLen) {
 		return 0;
 	}
 
@@ -349,86 +414,66 @@ u32 Usb_Ch9SetupCfgDescReply(struct Usb_DevData *InstancePtr,
 
 /*****************************************************************************/
 /**
- *
- * This function returns a string descriptor for the given index.
- *
- * @param	InstancePtr is a pointer to the Usb_DevData instance.
- * @param	BufPtr is a  pointer to the buffer that is to be filled with
- *			the descriptor.
- * @param	BufLen is the size of the provided buffer.
- * @param	Index is the index of the string for which the descriptor
- *			is requested.
- *
- * @return 	Length of the descriptor in the buffer on success.
- *			0 on error.
- *
- ******************************************************************************/
-u32 Usb_Ch9SetupStrDescReply(struct Usb_DevData *InstancePtr,
-							 u8 *BufPtr, u32 BufLen, u8 Index)
+*
+* This function returns a string descriptor for the given index.
+*
+* @param	InstancePtr is a pointer to the Usb_DevData instance.
+* @param	BufPtr is a  pointer to the buffer that is to be filled with
+*			the descriptor.
+* @param	BufLen is the size of the provided buffer.
+* @param	Index is the index of the string for which the descriptor
+*			is requested.
+*
+* @return 	Length of the descriptor in the buffer on success.
+*			0 on error.
+*
+******************************************************************************/
+u32 Ccid_Ch9SetupStrDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen, u8 Index)
 {
 	u32 i;
-	char *String;
+	const char *String;
 	u32 StringLen;
 	u32 DescLen;
 	u8 TmpBuf[128];
-	s32 Status;
-	u8 StrArray;
-
 	USB_STD_STRING_DESC *StringDesc;
 
-	Status = IsSuperSpeed(InstancePtr);
-	if (Status != XST_SUCCESS)
-	{
-		/* USB 2.0 */
-		StrArray = 0;
-	}
-	else
-	{
-		/* USB 3.0 */
-		StrArray = 1;
-	}
+	(void)InstancePtr;
 
-	if (!BufPtr)
-	{
+	if (!BufPtr) {
 		return 0;
 	}
 
-	String = (char *)&StringList[StrArray][Index];
-
-	if (Index >= sizeof(StringList) / sizeof(u8 *))
-	{
+	if (Index >= sizeof(StringList) / sizeof(StringList[0])) {
 		return 0;
 	}
 
+	String = StringList[Index];
 	StringLen = strlen(String);
 
-	StringDesc = (USB_STD_STRING_DESC *)TmpBuf;
+	StringDesc = (USB_STD_STRING_DESC *) TmpBuf;
 
 	/* Index 0 is special as we can not represent the string required in
 	 * the table above. Therefore we handle index 0 as a special case.
 	 */
-	if (0 == Index)
-	{
+	if (0 == Index) {
 		StringDesc->bLength = 4;
 		StringDesc->bDescriptorType = 0x03;
 		StringDesc->wLANGID[0] = 0x0409;
 	}
 	/* All other strings can be pulled from the table above. */
-	else
-	{
+	else {
 		StringDesc->bLength = StringLen * 2 + 2;
 		StringDesc->bDescriptorType = 0x03;
 
-		for (i = 0; i < StringLen; i++)
-		{
-			StringDesc->wLANGID[i] = (u16)String[i];
+		for (i = 0; i < StringLen; i++) {
+			StringDesc->wLANGID[i] = (u16) String[i];
 		}
 	}
 	DescLen = StringDesc->bLength;
 
 	/* Check if the provided buffer is big enough to hold the descriptor. */
-	if (DescLen > BufLen)
-	{
+	if (DescLen > BufLen) {
 		return 0;
 	}
 
@@ -439,58 +484,59 @@ u32 Usb_Ch9SetupStrDescReply(struct Usb_DevData *InstancePtr,
 
 /*****************************************************************************/
 /**
- *
- * This function returns the BOS descriptor for the device.
- *
- * @param	BufPtr is the pointer to the buffer that is to be filled with
- *			the descriptor.
- * @param	BufLen is the size of the provided buffer.
- *
- * @return 	Length of the descriptor in the buffer on success.
- *			0 on error.
- *
- ******************************************************************************/
-u32 Usb_Ch9SetupBosDescReply(u8 *BufPtr, u32 BufLen)
+*
+* This function returns the BOS descriptor for the device.
+*
+* @param	BufPtr is the pointer to the buffer that is to be filled with
+*			the descriptor.
+* @param	BufLen is the size of the provided buffer.
+*
+* @return 	Length of the descriptor in the buffer on success.
+*			0 on error.
+*
+******************************************************************************/
+u32 Ccid_Ch9SetupBosDescReply(u8 *BufPtr, u32 BufLen)
 {
 
 #ifdef __ICCARM__
 #pragma data_alignment = 16
 	static USB_BOS_DESC bosDesc = {
 #else
-	static USB_BOS_DESC __attribute__((aligned(16))) bosDesc = {
+	static USB_BOS_DESC __attribute__ ((aligned(16))) bosDesc = {
 #endif
 		/* BOS descriptor */
 		{
 			sizeof(USB_STD_BOS_DESC), /* bLength */
-			USB_TYPE_BOS_DESC,		  /* DescriptorType */
-			sizeof(USB_BOS_DESC),	  /* wTotalLength */
-			0x02},					  /* bNumDeviceCaps */
+			USB_TYPE_BOS_DESC, /* DescriptorType */
+			sizeof(USB_BOS_DESC), /* wTotalLength */
+			0x02
+		}, /* bNumDeviceCaps */
 
 		{
 			sizeof(USB_STD_DEVICE_CAP_7BYTE), /* bLength */
-			0x10,							  /* bDescriptorType */
-			0x02,							  /* bDevCapabiltyType */
-			0x06},							  /* bmAttributes */
+			0x10, /* bDescriptorType */
+			0x02, /* bDevCapabiltyType */
+			0x06
+		}, /* bmAttributes */
 
 		{
 			sizeof(USB_STD_DEVICE_CAP_10BYTE), /* bLength */
-			0x10,							   /* bDescriptorType */
-			0x03,							   /* bDevCapabiltyType */
-			0x00,							   /* bmAttributes */
-			(0x000F),						   /* wSpeedsSupported */
-			0x01,							   /* bFunctionalitySupport */
-			0x01,							   /* bU1DevExitLat */
-			(0x01F4)}						   /* wU2DevExitLat */
+			0x10, /* bDescriptorType */
+			0x03, /* bDevCapabiltyType */
+			0x00, /* bmAttributes */
+			(0x000F), /* wSpeedsSupported */
+			0x01, /* bFunctionalitySupport */
+			0x01, /* bU1DevExitLat */
+			(0x01F4)
+		} /* wU2DevExitLat */
 	};
 
 	/* Check buffer pointer is OK and buffer is big enough. */
-	if (!BufPtr)
-	{
+	if (!BufPtr) {
 		return 0;
 	}
 
-	if (BufLen < sizeof(USB_STD_BOS_DESC))
-	{
+	if (BufLen < sizeof(USB_STD_BOS_DESC)) {
 		return 0;
 	}
 
@@ -501,17 +547,17 @@ u32 Usb_Ch9SetupBosDescReply(u8 *BufPtr, u32 BufLen)
 
 /****************************************************************************/
 /**
- * Changes State of Core to USB configured State.
- *
- * @param	InstancePtr is a pointer to the Usb_DevData instance.
- * @param	Ctrl is a pointer to the Setup packet data.
- *
- * @return	XST_SUCCESS else XST_FAILURE
- *
- * @note		None.
- *
- *****************************************************************************/
-s32 Usb_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl)
+* Changes State of Core to USB configured State.
+*
+* @param	InstancePtr is a pointer to the Usb_DevData instance.
+* @param	Ctrl is a pointer to the Setup packet data.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		None.
+*
+*****************************************************************************/
+s32 Ccid_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl)
 {
 	u8 State;
 	s32 Ret = XST_SUCCESS;
@@ -522,22 +568,21 @@ s32 Usb_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl)
 	State = InstancePtr->State;
 	SetConfigDone(InstancePtr->PrivateData, 0U);
 
-	switch (State)
-	{
-	case USB_STATE_DEFAULT:
-		Ret = XST_FAILURE;
-		break;
+	switch (State) {
+		case USB_STATE_DEFAULT:
+			Ret = XST_FAILURE;
+			break;
 
-	case USB_STATE_ADDRESS:
-		InstancePtr->State = USB_STATE_CONFIGURED;
-		break;
+		case USB_STATE_ADDRESS:
+			InstancePtr->State = USB_STATE_CONFIGURED;
+			break;
 
-	case USB_STATE_CONFIGURED:
-		break;
+		case USB_STATE_CONFIGURED:
+			break;
 
-	default:
-		Ret = XST_FAILURE;
-		break;
+		default:
+			Ret = XST_FAILURE;
+			break;
 	}
 
 	return Ret;
@@ -545,98 +590,109 @@ s32 Usb_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl)
 
 /****************************************************************************/
 /**
- * This function is called by Chapter9 handler when SET_CONFIGURATION command
- * is received from Host.
- *
- * @param	InstancePtr is pointer to Usb_DevData instance.
- * @param	SetupData is the setup packet received from Host.
- *
- * @return
- *		- XST_SUCCESS if successful,
- *		- XST_FAILURE if unsuccessful.
- *
- * @note
- *		Non control endpoints must be enabled after SET_CONFIGURATION
- *		command since hardware clears all previously enabled endpoints
- *		except control endpoints when this command is received.
- *
- *****************************************************************************/
-
-s32 Usb_SetConfigurationApp(struct Usb_DevData *InstancePtr,
-							SetupPacket *SetupData)
+* This function is called by Chapter9 handler when SET_CONFIGURATION command
+* is received from Host.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	SetupData is the setup packet received from Host.
+*
+* @return
+*		- XST_SUCCESS if successful,
+*		- XST_FAILURE if unsuccessful.
+*
+* @note
+*		Non control endpoints must be enabled after SET_CONFIGURATION
+*		command since hardware clears all previously enabled endpoints
+*		except control endpoints when this command is received.
+*
+*****************************************************************************/
+s32 Ccid_SetConfigurationApp(struct Usb_DevData *InstancePtr,
+			     SetupPacket *SetupData)
 {
 	s32 RetVal;
 	u16 MaxPktSize;
 
-	if (InstancePtr->Speed == USB_SPEED_SUPER)
-	{
+	if (InstancePtr->Speed == USB_SPEED_SUPER) {
 		MaxPktSize = 1024;
-	}
-	else
-	{
+	} else {
 		MaxPktSize = 512;
 	}
 
-	/* When we run CV test suite application in Windows, need to
-	 * add SET_CONFIGURATION command with value 0/1 to pass test suite
-	 */
-	if ((SetupData->wValue && 0xff) == 1)
-	{
+	if ((SetupData->wValue & 0xff) == 1) {
 		/* SET_CONFIGURATION with value 1 */
 
 		/* Endpoint enables - not needed for Control EP */
 		RetVal = EpEnable(InstancePtr->PrivateData, 1, USB_EP_DIR_IN,
-						  MaxPktSize, USB_EP_TYPE_BULK);
-		if (RetVal != XST_SUCCESS)
-		{
+				  MaxPktSize, USB_EP_TYPE_BULK);
+		if (RetVal != XST_SUCCESS) {
 			xil_printf("failed to enable BULK IN Ep\r\n");
 			return XST_FAILURE;
 		}
 
 		RetVal = EpEnable(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT,
-						  MaxPktSize, USB_EP_TYPE_BULK);
-		if (RetVal != XST_SUCCESS)
-		{
+				  MaxPktSize, USB_EP_TYPE_BULK);
+		if (RetVal != XST_SUCCESS) {
 			xil_printf("failed to enable BULK OUT Ep\r\n");
 			return XST_FAILURE;
 		}
 
+		SetEpInterval(InstancePtr->PrivateData, CCID_NOTIFY_EP,
+			      USB_EP_DIR_IN, CCID_NOTIFY_INTERVAL);
+		RetVal = EpEnable(InstancePtr->PrivateData, CCID_NOTIFY_EP,
+				  USB_EP_DIR_IN, CCID_NOTIFY_PACKET_SIZE,
+				  USB_EP_TYPE_INTERRUPT);
+		if (RetVal != XST_SUCCESS) {
+			xil_printf("failed to enable INTERRUPT IN Ep\r\n");
+			return XST_FAILURE;
+		}
+
 		SetConfigDone(InstancePtr->PrivateData, 1U);
 
-		/* Reset the Phase to default COMMAND STATE */
-		Phase = USB_EP_STATE_COMMAND;
+		/* Drop requests left over from a previous configuration */
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
+		EpQueueFlush(InstancePtr->PrivateData, CCID_NOTIFY_EP,
+			     USB_EP_DIR_IN);
 
 		/*
-		 * As per Mass storage specification we receive 31 byte length
-		 * Command Block Wrapper first. So lets make OUT Endpoint ready
-		 * to receive it. OUT Ep Handler will be called when data is
-		 * received
+		 * All CCID commands start on the bulk OUT endpoint, make it
+		 * ready for the first one. The request completion runs it.
+		 * Card presence is reported on the interrupt endpoint.
 		 */
-		EpBufferRecv(InstancePtr->PrivateData, 1, (u8 *)&CBW, sizeof(CBW));
-	}
-	else
-	{
+		CcidReset();
+		CcidRecvCommand(InstancePtr);
+		CcidStartNotify(InstancePtr);
+	} else {
 		/* SET_CONFIGURATION with value 0 */
 
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
+		EpQueueFlush(InstancePtr->PrivateData, CCID_NOTIFY_EP,
+			     USB_EP_DIR_IN);
+
 		/* Endpoint disables - not needed for Control EP */
 		RetVal = EpDisable(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
-		if (RetVal != XST_SUCCESS)
-		{
+		if (RetVal != XST_SUCCESS) {
 			xil_printf("failed to disable BULK IN Ep\r\n");
 			return XST_FAILURE;
 		}
 
 		RetVal = EpDisable(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
-		if (RetVal != XST_SUCCESS)
-		{
+		if (RetVal != XST_SUCCESS) {
 			xil_printf("failed to disable BULK OUT Ep\r\n");
 			return XST_FAILURE;
 		}
 
+		RetVal = EpDisable(InstancePtr->PrivateData, CCID_NOTIFY_EP,
+				   USB_EP_DIR_IN);
+		if (RetVal != XST_SUCCESS) {
+			xil_printf("failed to disable INTERRUPT IN Ep\r\n");
+			return XST_FAILURE;
+		}
+
 		SetConfigDone(InstancePtr->PrivateData, 0U);
 
-		/* Reset the Phase to default COMMAND STATE */
-		Phase = USB_EP_STATE_COMMAND;
+		CcidReset();
 	}
 
 	return XST_SUCCESS;
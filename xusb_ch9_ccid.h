@@ -7,10 +7,9 @@
 /*****************************************************************************/
 /**
  *
- * @file xusb_ch9_storage.h
+ * @file xusb_ch9_ccid.h
  *
- * This file contains definitions used in the Mass Storage specific chapter 9
- * code.
+ * This file contains definitions used in the CCID specific chapter 9 code.
  *
  * <pre>
  * MODIFICATION HISTORY:
@@ -25,8 +24,8 @@
  *
  ******************************************************************************/
 
-#ifndef XUSB_CH9_STORAGE_H
-#define XUSB_CH9_STORAGE_H
+#ifndef XUSB_CH9_CCID_H
+#define XUSB_CH9_CCID_H
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +37,17 @@ extern "C" {
 #include "xusb_ch9.h"
 
 /************************** Constant Definitions *****************************/
+#define USB_TYPE_CCID_CLASS_DESC	0x21
+
+/* dwFeatures of the CCID class descriptor */
+#define CCID_FEATURE_AUTO_PARAM_ATR	0x00000002U
+#define CCID_FEATURE_AUTO_VOLTAGE	0x00000008U
+#define CCID_FEATURE_AUTO_CLOCK		0x00000010U
+#define CCID_FEATURE_AUTO_BAUD		0x00000020U
+#define CCID_FEATURE_AUTO_PPS		0x00000080U
+#define CCID_FEATURE_TPDU		0x00010000U
+#define CCID_FEATURE_SHORT_APDU		0x00020000U
+#define CCID_FEATURE_EXTENDED_APDU	0x00040000U
 
 /**************************** Type Definitions *******************************/
 
@@ -45,51 +55,75 @@ extern "C" {
 #pragma pack(push, 1)
 #endif
 
+/*
+ * Smart card device class descriptor, CCID rev 1.1 section 5.1
+ */
+typedef struct {
+	u8 bLength;
+	u8 bDescriptorType;
+	u16 bcdCCID;
+	u8 bMaxSlotIndex;
+	u8 bVoltageSupport;
+	u32 dwProtocols;
+	u32 dwDefaultClock;
+	u32 dwMaximumClock;
+	u8 bNumClockSupported;
+	u32 dwDataRate;
+	u32 dwMaxDataRate;
+	u8 bNumDataRatesSupported;
+	u32 dwMaxIFSD;
+	u32 dwSynchProtocols;
+	u32 dwMechanical;
+	u32 dwFeatures;
+	u32 dwMaxCCIDMessageLength;
+	u8 bClassGetResponse;
+	u8 bClassEnvelope;
+	u16 wLcdLayout;
+	u8 bPINSupport;
+	u8 bMaxCCIDBusySlots;
+} attribute(USB_CCID_CLASS_DESC);
+
 typedef struct {
 	USB_STD_CFG_DESC stdCfg;
 	USB_STD_IF_DESC ifCfg;
+	USB_CCID_CLASS_DESC ccidCfg;
 	USB_STD_EP_DESC epin;
 	USB_STD_EP_DESC epout;
-} attribute(USB_CONFIG);
+	USB_STD_EP_DESC epintr;
+} attribute(USB_CCID_CONFIG);
 
 typedef struct {
 	USB_STD_CFG_DESC stdCfg;
 	USB_STD_IF_DESC ifCfg;
+	USB_CCID_CLASS_DESC ccidCfg;
 	USB_STD_EP_DESC epin;
 	USB_STD_EP_SS_COMP_DESC epssin;
 	USB_STD_EP_DESC epout;
 	USB_STD_EP_SS_COMP_DESC epssout;
-
-} attribute(USB30_CONFIG);
+	USB_STD_EP_DESC epintr;
+	USB_STD_EP_SS_COMP_DESC epssintr;
+} attribute(USB30_CCID_CONFIG);
 
 #if defined (__ICCARM__)
 #pragma pack(pop)
 #endif
 
 /***************** Macros (Inline Functions) Definitions *********************/
-/* Check where these defines need to go  */
-#define be2le(val)	(u32)(val)
-#define be2les(x)	(u16) (x)
-#define htonl(val)	((((u32)(val) & 0x000000FF)<<24) |	\
-			 (((u32)(val) & 0x0000FF00)<<8)  |	\
-			 (((u32)(val) & 0x00FF0000)>>8)  |	\
-			 (((u32)(val) & 0xFF000000)>>24))
-
-#define htons(x)	(u16) ((((u16)(x))<<8) | (((u16)(x))>>8))
 
 /************************** Function Prototypes ******************************/
-u32 Usb_Ch9SetupDevDescReply(struct Usb_DevData *InstancePtr,
-			     u8 *BufPtr, u32 BufLen);
-u32 Usb_Ch9SetupCfgDescReply(struct Usb_DevData *InstancePtr,
-			     u8 *BufPtr, u32 BufLen);
-u32 Usb_Ch9SetupBosDescReply(u8 *BufPtr, u32 BufLen);
-u32 Usb_Ch9SetupStrDescReply(struct Usb_DevData *InstancePtr,
-			     u8 *BufPtr, u32 BufLen, u8 Index);
-s32 Usb_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl);
-s32 Usb_SetConfigurationApp(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl);
-#ifdef __cplusplus
+u32 Ccid_Ch9SetupDevDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen);
+u32 Ccid_Ch9SetupCfgDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen);
+u32 Ccid_Ch9SetupBosDescReply(u8 *BufPtr, u32 BufLen);
+u32 Ccid_Ch9SetupStrDescReply(struct Usb_DevData *InstancePtr,
+			      u8 *BufPtr, u32 BufLen, u8 Index);
+s32 Ccid_SetConfiguration(struct Usb_DevData *InstancePtr, SetupPacket *Ctrl);
+s32 Ccid_SetConfigurationApp(struct Usb_DevData *InstancePtr,
+			     SetupPacket *SetupData);
 
+#ifdef __cplusplus
 }
 #endif
 
-#endif /* XUSB_CH9_STORAGE_H */
+#endif /* XUSB_CH9_CCID_H */
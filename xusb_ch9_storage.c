@@ -41,7 +41,6 @@
 /************************** Function Prototypes ******************************/
 
 /************************** Variable Definitions *****************************/
-extern USB_CBW CBW;
 extern u8 Phase;
 
 /*
@@ -577,19 +576,22 @@ s32 Usb_SetConfigurationApp(struct Usb_DevData *InstancePtr,
 
 		SetConfigDone(InstancePtr->PrivateData, 1U);
 
-		/* Reset the Phase to default COMMAND STATE */
-		Phase = USB_EP_STATE_COMMAND;
+		/* Drop requests left over from a previous configuration */
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
 
 		/*
 		 * As per Mass storage specification we receive 31 byte length
 		 * Command Block Wrapper first. So lets make OUT Endpoint ready
-		 * to receive it. OUT Ep Handler will be called when data is
-		 * received
+		 * to receive it. The request completion parses it.
 		 */
-		EpBufferRecv(InstancePtr->PrivateData, 1, (u8 *)&CBW, sizeof(CBW));
+		StorageRecvCBW(InstancePtr);
 	} else {
 		/* SET_CONFIGURATION with value 0 */
 
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
+		EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
+
 		/* Endpoint disables - not needed for Control EP */
 		RetVal = EpDisable(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
 		if (RetVal != XST_SUCCESS) {
@@ -9,8 +9,42 @@
  *
  * @file xusb_class_ccid.c
  *
- * This file contains the implementation of the Mass Storage specific class
- * code for the example.
+ * This file contains the implementation of the CCID specific class code for
+ * the example.
+ *
+ * The bulk OUT endpoint always has a request for a whole message pending.
+ * Its completion decodes the header in place, looks the message type up in
+ * a table and runs the handler, which writes the response data directly
+ * behind the response header in the bulk IN buffer of the slot. The next
+ * command is received as soon as the response is on its way.
+ *
+ * A slot is idle, busy while its card runs a command, or sending while its
+ * response is on the bulk IN endpoint. Commands for a slot that is not idle
+ * fail with CCID_ERR_CMD_SLOT_BUSY, from a reply buffer of the reader; the
+ * next command is received once that reply has been sent. Busy slots are
+ * completed by Ccid_Poll() in the main loop.
+ *
+ * An ABORT class request fails the command its slot is busy with, from
+ * Ccid_Poll(). The PC_to_RDR_Abort of the pair is taken by a slot that is
+ * not idle too: a command the card still runs fails at once and the Abort
+ * is answered from the reply buffer of the reader. The halves may come in
+ * either order, commands after the class request and before its Abort
+ * fail with CCID_ERR_CMD_ABORTED.
+ *
+ * While a card is busy, a DataBlock with CCID_CMD_TIME_EXTENSION goes to
+ * the host every half waiting time, BWT for T=1 or WWT for T=0, from the
+ * parameters of the slot. The deadline is armed with UsbTimerArm(), the
+ * timer interrupt sends the time extension while the command keeps
+ * running. Without a timer Ccid_Poll() checks the deadline instead.
+ *
+ * Notifications use a single request on the interrupt IN endpoint. While
+ * it waits for the host, changes of further slots are collected in Notify
+ * and go out together when it completes.
+ *
+ * With CCID_MEMORY_LIMITED the OUT request is one packet long. A command
+ * that does not fit is kept as its header in Rx while the following
+ * packets arrive, the XfrBlock data of each packet is passed to the card
+ * straight from the receive buffer.
  *
  * <pre>
  * MODIFICATION HISTORY:
@@ -33,476 +67,1854 @@
 /***************************** Include Files *********************************/
 #include "xusb_class_ccid.h"
 #include "xparameters.h"
-#include "xusb_ch9_storage.h"
+#include "xusb_ch9_ccid.h"
+#include "xusb_cache.h"
+#include "xusb_wrapper.h"
+#include <string.h>
 
 /************************** Constant Definitions *****************************/
+#define CCID_COMMANDS	(CCID_PC_TO_RDR_LAST - CCID_PC_TO_RDR_FIRST + 1)
+
+/* Chaining state of a slot */
+#define CCID_CHAIN_IDLE		0U
+#define CCID_CHAIN_COMMAND	1U	/* Receiving command parts */
+#define CCID_CHAIN_RESPONSE	2U	/* Sending response parts */
+
+/* Command state of a slot */
+#define CCID_SLOT_IDLE		0U
+#define CCID_SLOT_BUSY		1U	/* Card running, see Ccid_Poll() */
+#define CCID_SLOT_SENDING	2U	/* Response on the bulk IN endpoint */
+
+/* Abort state of a slot, the halves of the pair may come in any order */
+#define CCID_ABORT_NONE		0U
+#define CCID_ABORT_REQUEST	1U	/* ABORT class request, Abort to come */
+#define CCID_ABORT_MESSAGE	2U	/* PC_to_RDR_Abort, request to come */
+
+/* bError of a time extension, multiplier of the waiting time */
+#define CCID_WTX_MULTIPLIER	1U
+
+/* Response index of the reader reply buffer, slots use their number */
+#define CCID_READER_REPLY	CCID_MAX_SLOTS
+
+#if (2U * CCID_MAX_SLOTS + 1U) > USB_EP_QUEUE_DEPTH
+#error "USB_EP_QUEUE_DEPTH is too small for CCID_MAX_SLOTS"
+#endif
+
+#if (1U + CCID_NOTIFY_BITMAP_SIZE) > CCID_NOTIFY_PACKET_SIZE
+#error "NotifySlotChange does not fit CCID_NOTIFY_PACKET_SIZE"
+#endif
 
 /***************** Macros (Inline Functions) Definitions *********************/
+/* TRUE for the part of an APDU that runs the command */
+#define CCID_LEVEL_LAST(Level)	(((Level) == CCID_LEVEL_SINGLE ||	\
+				  (Level) == CCID_LEVEL_END) ? TRUE : FALSE)
 
 /**************************** Type Definitions *******************************/
+typedef struct {
+	u8 Powered;
+	u8 ClockStopped;
+	u8 Abort;		/* CCID_ABORT_*, for bSeq AbortSeq */
+	u8 AbortSeq;
+	u8 ProtocolNum;
+	u8 State;		/* CCID_SLOT_IDLE, _BUSY or _SENDING */
+	u8 BusyFirst;		/* The busy card owes the first response part */
+	u8 Chain;		/* CCID_CHAIN_IDLE, _COMMAND or _RESPONSE */
+	u8 ChainedCmd;		/* The command came in several parts */
+	u8 WtxPending;		/* Time extension on the bulk IN endpoint */
+	u32 ChainBytes;		/* Of the APDU being chained */
+	CCID_ProtocolT1 Params;	/* T=0 uses the first 5 bytes */
+	u64 WtxTicks;		/* UsbGetTicks() of the next time extension */
+} CcidSlot;
 
-/************************** Function Prototypes ******************************/
+/*
+ * Handles one bulk OUT message. Returns the length of the response data
+ * written at CCID_MSG_DATA(RspPtr), failures set bStatus and bError.
+ */
+typedef u32 (*CcidHandler)(CcidSlot *SlotPtr,
+			   const CCID_BulkOutMessage *MsgPtr,
+			   CCID_BulkInMessage *RspPtr);
 
-/************************** Variable Definitions *****************************/
-extern u8 Phase;
-extern u8 VirtFlash[];
+typedef struct {
+	u8 Response;		/* RDR_to_PC message type, 0 if unknown */
+	CcidHandler Handler;	/* NULL if not supported */
+} CcidCommand;
+
+#ifdef CCID_MEMORY_LIMITED
+/*
+ * Command received in several packets. Its response header is set up in
+ * the bulk IN buffer from the first packet on.
+ */
+typedef struct {
+	CCID_BulkOutMessage Header;
+	u32 Received;		/* Data bytes so far */
+	u32 Index;		/* Of the response, see CcidResponse() */
+	u8 Active;		/* More packets to come */
+	u8 Stream;		/* XfrBlock data goes to the card */
+} CcidRxMessage;
+#endif
 
 /*
- * Pre-manufactured response to the SCSI Inquiry command.
+ * Notifications waiting for the interrupt IN endpoint, one bit per slot.
  */
-#if __ICCARM__
-#if defined(PLATFORM_ZYNQMP) || defined(versal)
+typedef struct {
+	u32 Changed;		/* Presence changed since the last message */
+	u32 Errors;		/* Hardware error to report */
+	u8 ErrorCode[CCID_MAX_SLOTS];
+	u8 Ready;		/* Configured, messages can be sent */
+	u8 Busy;		/* A message is on the endpoint */
+} CcidNotifyState;
+
+/************************** Function Prototypes ******************************/
+static u32 CcidPowerOn(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+		       CCID_BulkInMessage *RspPtr);
+static u32 CcidPowerOff(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr);
+static u32 CcidGetSlotStatus(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr);
+static u32 CcidXfrBlock(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr);
+static u32 CcidGetParameters(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr);
+static u32 CcidResetParameters(CcidSlot *SlotPtr,
+			       const CCID_BulkOutMessage *MsgPtr,
+			       CCID_BulkInMessage *RspPtr);
+static u32 CcidSetParameters(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr);
+static u32 CcidIccClock(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr);
+static u32 CcidAbort(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+		     CCID_BulkInMessage *RspPtr);
+static u32 CcidSetDataRate(CcidSlot *SlotPtr,
+			   const CCID_BulkOutMessage *MsgPtr,
+			   CCID_BulkInMessage *RspPtr);
+static void CcidCommandDone(Usb_EpRequest *RequestPtr);
+static void CcidResponseDone(Usb_EpRequest *RequestPtr);
+static void CcidWtxDone(Usb_EpRequest *RequestPtr);
+static void CcidWtxArm(void);
+static void CcidWtxTimer(void *Context);
+static void CcidNotifyDone(Usb_EpRequest *RequestPtr);
+
+static u32 CcidNullPresent(u8 Slot);
+static u32 CcidNullPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax);
+static void CcidNullPowerOff(u8 Slot);
+static s32 CcidNullXfr(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+		       u32 RspMax, u32 *RspLenPtr);
+static s32 CcidNullXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last);
+static s32 CcidNullXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+			  u32 *MorePtr);
+
+/************************** Variable Definitions *****************************/
+/* Bulk message buffers */
+#ifdef __ICCARM__
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
 #pragma data_alignment = 64
+static u8 CcidOut[CCID_BULK_OUT_SIZE];
+#pragma data_alignment = 64
+static u8 CcidIn[CCID_MAX_SLOTS][CCID_BULK_IN_SIZE];
+#pragma data_alignment = 64
+static u8 CcidReply[CCID_HEADER_SIZE];
 #else
 #pragma data_alignment = 32
+static u8 CcidOut[CCID_BULK_OUT_SIZE];
+#pragma data_alignment = 32
+static u8 CcidIn[CCID_MAX_SLOTS][CCID_BULK_IN_SIZE];
+#pragma data_alignment = 32
+static u8 CcidReply[CCID_HEADER_SIZE];
 #endif
-const static SCSI_INQUIRY scsiInquiry[] = {
 #else
-const static SCSI_INQUIRY scsiInquiry[] ALIGNMENT_CACHELINE = {
+static u8 CcidOut[CCID_BULK_OUT_SIZE] ALIGNMENT_CACHELINE;
+static u8 CcidIn[CCID_MAX_SLOTS][CCID_BULK_IN_SIZE] ALIGNMENT_CACHELINE;
+static u8 CcidReply[CCID_HEADER_SIZE] ALIGNMENT_CACHELINE;
 #endif
-	{
-		0x00,
-		0x80,
-		0x00,
-		0x01,
-		0x1f,
-		0x00,
-		0x00,
-		0x00,
-		{"Xilinx "},		 /* Vendor ID:  must be  8 characters long. */
-		{"PS USB VirtDisk"}, /* Product ID: must be 16 characters long. */
-		{"1.0"}				 /* Revision:   must be  4 characters long. */
-	},
-	{
-		0x00,
-		0x80,
-		0x02,
-		0x02,
-		0x1F,
-		0x00,
-		0x00,
-		0x00,
-		{"Linux  "},		 /* Vendor ID:  must be  8 characters long. */
-		{"File-StorGadget"}, /* Product ID: must be 16 characters long. */
-		{"040"}				 /* Revision:   must be  4 characters long. */
-	}};
+
+/* Time extensions, one per slot */
 #ifdef __ICCARM__
-static u8 MaxLUN = 0;
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
 #else
-static u8 MaxLUN ALIGNMENT_CACHELINE = 0;
+#pragma data_alignment = 32
+#endif
+static u8 CcidWtx[CCID_MAX_SLOTS][CCID_HEADER_SIZE];
+#else
+static u8 CcidWtx[CCID_MAX_SLOTS][CCID_HEADER_SIZE] ALIGNMENT_CACHELINE;
 #endif
 
-extern USB_CBW CBW;
-extern USB_CSW CSW;
-
-extern u32 rxBytesLeft;
-extern u8 *VirtFlashWritePointer;
+/* Replies to the class requests */
+#ifdef __ICCARM__
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
+#else
+#pragma data_alignment = 32
+#endif
+static CCID_DataRate ClassReply;
+#else
+static CCID_DataRate ClassReply ALIGNMENT_CACHELINE;
+#endif
 
-/* Local transmit buffer for simple replies. */
+/* Interrupt IN message */
 #ifdef __ICCARM__
-static u8 txBuffer[128];
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
 #else
-static u8 txBuffer[128] ALIGNMENT_CACHELINE;
+#pragma data_alignment = 32
+#endif
+static u8 CcidNotify[CCID_NOTIFY_PACKET_SIZE];
+#else
+static u8 CcidNotify[CCID_NOTIFY_PACKET_SIZE] ALIGNMENT_CACHELINE;
 #endif
 
-const u8 MAX_SLOTS = 1;
-SlotState slotStates[MAX_SLOTS];
+static Usb_EpRequest CommandRequest USB_HOT_BSS;
+static Usb_EpRequest ResponseRequest[CCID_MAX_SLOTS + 1U] USB_HOT_BSS;
+static Usb_EpRequest ZlpRequest[CCID_MAX_SLOTS + 1U] USB_HOT_BSS;
+static Usb_EpRequest WtxRequest[CCID_MAX_SLOTS];
+static Usb_EpRequest NotifyRequest;
+static struct Usb_DevData *CcidDev;
 
-/*****************************************************************************/
+static CcidSlot Slots[CCID_MAX_SLOTS];
+static Ccid_Stats Stats;
+static CcidNotifyState Notify;
+static u8 WtxTimer;		/* Time extensions sent by CcidWtxTimer() */
+
+#ifdef CCID_MEMORY_LIMITED
+static CcidRxMessage Rx;
+#endif
+
+/* Bulk OUT message types and their responses */
+static const CcidCommand Commands[CCID_COMMANDS] = {
+	[CCID_PC_TO_RDR_SET_PARAMETERS - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_PARAMETERS, CcidSetParameters },
+	[CCID_PC_TO_RDR_ICC_POWER_ON - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_DATA_BLOCK, CcidPowerOn },
+	[CCID_PC_TO_RDR_ICC_POWER_OFF - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, CcidPowerOff },
+	[CCID_PC_TO_RDR_GET_SLOT_STATUS - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, CcidGetSlotStatus },
+	[CCID_PC_TO_RDR_SECURE - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_DATA_BLOCK, NULL },
+	[CCID_PC_TO_RDR_T0_APDU - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, NULL },
+	[CCID_PC_TO_RDR_ESCAPE - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_ESCAPE, NULL },
+	[CCID_PC_TO_RDR_GET_PARAMETERS - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_PARAMETERS, CcidGetParameters },
+	[CCID_PC_TO_RDR_RESET_PARAMETERS - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_PARAMETERS, CcidResetParameters },
+	[CCID_PC_TO_RDR_ICC_CLOCK - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, CcidIccClock },
+	[CCID_PC_TO_RDR_XFR_BLOCK - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_DATA_BLOCK, CcidXfrBlock },
+	[CCID_PC_TO_RDR_MECHANICAL - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, NULL },
+	[CCID_PC_TO_RDR_ABORT - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_SLOT_STATUS, CcidAbort },
+	[CCID_PC_TO_RDR_SET_DATA_RATE - CCID_PC_TO_RDR_FIRST] =
+		{ CCID_RDR_TO_PC_DATA_RATE, CcidSetDataRate },
+};
+
+/*
+ * Default card: always present, a T=1 ATR and 90 00 to every APDU. It
+ * streams, so the chained extended APDUs of the descriptor are taken.
+ */
+static const Ccid_IccOps CcidNullIcc = {
+	.Present = CcidNullPresent,
+	.PowerOn = CcidNullPowerOn,
+	.PowerOff = CcidNullPowerOff,
+	.Xfr = CcidNullXfr,
+	.XfrPut = CcidNullXfrPut,
+	.XfrGet = CcidNullXfrGet,
+};
+
+static const Ccid_IccOps *Icc = &CcidNullIcc;
+
+/* Clock rate conversion Fi and baud rate adjustment Di, ISO 7816-3 */
+static const u16 CcidFi[16] = {
+	372U, 372U, 558U, 744U, 1116U, 1488U, 1860U, 0U,
+	0U, 512U, 768U, 1024U, 1536U, 2048U, 0U, 0U
+};
+static const u8 CcidDi[16] = {
+	0U, 1U, 2U, 4U, 8U, 16U, 32U, 64U, 12U, 20U, 0U, 0U, 0U, 0U, 0U, 0U
+};
+
+/****************************************************************************/
 /**
- * This function is class handler for Mass storage and is called when
- * Setup packet received is for Class request(not Standard Device request)
- *
- * @param	InstancePtr is pointer to Usb_DevData instance.
- * @param	SetupData is pointer to SetupPacket received.
- *
- * @return	None
- *
- * @note		None.
- *
- ******************************************************************************/
-void ConstructBulkInMessage(BulkInMessage *bulkInResponse, u8 messageType, u32 length, u8 slot, u8 seq, u8 status, u8 error, u8 chainParameter, void *responseData)
+* Marks a response as failed.
+*
+* @param	RspPtr is the response header.
+* @param	Error is the bError value.
+*
+* @return	0, the length of the response data.
+*
+* @note		None.
+*
+*****************************************************************************/
+static inline u32 CcidFail(CCID_BulkInMessage *RspPtr, u8 Error)
 {
-	bulkInResponse->bMessageType = messageType;
-	bulkInResponse->dwLength = length;
-	bulkInResponse->bSlot = slot;
-	bulkInResponse->bSeq = seq;
-	bulkInResponse->bStatus = status;
-	bulkInResponse->bError = error;
-	bulkInResponse->bChainParameter = chainParameter;
-	bulkInResponse->responseData = responseData;
+	RspPtr->bStatus = CCID_CMD_FAILED;
+	RspPtr->bError = Error;
+
+	return 0U;
 }
 
-void ConstructProtocolData(ProtocolDataStructureT1 *protocolData)
+/****************************************************************************/
+/**
+* Returns the response buffer of a slot, or the reply buffer of the reader
+* for CCID_READER_REPLY.
+*
+* @param	Index is the slot number or CCID_READER_REPLY.
+*
+* @return	The response header.
+*
+* @note		None.
+*
+*****************************************************************************/
+static inline CCID_BulkInMessage *CcidResponse(u32 Index)
 {
-	protocolData->bmFindexDindex = 0x11;
-	protocolData->bmTCCKST1 = 0x11;
-	protocolData->bGuardTimeT1 = 0x00;
-	protocolData->bmWaitingIntegersT1 = 0x9f;
-	protocolData->bClockStop = 0x00;
-	protocolData->bIFSC = 0x40;
-	protocolData->bNadValue = 0x00;
+	if (Index < CCID_MAX_SLOTS) {
+		return (CCID_BulkInMessage *)CcidIn[Index];
+	}
+
+	return (CCID_BulkInMessage *)CcidReply;
 }
 
-void ClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
+/****************************************************************************/
+/**
+* Returns bmICCStatus of a slot.
+*
+* @param	SlotPtr is the slot.
+*
+* @return	CCID_ICC_ACTIVE, CCID_ICC_INACTIVE or CCID_ICC_ABSENT.
+*
+* @note		None.
+*
+*****************************************************************************/
+static u8 CcidIccStatus(const CcidSlot *SlotPtr)
 {
-	Xil_AssertVoid(InstancePtr != NULL);
-	Xil_AssertVoid(SetupData != NULL);
-	switch (SetupData->bRequest)
-	{
-	case USB_CLASSREQ_CCID_POWER_ON:
-		// 1. Receive command data from the host (check SetupData and use EpBufferRecv if needed)
-		// 2. Send the command data to the smart card reader
-		// 3. Get the response data from the smart card reader (assume you store it in 'responseData')
-		// 4. Construct the RDR_to_PC_DataBlock bulk-in response
-		RDR_to_PC_DataBlock dataBlock;
-		dataBlock.abData = {0x3b, 0x90, 0x11, 0x91, 0x81, 0x71, 0x40, 0x9f, 0x01, 0x3e}; // Replace with the actual response data
-
-		BulkInMessage bulkInResponse;
-		ConstructBulkInMessage(&bulkInResponse, 0x80, sizeof(dataBlock.abData), 0, SetupData->bSeq, 0, 0, 0, &dataBlock);
-		// 5. Send the response back to the host
-		EpBufferSend(InstancePtr->PrivateData, 0, (u8 *)&bulkInResponse, sizeof(bulkInResponse));
-		break;
-	case USB_CLASSREQ_CCID_POWER_OFF:
-		// Similar to above, but for powering off
-		RDR_to_PC_SlotStatus slotStatus;
-		slotStatus.bClockStatus = 0; // Replace with the actual clock status
-
-		BulkInMessage bulkInResponse;
-		ConstructBulkInMessage(&bulkInResponse, 0x81, sizeof(slotStatus), 0, SetupData->bSeq, 0, 0, 0, &slotStatus);
-		EpBufferSend(InstancePtr->PrivateData, 0, (u8 *)&bulkInResponse, sizeof(bulkInResponse));
-		break;
-	case USB_CLASSREQ_CCID_GET_SLOT_STATUS:
-		// 1. Read the slot status from your card reader hardware
-		// 2. Construct a CCID response structure (`u8 responseBuffer[...];`)
-		// 3. Send the response:
-		0 EpBufferSend(InstancePtr->PrivateData, 0, responseBuffer, sizeof(responseBuffer));
-		break;
-	case USB_CLASSREQ_CCID_XFR_BLOCK:
-		// 1. Receive command data from the host (check SetupData and use EpBufferRecv if needed)
-		// 2. Send the command data to the smart card reader
-		// 3. Get the response from the smart card reader
-		// 4. Send the response back to the host
-		break;
-	case USB_CLASSREQ_CCID_GET_PARAMETERS:
-		// 1. Construct a CCID response containing supported protocols, data rates, etc.
-		// 2. Send the response back to the host
-
-		ProtocolDataStructureT1 protocolData;
-		ConstructProtocolData(&protocolData);
-
-		RDR_to_PC_Parameters parameters;
-		parameters.bProtocolNum = 0x01; // Replace with the actual protocol number
-		parameters.protocolData = protocolData;
-
-		BulkInMessage bulkInResponse;
-		ConstructBulkInMessage(&bulkInResponse, 0x82, sizeof(parameters), 0, SetupData->bSeq, 0, 0, 0, &parameters);
-
-		EpBufferSend(InstancePtr->PrivateData, 0, (u8 *)&bulkInResponse, sizeof(bulkInResponse));
-		break;
-	case USB_CLASSREQ_CCID_RESET_PARAMETERS:
-		break;
-	case USB_CLASSREQ_CCID_SET_PARAMETERS:
-		break;
-	case USB_CLASSREQ_CCID_ESCAPE:
-		break;
-	case USB_CLASSREQ_CCID_GET_DATA_RATES:
-		break;
-	case USB_CLASSREQ_CCID_SET_DATA_RATES:
-		break;
-	case USB_CLASSREQ_CCID_GET_PROTOCOLS:
-		break;
-	case USB_CLASSREQ_CCID_SET_PROTOCOL:
-		break;
-	case USB_CLASSREQ_CCID_GET_CLOCK_FREQUENCIES:
-		break;
-	case USB_CLASSREQ_CCID_SET_CLOCK_FREQUENCY:
-		break;
-	case USB_CLASSREQ_CCID_ABORT:
-		handleAbortRequest(InstancePtr, SetupData);
-		break;
-	case USB_CLASSREQ_CCID_T0_APDU:
-		break;
-	case USB_CLASSREQ_CCID_T1_APDU:
-		break;
-	case USB_CLASSREQ_CCID_GET_TLV_PROPERTIES:
-		break;
-	case USB_CLASSREQ_CCID_SET_TLV_PROPERTIES:
-		break;
-	case USB_CLASSREQ_CCID_GET_FEATURE_REQUEST:
-		break;
-	case USB_CLASSREQ_CCID_SET_FEATURE_REQUEST:
-		break;
-	default:
-		/*
-		 * Unsupported command. Stall the end point.
-		 */
-		EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
-		break;
+	if (Icc->Present((u8)(SlotPtr - Slots)) == 0U) {
+		return CCID_ICC_ABSENT;
 	}
+
+	return (SlotPtr->Powered != 0U) ? CCID_ICC_ACTIVE : CCID_ICC_INACTIVE;
 }
 
-/*****************************************************************************/
+/****************************************************************************/
 /**
- * This function handles Reduced Block Command (RBC) requests from the host.
- *
- * @param	InstancePtr is a pointer to Usb_DevData instance of the controller.
- *
- * @return	None.
- *
- * @note		None.
- *
- ******************************************************************************/
-void ParseCBW(struct Usb_DevData *InstancePtr)
+* Sets the default protocol parameters of a slot, T=0 at Fi=372 Di=1.
+*
+* @param	SlotPtr is the slot.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+static void CcidDefaultParameters(CcidSlot *SlotPtr)
+{
+	memset(&SlotPtr->Params, 0, sizeof(SlotPtr->Params));
+	SlotPtr->ProtocolNum = CCID_PROTOCOL_T0;
+	SlotPtr->Params.bmFindexDindex = 0x11;
+	SlotPtr->Params.bmWaitingIntegersT1 = 0x0A;	/* WI for T=0 */
+}
+
+/****************************************************************************/
+/**
+* Returns the time between two time extensions of a slot, half its waiting
+* time: WWT = 960 x WI x Fi / f for T=0, BWT = 11 etu + 2^BWI x 960 x 372 / f
+* for T=1.
+*
+* @param	SlotPtr is the slot.
+*
+* @return	The interval in UsbGetTicks() units.
+*
+* @note		Reserved Fi and Di values count as the defaults.
+*
+*****************************************************************************/
+static u64 CcidWtxInterval(const CcidSlot *SlotPtr)
 {
-	u32 Offset;
-	u8 Array[50];
-	u8 Index;
+	u32 Fi = CcidFi[SlotPtr->Params.bmFindexDindex >> 4];
+	u32 Di = CcidDi[SlotPtr->Params.bmFindexDindex & 0x0FU];
+	u32 Wi = SlotPtr->Params.bmWaitingIntegersT1;
+	u64 WaitUs;
+
+	Fi = (Fi == 0U) ? 372U : Fi;
+	Di = (Di == 0U) ? 1U : Di;
+
+	if (SlotPtr->ProtocolNum == CCID_PROTOCOL_T1) {
+		WaitUs = (11U * Fi * 1000U) / (Di * CCID_DEFAULT_CLOCK) +
+			 ((u64)960U * 372U * 1000U << (Wi >> 4)) /
+			 CCID_DEFAULT_CLOCK;
+	} else {
+		Wi = (Wi == 0U) ? 10U : Wi;
+		WaitUs = ((u64)960U * Wi * Fi * 1000U) / CCID_DEFAULT_CLOCK;
+	}
+
+	return (WaitUs / 2U) * USB_TICKS_PER_SECOND / 1000000U;
+}
+
+/****************************************************************************/
+/**
+* Message handlers. Each gets the decoded header of the command in the bulk
+* OUT buffer and builds its response in the bulk IN buffer.
+*
+* @param	SlotPtr is the addressed slot.
+* @param	MsgPtr is the command.
+* @param	RspPtr is the response, its header is set up for success.
+*
+* @return	Length of the response data.
+*
+* @note		Called in interrupt context.
+*
+*****************************************************************************/
+static u32 CcidPowerOn(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+		       CCID_BulkInMessage *RspPtr)
+{
+	u8 Slot = MsgPtr->bSlot;
+	u32 AtrLen;
+
+	if (Icc->Present(Slot) == 0U) {
+		return CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+	}
+
+	AtrLen = Icc->PowerOn(Slot, CCID_MSG_DATA(RspPtr), CCID_RSP_DATA_SIZE);
+	if (AtrLen == 0U) {
+		return CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+	}
+
+	SlotPtr->Powered = 1U;
+	SlotPtr->ClockStopped = 0U;
+	SlotPtr->Chain = CCID_CHAIN_IDLE;
+	CcidDefaultParameters(SlotPtr);
+
+	return AtrLen;
+}
+
+static u32 CcidPowerOff(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr)
+{
+	(void)RspPtr;
+
+	if (SlotPtr->Powered != 0U) {
+		Icc->PowerOff(MsgPtr->bSlot);
+		SlotPtr->Powered = 0U;
+		SlotPtr->Chain = CCID_CHAIN_IDLE;
+	}
+
+	return 0U;
+}
+
+static u32 CcidGetSlotStatus(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr)
+{
+	(void)MsgPtr;
+
+	RspPtr->bSpecific = SlotPtr->ClockStopped;
+
+	return 0U;
+}
+
+/****************************************************************************/
+/**
+* Fetches the next part of the response of a streaming card into the
+* response buffer and sets bChainParameter for it. While the card is busy
+* the slot is left in CCID_SLOT_BUSY and nothing is returned.
+*
+* @param	SlotPtr is the slot.
+* @param	Slot is the slot number.
+* @param	RspPtr is the response.
+* @param	First is TRUE for the first part of the response.
+*
+* @return	Length of the response data.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static u32 CcidXfrNext(CcidSlot *SlotPtr, u8 Slot, CCID_BulkInMessage *RspPtr,
+		       u32 First)
+{
+	u32 RspLen = 0U;
+	u32 More = FALSE;
 	s32 Status;
 
-	switch (CBW.CBWCB[0])
-	{
-	case USB_RBC_INQUIRY:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: INQUIRY\r\n");
-#endif
-		Phase = USB_EP_STATE_DATA_IN;
+	Status = Icc->XfrGet(Slot, CCID_MSG_DATA(RspPtr), CCID_RSP_DATA_SIZE,
+			     &RspLen, &More);
+	if (Status == XST_DEVICE_BUSY) {
+		SlotPtr->State = CCID_SLOT_BUSY;
+		SlotPtr->BusyFirst = (u8)First;
+		return 0U;
+	}
+	if (Status != XST_SUCCESS) {
+		SlotPtr->Chain = CCID_CHAIN_IDLE;
+		return CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+	}
+
+	if (First == TRUE && More == TRUE && SlotPtr->ChainedCmd == FALSE) {
+		/* Whole command, chained response */
+		Stats.Chained++;
+	}
 
-		Status = IsSuperSpeed(InstancePtr);
-		if (Status != XST_SUCCESS)
-		{
-			/* USB 2.0 */
-			Index = 0;
+	if (First == TRUE) {
+		RspPtr->bSpecific = (More == TRUE) ? CCID_CHAIN_BEGIN :
+				    CCID_CHAIN_SINGLE;
+	} else {
+		RspPtr->bSpecific = (More == TRUE) ? CCID_CHAIN_CONTINUE :
+				    CCID_CHAIN_END;
+	}
+	SlotPtr->Chain = (More == TRUE) ? CCID_CHAIN_RESPONSE : CCID_CHAIN_IDLE;
+
+	return RspLen;
+}
+
+/****************************************************************************/
+/**
+* Drops the parts of a chained command that the streaming card has taken
+* so far.
+*
+* @param	SlotPtr is the slot.
+* @param	Slot is the slot number.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+static void CcidXfrDrop(CcidSlot *SlotPtr, u8 Slot)
+{
+	if (SlotPtr->Chain == CCID_CHAIN_COMMAND) {
+		(void)Icc->XfrPut(Slot, NULL, 0U, FALSE);
+	}
+	SlotPtr->Chain = CCID_CHAIN_IDLE;
+}
+
+/****************************************************************************/
+/**
+* Starts an XfrBlock part for a streaming card: checks wLevelParameter
+* against the chaining state of the slot and accounts for the data.
+*
+* @param	SlotPtr is the slot.
+* @param	MsgPtr is the command header.
+* @param	RspPtr is the response.
+*
+* @return	XST_SUCCESS if the data goes to the card, else XST_FAILURE with
+*		the response failed.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static s32 CcidXfrStart(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr)
+{
+	u16 Level = MsgPtr->Params.XfrBlock.wLevelParameter;
+	u32 Length = MsgPtr->dwLength;
+
+	switch (Level) {
+		case CCID_LEVEL_SINGLE:
+		case CCID_LEVEL_BEGIN:
+			/* A new APDU drops what is left of the last one */
+			CcidXfrDrop(SlotPtr, MsgPtr->bSlot);
+			SlotPtr->ChainBytes = 0U;
+			SlotPtr->ChainedCmd = (Level == CCID_LEVEL_BEGIN) ?
+					      TRUE : FALSE;
+			Stats.Apdus++;
+			if (Level == CCID_LEVEL_BEGIN) {
+				Stats.Chained++;
+			}
+			break;
+
+		case CCID_LEVEL_CONTINUE:
+		case CCID_LEVEL_END:
+			if (SlotPtr->Chain != CCID_CHAIN_COMMAND) {
+				CcidFail(RspPtr, CCID_ERR_OFFSET_LEVEL);
+				return XST_FAILURE;
+			}
+			break;
+
+		default:
+			CcidFail(RspPtr, CCID_ERR_OFFSET_LEVEL);
+			return XST_FAILURE;
+	}
+
+	SlotPtr->Chain = CCID_CHAIN_COMMAND;
+	SlotPtr->ChainBytes += Length;
+	if (Length == 0U || SlotPtr->ChainBytes > MAX_APDU_SIZE) {
+		CcidXfrDrop(SlotPtr, MsgPtr->bSlot);
+		CcidFail(RspPtr, (Length == 0U) ? CCID_ERR_OFFSET_LENGTH :
+			 CCID_ERR_XFR_OVERRUN);
+		return XST_FAILURE;
+	}
+
+	return XST_SUCCESS;
+}
+
+/****************************************************************************/
+/**
+* Passes command data to a streaming card.
+*
+* @param	SlotPtr is the slot.
+* @param	Slot is the slot number.
+* @param	DataPtr is the data.
+* @param	Length is the length of the data.
+* @param	Last is TRUE for the end of the command, the card runs it.
+* @param	RspPtr is the response.
+*
+* @return	XST_SUCCESS, else XST_FAILURE with the response failed.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static s32 CcidXfrPut(CcidSlot *SlotPtr, u8 Slot, const u8 *DataPtr,
+		      u32 Length, u32 Last, CCID_BulkInMessage *RspPtr)
+{
+	if (Icc->XfrPut(Slot, DataPtr, Length, Last) != XST_SUCCESS) {
+		SlotPtr->Chain = CCID_CHAIN_IDLE;
+		CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+		return XST_FAILURE;
+	}
+
+	return XST_SUCCESS;
+}
+
+/****************************************************************************/
+/**
+* Ends an XfrBlock part for a streaming card: asks the host for the next
+* part of the command, or returns the first part of the response.
+*
+* @param	SlotPtr is the slot.
+* @param	Slot is the slot number.
+* @param	Level is wLevelParameter of the part.
+* @param	RspPtr is the response.
+*
+* @return	Length of the response data.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static u32 CcidXfrEnd(CcidSlot *SlotPtr, u8 Slot, u16 Level,
+		      CCID_BulkInMessage *RspPtr)
+{
+	if (CCID_LEVEL_LAST(Level) == FALSE) {
+		/* Empty DataBlock, the host sends the next part */
+		RspPtr->bSpecific = CCID_CHAIN_NEXT_COMMAND;
+		return 0U;
+	}
+
+	return CcidXfrNext(SlotPtr, Slot, RspPtr, TRUE);
+}
+
+/****************************************************************************/
+/**
+* XfrBlock. A whole APDU goes to Xfr, or to a streaming card in one part.
+* Chained APDUs go to the streaming card part by part as their messages
+* arrive, long responses come back one message per NEXT_RESPONSE request.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static u32 CcidXfrBlock(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr)
+{
+	u16 Level = MsgPtr->Params.XfrBlock.wLevelParameter;
+	u32 Length = MsgPtr->dwLength;
+	u8 Slot = MsgPtr->bSlot;
+	u32 RspLen = 0U;
+	u64 Start;
+	s32 Status;
+
+	if (SlotPtr->Powered == 0U) {
+		return CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+	}
+
+	if (Icc->XfrPut == NULL) {
+		/* Whole APDUs only, one message each way */
+		if (Level != CCID_LEVEL_SINGLE) {
+			return CcidFail(RspPtr, CCID_ERR_OFFSET_LEVEL);
+		}
+		if (Length == 0U) {
+			return CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+		}
+
+		Stats.Apdus++;
+		Start = UsbGetTicks();
+		Status = Icc->Xfr(Slot, CCID_MSG_DATA(MsgPtr), Length,
+				  CCID_MSG_DATA(RspPtr), CCID_RSP_DATA_SIZE,
+				  &RspLen);
+		if (UsbGetTicks() - Start >= CcidWtxInterval(SlotPtr)) {
+			/* The host got no time extension, see Ccid_IccOps */
+			Stats.SlowXfr++;
 		}
-		else
-		{
-			/* USB 3.0 */
-			Index = 1;
+		if (Status != XST_SUCCESS) {
+			return CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
 		}
 
-		EpBufferSend(InstancePtr->PrivateData, 1,
-					 (u8 *)&scsiInquiry[Index],
-					 sizeof(scsiInquiry[Index]));
-		break;
+		return RspLen;
 	}
 
-	case USB_UFI_GET_CAP_LIST:
-	{
-		SCSI_CAP_LIST *CapList;
+	if (Level == CCID_LEVEL_NEXT_RESPONSE) {
+		if (SlotPtr->Chain != CCID_CHAIN_RESPONSE || Length != 0U) {
+			return CcidFail(RspPtr, CCID_ERR_OFFSET_LEVEL);
+		}
+		return CcidXfrNext(SlotPtr, Slot, RspPtr, FALSE);
+	}
 
-		CapList = (SCSI_CAP_LIST *)txBuffer;
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: CAPLIST\r\n");
-#endif
-		CapList->listLength = 8;
-		CapList->descCode = 3;
-		CapList->numBlocks = htonl(VFLASH_NUM_BLOCKS);
-		CapList->blockLength = htons(VFLASH_BLOCK_SIZE);
+	if (CcidXfrStart(SlotPtr, MsgPtr, RspPtr) != XST_SUCCESS ||
+	    CcidXfrPut(SlotPtr, Slot, CCID_MSG_DATA(MsgPtr), Length,
+		       CCID_LEVEL_LAST(Level), RspPtr) != XST_SUCCESS) {
+		return 0U;
+	}
+
+	return CcidXfrEnd(SlotPtr, Slot, Level, RspPtr);
+}
+
+static u32 CcidGetParameters(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr)
+{
+	u32 Length;
+
+	(void)MsgPtr;
+
+	Length = (SlotPtr->ProtocolNum == CCID_PROTOCOL_T1) ?
+		 sizeof(CCID_ProtocolT1) : sizeof(CCID_ProtocolT0);
+
+	RspPtr->bSpecific = SlotPtr->ProtocolNum;
+	memcpy(CCID_MSG_DATA(RspPtr), &SlotPtr->Params, Length);
 
-		Phase = USB_EP_STATE_DATA_IN;
-		EpBufferSend(InstancePtr->PrivateData, 1, txBuffer,
-					 sizeof(SCSI_CAP_LIST));
+	return Length;
+}
+
+static u32 CcidResetParameters(CcidSlot *SlotPtr,
+			       const CCID_BulkOutMessage *MsgPtr,
+			       CCID_BulkInMessage *RspPtr)
+{
+	CcidDefaultParameters(SlotPtr);
+
+	return CcidGetParameters(SlotPtr, MsgPtr, RspPtr);
+}
+
+static u32 CcidSetParameters(CcidSlot *SlotPtr,
+			     const CCID_BulkOutMessage *MsgPtr,
+			     CCID_BulkInMessage *RspPtr)
+{
+	u8 Protocol = MsgPtr->Params.SetParameters.bProtocolNum;
+	u32 Length;
 
-		break;
+	if (Protocol == CCID_PROTOCOL_T0) {
+		Length = sizeof(CCID_ProtocolT0);
+	} else if (Protocol == CCID_PROTOCOL_T1) {
+		Length = sizeof(CCID_ProtocolT1);
+	} else {
+		return CcidFail(RspPtr, CCID_ERR_OFFSET_PARAM);
 	}
 
-	case USB_RBC_READ_CAP:
-	{
-		SCSI_READ_CAPACITY *Cap;
+	if (MsgPtr->dwLength != Length) {
+		return CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+	}
 
-		Cap = (SCSI_READ_CAPACITY *)txBuffer;
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: READCAP\r\n");
-#endif
-		Cap->numBlocks = htonl(VFLASH_NUM_BLOCKS - 1);
-		Cap->blockSize = htonl(VFLASH_BLOCK_SIZE);
-		Phase = USB_EP_STATE_DATA_IN;
-		EpBufferSend(InstancePtr->PrivateData, 1, txBuffer,
-					 sizeof(SCSI_READ_CAPACITY));
+	SlotPtr->ProtocolNum = Protocol;
+	memset(&SlotPtr->Params, 0, sizeof(SlotPtr->Params));
+	memcpy(&SlotPtr->Params, CCID_MSG_DATA(MsgPtr), Length);
+
+	return CcidGetParameters(SlotPtr, MsgPtr, RspPtr);
+}
+
+static u32 CcidIccClock(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+			CCID_BulkInMessage *RspPtr)
+{
+	switch (MsgPtr->Params.IccClock.bClockCommand) {
+		case 0x00:	/* Restart */
+			SlotPtr->ClockStopped = 0U;
+			break;
+
+		case 0x01:	/* Stop in the state of bClockStop */
+			SlotPtr->ClockStopped = 1U;
+			break;
 
-		break;
+		default:
+			return CcidFail(RspPtr, CCID_ERR_OFFSET_PARAM);
 	}
 
-	case USB_RBC_READ:
-	{
-		Offset = htonl(((SCSI_READ_WRITE *)&CBW.CBWCB)->block) *
-				 VFLASH_BLOCK_SIZE;
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: READ Offset 0x%08x\r\n", Offset);
-#endif
+	RspPtr->bSpecific = SlotPtr->ClockStopped;
+
+	return 0U;
+}
+
+static u32 CcidAbort(CcidSlot *SlotPtr, const CCID_BulkOutMessage *MsgPtr,
+		     CCID_BulkInMessage *RspPtr)
+{
+	(void)RspPtr;
+
+	/*
+	 * A command the card was busy with has failed already, so the abort
+	 * is complete with the bulk half of the pair. A chained APDU is
+	 * dropped.
+	 */
+	if (SlotPtr->Abort == CCID_ABORT_REQUEST &&
+	    SlotPtr->AbortSeq == MsgPtr->bSeq) {
+		SlotPtr->Abort = CCID_ABORT_NONE;
+	} else {
+		/* The class request of the pair is still to come */
+		SlotPtr->Abort = CCID_ABORT_MESSAGE;
+		SlotPtr->AbortSeq = MsgPtr->bSeq;
+	}
+	if (Icc->XfrPut != NULL) {
+		CcidXfrDrop(SlotPtr, MsgPtr->bSlot);
+	}
+	SlotPtr->Chain = CCID_CHAIN_IDLE;
+
+	return 0U;
+}
+
+static u32 CcidSetDataRate(CcidSlot *SlotPtr,
+			   const CCID_BulkOutMessage *MsgPtr,
+			   CCID_BulkInMessage *RspPtr)
+{
+	CCID_DataRate *RatePtr = (CCID_DataRate *)CCID_MSG_DATA(RspPtr);
+
+	(void)SlotPtr;
+
+	if (MsgPtr->dwLength != sizeof(CCID_DataRate)) {
+		return CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+	}
+
+	/* The emulated interface runs at one clock and data rate */
+	RatePtr->dwClockFrequency = CCID_DEFAULT_CLOCK;
+	RatePtr->dwDataRate = CCID_DEFAULT_DATA_RATE;
+
+	return sizeof(CCID_DataRate);
+}
+
+/****************************************************************************/
+/**
+* Sends a response, with a zero length packet when it ends on a packet
+* boundary so that the host sees the end of the message.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Index is the slot number or CCID_READER_REPLY.
+* @param	Length is the length of the response, header included.
+*
+* @return	None.
+*
+* @note		A response the endpoint does not take is dropped like a sent
+*		one: the slot goes back to idle, and after a reply of the
+*		reader the next command is received. Called from the
+*		interrupt handler or with interrupts disabled, so that no
+*		completion runs before the requests are set up.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static void CcidSendResponse(struct Usb_DevData *InstancePtr, u32 Index,
+			     u32 Length)
+{
+	Usb_EpRequest *RequestPtr = &ResponseRequest[Index];
+	Usb_EpRequest *ZlpPtr = &ZlpRequest[Index];
+	void *Context = (Index < CCID_MAX_SLOTS) ? &Slots[Index] : NULL;
+	u32 MaxPacket;
+
+	MaxPacket = (InstancePtr->Speed == USB_SPEED_SUPER) ? 1024U : 512U;
+
+	RequestPtr->BufferPtr = (u8 *)CcidResponse(Index);
+	RequestPtr->Length = Length;
+	RequestPtr->Context = Context;
+
+	RequestPtr->Complete = ((Length % MaxPacket) != 0U) ?
+			       CcidResponseDone : NULL;
+	if (EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_IN,
+			    RequestPtr) != XST_SUCCESS) {
+		Stats.Unsent++;
+		if (Context != NULL) {
+			Slots[Index].State = CCID_SLOT_IDLE;
+		} else {
+			CcidRecvCommand(InstancePtr);
+		}
+		return;
+	}
+	if (RequestPtr->Complete != NULL) {
+		return;
+	}
+
+	ZlpPtr->BufferPtr = RequestPtr->BufferPtr;
+	ZlpPtr->Length = 0U;
+	ZlpPtr->Complete = CcidResponseDone;
+	ZlpPtr->Context = Context;
+	if (EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_IN,
+			    ZlpPtr) != XST_SUCCESS) {
+		/* The host misses the end, the data request frees the slot */
+		Stats.Unsent++;
+		RequestPtr->Complete = CcidResponseDone;
+	}
+}
+
+/****************************************************************************/
+/**
+* Sets up the response to a command and checks the command header. The
+* response goes to the buffer of the addressed slot, or to the reply buffer
+* of the reader when there is no such slot or it is not idle. Only an Abort
+* is handled for a slot that is not idle.
+*
+* @param	MsgPtr is the command header.
+* @param	Received is the number of data bytes of the command.
+* @param	IndexPtr returns the response index, see CcidResponse().
+*
+* @return	The handler of the command, NULL when the response is failed
+*		already.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static CcidHandler CcidCheckCommand(const CCID_BulkOutMessage *MsgPtr,
+				    u32 Received, u32 *IndexPtr)
+{
+	const CcidCommand *CmdPtr = NULL;
+	CCID_BulkInMessage *RspPtr;
+	u8 Slot = MsgPtr->bSlot;
+	u32 Busy;
+	u8 Type;
 
-		Phase = USB_EP_STATE_DATA_IN;
-		u32 RetVal = EpBufferSend(InstancePtr->PrivateData, 1,
-								  &VirtFlash[Offset],
-								  htons(((SCSI_READ_WRITE *)&CBW.CBWCB)->length) * VFLASH_BLOCK_SIZE);
-		if (RetVal != XST_SUCCESS)
-		{
-			xil_printf("Failed: READ Offset 0x%08x\n",
-					   Offset);
+	Stats.Commands++;
+
+	*IndexPtr = (Slot < CCID_MAX_SLOTS &&
+		     Slots[Slot].State == CCID_SLOT_IDLE) ? Slot :
+		    CCID_READER_REPLY;
+	RspPtr = CcidResponse(*IndexPtr);
+
+	Type = MsgPtr->bMessageType;
+	if (Type >= CCID_PC_TO_RDR_FIRST && Type <= CCID_PC_TO_RDR_LAST) {
+		CmdPtr = &Commands[Type - CCID_PC_TO_RDR_FIRST];
+	}
+	/* An Abort is not held up by the command it aborts */
+	Busy = (*IndexPtr == CCID_READER_REPLY && Slot < CCID_MAX_SLOTS &&
+		Type != CCID_PC_TO_RDR_ABORT) ? TRUE : FALSE;
+
+	RspPtr->bMessageType = (CmdPtr != NULL && CmdPtr->Response != 0U) ?
+			       CmdPtr->Response : CCID_RDR_TO_PC_SLOT_STATUS;
+	RspPtr->bSlot = Slot;
+	RspPtr->bSeq = MsgPtr->bSeq;
+	RspPtr->bStatus = CCID_CMD_PROCESSED;
+	RspPtr->bError = 0U;
+	RspPtr->bSpecific = 0U;
+
+	if (Slot >= CCID_MAX_SLOTS) {
+		CcidFail(RspPtr, CCID_ERR_OFFSET_SLOT);
+	} else if (Busy == TRUE) {
+		Stats.SlotBusy++;
+		CcidFail(RspPtr, CCID_ERR_CMD_SLOT_BUSY);
+	} else if (MsgPtr->dwLength > MAX_DATA_SIZE ||
+		   MsgPtr->dwLength != Received) {
+		Stats.Malformed++;
+		CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+	} else if (CmdPtr == NULL || CmdPtr->Handler == NULL) {
+		CcidFail(RspPtr, CCID_ERR_CMD_NOT_SUPPORTED);
+	} else if (Slots[Slot].Abort == CCID_ABORT_REQUEST &&
+		   Type != CCID_PC_TO_RDR_ABORT) {
+		CcidFail(RspPtr, CCID_ERR_CMD_ABORTED);
+	} else {
+		return CmdPtr->Handler;
+	}
+
+	return NULL;
+}
+
+/****************************************************************************/
+/**
+* Completes a response with the ICC status and the data length, and sends
+* it. Nothing is sent for a slot whose card is still busy, Ccid_Poll()
+* finishes it later.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Index is the slot number or CCID_READER_REPLY.
+* @param	Length is the length of the response data.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static void CcidFinish(struct Usb_DevData *InstancePtr, u32 Index, u32 Length)
+{
+	CCID_BulkInMessage *RspPtr = CcidResponse(Index);
+
+	if (Index < CCID_MAX_SLOTS) {
+		if (Slots[Index].State == CCID_SLOT_BUSY) {
+			/* First time extension, see CcidWtxTimer() */
+			Slots[Index].WtxTicks = UsbGetTicks() +
+						CcidWtxInterval(&Slots[Index]);
+			if (WtxTimer == TRUE) {
+				CcidWtxArm();
+			}
 			return;
 		}
-		break;
+		Slots[Index].State = CCID_SLOT_SENDING;
 	}
-	case USB_RBC_MODE_SENSE:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: MODE SENSE\r\n");
-#endif
-		Phase = USB_EP_STATE_DATA_IN;
-		EpBufferSend(InstancePtr->PrivateData, 1,
-					 (u8 *)"\003\000\000\000", 4);
-		break;
-	}
-	case USB_RBC_MODE_SELECT:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: MODE_SELECT\r\n");
-#endif
-		Phase = USB_EP_STATE_DATA_OUT;
-		EpBufferRecv(InstancePtr->PrivateData,
-					 1, (u8 *)Array, 24);
-		break;
-	}
-	case USB_RBC_TEST_UNIT_READY:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: TEST UNIT READY\r\n");
-#endif
-		SendCSW(InstancePtr, 0);
-		break;
+
+	if (RspPtr->bSlot < CCID_MAX_SLOTS) {
+		RspPtr->bStatus |= CcidIccStatus(&Slots[RspPtr->bSlot]);
+	} else {
+		RspPtr->bStatus |= CCID_ICC_ABSENT;
 	}
-	case USB_RBC_MEDIUM_REMOVAL:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: MEDIUM REMOVAL\r\n");
-#endif
-		SendCSW(InstancePtr, 0);
-		break;
+
+	if ((RspPtr->bStatus & CCID_CMD_FAILED) != 0U) {
+		Stats.Failed++;
 	}
-	case USB_RBC_VERIFY:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: VERIFY\n");
-#endif
-		SendCSW(InstancePtr, 0);
-		break;
-	}
-	case USB_RBC_WRITE:
-	{
-		Offset = htonl(((SCSI_READ_WRITE *)&CBW.CBWCB)->block) * VFLASH_BLOCK_SIZE;
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: WRITE Offset 0x%08x\r\n", Offset);
-#endif
-		VirtFlashWritePointer = &VirtFlash[Offset];
 
-		rxBytesLeft = htons(((SCSI_READ_WRITE *)&CBW.CBWCB)->length) * VFLASH_BLOCK_SIZE;
+	RspPtr->dwLength = Length;
+	CcidSendResponse(InstancePtr, Index, CCID_HEADER_SIZE + Length);
+}
+
+/****************************************************************************/
+/**
+* Fails the command a slot is busy with, CCID_ERR_CMD_ABORTED. The card
+* drops it.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Index is the slot number.
+*
+* @return	None.
+*
+* @note		Called with interrupts disabled or in interrupt context.
+*
+*****************************************************************************/
+static void CcidCancel(struct Usb_DevData *InstancePtr, u32 Index)
+{
+	CcidSlot *SlotPtr = &Slots[Index];
+
+	(void)Icc->XfrPut((u8)Index, NULL, 0U, FALSE);
+	SlotPtr->Chain = CCID_CHAIN_IDLE;
+	SlotPtr->State = CCID_SLOT_IDLE;
+	Stats.Aborted++;
+	CcidFinish(InstancePtr, Index,
+		   CcidFail(CcidResponse(Index), CCID_ERR_CMD_ABORTED));
+}
+
+/****************************************************************************/
+/**
+* Processes the bulk OUT message in the receive buffer. The header is read
+* where it was received, the command data stays there for the handler.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Actual is the number of bytes received.
+*
+* @return	None.
+*
+* @note		Called in interrupt context.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static void CcidDispatch(struct Usb_DevData *InstancePtr, u32 Actual)
+{
+	const CCID_BulkOutMessage *MsgPtr =
+		(const CCID_BulkOutMessage *)CcidOut;
+	CcidHandler Handler;
+	u32 Length = 0U;
+	u32 Index;
+
+	if (Actual < CCID_HEADER_SIZE) {
+		/* Nothing to answer to, wait for the next message */
+		Stats.Malformed++;
+		CcidRecvCommand(InstancePtr);
+		return;
+	}
+
+	Handler = CcidCheckCommand(MsgPtr, Actual - CCID_HEADER_SIZE, &Index);
+	if (Handler != NULL) {
+		if (Slots[MsgPtr->bSlot].State == CCID_SLOT_BUSY) {
+			/* Abort, the aborted command is answered first */
+			CcidCancel(InstancePtr, MsgPtr->bSlot);
+		}
+		Length = Handler(&Slots[MsgPtr->bSlot], MsgPtr,
+				 CcidResponse(Index));
+	}
+
+	CcidFinish(InstancePtr, Index, Length);
+
+	/* The reply buffer of the reader is free again once it is sent */
+	if (Index != CCID_READER_REPLY) {
+		CcidRecvCommand(InstancePtr);
+	}
+}
+
+#ifdef CCID_MEMORY_LIMITED
+/****************************************************************************/
+/**
+* Starts a command that does not fit one packet, from its first packet. Only
+* XfrBlock data goes on to a streaming card, other commands that long fail
+* and the rest of their data is dropped as it arrives.
+*
+* @param	Received is the number of data bytes in the first packet.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static void CcidRxStart(u32 Received)
+{
+	const CCID_BulkOutMessage *MsgPtr = &Rx.Header;
+	CCID_BulkInMessage *RspPtr;
+	CcidSlot *SlotPtr;
+
+	memcpy(&Rx.Header, CcidOut, CCID_HEADER_SIZE);
+	Rx.Received = Received;
+	Rx.Active = TRUE;
+	Rx.Stream = FALSE;
+	Stats.Streamed++;
+
+	if (CcidCheckCommand(MsgPtr, MsgPtr->dwLength, &Rx.Index) == NULL) {
+		return;
+	}
+
+	SlotPtr = &Slots[Rx.Index];
+	RspPtr = CcidResponse(Rx.Index);
+	if (MsgPtr->bMessageType != CCID_PC_TO_RDR_XFR_BLOCK) {
+		CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+	} else if (SlotPtr->Powered == 0U) {
+		CcidFail(RspPtr, CCID_ERR_ICC_MUTE);
+	} else if (Icc->XfrPut == NULL) {
+		/* Xfr takes a whole APDU, there is no room for it */
+		CcidFail(RspPtr, CCID_ERR_XFR_OVERRUN);
+	} else if (CcidXfrStart(SlotPtr, MsgPtr, RspPtr) == XST_SUCCESS &&
+		   CcidXfrPut(SlotPtr, MsgPtr->bSlot, CCID_MSG_DATA(CcidOut),
+			      Received, FALSE, RspPtr) == XST_SUCCESS) {
+		Rx.Stream = TRUE;
+	}
+}
+
+/****************************************************************************/
+/**
+* Takes the next packet of the command started by CcidRxStart().
+*
+* @param	Actual is the number of bytes received.
+*
+* @return	TRUE when the command is complete.
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static u32 CcidRxNext(u32 Actual)
+{
+	const CCID_BulkOutMessage *MsgPtr = &Rx.Header;
+	CCID_BulkInMessage *RspPtr = CcidResponse(Rx.Index);
+	u32 Done;
+
+	Rx.Received += Actual;
+	Done = (Rx.Received >= MsgPtr->dwLength ||
+		Actual < CCID_BULK_OUT_SIZE) ? TRUE : FALSE;
+
+	if (Done == TRUE && Rx.Received != MsgPtr->dwLength) {
+		/* Shorter or longer than its header says */
+		Stats.Malformed++;
+		if (Rx.Stream == TRUE) {
+			CcidXfrDrop(&Slots[Rx.Index], MsgPtr->bSlot);
+			Rx.Stream = FALSE;
+		}
+		if ((RspPtr->bStatus & CCID_CMD_FAILED) == 0U) {
+			CcidFail(RspPtr, CCID_ERR_OFFSET_LENGTH);
+		}
+	} else if (Rx.Stream == TRUE &&
+		   CcidXfrPut(&Slots[Rx.Index], MsgPtr->bSlot, CcidOut, Actual,
+			      (Done == TRUE) ? CCID_LEVEL_LAST(
+			      MsgPtr->Params.XfrBlock.wLevelParameter) : FALSE,
+			      RspPtr) != XST_SUCCESS) {
+		Rx.Stream = FALSE;
+	}
 
-		Phase = USB_EP_STATE_DATA_OUT;
-		EpBufferRecv(InstancePtr->PrivateData, 1,
-					 &VirtFlash[Offset], rxBytesLeft);
-		break;
+	if (Done == TRUE) {
+		Rx.Active = FALSE;
 	}
-	case USB_RBC_STARTSTOP_UNIT:
-	{
-		u8 immed;
 
-		immed = ((SCSI_START_STOP *)&CBW.CBWCB)->immed;
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: START/STOP unit: immed %02x\r\n", immed);
+	return Done;
+}
 #endif
-		/* If the immediate bit is 0 we are supposed to send
-		 * a success status.
-		 */
-		if (0 == (immed & 0x01))
-		{
-			SendCSW(InstancePtr, 0);
+
+/****************************************************************************/
+/**
+* Completion callbacks of the bulk requests. A flushed request completes
+* with a failure status and ends the sequence, it is restarted by the next
+* SET_CONFIGURATION.
+*
+* @param	RequestPtr is the completed request.
+*
+* @return	None
+*
+* @note		Called in interrupt context.
+*
+*****************************************************************************/
+#ifndef CCID_MEMORY_LIMITED
+USB_HOT_TEXT
+static void CcidCommandDone(Usb_EpRequest *RequestPtr)
+{
+	if (RequestPtr->Status == XST_SUCCESS) {
+		CcidDispatch((struct Usb_DevData *)RequestPtr->Context,
+			     RequestPtr->Actual);
+	}
+}
+#else
+USB_HOT_TEXT
+static void CcidCommandDone(Usb_EpRequest *RequestPtr)
+{
+	struct Usb_DevData *InstancePtr =
+		(struct Usb_DevData *)RequestPtr->Context;
+	const CCID_BulkOutMessage *MsgPtr =
+		(const CCID_BulkOutMessage *)CcidOut;
+	u32 Actual = RequestPtr->Actual;
+	u32 Length = 0U;
+
+	if (RequestPtr->Status != XST_SUCCESS) {
+		return;
+	}
+
+	if (Rx.Active == FALSE) {
+		if (Actual < CCID_BULK_OUT_SIZE ||
+		    Actual - CCID_HEADER_SIZE >= MsgPtr->dwLength) {
+			/* The whole message is in the buffer */
+			CcidDispatch(InstancePtr, Actual);
+			return;
+		}
+		CcidRxStart(Actual - CCID_HEADER_SIZE);
+	} else if (CcidRxNext(Actual) == TRUE) {
+		if (Rx.Stream == TRUE) {
+			Length = CcidXfrEnd(&Slots[Rx.Index], Rx.Header.bSlot,
+					    Rx.Header.Params.XfrBlock.wLevelParameter,
+					    CcidResponse(Rx.Index));
 		}
-		break;
+		CcidFinish(InstancePtr, Rx.Index, Length);
+		if (Rx.Index != CCID_READER_REPLY) {
+			CcidRecvCommand(InstancePtr);
+		}
+		return;
 	}
 
-	case USB_RBC_REQUEST_SENSE:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: REQUEST_SENSE\r\n");
+	/* Next packet of the command, into the same buffer */
+	EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT,
+			&CommandRequest);
+}
 #endif
-		break;
+
+/****************************************************************************/
+/**
+* Sends a DataBlock that asks the host for more time, for the command a slot
+* is busy with. It leaves the response of the command alone.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Index is the slot number.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+static void CcidSendWtx(struct Usb_DevData *InstancePtr, u32 Index)
+{
+	CCID_BulkInMessage *WtxPtr = (CCID_BulkInMessage *)CcidWtx[Index];
+	CcidSlot *SlotPtr = &Slots[Index];
+
+	WtxPtr->bMessageType = CCID_RDR_TO_PC_DATA_BLOCK;
+	WtxPtr->dwLength = 0U;
+	WtxPtr->bSlot = (u8)Index;
+	WtxPtr->bSeq = CcidResponse(Index)->bSeq;
+	WtxPtr->bStatus = CCID_CMD_TIME_EXTENSION | CcidIccStatus(SlotPtr);
+	WtxPtr->bError = CCID_WTX_MULTIPLIER;
+	WtxPtr->bSpecific = 0U;
+
+	WtxRequest[Index].BufferPtr = CcidWtx[Index];
+	WtxRequest[Index].Length = CCID_HEADER_SIZE;
+	WtxRequest[Index].Complete = CcidWtxDone;
+	WtxRequest[Index].Context = SlotPtr;
+	if (EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_IN,
+			    &WtxRequest[Index]) == XST_SUCCESS) {
+		SlotPtr->WtxPending = TRUE;
+		Stats.TimeExtensions++;
+	}
+}
+
+USB_HOT_TEXT
+static void CcidResponseDone(Usb_EpRequest *RequestPtr)
+{
+	CcidSlot *SlotPtr = (CcidSlot *)RequestPtr->Context;
+
+	if (SlotPtr != NULL) {
+		SlotPtr->State = CCID_SLOT_IDLE;
+	} else if (RequestPtr->Status == XST_SUCCESS) {
+		CcidRecvCommand(CcidDev);
+	}
+}
+
+static void CcidWtxDone(Usb_EpRequest *RequestPtr)
+{
+	((CcidSlot *)RequestPtr->Context)->WtxPending = FALSE;
+}
+
+/****************************************************************************/
+/**
+* Arms the timer for the earliest time extension of the busy slots.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called with interrupts disabled or in interrupt context.
+*
+*****************************************************************************/
+static void CcidWtxArm(void)
+{
+	u64 Next = 0U;
+	u32 Index;
+
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		if (Slots[Index].State == CCID_SLOT_BUSY &&
+		    (Next == 0U || Slots[Index].WtxTicks < Next)) {
+			Next = Slots[Index].WtxTicks;
+		}
+	}
+
+	if (Next != 0U) {
+		UsbTimerArm(Next);
+	}
+}
+
+/****************************************************************************/
+/**
+* Timer handler, sends the time extensions that have fallen due. A slot
+* whose last time extension the host has not taken yet skips this one.
+*
+* @param	Context is not used.
+*
+* @return	None.
+*
+* @note		Runs in interrupt context, see UsbTimerSetHandler().
+*
+*****************************************************************************/
+static void CcidWtxTimer(void *Context)
+{
+	u64 Now = UsbGetTicks();
+	CcidSlot *SlotPtr;
+	u32 Index;
+
+	(void)Context;
+
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		SlotPtr = &Slots[Index];
+		if (SlotPtr->State != CCID_SLOT_BUSY ||
+		    Now < SlotPtr->WtxTicks) {
+			continue;
+		}
+
+		if (SlotPtr->WtxPending == FALSE) {
+			CcidSendWtx(CcidDev, Index);
+		}
+		SlotPtr->WtxTicks = Now + CcidWtxInterval(SlotPtr);
+	}
+
+	CcidWtxArm();
+}
+
+/*****************************************************************************/
+/**
+* This function is class handler for CCID and is called when Setup packet
+* received is for Class request(not Standard Device request)
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	SetupData is pointer to SetupPacket received.
+*
+* @return	None
+*
+* @note		None.
+*
+******************************************************************************/
+void CcidClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
+{
+	s32 Status;
+	u8 Slot;
+	u8 Seq;
+
+	Xil_AssertVoid(InstancePtr != NULL);
+	Xil_AssertVoid(SetupData   != NULL);
+
+	switch (SetupData->bRequest) {
+		case USB_CLASSREQ_CCID_ABORT:
+			/* wValue is bSeq << 8 | bSlot */
+			Slot = (u8)(SetupData->wValue & 0xFFU);
+			if (Slot >= CCID_MAX_SLOTS) {
+				EpSetStall(InstancePtr->PrivateData, 0,
+					   USB_EP_DIR_OUT);
+				break;
+			}
+			Seq = (u8)(SetupData->wValue >> 8);
+			if (Slots[Slot].Abort == CCID_ABORT_MESSAGE &&
+			    Slots[Slot].AbortSeq == Seq) {
+				/* PC_to_RDR_Abort came first, pair complete */
+				Slots[Slot].Abort = CCID_ABORT_NONE;
+			} else {
+				Slots[Slot].Abort = CCID_ABORT_REQUEST;
+				Slots[Slot].AbortSeq = Seq;
+			}
+			EpBufferSend(InstancePtr->PrivateData, 0, NULL, 0);
+			break;
+
+		case USB_CLASSREQ_CCID_GET_CLOCK_FREQUENCIES:
+			ClassReply.dwClockFrequency = CCID_DEFAULT_CLOCK;
+			Status = EpBufferSend(InstancePtr->PrivateData, 0,
+					      (u8 *)&ClassReply.dwClockFrequency,
+					      (SetupData->wLength < 4U) ?
+					      SetupData->wLength : 4U);
+			if (Status != XST_SUCCESS) {
+				EpSetStall(InstancePtr->PrivateData, 0,
+					   USB_EP_DIR_OUT);
+			}
+			break;
+
+		case USB_CLASSREQ_CCID_GET_DATA_RATES:
+			ClassReply.dwDataRate = CCID_DEFAULT_DATA_RATE;
+			Status = EpBufferSend(InstancePtr->PrivateData, 0,
+					      (u8 *)&ClassReply.dwDataRate,
+					      (SetupData->wLength < 4U) ?
+					      SetupData->wLength : 4U);
+			if (Status != XST_SUCCESS) {
+				EpSetStall(InstancePtr->PrivateData, 0,
+					   USB_EP_DIR_OUT);
+			}
+			break;
+
+		default:
+			/*
+			 * Unsupported command. Stall the end point.
+			 */
+			EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
+			break;
 	}
-	case USB_SYNC_SCSI:
-	{
-#ifdef CLASS_STORAGE_DEBUG
-		printf("SCSI: SYNCHRONISE_SCSI\r\n");
+}
+
+/*****************************************************************************/
+/**
+* This function receives the next CCID command on the bulk OUT endpoint.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		The request completion processes the command.
+*
+******************************************************************************/
+USB_HOT_TEXT
+s32 CcidRecvCommand(struct Usb_DevData *InstancePtr)
+{
+#ifdef CCID_MEMORY_LIMITED
+	Rx.Active = FALSE;
 #endif
-		SendCSW(InstancePtr, 0);
-		break;
+
+	CcidDev = InstancePtr;
+
+	CommandRequest.BufferPtr = CcidOut;
+	CommandRequest.Length = CCID_BULK_OUT_SIZE;
+	CommandRequest.Complete = CcidCommandDone;
+	CommandRequest.Context = InstancePtr;
+
+	return EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT,
+			       &CommandRequest);
+}
+
+/*****************************************************************************/
+/**
+* This function powers off all slots and drops pending aborts and
+* notifications, on a new configuration of the device. It takes the timer
+* for the time extensions.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void CcidReset(void)
+{
+	u32 Index;
+
+	UsbTimerCancel();
+	WtxTimer = (UsbTimerSetHandler(CcidWtxTimer, NULL) == XST_SUCCESS) ?
+		   TRUE : FALSE;
+
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		if (Slots[Index].Powered != 0U) {
+			Icc->PowerOff((u8)Index);
+		}
+		memset(&Slots[Index], 0, sizeof(Slots[Index]));
+		CcidDefaultParameters(&Slots[Index]);
 	}
+
+	memset(&Notify, 0, sizeof(Notify));
+}
+
+/*****************************************************************************/
+/**
+* This function registers the DMA buffers of the class with the cache
+* layer.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Call before the controller is started.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void CcidCacheRegister(void)
+{
+	UsbCache_RegisterRegion(CcidOut, sizeof(CcidOut), 0U);
+	UsbCache_RegisterRegion(CcidIn, sizeof(CcidIn), 0U);
+	UsbCache_RegisterRegion(CcidReply, sizeof(CcidReply), 0U);
+	UsbCache_RegisterRegion(CcidWtx, sizeof(CcidWtx), 0U);
+	UsbCache_RegisterRegion(&ClassReply, sizeof(ClassReply), 0U);
+	UsbCache_RegisterRegion(CcidNotify, sizeof(CcidNotify), 0U);
+}
+
+/*****************************************************************************/
+/**
+* This function selects the card backend of the reader.
+*
+* @param	OpsPtr is the backend, NULL for the default card.
+*
+* @return	None.
+*
+* @note		Call before the controller is started.
+*
+******************************************************************************/
+void Ccid_SetIcc(const Ccid_IccOps *OpsPtr)
+{
+	Icc = (OpsPtr != NULL) ? OpsPtr : &CcidNullIcc;
+}
+
+/*****************************************************************************/
+/**
+* This function returns the command counters of the class.
+*
+* @param	StatsPtr is filled with the counters.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void Ccid_GetStats(Ccid_Stats *StatsPtr)
+{
+	*StatsPtr = Stats;
+}
+
+/*****************************************************************************/
+/**
+* This function completes the commands of busy slots: their card is asked
+* for the response again, which is sent once it is there. A command aborted
+* by the host in the meantime is dropped and fails. Without a timer for
+* them, time extensions are sent here as they fall due while the card is
+* still busy.
+*
+* @param	None.
+*
+* @return	Number of busy slots, 0 when there is nothing to do.
+*
+* @note		Call from the main loop.
+*
+******************************************************************************/
+u32 Ccid_Poll(void)
+{
+	CCID_BulkInMessage *RspPtr;
+	CcidSlot *SlotPtr;
+	u64 Now = 0U;
+	u32 Busy = 0U;
+	u32 Length;
+	u32 Index;
+	u32 Flags;
+
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		SlotPtr = &Slots[Index];
+		if (SlotPtr->State != CCID_SLOT_BUSY) {
+			continue;
+		}
+
+		Busy++;
+		if (SlotPtr->WtxPending == TRUE) {
+			/* The response waits for the time extension */
+			continue;
+		}
+
+		Flags = UsbIrqSave();
+		if (SlotPtr->State != CCID_SLOT_BUSY) {
+			/* Aborted while waiting for the lock */
+			UsbIrqRestore(Flags);
+			continue;
+		}
+		if (SlotPtr->Abort == CCID_ABORT_REQUEST) {
+			/* The ABORT request names the Abort, not this command */
+			CcidCancel(CcidDev, Index);
+			UsbIrqRestore(Flags);
+			continue;
+		}
+		RspPtr = CcidResponse(Index);
+		SlotPtr->State = CCID_SLOT_IDLE;
+		Length = CcidXfrNext(SlotPtr, (u8)Index, RspPtr,
+				     SlotPtr->BusyFirst);
+		if (SlotPtr->State != CCID_SLOT_BUSY) {
+			Stats.Deferred++;
+			CcidFinish(CcidDev, Index, Length);
+		} else if (WtxTimer == FALSE) {
+			/* One time stamp for all slots of the pass */
+			Now = (Now == 0U) ? UsbGetTicks() : Now;
+			if (Now >= SlotPtr->WtxTicks) {
+				CcidSendWtx(CcidDev, Index);
+				SlotPtr->WtxTicks = Now +
+						    CcidWtxInterval(SlotPtr);
+			}
+		}
+		UsbIrqRestore(Flags);
 	}
+
+	return Busy;
 }
 
 /****************************************************************************/
 /**
- * This function is used to send SCSI Command Status Wrapper to Host.
- *
- * @param	InstancePtr is pointer to Usb_DevData instance.
- * @param	Length is the data residue.
- *
- * @return	None
- *
- * @note
- *
- *****************************************************************************/
-void SendCSW(struct Usb_DevData *InstancePtr, u32 Length)
+* Sends the next notification if the interrupt IN endpoint is free. Hardware
+* errors go first, then one NotifySlotChange for all slots changed so far.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called with interrupts disabled or in interrupt context.
+*
+*****************************************************************************/
+static void CcidNotifySend(void)
 {
-	CSW.dCSWSignature = 0x53425355;
-	CSW.dCSWTag = CBW.dCBWTag;
-	CSW.dCSWDataResidue = Length;
-	CSW.bCSWStatus = 0;
-	Phase = USB_EP_STATE_STATUS;
-	EpBufferSend(InstancePtr->PrivateData, 1, (u8 *)&CSW, 13);
+	u32 Length;
+	u32 Index;
+	u32 Bits;
+
+	if (Notify.Ready == FALSE || Notify.Busy == TRUE) {
+		return;
+	}
+
+	if (Notify.Errors != 0U) {
+		for (Index = 0U; (Notify.Errors & (1U << Index)) == 0U;
+		     Index++) {
+		}
+		Notify.Errors &= ~(1U << Index);
+		CcidNotify[0] = CCID_RDR_TO_PC_HARDWARE_ERROR;
+		CcidNotify[1] = (u8)Index;
+		CcidNotify[2] = CcidResponse(Index)->bSeq;
+		CcidNotify[3] = Notify.ErrorCode[Index];
+		Length = 4U;
+	} else if (Notify.Changed != 0U) {
+		CcidNotify[0] = CCID_RDR_TO_PC_NOTIFY_SLOT_CHANGE;
+		memset(&CcidNotify[1], 0, CCID_NOTIFY_BITMAP_SIZE);
+		for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+			Bits = (Icc->Present((u8)Index) != 0U) ?
+			       CCID_SLOT_ICC_PRESENT : 0U;
+			if ((Notify.Changed & (1U << Index)) != 0U) {
+				Bits |= CCID_SLOT_ICC_CHANGED;
+			}
+			CcidNotify[1U + Index / 4U] |=
+				(u8)(Bits << ((Index % 4U) * 2U));
+		}
+		Notify.Changed = 0U;
+		Length = 1U + CCID_NOTIFY_BITMAP_SIZE;
+	} else {
+		return;
+	}
+
+	NotifyRequest.BufferPtr = CcidNotify;
+	NotifyRequest.Length = Length;
+	NotifyRequest.Complete = CcidNotifyDone;
+	NotifyRequest.Context = NULL;
+	if (EpRequestSubmit(CcidDev->PrivateData, CCID_NOTIFY_EP, USB_EP_DIR_IN,
+			    &NotifyRequest) == XST_SUCCESS) {
+		Notify.Busy = TRUE;
+		Stats.Notifications++;
+	}
 }
 
-bool isLastBulkOutAbort(struct Usb_DevData *InstancePtr, u8 slotNum, u8 seqNum)
+/****************************************************************************/
+/**
+* Completion of a notification. The host polls the endpoint once per
+* bInterval, what changed in the meantime is sent now.
+*
+* @param	RequestPtr is the completed request.
+*
+* @return	None
+*
+* @note		Called in interrupt context.
+*
+*****************************************************************************/
+static void CcidNotifyDone(Usb_EpRequest *RequestPtr)
 {
-	if (slotNum >= MAX_SLOTS)
-	{
-		return false; // Invalid slot
+	Notify.Busy = FALSE;
+	if (RequestPtr->Status == XST_SUCCESS) {
+		CcidNotifySend();
 	}
+}
 
-	return (slotStates[slotNum].lastBulkOutCommand == PC_TO_RDR_ABORT &&
-			slotStates[slotNum].lastBulkOutSeqNum == seqNum);
+/*****************************************************************************/
+/**
+* This function starts the notifications on the interrupt IN endpoint, with
+* a NotifySlotChange for the cards present.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+*
+* @return	None.
+*
+* @note		Call after SET_CONFIGURATION, once the endpoint is enabled.
+*
+******************************************************************************/
+void CcidStartNotify(struct Usb_DevData *InstancePtr)
+{
+	u32 Index;
+	u32 Flags;
+
+	Flags = UsbIrqSave();
+	CcidDev = InstancePtr;
+	for (Index = 0U; Index < CCID_MAX_SLOTS; Index++) {
+		if (Icc->Present((u8)Index) != 0U) {
+			Notify.Changed |= 1U << Index;
+		}
+	}
+	Notify.Ready = TRUE;
+	CcidNotifySend();
+	UsbIrqRestore(Flags);
 }
 
-void acknowledgeAbort(struct Usb_DevData *InstancePtr, u8 slotNum)
+/*****************************************************************************/
+/**
+* This function is called by the card backend when a card is inserted in or
+* removed from a slot. A removed card is powered off.
+*
+* @param	Slot is the slot number.
+*
+* @return	None.
+*
+* @note		May be called in interrupt context.
+*
+******************************************************************************/
+void Ccid_SlotChange(u8 Slot)
 {
-	// Construct and send your RDR_to_PC_SlotStatus response here
+	u32 Flags;
+
+	if (Slot >= CCID_MAX_SLOTS) {
+		return;
+	}
+
+	Flags = UsbIrqSave();
+	if (Icc->Present(Slot) == 0U) {
+		Slots[Slot].Powered = 0U;
+	}
+	Notify.Changed |= 1U << Slot;
+	Stats.SlotChanges++;
+	CcidNotifySend();
+	UsbIrqRestore(Flags);
 }
 
-void setBulkOutFailureFlag(struct Usb_DevData *InstancePtr, u8 slotNum)
+/*****************************************************************************/
+/**
+* This function is called by the card backend on a hardware error of a slot,
+* it is reported to the host with RDR_to_PC_HardwareError.
+*
+* @param	Slot is the slot number.
+* @param	Error is bHardwareErrorCode, e.g. CCID_HW_ERROR_OVERCURRENT.
+*
+* @return	None.
+*
+* @note		May be called in interrupt context.
+*
+******************************************************************************/
+void Ccid_HardwareError(u8 Slot, u8 Error)
 {
-	if (slotNum >= MAX_SLOTS)
-	{
-		return; // Invalid slot
+	u32 Flags;
+
+	if (Slot >= CCID_MAX_SLOTS) {
+		return;
 	}
-	slotStates[slotNum].isFailingBulkOut = true;
+
+	Flags = UsbIrqSave();
+	Notify.Errors |= 1U << Slot;
+	Notify.ErrorCode[Slot] = Error;
+	CcidNotifySend();
+	UsbIrqRestore(Flags);
+}
+
+/****************************************************************************/
+/**
+* The default card.
+*
+*****************************************************************************/
+static u32 CcidNullPresent(u8 Slot)
+{
+	(void)Slot;
+
+	return 1U;
 }
 
-void handleAbortRequest(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
+static u32 CcidNullPowerOn(u8 Slot, u8 *AtrPtr, u32 AtrMax)
 {
-	u8 slotNum = SetupData->wValue & 0xFF; // Extract slot number
-	u8 seqNum = SetupData->wValue >> 8;	   // Extract sequence number
+	/* TS, T0, TD1 (T=0), TD2 (T=1), TCK */
+	static const u8 Atr[] = { 0x3B, 0x80, 0x80, 0x01, 0x01 };
 
-	// 1. Check if the last Bulk-OUT message for 'slotNum' matches 'seqNum'
-	if (isLastBulkOutAbort(InstancePtr, slotNum, seqNum))
-	{
-		// Acknowledge the abort (details depend on your communication protocol)
-		acknowledgeAbort(InstancePtr, slotNum);
+	(void)Slot;
+
+	if (AtrMax < sizeof(Atr)) {
+		return 0U;
 	}
-	else
-	{
-		// Set a flag to start failing Bulk-OUT commands for 'slotNum'
-		setBulkOutFailureFlag(InstancePtr, slotNum);
+
+	memcpy(AtrPtr, Atr, sizeof(Atr));
+
+	return sizeof(Atr);
+}
+
+static void CcidNullPowerOff(u8 Slot)
+{
+	(void)Slot;
+}
+
+USB_HOT_TEXT
+static s32 CcidNullXfr(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+		       u32 RspMax, u32 *RspLenPtr)
+{
+	(void)Slot;
+	(void)CmdPtr;
+	(void)CmdLen;
+
+	if (RspMax < 2U) {
+		return XST_FAILURE;
 	}
 
-	// Send standard control transfer success response
-	EpBufferSend(InstancePtr->PrivateData, 0, NULL, 0);
+	RspPtr[0] = 0x90;
+	RspPtr[1] = 0x00;
+	*RspLenPtr = 2U;
+
+	return XST_SUCCESS;
+}
+
+USB_HOT_TEXT
+static s32 CcidNullXfrPut(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last)
+{
+	(void)Slot;
+	(void)CmdPtr;
+	(void)CmdLen;
+	(void)Last;
+
+	return XST_SUCCESS;
+}
+
+USB_HOT_TEXT
+static s32 CcidNullXfrGet(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+			  u32 *MorePtr)
+{
+	*MorePtr = FALSE;
+
+	return CcidNullXfr(Slot, NULL, 0U, RspPtr, RspMax, RspLenPtr);
 }
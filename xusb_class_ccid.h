@@ -9,7 +9,31 @@
  *
  * @file xusb_class_ccid.h
  *
- * This file contains definitions used in the Mass Storage class code.
+ * This file contains definitions used in the CCID (smart card reader) class
+ * code, see the USB CCID specification rev 1.1.
+ *
+ * CCID commands and their responses travel on the bulk endpoints. A command
+ * is received into a DMA buffer and decoded in place: the 10 byte header is
+ * read through CCID_BulkOutMessage, the command data follows it in the same
+ * buffer. The response is built directly in the bulk IN buffer.
+ *
+ * Each of the CCID_MAX_SLOTS slots has its own response buffer and command
+ * state, so a card that takes long to answer holds up its slot only.
+ *
+ * Card insertion and removal, reported by the backend with Ccid_SlotChange(),
+ * and hardware errors go to the host on the interrupt IN endpoint. One
+ * message is in flight at a time, the changes seen meanwhile are merged
+ * into the next NotifySlotChange, so there is at most one per bInterval.
+ *
+ * The card itself is reached through a Ccid_IccOps backend registered with
+ * Ccid_SetIcc(). APDUs longer than one message are chained: each part goes
+ * through the message buffers on its way to or from the card, so only
+ * MAX_DATA_SIZE bytes are buffered whatever the length of the APDU.
+ *
+ * With CCID_MEMORY_LIMITED the OUT buffer holds one packet and each IN
+ * buffer one full short APDU response, under 2 KiB in all. A command is
+ * received a packet at a time, only its header is kept and the data of an
+ * XfrBlock goes to the card as it arrives. Longer responses are chained.
  *
  * <pre>
  * MODIFICATION HISTORY:
@@ -28,8 +52,7 @@
 #define XUSB_CLASS_CCID_H
 
 #ifdef __cplusplus
-extern "C"
-{
+extern "C" {
 #endif
 
 /***************************** Include Files *********************************/
@@ -39,325 +62,304 @@ extern "C"
 
 /************************** Constant Definitions *****************************/
 /*
- * Mass storage opcodes.
+ * Bulk OUT messages, PC_to_RDR_*
  */
-#define USB_RBC_TEST_UNIT_READY 0x00
-#define USB_RBC_REQUEST_SENSE 0x03
-#define USB_RBC_FORMAT 0x04
-#define USB_RBC_INQUIRY 0x12
-#define USB_RBC_MODE_SELECT 0x15
-#define USB_RBC_MODE_SENSE 0x1a
-#define USB_RBC_STARTSTOP_UNIT 0x1b
-#define USB_RBC_MEDIUM_REMOVAL 0x1e
-#define USB_UFI_GET_CAP_LIST 0x23
-#define USB_RBC_READ_CAP 0x25
-#define USB_RBC_READ 0x28
-#define USB_RBC_WRITE 0x2a
-#define USB_RBC_VERIFY 0x2f
-#define USB_SYNC_SCSI 0x35
-
-/* Virtual Flash memory related definitions.
+#define CCID_PC_TO_RDR_SET_PARAMETERS		0x61
+#define CCID_PC_TO_RDR_ICC_POWER_ON		0x62
+#define CCID_PC_TO_RDR_ICC_POWER_OFF		0x63
+#define CCID_PC_TO_RDR_GET_SLOT_STATUS		0x65
+#define CCID_PC_TO_RDR_SECURE			0x69
+#define CCID_PC_TO_RDR_T0_APDU			0x6A
+#define CCID_PC_TO_RDR_ESCAPE			0x6B
+#define CCID_PC_TO_RDR_GET_PARAMETERS		0x6C
+#define CCID_PC_TO_RDR_RESET_PARAMETERS		0x6D
+#define CCID_PC_TO_RDR_ICC_CLOCK		0x6E
+#define CCID_PC_TO_RDR_XFR_BLOCK		0x6F
+#define CCID_PC_TO_RDR_MECHANICAL		0x71
+#define CCID_PC_TO_RDR_ABORT			0x72
+#define CCID_PC_TO_RDR_SET_DATA_RATE		0x73
+
+#define CCID_PC_TO_RDR_FIRST			CCID_PC_TO_RDR_SET_PARAMETERS
+#define CCID_PC_TO_RDR_LAST			CCID_PC_TO_RDR_SET_DATA_RATE
+
+/*
+ * Bulk IN messages, RDR_to_PC_*
  */
-#ifdef __MICROBLAZE__
-/* 16MB due to limited memory on AXIUSB platform. */
-#define VFLASH_SIZE 0x1000000 /* 16MB space */
-#else
-#define VFLASH_SIZE 0x10000000 /* 256MB space */
-#endif
-#define VFLASH_BLOCK_SIZE 0x200
-#define VFLASH_NUM_BLOCKS (VFLASH_SIZE / VFLASH_BLOCK_SIZE)
+#define CCID_RDR_TO_PC_DATA_BLOCK		0x80
+#define CCID_RDR_TO_PC_SLOT_STATUS		0x81
+#define CCID_RDR_TO_PC_PARAMETERS		0x82
+#define CCID_RDR_TO_PC_ESCAPE			0x83
+#define CCID_RDR_TO_PC_DATA_RATE		0x84
+
+/*
+ * Interrupt IN messages, RDR_to_PC_*
+ */
+#define CCID_RDR_TO_PC_NOTIFY_SLOT_CHANGE	0x50
+#define CCID_RDR_TO_PC_HARDWARE_ERROR		0x51
+
+/* bHardwareErrorCode */
+#define CCID_HW_ERROR_OVERCURRENT		0x01
+
+/* bmSlotICCState, 2 bits per slot */
+#define CCID_SLOT_ICC_PRESENT			0x01
+#define CCID_SLOT_ICC_CHANGED			0x02
 
-/* Class request opcodes.
+/*
+ * bStatus of a response: bmICCStatus and bmCommandStatus
  */
-#define USB_CLASSREQ_MASS_STORAGE_RESET 0xFF
-#define USB_CLASSREQ_GET_MAX_LUN 0xFE
+#define CCID_ICC_ACTIVE				0x00
+#define CCID_ICC_INACTIVE			0x01
+#define CCID_ICC_ABSENT				0x02
+
+#define CCID_CMD_PROCESSED			0x00
+#define CCID_CMD_FAILED				0x40
+#define CCID_CMD_TIME_EXTENSION			0x80
+#define CCID_CMD_STATUS_MASK			0xC0
 
-/* SCSI machine states
+/*
+ * bError of a failed command. Values 1 to 127 are the offset of the
+ * message field found invalid.
  */
-#define USB_EP_STATE_COMMAND 0
-#define USB_EP_STATE_DATA_IN 1
-#define USB_EP_STATE_DATA_OUT 2
-#define USB_EP_STATE_STATUS 3
+#define CCID_ERR_CMD_NOT_SUPPORTED		0x00
+#define CCID_ERR_OFFSET_LENGTH			1
+#define CCID_ERR_OFFSET_SLOT			5
+#define CCID_ERR_OFFSET_PARAM			7	/* First specific byte */
+#define CCID_ERR_OFFSET_LEVEL			8	/* wLevelParameter */
+#define CCID_ERR_CMD_SLOT_BUSY			0xE0
+#define CCID_ERR_ICC_PROTOCOL_NOT_SUPPORTED	0xF6
+#define CCID_ERR_HW_ERROR			0xFB
+#define CCID_ERR_XFR_OVERRUN			0xFC
+#define CCID_ERR_ICC_MUTE			0xFE
+#define CCID_ERR_CMD_ABORTED			0xFF
 
-	/**************************** Type Definitions ******************************/
+/*
+ * Class requests
+ */
+#define USB_CLASSREQ_CCID_ABORT			0x01
+#define USB_CLASSREQ_CCID_GET_CLOCK_FREQUENCIES	0x02
+#define USB_CLASSREQ_CCID_GET_DATA_RATES	0x03
+
+/* wLevelParameter of XfrBlock with APDU level exchanges */
+#define CCID_LEVEL_SINGLE			0x0000	/* Whole APDU */
+#define CCID_LEVEL_BEGIN			0x0001	/* First part */
+#define CCID_LEVEL_END				0x0002	/* Last part */
+#define CCID_LEVEL_CONTINUE			0x0003	/* Middle part */
+#define CCID_LEVEL_NEXT_RESPONSE		0x0010	/* Next part of response */
+
+/* bChainParameter of DataBlock */
+#define CCID_CHAIN_SINGLE			0x00	/* Whole response */
+#define CCID_CHAIN_BEGIN			0x01	/* First part */
+#define CCID_CHAIN_END				0x02	/* Last part */
+#define CCID_CHAIN_CONTINUE			0x03	/* Middle part */
+#define CCID_CHAIN_NEXT_COMMAND			0x10	/* Send next part */
+
+/* Protocols, bProtocolNum */
+#define CCID_PROTOCOL_T0			0x00
+#define CCID_PROTOCOL_T1			0x01
+
+#define CCID_HEADER_SIZE			10U
+#define CCID_MAX_MESSAGE_SIZE			(CCID_HEADER_SIZE + MAX_DATA_SIZE)
+
+/* Largest bulk packet, SuperSpeed */
+#define CCID_PACKET_SIZE			1024U
+
+/*
+ * Bulk buffers, whole packets so that an OUT transfer can take any message.
+ * CCID_RSP_DATA_SIZE is the response data that fits one message. In the
+ * limited build an IN buffer takes a short APDU response, 256 bytes and
+ * SW1-SW2, in whole cache lines.
+ */
+#ifdef CCID_MEMORY_LIMITED
+#define CCID_BULK_OUT_SIZE			CCID_PACKET_SIZE
+#define CCID_BULK_IN_SIZE	((CCID_HEADER_SIZE + 258U + 63U) & ~63U)
+#define CCID_RSP_DATA_SIZE	(CCID_BULK_IN_SIZE - CCID_HEADER_SIZE)
+#else
+#define CCID_BULK_OUT_SIZE	((CCID_MAX_MESSAGE_SIZE + 1023U) & ~1023U)
+#define CCID_BULK_IN_SIZE			CCID_BULK_OUT_SIZE
+#define CCID_RSP_DATA_SIZE			MAX_DATA_SIZE
+#endif
+
+/* Interrupt IN endpoint of the notifications */
+#define CCID_NOTIFY_EP				2U
+#define CCID_NOTIFY_PACKET_SIZE			8U
+#define CCID_NOTIFY_BITMAP_SIZE			((2U * CCID_MAX_SLOTS + 7U) / 8U)
+
+/* Clock and data rate of the emulated interface, kHz and bps */
+#define CCID_DEFAULT_CLOCK			3580U
+#define CCID_DEFAULT_DATA_RATE			9600U
+
+/**************************** Type Definitions ******************************/
 
 #ifdef __ICCARM__
 #pragma pack(push, 1)
 #endif
 
-	// Payload for PC_to_RDR_IccPowerOn
-	typedef struct
-	{
-		u8 bPowerSelect; // 00h: Auto, 01h: 5V, 02h: 3V, 03h: 1.8V
-		u8 abRFU[2];	 // Reserved for future use
-	} PC_to_RDR_IccPowerOnPayload;
-
-	// Payload for PC_to_RDR_IccPowerOff, PC_to_RDR_GetSlotStatus, PC_to_RDR_GetParameters, PC_to_RDR_ResetParameters, PC_to_RDR_IccClock
-	typedef struct
-	{
-		u8 abRFU[3]; // Reserved
-	} NoPayload;
-
-	// Payload for PC_to_RDR_Mechanical
-	typedef struct
-	{
-		u8 abRFU[2];
-	} NoPayload1;
-
-	// Payload for PC_to_RDR_XfrBlock
-	typedef struct
-	{
-		u8 bBWI;
-		u16 wLevelParameter;
-		u8 abData[MAX_DATA_SIZE]; // Replace MAX_DATA_SIZE with the appropriate size
-	} PC_to_RDR_XfrBlockPayload;
-
-	// Payload for PC_to_RDR_T0APDU
-	typedef struct
-	{
-		u8 bmChanges;
-		u8 bClassGetResponse;
-		u8 bClassEnvelope;
-	} PC_to_RDR_T0APDU_Payload;
-
-	// payload varies based on the protocol
-	typedef struct
-	{
-		u8 bmFindexDindex;
-		u8 bmTCCKST0;
-		u8 bGuardTimeT0;
-		u8 bWaitingIntegerT0;
-		u8 bClockStop;
-	} ProtocolDataStructureT0;
-
-	typedef struct
-	{
-		u8 bmFindexDindex;
-		u8 bmTCCKST1;
-		u8 bGuardTimeT1;
-		u8 bmWaitingIntegersT1;
-		u8 bClockStop;
-		u8 bIFSC;
-		u8 bNadValue;
-	} ProtocolDataStructureT1;
-
-	// Payload for PC_to_RDR_Escape
-	typedef struct
-	{
-		u8 abData[MAX_ESCAPE_DATA_SIZE];
-	} PC_to_RDR_EscapePayload;
-
-	typedef struct
-	{
-		u8 bTimeOut;
-		u8 bmFormatString;
-		u8 bmPINBlockString;
-		u8 bmPINLengthFormat;
-		u16 wPINMaxExtraDigit;
-		u8 bEntryValidationCondition;
-		u8 bNumberMessage;
-		u16 wLangID;
-		u8 bMsgIndex;
-		u8 bTeoPrologue[3]; // For T=1
-							// abPINApduByte would be a dynamically sized array,
-							// handle its allocation separately
-	} PINVerificationDataStructure;
-
-	typedef struct
-	{
-		// ... similar fields as PINVerificationDataStructure ...
-		u8 bInsertionOffsetOld;
-		u8 bInsertionOffsetNew;
-		u8 bConfirmPIN;
-		// ... other fields ...
-	} PINModificationDataStructure;
-
-	typedef struct
-	{
-		u8 bPINOperation;
-		union
-		{
-			PINVerificationDataStructure verifyData;
-			PINModificationDataStructure modifyData;
-			// Add other operation-specific structs as needed
-		} operationData;
-	} PC_to_RDR_SecurePayload;
-
-	// Payload for PC_to_RDR_SetDataRateAndClockFrequency
-	typedef struct
-	{
-		u32 dwClockFrequency;
-		u32 dwDataRate;
-	} PC_to_RDR_SetDataRateAndClockFrequencyPayload;
-
-	// Message payload for CCID bulk out message
-	typedef union
-	{
-		PC_to_RDR_IccPowerOnPayload powerOnPayload;
-		NoPayload noPayload;
-		NoPayload1 noPayload1;
-		PC_to_RDR_XfrBlockPayload xfrBlockPayload;
-		ProtocolDataStructureT0 protocolDataStructureT0;
-		ProtocolDataStructureT1 protocolDataStructureT1;
-		PC_to_RDR_T0APDU_Payload t0APDUPayload;
-		PC_to_RDR_EscapePayload escapePayload;
-		PINVerificationDataStructure pinVerifyData;
-		PINModificationDataStructure pinModifyData;
-		PC_to_RDR_SecurePayload securePayload;
-		PC_to_RDR_SetDataRateAndClockFrequencyPayload setDataRateAndClockFrequencyPayload;
-	} CCID_MessagePayload;
-
-	typedef struct
-	{
-		u8 bMessageType;			 // Identifies the command type
-		u8 bSlot;					 // Slot number
-		u8 bSeq;					 // Sequence number
-		u32 dwLength;				 // Message-specific data length
-		CCID_MessagePayload payload; // Payload (variable length, interpretation depends on bMessageType)
-	} CCID_BulkOutMessage;
-
-	typedef struct
-	{
-		u8 lastBulkOutCommand;
-		u8 lastBulkOutSeqNum;
-		bool isFailingBulkOut;
-	} SlotState;
-
-	// Response data for RDR_to_PC_DataBlock
-	typedef struct
-	{
-		u8 abData[]; // Flexible array member for dynamic size
-	} RDR_to_PC_DataBlock;
-
-	// Response data for RDR_to_PC_SlotStatus
-	typedef struct
-	{
-		u8 bClockStatus; // Clock status (00h: running, 01h: stopped low, etc.)
-	} RDR_to_PC_SlotStatus;
-
-	typedef struct
-	{
-		u8 bProtocolNum;
-		union
-		{
-			ProtocolDataStructureT0 protocolDataT0;
-			ProtocolDataStructureT1 protocolDataT1;
-		} protocolData;
-	} RDR_to_PC_Parameters;
-
-	typedef struct
-	{
-		u8 abData[MAX_ESCAPE_DATA_SIZE]; // Replace MAX_ESCAPE_DATA_SIZE
-	} RDR_to_PC_Escape;
-
-	typedef struct
-	{
-		u32 dwClockFrequency;
-		u32 dwDataRate;
-	} RDR_to_PC_DataRateAndClockFrequency;
-
-	typedef struct
-	{
-		u8 bMessageType;
-		u32 dwLength;
-		u8 bSlot;
-		u8 bSeq;
-		u8 bStatus;
-		u8 bError;
-		u8 bChainParameter;
-		union
-		{
-			RDR_to_PC_DataBlock dataBlock;	 // For basic data block responses
-			RDR_to_PC_SlotStatus slotStatus; // For slot status responses
-			RDR_to_PC_Parameters parameters; // For parameter responses
-			RDR_to_PC_Escape escapeData;	 // For escape responses
-			RDR_to_PC_DataRateAndClockFrequency dataRateAndClockFrequency;
-		} responseData;
-	} BulkInMessage;
-
-	/*
-	 * The following structures define USB storage class requests. The details of
-	 * the contents of those structures are not important in the context of this
-	 * example.
-	 */
-	typedef struct
-	{
-		u32 dCBWSignature;
-		u32 dCBWTag;
-		u32 dCBWDataTransferLength;
-		u8 bmCBWFlags;
-		u8 cCBWLUN;
-		u8 bCBWCBLength;
-		u8 CBWCB[16];
-	} attribute(USB_CBW);
-
-	typedef struct
-	{
-		u32 dCSWSignature;
-		u32 dCSWTag;
-		u32 dCSWDataResidue;
-		u8 bCSWStatus;
-	} attribute(USB_CSW);
-
-	typedef struct
-	{
-		u8 deviceType;
-		u8 rmb;
-		u8 version;
-		u8 blah;
-		u8 additionalLength;
-		u8 sccs;
-		u8 info0;
-		u8 info1;
-		u8 vendorID[8];
-		u8 productID[16];
-		u8 revision[4];
-	} attribute(SCSI_INQUIRY);
-
-	typedef struct
-	{
-		u8 reserved[3];
-		u8 listLength;
-		u32 numBlocks;
-		u8 descCode;
-		u8 blockLengthMSB;
-		u16 blockLength;
-	} attribute(SCSI_CAP_LIST);
-
-	typedef struct
-	{
-		u32 numBlocks;
-		u32 blockSize;
-	} attribute(SCSI_READ_CAPACITY);
-
-	typedef struct
-	{
-		u8 opCode;
-		u8 reserved1;
-		u32 block;
-		u8 reserved2;
-		u16 length;
-		u8 control;
-	} attribute(SCSI_READ_WRITE);
-
-	typedef struct
-	{
-		u8 opCode;
-		u8 immed;
-		u8 reserved1;
-		u8 reserved2;
-		u8 start;
-		u8 control;
-	} attribute(SCSI_START_STOP);
+/*
+ * Message specific header bytes 7 to 9 of the PC_to_RDR messages
+ */
+typedef struct {
+	u8 bPowerSelect;		/* 00h automatic, 01h 5V, 02h 3V, 03h 1.8V */
+	u8 abRFU[2];
+} attribute(CCID_PowerOnParams);
+
+typedef struct {
+	u8 bBWI;
+	u16 wLevelParameter;
+} attribute(CCID_XfrBlockParams);
+
+typedef struct {
+	u8 bProtocolNum;
+	u8 abRFU[2];
+} attribute(CCID_SetParametersParams);
+
+typedef struct {
+	u8 bClockCommand;
+	u8 abRFU[2];
+} attribute(CCID_IccClockParams);
+
+typedef struct {
+	u8 bmChanges;
+	u8 bClassGetResponse;
+	u8 bClassEnvelope;
+} attribute(CCID_T0ApduParams);
+
+typedef struct {
+	u8 bFunction;
+	u8 abRFU[2];
+} attribute(CCID_MechanicalParams);
+
+typedef union {
+	u8 abRFU[3];
+	CCID_PowerOnParams PowerOn;
+	CCID_XfrBlockParams XfrBlock;
+	CCID_SetParametersParams SetParameters;
+	CCID_IccClockParams IccClock;
+	CCID_T0ApduParams T0Apdu;
+	CCID_MechanicalParams Mechanical;
+} attribute(CCID_MessageParams);
+
+/*
+ * Header of a bulk OUT message. The dwLength bytes of command data follow
+ * it in the receive buffer, see CCID_MSG_DATA().
+ */
+typedef struct {
+	u8 bMessageType;
+	u32 dwLength;
+	u8 bSlot;
+	u8 bSeq;
+	CCID_MessageParams Params;
+} attribute(CCID_BulkOutMessage);
+
+/*
+ * Header of a bulk IN message, the response data follows it
+ */
+typedef struct {
+	u8 bMessageType;
+	u32 dwLength;
+	u8 bSlot;
+	u8 bSeq;
+	u8 bStatus;
+	u8 bError;
+	u8 bSpecific;		/* bChainParameter, bClockStatus, bProtocolNum */
+} attribute(CCID_BulkInMessage);
+
+/*
+ * Protocol data of SetParameters and RDR_to_PC_Parameters
+ */
+typedef struct {
+	u8 bmFindexDindex;
+	u8 bmTCCKST0;
+	u8 bGuardTimeT0;
+	u8 bWaitingIntegerT0;
+	u8 bClockStop;
+} attribute(CCID_ProtocolT0);
+
+typedef struct {
+	u8 bmFindexDindex;
+	u8 bmTCCKST1;
+	u8 bGuardTimeT1;
+	u8 bmWaitingIntegersT1;
+	u8 bClockStop;
+	u8 bIFSC;
+	u8 bNadValue;
+} attribute(CCID_ProtocolT1);
+
+typedef struct {
+	u32 dwClockFrequency;
+	u32 dwDataRate;
+} attribute(CCID_DataRate);
 
 #ifdef __ICCARM__
 #pragma pack(pop)
 #endif
 
-	/************************** Function Prototypes ******************************/
-	void ClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData);
-	void ParseCBW(struct Usb_DevData *InstancePtr);
-	void SendCSW(struct Usb_DevData *InstancePtr, u32 Length);
+/*
+ * Card backend of the reader. PowerOn returns the ATR length, 0 if the card
+ * does not answer. Xfr exchanges one APDU that fits a message each way and
+ * returns XST_SUCCESS or XST_FAILURE for a mute card.
+ *
+ * A backend that streams APDUs sets XfrPut and XfrGet, they are then used
+ * for all exchanges. XfrPut takes the command in parts, the card runs it
+ * when Last is set. A part of 0 bytes without Last drops the parts taken so
+ * far, or the command the card is running. XfrGet returns the response in
+ * parts of up to RspMax bytes and sets *MorePtr while parts are left. It
+ * returns XST_DEVICE_BUSY while the card is still running the command, the
+ * slot then stays busy and Ccid_Poll() asks again while time extensions go
+ * to the host. Xfr may be NULL then.
+ *
+ * Xfr and XfrPut run in the USB interrupt. No time extension reaches the
+ * host while they do, so Xfr has to answer within half the waiting time of
+ * the slot, BWT or WWT. Ccid_Stats.SlowXfr counts the exchanges that took
+ * longer. A card that can be slower has to stream and return
+ * XST_DEVICE_BUSY until it is done.
+ *
+ * The reader announces the extended APDU level, which the host reaches by
+ * chaining XfrBlock messages. Backends with Xfr only take APDUs of one
+ * message, with CCID_MEMORY_LIMITED of one packet, and fail chained ones.
+ * The default and virtual cards stream.
+ */
+typedef struct {
+	u32 (*Present)(u8 Slot);
+	u32 (*PowerOn)(u8 Slot, u8 *AtrPtr, u32 AtrMax);
+	void (*PowerOff)(u8 Slot);
+	s32 (*Xfr)(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u8 *RspPtr,
+		   u32 RspMax, u32 *RspLenPtr);
+	s32 (*XfrPut)(u8 Slot, const u8 *CmdPtr, u32 CmdLen, u32 Last);
+	s32 (*XfrGet)(u8 Slot, u8 *RspPtr, u32 RspMax, u32 *RspLenPtr,
+		      u32 *MorePtr);
+} Ccid_IccOps;
+
+typedef struct {
+	u32 Commands;		/* Bulk OUT messages processed */
+	u32 Failed;		/* Responses with CCID_CMD_FAILED */
+	u32 Apdus;		/* XfrBlock exchanges with the card */
+	u32 Chained;		/* Of those, exchanges of several messages */
+	u32 Malformed;		/* Messages shorter than their header says */
+	u32 Streamed;		/* Messages received in several packets */
+	u32 SlotBusy;		/* Commands for a slot still busy */
+	u32 Deferred;		/* Responses sent by Ccid_Poll() */
+	u32 Aborted;		/* Busy commands failed by an abort */
+	u32 TimeExtensions;	/* DataBlocks with CCID_CMD_TIME_EXTENSION */
+	u32 SlowXfr;		/* Xfr calls longer than a time extension */
+	u32 Unsent;		/* Responses the bulk IN endpoint did not take */
+	u32 SlotChanges;	/* Reported by Ccid_SlotChange() */
+	u32 Notifications;	/* Interrupt IN messages sent */
+} Ccid_Stats;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define CCID_MSG_DATA(MsgPtr)	((u8 *)(MsgPtr) + CCID_HEADER_SIZE)
+
+/************************** Function Prototypes ******************************/
+void CcidClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData);
+s32 CcidRecvCommand(struct Usb_DevData *InstancePtr);
+void CcidReset(void);
+void CcidCacheRegister(void);
+void Ccid_SetIcc(const Ccid_IccOps *OpsPtr);
+void Ccid_GetStats(Ccid_Stats *StatsPtr);
+u32 Ccid_Poll(void);
+void CcidStartNotify(struct Usb_DevData *InstancePtr);
+void Ccid_SlotChange(u8 Slot);
+void Ccid_HardwareError(u8 Slot, u8 Error);
 
 #ifdef __cplusplus
 }
@@ -34,6 +34,15 @@
 #include "xusb_class_storage.h"
 #include "xparameters.h"
 #include "xusb_ch9_storage.h"
+#ifdef VFLASH_DEDUP
+#include "xusb_storage_dedup.h"
+#endif
+#include "xusb_cache.h"
+#include "xusb_dma_pool.h"
+#include "xusb_event.h"
+#include "xusb_trace.h"
+#include "xusb_telemetry.h"
+#include <string.h>
 
 /************************** Constant Definitions *****************************/
 
@@ -42,6 +51,17 @@
 /**************************** Type Definitions *******************************/
 
 /************************** Function Prototypes ******************************/
+static void StorageDataDone(Usb_EpRequest *RequestPtr);
+static void StorageSendCSW(struct Usb_DevData *InstancePtr, u32 Length,
+			   u8 Status);
+static void StorageFail(struct Usb_DevData *InstancePtr, u32 Residue,
+			u8 Key, u8 Asc);
+#ifdef VFLASH_DEDUP
+static u32 StorageDedupDataIn(struct Usb_DevData *InstancePtr);
+static void StorageDedupDataOut(struct Usb_DevData *InstancePtr, u32 BytesTxed);
+static void StorageDedupCommitted(void *Context, s32 Status);
+static void StorageDedupEnd(struct Usb_DevData *InstancePtr);
+#endif
 
 /************************** Variable Definitions *****************************/
 extern u8 Phase;
@@ -97,20 +117,151 @@ static u8 MaxLUN ALIGNMENT_CACHELINE = 0;
 extern USB_CBW CBW;
 extern USB_CSW CSW;
 
-extern u32	rxBytesLeft;
-extern u8	*VirtFlashWritePointer;
+/* Requests of the bulk-only transport stages */
+static Usb_EpRequest CbwRequest USB_HOT_BSS;
+static Usb_EpRequest DataRequest USB_HOT_BSS;
+static Usb_EpRequest CswRequest USB_HOT_BSS;
+
+/* Local transmit buffer for simple replies, allocated from the DMA pool. */
+static u8 *txBuffer;
+
+/* Sense of the last failed command, returned by REQUEST SENSE */
+static u8 SenseKey;
+static u8 SenseAsc;
 
-/* Local transmit buffer for simple replies. */
+
+#ifdef VFLASH_DEDUP
+/* Staging window for the data phase of READ/WRITE with the dedup backend. */
 #ifdef __ICCARM__
-static u8 txBuffer[128];
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
 #else
-static u8 txBuffer[128] ALIGNMENT_CACHELINE;
+#pragma data_alignment = 32
 #endif
+static u8 DedupWindow[VFLASH_DEDUP_WINDOW_SIZE];
+#else
+static u8 DedupWindow[VFLASH_DEDUP_WINDOW_SIZE] ALIGNMENT_CACHELINE;
+#endif
+/* Pool segments of the READ window being sent, see VFlashDedup_ReadV() */
+static Usb_IoVec DedupVec[USB_EP_QUEUE_DEPTH];
+static u32 DedupOffset;
+static u32 DedupBytesLeft;
+static u32 DedupWindowBytes;	/* Bytes of the window being committed */
+static u8 DedupFailed;	/* Sense key of a failed window, or 0 */
+static u8 DedupAsc;
+#endif
+
+
+/****************************************************************************/
+/**
+* These functions submit the data stage of a command.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	BufferPtr is the data buffer.
+* @param	Length is the length of the data.
+* @param	Complete is called when the data stage is done.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static s32 StorageDataIn(struct Usb_DevData *InstancePtr, u8 *BufferPtr,
+			 u32 Length, void (*Complete)(Usb_EpRequest *))
+{
+	DataRequest.BufferPtr = BufferPtr;
+	DataRequest.Length = Length;
+	DataRequest.Complete = Complete;
+	DataRequest.Context = InstancePtr;
+
+	return EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_IN,
+			       &DataRequest);
+}
+
+USB_HOT_TEXT
+static s32 StorageDataOut(struct Usb_DevData *InstancePtr, u8 *BufferPtr,
+			  u32 Length, void (*Complete)(Usb_EpRequest *))
+{
+	DataRequest.BufferPtr = BufferPtr;
+	DataRequest.Length = Length;
+	DataRequest.Complete = Complete;
+	DataRequest.Context = InstancePtr;
+
+	return EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT,
+			       &DataRequest);
+}
 
+/****************************************************************************/
+/**
+* Completion callbacks of the bulk-only transport stages. Each stage knows
+* what it completed, so no global phase has to be decoded. Flushed requests
+* complete with a failure status and end the sequence, it is restarted by
+* the next SET_CONFIGURATION.
+*
+* @param	RequestPtr is the completed request.
+*
+* @return	None
+*
+* @note		Called in interrupt context.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+static void StorageCbwDone(Usb_EpRequest *RequestPtr)
+{
+	if (RequestPtr->Status == XST_SUCCESS) {
+		ParseCBW((struct Usb_DevData *)RequestPtr->Context);
+	}
+}
+
+USB_HOT_TEXT
+static void StorageDataDone(Usb_EpRequest *RequestPtr)
+{
+	if (RequestPtr->Status == XST_SUCCESS) {
+		SendCSW((struct Usb_DevData *)RequestPtr->Context, 0);
+	}
+}
+
+USB_HOT_TEXT
+static void StorageCswDone(Usb_EpRequest *RequestPtr)
+{
+	if (RequestPtr->Status == XST_SUCCESS) {
+		USB_TRACE_POINT(USB_TRACE_CSW_DONE);
+		StorageRecvCBW((struct Usb_DevData *)RequestPtr->Context);
+	}
+}
+
+#ifdef VFLASH_DEDUP
+static void StorageDedupInDone(void *Context, u8 *BufferPtr,
+			       u32 RequestedBytes, u32 BytesTxed, s32 Status)
+{
+	struct Usb_DevData *InstancePtr = (struct Usb_DevData *)Context;
+
+	(void)BufferPtr;
+	(void)RequestedBytes;
+	(void)BytesTxed;
+
+	if (Status != XST_SUCCESS) {
+		return;
+	}
+
+	if (StorageDedupDataIn(InstancePtr) == FALSE) {
+		StorageDedupEnd(InstancePtr);
+	}
+}
+
+static void StorageDedupOutDone(Usb_EpRequest *RequestPtr)
+{
+	struct Usb_DevData *InstancePtr =
+		(struct Usb_DevData *)RequestPtr->Context;
 
-const u8 MAX_SLOTS = 1;  
-SlotState slotStates[MAX_SLOTS];
+	if (RequestPtr->Status != XST_SUCCESS) {
+		return;
+	}
 
+	StorageDedupDataOut(InstancePtr, RequestPtr->Actual);
+}
+#endif
 
 /*****************************************************************************/
 /**
@@ -127,67 +278,34 @@ SlotState slotStates[MAX_SLOTS];
 ******************************************************************************/
 void ClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
 {
+	s32 Status;
 
 	Xil_AssertVoid(InstancePtr != NULL);
 	Xil_AssertVoid(SetupData   != NULL);
+
 	switch (SetupData->bRequest) {
-		case USB_CLASSREQ_CCID_POWER_ON:
-			EpBufferSend(InstancePtr->PrivateData, 0, NULL, 0);
-			break;
-		case USB_CLASSREQ_CCID_POWER_OFF:
+		case USB_CLASSREQ_MASS_STORAGE_RESET:
+			/* Bulk-only mass storage reset, rearm for a CBW */
+			EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_IN);
+			EpQueueFlush(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT);
 			EpBufferSend(InstancePtr->PrivateData, 0, NULL, 0);
+			StorageRecvCBW(InstancePtr);
 			break;
-		case USB_CLASSREQ_CCID_GET_SLOT_STATUS:
-			break;
-		case USB_CLASSREQ_CCID_XFR_BLOCK:	
-			break;	
-		case USB_CLASSREQ_CCID_GET_PARAMETERS:
-			break;	
-		case USB_CLASSREQ_CCID_RESET_PARAMETERS:
-			break;
-		case USB_CLASSREQ_CCID_SET_PARAMETERS:
-			break;
-		case USB_CLASSREQ_CCID_ESCAPE:
-			break;
-		case USB_CLASSREQ_CCID_ICC_POWER_ON:
-			break;
-		case USB_CLASSREQ_CCID_ICC_POWER_OFF:
-			break;
-		case USB_CLASSREQ_CCID_GET_DATA_RATES:
-			break;
-		case USB_CLASSREQ_CCID_SET_DATA_RATES:
-			break;
-		case USB_CLASSREQ_CCID_GET_PROTOCOLS:
-			break;
-		case USB_CLASSREQ_CCID_SET_PROTOCOL:
-			break;
-		case USB_CLASSREQ_CCID_GET_CLOCK_FREQUENCIES:
-			break;
-		case USB_CLASSREQ_CCID_SET_CLOCK_FREQUENCY:
-			break;
-		case USB_CLASSREQ_CCID_ABORT:
-			handleAbortRequest(InstancePtr, SetupData);
-			break;
-		case USB_CLASSREQ_CCID_T0_APDU:
-			break;
-		case USB_CLASSREQ_CCID_T1_APDU:
-			break;
-		case USB_CLASSREQ_CCID_GET_TLV_PROPERTIES:
-			break;
-		case USB_CLASSREQ_CCID_SET_TLV_PROPERTIES:
-			break;
-		case USB_CLASSREQ_CCID_GET_FEATURE_REQUEST:
+
+		case USB_CLASSREQ_GET_MAX_LUN:
+			Status = EpBufferSend(InstancePtr->PrivateData, 0, &MaxLUN, 1);
+			if (Status != XST_SUCCESS) {
+				EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
+			}
 			break;
-		case USB_CLASSREQ_CCID_SET_FEATURE_REQUEST:
-			break;		
+
 		default:
 			/*
-				* Unsupported command. Stall the end point.
-				*/
+			 * Unsupported command. Stall the end point.
+			 */
 			EpSetStall(InstancePtr->PrivateData, 0, USB_EP_DIR_OUT);
 			break;
 	}
-	
 }
 
 /*****************************************************************************/
@@ -201,13 +319,28 @@ void ClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
 * @note		None.
 *
 ******************************************************************************/
+USB_HOT_TEXT
 void ParseCBW(struct Usb_DevData *InstancePtr)
 {
 	u32	Offset;
-	u8 Array[50];
+	u32	Length;
+	static u8 Array[50] ALIGNMENT_CACHELINE;
 	u8 Index;
 	s32 Status;
 
+	UsbCache_CpuRead(&CBW, sizeof(CBW));
+	USB_TRACE_CBW(CBW.CBWCB[0]);
+	USB_TELEMETRY_SCSI(CBW.CBWCB[0]);
+
+	if (txBuffer == NULL) {
+		txBuffer = UsbPool_Alloc(128);
+		if (txBuffer == NULL) {
+			xil_printf("Failed: no reply buffer\n");
+			return;
+		}
+		memset(txBuffer, 0, 128);
+	}
+
 	switch (CBW.CBWCB[0]) {
 		case USB_RBC_INQUIRY: {
 #ifdef CLASS_STORAGE_DEBUG
@@ -224,9 +357,8 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 					Index = 1;
 				}
 
-				EpBufferSend(InstancePtr->PrivateData, 1,
-					     (u8 *) &scsiInquiry[Index],
-					     sizeof(scsiInquiry[Index]));
+				StorageDataIn(InstancePtr, (u8 *) &scsiInquiry[Index],
+					      sizeof(scsiInquiry[Index]), StorageDataDone);
 				break;
 			}
 
@@ -243,8 +375,8 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				CapList->blockLength = htons(VFLASH_BLOCK_SIZE);
 
 				Phase = USB_EP_STATE_DATA_IN;
-				EpBufferSend(InstancePtr->PrivateData, 1, txBuffer,
-					     sizeof(SCSI_CAP_LIST));
+				StorageDataIn(InstancePtr, txBuffer,
+					      sizeof(SCSI_CAP_LIST), StorageDataDone);
 
 				break;
 			}
@@ -259,8 +391,8 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				Cap->numBlocks = htonl(VFLASH_NUM_BLOCKS - 1);
 				Cap->blockSize = htonl(VFLASH_BLOCK_SIZE);
 				Phase = USB_EP_STATE_DATA_IN;
-				EpBufferSend(InstancePtr->PrivateData, 1, txBuffer,
-					     sizeof(SCSI_READ_CAPACITY));
+				StorageDataIn(InstancePtr, txBuffer,
+					      sizeof(SCSI_READ_CAPACITY), StorageDataDone);
 
 				break;
 			}
@@ -272,16 +404,27 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				printf("SCSI: READ Offset 0x%08x\r\n", Offset);
 #endif
 
+				Length = htons(((SCSI_READ_WRITE *) &CBW.CBWCB)->length)
+					 * VFLASH_BLOCK_SIZE;
+
 				Phase = USB_EP_STATE_DATA_IN;
-				u32 RetVal = EpBufferSend(InstancePtr->PrivateData, 1,
-							  &VirtFlash[Offset],
-							  htons(((SCSI_READ_WRITE *) &CBW.CBWCB)->
-								length) * VFLASH_BLOCK_SIZE);
-				if (RetVal != XST_SUCCESS) {
+#ifdef VFLASH_DEDUP
+				DedupOffset = Offset;
+				DedupBytesLeft = Length;
+				DedupFailed = USB_SCSI_SENSE_NONE;
+				if (StorageDedupDataIn(InstancePtr) == FALSE) {
+					StorageDedupEnd(InstancePtr);
+				}
+#else
+				if (StorageDataIn(InstancePtr, &VirtFlash[Offset], Length,
+						  StorageDataDone) != XST_SUCCESS) {
 					xil_printf("Failed: READ Offset 0x%08x\n",
 						   Offset);
-					return;
+					StorageFail(InstancePtr, Length,
+						    USB_SCSI_SENSE_MEDIUM_ERROR,
+						    USB_SCSI_ASC_READ_ERROR);
 				}
+#endif
 				break;
 			}
 		case USB_RBC_MODE_SENSE: {
@@ -289,8 +432,8 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				printf("SCSI: MODE SENSE\r\n");
 #endif
 				Phase = USB_EP_STATE_DATA_IN;
-				EpBufferSend(InstancePtr->PrivateData, 1,
-					     (u8 *) "\003\000\000\000", 4);
+				StorageDataIn(InstancePtr, (u8 *) "\003\000\000\000", 4,
+					      StorageDataDone);
 				break;
 			}
 		case USB_RBC_MODE_SELECT: {
@@ -298,8 +441,7 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				printf("SCSI: MODE_SELECT\r\n");
 #endif
 				Phase = USB_EP_STATE_DATA_OUT;
-				EpBufferRecv(InstancePtr->PrivateData,
-					     1, (u8 *)Array, 24);
+				StorageDataOut(InstancePtr, Array, 24, StorageDataDone);
 				break;
 			}
 		case USB_RBC_TEST_UNIT_READY: {
@@ -329,14 +471,31 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 #ifdef CLASS_STORAGE_DEBUG
 				printf("SCSI: WRITE Offset 0x%08x\r\n", Offset);
 #endif
-				VirtFlashWritePointer = &VirtFlash[Offset];
-
-				rxBytesLeft = htons(((SCSI_READ_WRITE *) &CBW.CBWCB)->length)
-					      * VFLASH_BLOCK_SIZE;
+				Length = htons(((SCSI_READ_WRITE *) &CBW.CBWCB)->length)
+					 * VFLASH_BLOCK_SIZE;
 
 				Phase = USB_EP_STATE_DATA_OUT;
-				EpBufferRecv(InstancePtr->PrivateData, 1,
-					     &VirtFlash[Offset], rxBytesLeft);
+#ifdef VFLASH_DEDUP
+				DedupOffset = Offset;
+				DedupBytesLeft = Length;
+				DedupFailed = USB_SCSI_SENSE_NONE;
+				Status = StorageDataOut(InstancePtr, DedupWindow,
+							DedupBytesLeft <
+							VFLASH_DEDUP_WINDOW_SIZE ?
+							DedupBytesLeft :
+							VFLASH_DEDUP_WINDOW_SIZE,
+							StorageDedupOutDone);
+#else
+				Status = StorageDataOut(InstancePtr, &VirtFlash[Offset],
+							Length, StorageDataDone);
+#endif
+				if (Status != XST_SUCCESS) {
+					xil_printf("Failed: WRITE Offset 0x%08x\n",
+						   Offset);
+					StorageFail(InstancePtr, Length,
+						    USB_SCSI_SENSE_MEDIUM_ERROR,
+						    USB_SCSI_ASC_WRITE_FAULT);
+				}
 				break;
 			}
 		case USB_RBC_STARTSTOP_UNIT: {
@@ -359,6 +518,22 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 #ifdef CLASS_STORAGE_DEBUG
 				printf("SCSI: REQUEST_SENSE\r\n");
 #endif
+				/* Fixed format sense data, current error */
+				memset(txBuffer, 0, USB_SCSI_SENSE_DATA_SIZE);
+				txBuffer[0] = 0x70;
+				txBuffer[2] = SenseKey;
+				txBuffer[7] = USB_SCSI_SENSE_DATA_SIZE - 8U;
+				txBuffer[12] = SenseAsc;
+				SenseKey = USB_SCSI_SENSE_NONE;
+				SenseAsc = 0U;
+
+				Length = CBW.dCBWDataTransferLength;
+				if (Length > USB_SCSI_SENSE_DATA_SIZE) {
+					Length = USB_SCSI_SENSE_DATA_SIZE;
+				}
+				Phase = USB_EP_STATE_DATA_IN;
+				StorageDataIn(InstancePtr, txBuffer, Length,
+					      StorageDataDone);
 				break;
 			}
 		case USB_SYNC_SCSI: {
@@ -369,6 +544,11 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 				break;
 			}
 	}
+
+	if (Phase == USB_EP_STATE_DATA_IN || Phase == USB_EP_STATE_DATA_OUT) {
+		UsbLatency_Mark(USB_LATENCY_CBW_DATA);
+		USB_TRACE_POINT(USB_TRACE_DATA_START);
+	}
 }
 
 /****************************************************************************/
@@ -383,50 +563,334 @@ void ParseCBW(struct Usb_DevData *InstancePtr)
 * @note
 *
 *****************************************************************************/
+USB_HOT_TEXT
 void SendCSW(struct Usb_DevData *InstancePtr, u32 Length)
 {
+	StorageSendCSW(InstancePtr, Length, USB_CSW_STATUS_PASSED);
+}
+
+/****************************************************************************/
+/**
+* This function fails the current command. The sense is kept for the next
+* REQUEST SENSE and the CSW is sent with the failed status.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	Residue is the data residue.
+* @param	Key is the sense key.
+* @param	Asc is the additional sense code.
+*
+* @return	None
+*
+* @note		None.
+*
+*****************************************************************************/
+static void StorageFail(struct Usb_DevData *InstancePtr, u32 Residue,
+			u8 Key, u8 Asc)
+{
+	SenseKey = Key;
+	SenseAsc = Asc;
+	StorageSendCSW(InstancePtr, Residue, USB_CSW_STATUS_FAILED);
+}
+
+USB_HOT_TEXT
+static void StorageSendCSW(struct Usb_DevData *InstancePtr, u32 Length,
+			   u8 Status)
+{
+	USB_TRACE_POINT(USB_TRACE_DATA_END);
+
 	CSW.dCSWSignature = 0x53425355;
 	CSW.dCSWTag = CBW.dCBWTag;
 	CSW.dCSWDataResidue = Length;
-	CSW.bCSWStatus = 0;
+	CSW.bCSWStatus = Status;
+	UsbCache_CpuWrite(&CSW, sizeof(CSW));
 	Phase = USB_EP_STATE_STATUS;
-	EpBufferSend(InstancePtr->PrivateData, 1, (u8 *) &CSW, 13);
+
+	CswRequest.BufferPtr = (u8 *) &CSW;
+	CswRequest.Length = 13;
+	CswRequest.Complete = StorageCswDone;
+	CswRequest.Context = InstancePtr;
+	EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_IN, &CswRequest);
+}
+
+/****************************************************************************/
+/**
+* This function arms the Bulk Out endpoint for the next Command Block
+* Wrapper.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+s32 StorageRecvCBW(struct Usb_DevData *InstancePtr)
+{
+	Phase = USB_EP_STATE_COMMAND;
+
+	CbwRequest.BufferPtr = (u8 *) &CBW;
+	CbwRequest.Length = sizeof(CBW);
+	CbwRequest.Complete = StorageCbwDone;
+	CbwRequest.Context = InstancePtr;
+
+	return EpRequestSubmit(InstancePtr->PrivateData, 1, USB_EP_DIR_OUT,
+			       &CbwRequest);
+}
+
+/****************************************************************************/
+/**
+* This function registers the class DMA buffers with the cache manager.
+*
+* @param	None.
+*
+* @return	None
+*
+* @note		None.
+*
+*****************************************************************************/
+USB_COLD_TEXT
+void StorageCacheRegister(void)
+{
+	UsbCache_RegisterRegion(&CBW, sizeof(CBW), 0U);
+	UsbCache_RegisterRegion(&CSW, sizeof(CSW), 0U);
+#ifdef VFLASH_DEDUP
+	UsbCache_RegisterRegion(DedupWindow, sizeof(DedupWindow), 0U);
+#endif
+}
+
+/****************************************************************************/
+/**
+* This function prepares the virtual flash disk. It is cleared and mapped
+* with 2MB block descriptors of type VFLASH_MEM_ATTR.
+*
+* @param	None.
+*
+* @return	XST_SUCCESS, else the status of UsbCache_MapBlocks(). The disk
+*		keeps the default mapping then.
+*
+* @note		Call after CacheInit().
+*
+*****************************************************************************/
+USB_COLD_TEXT
+s32 StorageDiskInit(void)
+{
+	s32 Status;
+
+#ifndef VFLASH_DEDUP
+	/* The disk section is not cleared by the startup code */
+	memset(VirtFlash, 0, VFLASH_BACKING_SIZE);
+#endif
+
+	Status = UsbCache_MapBlocks(VirtFlash, VFLASH_BACKING_SIZE,
+				    VFLASH_MEM_ATTR);
+
+#ifndef VFLASH_DEDUP
+	UsbCache_RegisterRegion(VirtFlash, VFLASH_BACKING_SIZE,
+				(Status == XST_SUCCESS &&
+				 VFLASH_MEM_ATTR == USB_CACHE_MAP_NONCACHEABLE) ?
+				USB_CACHE_REGION_NONCACHEABLE : 0U);
+#endif
+
+	return Status;
+}
+
+/****************************************************************************/
+/**
+* This function measures random 4KB reads by the CPU across the whole disk
+* with the given memory type. VFLASH_MEM_ATTR is restored afterwards.
+*
+* @param	Attr is USB_CACHE_MAP_WRITEBACK or USB_CACHE_MAP_NONCACHEABLE.
+* @param	Ops is the number of reads.
+*
+* @return	Reads per second, 0 if the disk cannot be remapped.
+*
+* @note		Run before the controller is started.
+*
+*****************************************************************************/
+USB_COLD_TEXT
+u32 StorageDiskBench(u32 Attr, u32 Ops)
+{
+	static u8 Block[0x1000] ALIGNMENT_CACHELINE;
+	u32 Seed = 0x2545F491U;
+	u32 Index;
+	u64 Start;
+	u64 Ticks;
+
+	if (Ops == 0U ||
+	    UsbCache_MapBlocks(VirtFlash, VFLASH_BACKING_SIZE, Attr) !=
+	    XST_SUCCESS) {
+		return 0U;
+	}
+
+	Start = UsbGetTicks();
+	for (Index = 0U; Index < Ops; Index++) {
+		/* xorshift32 */
+		Seed ^= Seed << 13;
+		Seed ^= Seed >> 17;
+		Seed ^= Seed << 5;
+		memcpy(Block, &VirtFlash[(Seed % (VFLASH_BACKING_SIZE /
+						  sizeof(Block))) * sizeof(Block)],
+		       sizeof(Block));
+	}
+	Ticks = UsbGetTicks() - Start;
+
+	(void)UsbCache_MapBlocks(VirtFlash, VFLASH_BACKING_SIZE, VFLASH_MEM_ATTR);
+
+	if (Ticks == 0U) {
+		return 0U;
+	}
+
+	return (u32)(((u64)Ops * USB_TICKS_PER_SECOND) / Ticks);
 }
 
-bool isLastBulkOutAbort(struct Usb_DevData *InstancePtr, u8 slotNum, u8 seqNum) {
-    if (slotNum >= MAX_SLOTS) {
-        return false; // Invalid slot
-    }
+#ifdef VFLASH_DEDUP
+/****************************************************************************/
+/**
+* This function queues the next window of a READ data phase when the dedup
+* backend is used. The window is sent straight from the physical chunks of
+* the pool with EpBufferSendV(). It ends early, on a packet boundary, when
+* the chunks take more segments than the endpoint queue holds.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+*
+* @return	TRUE if a window was queued, FALSE if the data phase is done.
+*
+* @note		A segment that does not start on a packet boundary takes two
+*		queue entries, see EpBufferSendV().
+*
+*****************************************************************************/
+static u32 StorageDedupDataIn(struct Usb_DevData *InstancePtr)
+{
+	u32 MaxPacket;
+	u32 MaxVec;
+	u32 Length;
+	u32 Count;
 
-    return (slotStates[slotNum].lastBulkOutCommand == PC_TO_RDR_ABORT &&
-            slotStates[slotNum].lastBulkOutSeqNum == seqNum);
+	if (DedupBytesLeft == 0U) {
+		return FALSE;
+	}
+
+	Length = DedupBytesLeft < VFLASH_DEDUP_WINDOW_SIZE ?
+		 DedupBytesLeft : VFLASH_DEDUP_WINDOW_SIZE;
+	MaxPacket = (InstancePtr->Speed == USB_SPEED_SUPER) ? 1024U : 512U;
+	MaxVec = ((DedupOffset % MaxPacket) == 0U) ? USB_EP_QUEUE_DEPTH :
+		 USB_EP_QUEUE_DEPTH / 2U;
+	Length = VFlashDedup_ReadV(DedupOffset, Length, DedupVec, MaxVec,
+				   MaxPacket, &Count);
+
+	if (Length == 0U ||
+	    EpBufferSendV(InstancePtr->PrivateData, 1, DedupVec, Count,
+			  StorageDedupInDone, InstancePtr) != XST_SUCCESS) {
+		xil_printf("Failed: READ Offset 0x%08x\n", DedupOffset);
+		DedupFailed = USB_SCSI_SENSE_MEDIUM_ERROR;
+		DedupAsc = USB_SCSI_ASC_READ_ERROR;
+		return FALSE;
+	}
+	DedupOffset += Length;
+	DedupBytesLeft -= Length;
+
+	return TRUE;
 }
 
-void acknowledgeAbort(struct Usb_DevData *InstancePtr, u8 slotNum) {
-    // Construct and send your RDR_to_PC_SlotStatus response here 
-	
+/****************************************************************************/
+/**
+* This function hands a received WRITE window to the dedup backend. The
+* next window is queued by StorageDedupCommitted() once it is committed.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+* @param	BytesTxed is the number of bytes received in the window.
+*
+* @return	None.
+*
+* @note		With USB_OFFLOAD the chunk hashes are computed by the worker
+*		cores and the commit completes from UsbOffload_Poll().
+*
+*****************************************************************************/
+static void StorageDedupDataOut(struct Usb_DevData *InstancePtr, u32 BytesTxed)
+{
+	if (BytesTxed > DedupBytesLeft) {
+		BytesTxed = DedupBytesLeft;
+	}
+	DedupWindowBytes = BytesTxed;
+
+	/* After a failed window the rest of the data is taken but dropped */
+	UsbCache_CpuRead(DedupWindow, BytesTxed);
+	if (DedupFailed != USB_SCSI_SENSE_NONE) {
+		StorageDedupCommitted(InstancePtr, XST_SUCCESS);
+	} else if (VFlashDedup_WriteAsync(DedupOffset, DedupWindow, BytesTxed,
+					  StorageDedupCommitted,
+					  InstancePtr) != XST_SUCCESS) {
+		StorageDedupCommitted(InstancePtr, XST_FAILURE);
+	}
 }
 
-void setBulkOutFailureFlag(struct Usb_DevData *InstancePtr, u8 slotNum) {
-    if (slotNum >= MAX_SLOTS) {
-        return;  // Invalid slot
-    }
-    slotStates[slotNum].isFailingBulkOut = true;
+/****************************************************************************/
+/**
+* This function is called when a WRITE window has been committed and queues
+* reception of the next window, or ends the data phase.
+*
+* @param	Context is pointer to Usb_DevData instance.
+* @param	Status is the status of the commit.
+*
+* @return	None.
+*
+* @note		May run from the main loop, interrupts are held off so the
+*		command state does not change under the USB interrupt.
+*
+*****************************************************************************/
+static void StorageDedupCommitted(void *Context, s32 Status)
+{
+	struct Usb_DevData *InstancePtr = (struct Usb_DevData *)Context;
+	u32 BytesTxed = DedupWindowBytes;
+	u32 Length;
+	u32 Flags = UsbIrqSave();
+
+	if (Status != XST_SUCCESS) {
+		xil_printf("Failed: WRITE Offset 0x%08x\n", DedupOffset);
+		DedupFailed = USB_SCSI_SENSE_MEDIUM_ERROR;
+		DedupAsc = USB_SCSI_ASC_WRITE_FAULT;
+	}
+	DedupOffset += BytesTxed;
+	DedupBytesLeft -= BytesTxed;
+
+	if (DedupBytesLeft == 0U || BytesTxed == 0U) {
+		StorageDedupEnd(InstancePtr);
+		UsbIrqRestore(Flags);
+		return;
+	}
+
+	Length = DedupBytesLeft < VFLASH_DEDUP_WINDOW_SIZE ?
+		 DedupBytesLeft : VFLASH_DEDUP_WINDOW_SIZE;
+	if (StorageDataOut(InstancePtr, DedupWindow, Length,
+			   StorageDedupOutDone) != XST_SUCCESS) {
+		xil_printf("Failed: WRITE Offset 0x%08x\n", DedupOffset);
+		DedupFailed = USB_SCSI_SENSE_MEDIUM_ERROR;
+		DedupAsc = USB_SCSI_ASC_WRITE_FAULT;
+		StorageDedupEnd(InstancePtr);
+	}
+	UsbIrqRestore(Flags);
 }
 
-void handleAbortRequest(struct Usb_DevData *InstancePtr, SetupPacket *SetupData) {
-    u8 slotNum = SetupData->wValue & 0xFF; // Extract slot number
-    u8 seqNum = SetupData->wValue >> 8;    // Extract sequence number
-
-    // 1. Check if the last Bulk-OUT message for 'slotNum' matches 'seqNum' 
-    if (isLastBulkOutAbort(InstancePtr, slotNum, seqNum)) {
-        // Acknowledge the abort (details depend on your communication protocol)
-        acknowledgeAbort(InstancePtr, slotNum);
-    } else {
-        // Set a flag to start failing Bulk-OUT commands for 'slotNum'
-        setBulkOutFailureFlag(InstancePtr, slotNum);
-    }
-
-    // Send standard control transfer success response
-    EpBufferSend(InstancePtr->PrivateData, 0, NULL, 0);  
+/****************************************************************************/
+/**
+* This function ends the data phase of a READ or WRITE with the dedup
+* backend. The command fails if a window could not be read, written or
+* queued, the residue is the data not transferred.
+*
+* @param	InstancePtr is pointer to Usb_DevData instance.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+static void StorageDedupEnd(struct Usb_DevData *InstancePtr)
+{
+	if (DedupFailed != USB_SCSI_SENSE_NONE) {
+		StorageFail(InstancePtr, DedupBytesLeft, DedupFailed, DedupAsc);
+	} else {
+		SendCSW(InstancePtr, DedupBytesLeft);
+	}
 }
+#endif
@@ -34,7 +34,7 @@ extern "C" {
 /***************************** Include Files *********************************/
 #include "xil_types.h"
 #include "xusb_ch9.h"
-#include "ccid_config.h"
+#include "xusb_cache.h"
 
 /************************** Constant Definitions *****************************/
 /*
@@ -55,6 +55,18 @@ extern "C" {
 #define USB_RBC_VERIFY				0x2f
 #define USB_SYNC_SCSI				0x35
 
+/*
+ * Sense keys and additional sense codes reported by REQUEST SENSE.
+ */
+#define USB_SCSI_SENSE_NONE			0x00
+#define USB_SCSI_SENSE_MEDIUM_ERROR	0x03
+#define USB_SCSI_ASC_WRITE_FAULT	0x03
+#define USB_SCSI_ASC_READ_ERROR		0x11
+#define USB_SCSI_SENSE_DATA_SIZE	18U
+
+#define USB_CSW_STATUS_PASSED		0x00
+#define USB_CSW_STATUS_FAILED		0x01
+
 /* Virtual Flash memory related definitions.
  */
 #ifdef __MICROBLAZE__
@@ -66,6 +78,26 @@ extern "C" {
 #define VFLASH_BLOCK_SIZE	0x200
 #define VFLASH_NUM_BLOCKS	(VFLASH_SIZE/VFLASH_BLOCK_SIZE)
 
+/* With VFLASH_DEDUP the logical disk is backed by a smaller pool of unique
+ * chunks, see xusb_storage_dedup.h.
+ */
+#ifndef VFLASH_DEDUP_POOL_SIZE
+#define VFLASH_DEDUP_POOL_SIZE	(VFLASH_SIZE / 4)
+#endif
+
+#ifdef VFLASH_DEDUP
+#define VFLASH_BACKING_SIZE	VFLASH_DEDUP_POOL_SIZE
+#else
+#define VFLASH_BACKING_SIZE	VFLASH_SIZE
+#endif
+
+/* Memory type of the disk, USB_CACHE_MAP_NONCACHEABLE suits a disk that is
+ * only accessed by DMA.
+ */
+#ifndef VFLASH_MEM_ATTR
+#define VFLASH_MEM_ATTR		USB_CACHE_MAP_WRITEBACK
+#endif
+
 /* Class request opcodes.
  */
 #define USB_CLASSREQ_MASS_STORAGE_RESET	0xFF
@@ -84,130 +116,6 @@ extern "C" {
 #pragma pack(push, 1)
 #endif
 
-// Payload for PC_to_RDR_IccPowerOn
-typedef struct {
-    u8 bPowerSelect;  // 00h: Auto, 01h: 5V, 02h: 3V, 03h: 1.8V
-    u8 abRFU[2];         // Reserved for future use
-} PC_to_RDR_IccPowerOnPayload; 
-
-// Payload for PC_to_RDR_IccPowerOff, PC_to_RDR_GetSlotStatus, PC_to_RDR_GetParameters, PC_to_RDR_ResetParameters, PC_to_RDR_IccClock
-typedef struct {
-    u8 abRFU[3];  // Reserved
-} NoPayload;
-
-// Payload for PC_to_RDR_Mechanical
-typedef struct {
-    u8 abRFU[2]; 
-} NoPayload1; 
-
-
-// Payload for PC_to_RDR_XfrBlock
-typedef struct {
-    u8 bBWI; 
-    u16 wLevelParameter;
-    u8 abData[MAX_DATA_SIZE];  // Replace MAX_DATA_SIZE with the appropriate size 
-} PC_to_RDR_XfrBlockPayload; 
-
-// Payload for PC_to_RDR_T0APDU
-typedef struct {
-    u8 bmChanges;
-    u8 bClassGetResponse;
-    u8 bClassEnvelope;
-} PC_to_RDR_T0APDU_Payload; 
-
-
-// payload varies based on the protocol
-typedef struct {
-    u8 bmFindexDindex;
-    u8 bmTCCKST0;
-    u8 bGuardTimeT0;
-    u8 bWaitingIntegerT0;
-    u8 bClockStop;
-} ProtocolDataStructureT0;
-
-typedef struct {
-    u8 bmFindexDindex;
-    u8 bmTCCKST1;
-    u8 bGuardTimeT1;
-    u8 bmWaitingIntegersT1;
-    u8 bClockStop;
-    u8 bIFSC;
-    u8 bNadValue;
-} ProtocolDataStructureT1;
-
-// Payload for PC_to_RDR_Escape
-typedef struct {
-    u8 abData[];
-} PC_to_RDR_EscapePayload;
-
-typedef struct {
-    u8 bTimeOut;
-    u8 bmFormatString;
-    u8 bmPINBlockString;
-    u8 bmPINLengthFormat;
-    u16 wPINMaxExtraDigit;
-    u8 bEntryValidationCondition; 
-    u8 bNumberMessage;
-    u16 wLangID;
-    u8 bMsgIndex; 
-    u8 bTeoPrologue[3]; // For T=1
-    // abPINApduByte would be a dynamically sized array, 
-    // handle its allocation separately
-} PINVerificationDataStructure;
-
-typedef struct {
-    // ... similar fields as PINVerificationDataStructure ...
-    u8 bInsertionOffsetOld;
-    u8 bInsertionOffsetNew;
-    u8 bConfirmPIN;
-    // ... other fields ...
-} PINModificationDataStructure;
-
-typedef struct {
-    u8 bPINOperation; 
-    union {
-        PINVerificationDataStructure verifyData;
-        PINModificationDataStructure modifyData;
-        // Add other operation-specific structs as needed
-    } operationData;
-} PC_to_RDR_SecurePayload; 
-
-// Payload for PC_to_RDR_SetDataRateAndClockFrequency
-typedef struct {
-    u32 dwClockFrequency;
-    u32 dwDataRate;
-} PC_to_RDR_SetDataRateAndClockFrequencyPayload;
-
-
-// Message payload for CCID bulk out message
-typedef union {
-    PC_to_RDR_IccPowerOnPayload powerOnPayload;
-	NoPayload noPayload;
-	NoPayload1 noPayload1;
-	PC_to_RDR_XfrBlockPayload xfrBlockPayload;
-	ProtocolDataStructureT0 protocolDataStructureT0;
-	ProtocolDataStructureT1 protocolDataStructureT1;
-	PC_to_RDR_T0APDU_Payload t0APDUPayload;
-	PC_to_RDR_EscapePayload escapePayload;
-	PINVerificationDataStructure pinVerifyData;
-	PINModificationDataStructure pinModifyData;
-	PC_to_RDR_SecurePayload securePayload;
-	PC_to_RDR_SetDataRateAndClockFrequencyPayload setDataRateAndClockFrequencyPayload;
-} CCID_MessagePayload;
-
-typedef struct {
-    u8 bMessageType;  // Identifies the command type
-    u8 bSlot;           // Slot number
-    u8 bSeq;            // Sequence number 
-    u32 dwLength;       // Message-specific data length
-    CCID_MessagePayload payload; // Payload (variable length, interpretation depends on bMessageType)
-} CCID_BulkOutMessage;
-
-typedef struct {
-	u8 lastBulkOutCommand;
-	u8 lastBulkOutSeqNum;
-	bool isFailingBulkOut;
-} SlotState;
 /*
  * The following structures define USB storage class requests. The details of
  * the contents of those structures are not important in the context of this
@@ -284,6 +192,10 @@ typedef struct {
 void ClassReq(struct Usb_DevData *InstancePtr, SetupPacket *SetupData);
 void ParseCBW(struct Usb_DevData *InstancePtr);
 void SendCSW(struct Usb_DevData *InstancePtr, u32 Length);
+void StorageCacheRegister(void);
+s32 StorageDiskInit(void);
+u32 StorageDiskBench(u32 Attr, u32 Ops);
+s32 StorageRecvCBW(struct Usb_DevData *InstancePtr);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,343 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_dma_pool.c
+ *
+ * This file contains the implementation of the DMA buffer pool.
+ *
+ * Each size class is a slab of equally sized blocks with a free stack. The
+ * stack head packs a 16-bit block index with a 16-bit modification tag so a
+ * compare-and-swap detects a head that was popped and pushed back meanwhile.
+ * Free links are kept outside the blocks so the pool never writes into
+ * memory that may still be owned by the controller.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include "xusb_dma_pool.h"
+#include "xusb_wrapper.h"
+
+/************************** Constant Definitions *****************************/
+#define POOL_EMPTY		0xFFFFU
+#define POOL_INDEX_MASK		0xFFFFU
+#define POOL_TAG_SHIFT		16U
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u8 *Base;		/* First block */
+	u32 BlockSize;
+	u32 Blocks;
+	u32 First;		/* Index of the first block in Next[] */
+	u32 Head;		/* Tag << 16 | index of the top free block */
+} UsbPool_Slab;
+
+/************************** Variable Definitions *****************************/
+static const u32 ClassSize[USB_POOL_NUM_CLASSES] = {
+	USB_POOL_CLASS0_SIZE, USB_POOL_CLASS1_SIZE,
+	USB_POOL_CLASS2_SIZE, USB_POOL_CLASS3_SIZE,
+};
+
+static const u32 ClassCount[USB_POOL_NUM_CLASSES] = {
+	USB_POOL_CLASS0_COUNT, USB_POOL_CLASS1_COUNT,
+	USB_POOL_CLASS2_COUNT, USB_POOL_CLASS3_COUNT,
+};
+
+static UsbPool_Slab Slab[USB_POOL_NUM_CLASSES];
+static u16 Next[USB_POOL_MAX_BLOCKS];
+static u32 Requested[USB_POOL_MAX_BLOCKS];
+
+static UsbPool_Stats Stats;
+/* 64 bits wide, updated with interrupts disabled rather than atomically */
+static u64 AllocTicksTotal;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define PoolLoad(Ptr)		__atomic_load_n((Ptr), __ATOMIC_ACQUIRE)
+#define PoolAdd(Ptr, Val)	(void)__atomic_fetch_add((Ptr), (Val), __ATOMIC_RELAXED)
+#define PoolSub(Ptr, Val)	(void)__atomic_fetch_sub((Ptr), (Val), __ATOMIC_RELAXED)
+
+/*****************************************************************************/
+/**
+* Pops a block from the free stack of a slab.
+*
+* @param	SlabPtr is the slab.
+*
+* @return	Index of the block in Next[], or POOL_EMPTY.
+*
+* @note		None.
+*
+******************************************************************************/
+static u32 SlabPop(UsbPool_Slab *SlabPtr)
+{
+	u32 Old = PoolLoad(&SlabPtr->Head);
+	u32 New;
+	u32 Index;
+
+	do {
+		Index = Old & POOL_INDEX_MASK;
+		if (Index == POOL_EMPTY) {
+			return POOL_EMPTY;
+		}
+		New = (((Old >> POOL_TAG_SHIFT) + 1U) << POOL_TAG_SHIFT) |
+		      Next[Index];
+	} while (!__atomic_compare_exchange_n(&SlabPtr->Head, &Old, New, TRUE,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_ACQUIRE));
+
+	return Index;
+}
+
+/*****************************************************************************/
+/**
+* Pushes a block on the free stack of a slab.
+*
+* @param	SlabPtr is the slab.
+* @param	Index is the index of the block in Next[].
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void SlabPush(UsbPool_Slab *SlabPtr, u32 Index)
+{
+	u32 Old = PoolLoad(&SlabPtr->Head);
+	u32 New;
+
+	do {
+		Next[Index] = (u16)(Old & POOL_INDEX_MASK);
+		New = (((Old >> POOL_TAG_SHIFT) + 1U) << POOL_TAG_SHIFT) | Index;
+	} while (!__atomic_compare_exchange_n(&SlabPtr->Head, &Old, New, TRUE,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+}
+
+static void StatsMax(u32 *Ptr, u32 Val)
+{
+	u32 Old = PoolLoad(Ptr);
+
+	while (Val > Old &&
+	       !__atomic_compare_exchange_n(Ptr, &Old, Val, TRUE,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+static void StatsMin(u32 *Ptr, u32 Val)
+{
+	u32 Old = PoolLoad(Ptr);
+
+	while (Val < Old &&
+	       !__atomic_compare_exchange_n(Ptr, &Old, Val, TRUE,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/*****************************************************************************/
+/**
+* Splits a memory region into the slabs of the pool.
+*
+* @param	MemPtr is the start of the memory, cache line aligned.
+* @param	MemSize is the size of the memory.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if not every size class gets at
+*		least one block.
+*
+* @note		The memory must not be used by anything else afterwards.
+*
+******************************************************************************/
+USB_COLD_TEXT
+s32 UsbPool_Init(u8 *MemPtr, u32 MemSize)
+{
+	UINTPTR Addr = ((UINTPTR)MemPtr + USB_POOL_ALIGN - 1U) &
+		       ~((UINTPTR)USB_POOL_ALIGN - 1U);
+	UINTPTR End = (UINTPTR)MemPtr + MemSize;
+	u32 First = 0U;
+	u32 ClassNum;
+	u32 Index;
+
+	if (MemPtr == NULL) {
+		return XST_FAILURE;
+	}
+
+	Stats = (UsbPool_Stats) {
+		0
+	};
+	Stats.AllocTicksMin = 0xFFFFFFFFU;
+	AllocTicksTotal = 0U;
+
+	for (ClassNum = 0U; ClassNum < USB_POOL_NUM_CLASSES; ClassNum++) {
+		UsbPool_Slab *SlabPtr = &Slab[ClassNum];
+		u32 Blocks = ClassCount[ClassNum];
+		u32 Avail = (Addr < End) ? (u32)(End - Addr) : 0U;
+
+		if (Blocks > Avail / ClassSize[ClassNum]) {
+			Blocks = Avail / ClassSize[ClassNum];
+		}
+		if (Blocks > USB_POOL_MAX_BLOCKS - First) {
+			Blocks = USB_POOL_MAX_BLOCKS - First;
+		}
+		if (Blocks == 0U) {
+			return XST_FAILURE;
+		}
+
+		SlabPtr->Base = (u8 *)Addr;
+		SlabPtr->BlockSize = ClassSize[ClassNum];
+		SlabPtr->Blocks = Blocks;
+		SlabPtr->First = First;
+		SlabPtr->Head = POOL_EMPTY;
+		for (Index = First + Blocks; Index > First; Index--) {
+			SlabPush(SlabPtr, Index - 1U);
+		}
+
+		Stats.Class[ClassNum].BlockSize = ClassSize[ClassNum];
+		Stats.Class[ClassNum].Blocks = Blocks;
+
+		Addr += (UINTPTR)Blocks * ClassSize[ClassNum];
+		First += Blocks;
+	}
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Allocates a DMA buffer. The smallest fitting size class is used, a larger
+* class is tried when it is empty.
+*
+* @param	Size is the number of bytes needed.
+*
+* @return	Pointer to a cache line aligned buffer, or NULL.
+*
+* @note		May be called from interrupt context.
+*
+******************************************************************************/
+void *UsbPool_Alloc(u32 Size)
+{
+	u64 Start = UsbGetTicks();
+	u32 ClassNum;
+	u32 Ticks;
+	u32 Flags;
+	u32 Index = POOL_EMPTY;
+	UsbPool_Slab *SlabPtr = NULL;
+
+	for (ClassNum = 0U; ClassNum < USB_POOL_NUM_CLASSES; ClassNum++) {
+		SlabPtr = &Slab[ClassNum];
+		if (Size > SlabPtr->BlockSize || SlabPtr->Blocks == 0U) {
+			continue;
+		}
+
+		Index = SlabPop(SlabPtr);
+		if (Index != POOL_EMPTY) {
+			break;
+		}
+		PoolAdd(&Stats.Class[ClassNum].Failures, 1U);
+	}
+
+	if (Index == POOL_EMPTY) {
+		PoolAdd(&Stats.AllocFailures, 1U);
+		return NULL;
+	}
+
+	Requested[Index] = Size;
+	PoolAdd(&Stats.Class[ClassNum].Allocs, 1U);
+	if (ClassNum > 0U && Size <= Slab[ClassNum - 1U].BlockSize) {
+		PoolAdd(&Stats.Class[ClassNum].Fallbacks, 1U);
+	}
+	StatsMax(&Stats.Class[ClassNum].HighWater,
+		 __atomic_add_fetch(&Stats.Class[ClassNum].InUse, 1U,
+				    __ATOMIC_RELAXED));
+	PoolAdd(&Stats.BytesRequested, Size);
+	PoolAdd(&Stats.BytesAllocated, SlabPtr->BlockSize);
+
+	Ticks = (u32)(UsbGetTicks() - Start);
+	StatsMin(&Stats.AllocTicksMin, Ticks);
+	StatsMax(&Stats.AllocTicksMax, Ticks);
+	Flags = UsbIrqSave();
+	AllocTicksTotal += Ticks;
+	UsbIrqRestore(Flags);
+
+	return SlabPtr->Base + (UINTPTR)(Index - SlabPtr->First) *
+	       SlabPtr->BlockSize;
+}
+
+/*****************************************************************************/
+/**
+* Returns a buffer to the pool.
+*
+* @param	Ptr is a buffer returned by UsbPool_Alloc(), NULL is ignored.
+*
+* @return	None.
+*
+* @note		May be called from interrupt context.
+*
+******************************************************************************/
+void UsbPool_Free(void *Ptr)
+{
+	UINTPTR Addr = (UINTPTR)Ptr;
+	u32 ClassNum;
+
+	if (Ptr == NULL) {
+		return;
+	}
+
+	for (ClassNum = 0U; ClassNum < USB_POOL_NUM_CLASSES; ClassNum++) {
+		UsbPool_Slab *SlabPtr = &Slab[ClassNum];
+		UINTPTR Base = (UINTPTR)SlabPtr->Base;
+		u32 Index;
+
+		if (Addr < Base ||
+		    Addr >= Base + (UINTPTR)SlabPtr->Blocks * SlabPtr->BlockSize) {
+			continue;
+		}
+
+		Index = SlabPtr->First + (u32)((Addr - Base) / SlabPtr->BlockSize);
+		PoolSub(&Stats.BytesRequested, Requested[Index]);
+		PoolSub(&Stats.BytesAllocated, SlabPtr->BlockSize);
+		PoolSub(&Stats.Class[ClassNum].InUse, 1U);
+		SlabPush(SlabPtr, Index);
+		return;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Returns the pool statistics.
+*
+* @param	StatsPtr is filled with the statistics.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbPool_GetStats(UsbPool_Stats *StatsPtr)
+{
+	u32 Allocs = 0U;
+	u32 ClassNum;
+	u64 Total;
+	u32 Flags;
+
+	*StatsPtr = Stats;
+
+	for (ClassNum = 0U; ClassNum < USB_POOL_NUM_CLASSES; ClassNum++) {
+		Allocs += StatsPtr->Class[ClassNum].Allocs;
+	}
+
+	if (Allocs != 0U) {
+		Flags = UsbIrqSave();
+		Total = AllocTicksTotal;
+		UsbIrqRestore(Flags);
+		StatsPtr->AllocTicksAvg = (u32)(Total / Allocs);
+	} else {
+		StatsPtr->AllocTicksMin = 0U;
+	}
+
+	if (StatsPtr->BytesAllocated != 0U) {
+		StatsPtr->Fragmentation = (u32)(((u64)(StatsPtr->BytesAllocated -
+						       StatsPtr->BytesRequested) * 100U) /
+						StatsPtr->BytesAllocated);
+	}
+}
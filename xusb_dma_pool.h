@@ -0,0 +1,83 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_dma_pool.h
+ *
+ * This file contains declarations for the DMA buffer pool built by
+ * ConfigureDevice() on top of the memory passed by the application.
+ *
+ * The memory is split into slabs of fixed size blocks, one slab per size
+ * class. Every block starts on a cache line boundary and a block never shares
+ * a cache line with another block, so blocks can be handed to the controller
+ * directly. Free blocks are kept on lock-free stacks, allocation and release
+ * are O(1) and may be called from both interrupt and thread context.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_DMA_POOL_H
+#define XUSB_DMA_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_POOL_ALIGN			64U
+#define USB_POOL_NUM_CLASSES		4U
+#define USB_POOL_MAX_BLOCKS		256U
+
+/*
+ * Size classes and the number of blocks wanted in each. The defaults fill
+ * the 64KB buffer of the example exactly, smaller memory gets fewer of the
+ * large blocks.
+ */
+#define USB_POOL_CLASS0_SIZE		64U
+#define USB_POOL_CLASS0_COUNT		64U
+#define USB_POOL_CLASS1_SIZE		512U
+#define USB_POOL_CLASS1_COUNT		24U
+#define USB_POOL_CLASS2_SIZE		1024U
+#define USB_POOL_CLASS2_COUNT		16U
+#define USB_POOL_CLASS3_SIZE		4096U
+#define USB_POOL_CLASS3_COUNT		8U
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u32 BlockSize;
+	u32 Blocks;		/* Blocks in the slab */
+	u32 InUse;		/* Blocks currently allocated */
+	u32 HighWater;		/* Maximum of InUse */
+	u32 Allocs;		/* Successful allocations */
+	u32 Fallbacks;		/* Served by this class for a smaller request */
+	u32 Failures;		/* Slab empty when it was the best fit */
+} UsbPool_ClassStats;
+
+typedef struct {
+	UsbPool_ClassStats Class[USB_POOL_NUM_CLASSES];
+	u32 AllocFailures;	/* Requests that could not be served at all */
+	u32 BytesRequested;	/* Bytes asked for by allocated blocks */
+	u32 BytesAllocated;	/* Bytes of allocated blocks */
+	u32 Fragmentation;	/* Internal fragmentation in percent */
+	u32 AllocTicksMin;	/* Allocation latency in UsbGetTicks() units */
+	u32 AllocTicksMax;
+	u32 AllocTicksAvg;
+} UsbPool_Stats;
+
+/************************** Function Prototypes ******************************/
+s32 UsbPool_Init(u8 *MemPtr, u32 MemSize);
+void *UsbPool_Alloc(u32 Size);
+void UsbPool_Free(void *Ptr);
+void UsbPool_GetStats(UsbPool_Stats *StatsPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_DMA_POOL_H */
@@ -0,0 +1,637 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_event.c
+ *
+ * This file contains the implementation of the deferred event queue and of
+ * the instrumented USB interrupt handler.
+ *
+ * The driver event handler is the only producer and UsbEventDispatch() the
+ * only consumer of the ring. When the ring is full an event is handled in
+ * interrupt context instead of being dropped.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include "xusb_event.h"
+#include "xusb_ring.h"
+#include "xil_cache.h"
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	u32 Type;
+	union {
+		void (*Handler)(void *, u32, u32);
+		Usb_EpCallback Callback;
+		void (*Setup)(struct Usb_DevData *, SetupPacket *);
+	} Func;
+	void *Ref;		/* Callback reference, context or instance */
+	u8 *BufferPtr;
+	u32 RequestedBytes;
+	u32 BytesTxed;
+	s32 Status;
+	SetupPacket SetupData;	/* Copy, the driver reuses its buffer */
+	u64 PostTicks;
+} UsbEvent;
+
+/************************** Variable Definitions *****************************/
+#ifdef USB_DEFERRED_EVENTS
+static UsbEvent EventStorage[USB_EVENT_RING_SLOTS] USB_HOT_BSS;
+static UsbRing EventRing USB_HOT_BSS;
+#endif
+
+/* Interrupt time stamp of the event being handled */
+static u64 EventTicks;
+static UsbLatency_Stats Latency[USB_LATENCY_NUM_PATHS];
+
+static UsbEvent_Stats Stats;
+static UsbEvent_Stats LoadStats;
+static u64 LoadTicks;
+
+/* Software interrupt moderation */
+static u32 ModerationOn;
+static u64 ModerationTicks;
+static u32 ModerationHeld;	/* Interrupt masked by moderation */
+static u64 ModerationStart;
+
+#ifdef USB_HYBRID_POLL
+static UsbPoll_Stats PollStats;
+static u32 PollEnterEvents = USB_POLL_ENTER_EVENTS;
+static u64 PollExitIdleTicks;
+static u64 PollLastEventTicks;
+#endif
+
+/*****************************************************************************/
+/**
+* Runs one event.
+*
+* @param	EventPtr is the event.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static void UsbEventRun(UsbEvent *EventPtr)
+{
+	switch (EventPtr->Type) {
+		case USB_EVENT_EP_HANDLER:
+			EventPtr->Func.Handler(EventPtr->Ref, EventPtr->RequestedBytes,
+					       EventPtr->BytesTxed);
+			break;
+		case USB_EVENT_EP_CALLBACK:
+			EventPtr->Func.Callback(EventPtr->Ref, EventPtr->BufferPtr,
+						EventPtr->RequestedBytes,
+						EventPtr->BytesTxed, EventPtr->Status);
+			break;
+		case USB_EVENT_SETUP:
+			EventPtr->Func.Setup((struct Usb_DevData *)EventPtr->Ref,
+					     &EventPtr->SetupData);
+			break;
+		default:
+			break;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Queues an event for the main loop, or runs it when deferral is disabled
+* or the ring is full.
+*
+* @param	EventPtr is the event.
+*
+* @return	None.
+*
+* @note		Called from the driver event handler only, in interrupt
+*		context or from UsbPollService() with interrupts disabled.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static void UsbEventPost(UsbEvent *EventPtr)
+{
+#ifdef USB_DEFERRED_EVENTS
+	u32 Backlog;
+
+	EventPtr->PostTicks = UsbGetTicks();
+	if (UsbRing_Put(&EventRing, EventPtr) == TRUE) {
+		Stats.Posted++;
+		Backlog = UsbRing_Count(&EventRing);
+		if (Backlog > Stats.BacklogMax) {
+			Stats.BacklogMax = Backlog;
+		}
+		return;
+	}
+#endif
+
+	Stats.Inline++;
+	UsbEventRun(EventPtr);
+}
+
+/* Number of events waiting in the event buffer */
+static u32 UsbEventsPending(struct XUsbPsu *InstancePtr)
+{
+	return (XUsbPsu_ReadReg(InstancePtr, XUSBPSU_GEVNTCOUNT(0)) &
+		0xFFFFU) >> 2;
+}
+
+static void UsbEventIntrMask(struct XUsbPsu *InstancePtr, u32 Mask)
+{
+	u32 RegVal = XUsbPsu_ReadReg(InstancePtr, XUSBPSU_GEVNTSIZ(0));
+
+	if (Mask == TRUE) {
+		RegVal |= XUSBPSU_GEVNTSIZ_INTMASK;
+	} else {
+		RegVal &= ~XUSBPSU_GEVNTSIZ_INTMASK;
+	}
+	XUsbPsu_WriteReg(InstancePtr, XUSBPSU_GEVNTSIZ(0), RegVal);
+}
+
+/*****************************************************************************/
+/**
+* Looks for events in the event buffer that must not wait for the end of a
+* moderation interval.
+*
+* @param	InstancePtr is a pointer to the XUsbPsu instance.
+*
+* @return	TRUE if an EP0 or device event is pending, else FALSE.
+*
+* @note		The events are left in the buffer for the driver.
+*
+******************************************************************************/
+static u32 UsbEventsUrgent(struct XUsbPsu *InstancePtr)
+{
+	struct XUsbPsu_EvtBuffer *Evt = &InstancePtr->Evt;
+	u32 Count = UsbEventsPending(InstancePtr);
+	u32 Offset = Evt->Offset;
+	u32 Event;
+
+	if (Count != 0U && InstancePtr->ConfigPtr->IsCacheCoherent == 0U) {
+		Xil_DCacheInvalidateRange((INTPTR)Evt->BuffAddr,
+					  XUSBPSU_EVENT_BUFFERS_SIZE);
+	}
+
+	while (Count != 0U) {
+		Event = *(volatile u32 *)((UINTPTR)Evt->BuffAddr + Offset);
+		if ((Event & USB_EVT_DEVICE) != 0U ||
+		    ((Event & USB_EVT_EPNUM_MASK) >> USB_EVT_EPNUM_SHIFT) < 2U) {
+			return TRUE;
+		}
+		Offset = (Offset + 4U) % XUSBPSU_EVENT_BUFFERS_SIZE;
+		Count--;
+	}
+
+	return FALSE;
+}
+
+/*****************************************************************************/
+/**
+* Ends the moderation hold when the interval is over or an urgent event is
+* waiting, called from the main loop.
+*
+* @param	InstancePtr is a pointer to the XUsbPsu instance.
+*
+* @return	None.
+*
+* @note		Called with interrupts disabled.
+*
+******************************************************************************/
+static void UsbModerationService(struct XUsbPsu *InstancePtr)
+{
+	if (ModerationHeld == FALSE) {
+		return;
+	}
+
+	if (UsbGetTicks() - ModerationStart >= ModerationTicks) {
+		ModerationHeld = FALSE;
+	} else if (UsbEventsUrgent(InstancePtr) == TRUE) {
+		ModerationHeld = FALSE;
+		Stats.ModEarly++;
+	} else {
+		return;
+	}
+	UsbEventIntrMask(InstancePtr, FALSE);
+}
+
+/*****************************************************************************/
+/**
+* Initializes the event queue.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void UsbEvent_Init(void)
+{
+	u32 Path;
+
+#ifdef USB_DEFERRED_EVENTS
+	UsbRing_Init(&EventRing, EventStorage, USB_EVENT_RING_SLOTS,
+		     sizeof(UsbEvent));
+#endif
+	Stats = (UsbEvent_Stats) {
+		0
+	};
+	LoadStats = Stats;
+	LoadTicks = UsbGetTicks();
+	for (Path = 0U; Path < USB_LATENCY_NUM_PATHS; Path++) {
+		Latency[Path] = (UsbLatency_Stats) {
+			0
+		};
+		Latency[Path].TicksMin = 0xFFFFFFFFU;
+	}
+#ifdef USB_HYBRID_POLL
+	UsbPoll_SetConfig(USB_POLL_ENTER_EVENTS, USB_POLL_EXIT_IDLE_US);
+#endif
+}
+
+/****************************************************************************/
+/**
+* USB interrupt handler. Runs the driver handler and records how long the
+* interrupt kept the CPU.
+*
+* @param	CallBackRef is a pointer to the XUsbPsu instance.
+*
+* @return	None.
+*
+* @note		Registered with the interrupt controller instead of
+*		XUsbPsu_IntrHandler().
+*
+*****************************************************************************/
+USB_HOT_TEXT
+void UsbIntrHandler(void *CallBackRef)
+{
+	u64 Start = UsbGetTicks();
+	u64 SavedTicks = EventTicks;
+	u32 Ticks;
+	u32 Events = UsbEventsPending((struct XUsbPsu *)CallBackRef);
+
+	EventTicks = Start;
+	XUsbPsu_IntrHandler(CallBackRef);
+	EventTicks = SavedTicks;
+
+	if (ModerationOn == TRUE) {
+		/* The driver unmasked the interrupt, hold it for the interval */
+		UsbEventIntrMask((struct XUsbPsu *)CallBackRef, TRUE);
+		ModerationHeld = TRUE;
+		ModerationStart = UsbGetTicks();
+		Stats.ModHolds++;
+	}
+	Stats.Events += Events;
+
+#ifdef USB_HYBRID_POLL
+	PollStats.IrqTaken++;
+	PollStats.IrqEvents += Events;
+	if (Events >= PollEnterEvents) {
+		/* Heavy traffic, keep the interrupt masked and poll */
+		UsbEventIntrMask((struct XUsbPsu *)CallBackRef, TRUE);
+		PollStats.Polling = TRUE;
+		PollStats.PollEnters++;
+		PollLastEventTicks = UsbGetTicks();
+		ModerationHeld = FALSE;
+	}
+#endif
+
+	Ticks = (u32)(UsbGetTicks() - Start);
+	Stats.IsrCount++;
+	Stats.IsrTicksTotal += Ticks;
+	if (Ticks > Stats.IsrTicksMax) {
+		Stats.IsrTicksMax = Ticks;
+	}
+}
+
+USB_HOT_TEXT
+void UsbEventEpHandler(void (*Handler)(void *, u32, u32), void *CallBackRef,
+		       u32 RequestedBytes, u32 BytesTxed)
+{
+	UsbEvent Event;
+
+	Event.Type = USB_EVENT_EP_HANDLER;
+	Event.Func.Handler = Handler;
+	Event.Ref = CallBackRef;
+	Event.RequestedBytes = RequestedBytes;
+	Event.BytesTxed = BytesTxed;
+	UsbEventPost(&Event);
+}
+
+USB_HOT_TEXT
+void UsbEventEpCallback(Usb_EpCallback Callback, void *Context,
+			u8 *BufferPtr, u32 RequestedBytes, u32 BytesTxed,
+			s32 Status)
+{
+	UsbEvent Event;
+
+	Event.Type = USB_EVENT_EP_CALLBACK;
+	Event.Func.Callback = Callback;
+	Event.Ref = Context;
+	Event.BufferPtr = BufferPtr;
+	Event.RequestedBytes = RequestedBytes;
+	Event.BytesTxed = BytesTxed;
+	Event.Status = Status;
+	UsbEventPost(&Event);
+}
+
+USB_HOT_TEXT
+void UsbEventSetup(void (*Func)(struct Usb_DevData *, SetupPacket *),
+		   struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
+{
+	UsbEvent Event;
+
+	Event.Type = USB_EVENT_SETUP;
+	Event.Func.Setup = Func;
+	Event.Ref = InstancePtr;
+	Event.SetupData = *SetupData;
+	UsbEventPost(&Event);
+}
+
+/****************************************************************************/
+/**
+* Processes all queued events, called from the main loop.
+*
+* @param	None.
+*
+* @return	Number of events processed.
+*
+* @note		Each event runs to completion before the next one starts.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+u32 UsbEventDispatch(void)
+{
+	u32 Count = 0U;
+#ifdef USB_DEFERRED_EVENTS
+	UsbEvent Event;
+	u32 Ticks;
+
+	while (UsbRing_Get(&EventRing, &Event) == TRUE) {
+		Ticks = (u32)(UsbGetTicks() - Event.PostTicks);
+		if (Ticks > Stats.DispatchTicksMax) {
+			Stats.DispatchTicksMax = Ticks;
+		}
+		EventTicks = Event.PostTicks;
+		UsbEventRun(&Event);
+		Stats.Dispatched++;
+		Count++;
+	}
+#endif
+
+	return Count;
+}
+
+/****************************************************************************/
+/**
+* Returns the interrupt and event queue statistics.
+*
+* @param	StatsPtr is filled with the statistics.
+*
+* @return	None.
+*
+* @note		Worst case interrupt latency seen by other interrupts of the
+*		same or lower priority is IsrTicksMax, the worst case latency
+*		of deferred class processing is DispatchTicksMax.
+*
+*****************************************************************************/
+void UsbEvent_GetStats(UsbEvent_Stats *StatsPtr)
+{
+	u32 Flags = UsbIrqSave();
+
+	*StatsPtr = Stats;
+	UsbIrqRestore(Flags);
+}
+
+/****************************************************************************/
+/**
+* Sets the thresholds of the hybrid interrupt/poll mode.
+*
+* @param	EnterEvents is the number of events found by one interrupt
+*		that switches to polled mode, 0 never polls.
+* @param	ExitIdleUs is the time without events after which interrupts
+*		are enabled again.
+*
+* @return	None.
+*
+* @note		Without USB_HYBRID_POLL the call has no effect.
+*
+*****************************************************************************/
+void UsbPoll_SetConfig(u32 EnterEvents, u32 ExitIdleUs)
+{
+#ifdef USB_HYBRID_POLL
+	PollEnterEvents = (EnterEvents != 0U) ? EnterEvents : 0xFFFFFFFFU;
+	PollExitIdleTicks = ((u64)USB_TICKS_PER_SECOND * ExitIdleUs) / 1000000U;
+#else
+	(void)EnterEvents;
+	(void)ExitIdleUs;
+#endif
+}
+
+/****************************************************************************/
+/**
+* Drains the event buffer while in polled mode and ends interrupt moderation
+* holds, called from the main loop.
+*
+* @param	InstancePtr is a pointer to the XUsbPsu instance.
+*
+* @return	Number of events handled.
+*
+* @note		Does nothing in interrupt mode without moderation.
+*
+*****************************************************************************/
+u32 UsbPollService(struct XUsbPsu *InstancePtr)
+{
+	u32 Flags;
+#ifdef USB_HYBRID_POLL
+	u32 Events;
+	u64 Now;
+#endif
+
+	if (ModerationHeld == TRUE) {
+		Flags = UsbIrqSave();
+		UsbModerationService(InstancePtr);
+		UsbIrqRestore(Flags);
+	}
+
+#ifdef USB_HYBRID_POLL
+	if (PollStats.Polling == FALSE) {
+		return 0U;
+	}
+
+	Flags = UsbIrqSave();
+	PollStats.Polls++;
+	Events = UsbEventsPending(InstancePtr);
+	Now = UsbGetTicks();
+
+	if (Events != 0U) {
+		/* The driver unmasks the interrupt when it is done */
+		EventTicks = Now;
+		UsbPollHandler(InstancePtr);
+		UsbEventIntrMask(InstancePtr, TRUE);
+		PollStats.PolledEvents += Events;
+		PollLastEventTicks = Now;
+	} else if (Now - PollLastEventTicks >= PollExitIdleTicks) {
+		UsbEventIntrMask(InstancePtr, FALSE);
+		PollStats.Polling = FALSE;
+		PollStats.PollExits++;
+	}
+	UsbIrqRestore(Flags);
+
+	return Events;
+#else
+	return 0U;
+#endif
+}
+
+void UsbPoll_GetStats(UsbPoll_Stats *StatsPtr)
+{
+#ifdef USB_HYBRID_POLL
+	u32 Flags = UsbIrqSave();
+
+	*StatsPtr = PollStats;
+	UsbIrqRestore(Flags);
+#else
+	*StatsPtr = (UsbPoll_Stats) {
+		0
+	};
+#endif
+}
+
+/****************************************************************************/
+/**
+* Returns the interrupt load since the previous call.
+*
+* @param	LoadPtr is filled with the interrupt rate, the average number
+*		of events per interrupt and the share of CPU time spent in
+*		the interrupt handler.
+*
+* @return	None.
+*
+* @note		Compare at full bulk throughput with moderation off and on.
+*
+*****************************************************************************/
+void UsbEvent_GetLoad(UsbEvent_Load *LoadPtr)
+{
+	UsbEvent_Stats Now;
+	u64 Ticks = UsbGetTicks();
+	u64 Elapsed = Ticks - LoadTicks;
+	u32 Irqs;
+
+	UsbEvent_GetStats(&Now);
+	Irqs = Now.IsrCount - LoadStats.IsrCount;
+
+	*LoadPtr = (UsbEvent_Load) {
+		0
+	};
+	if (Elapsed != 0U) {
+		LoadPtr->IrqPerSec = (u32)(((u64)Irqs * USB_TICKS_PER_SECOND) /
+					   Elapsed);
+		LoadPtr->CpuPermille = (u32)(((Now.IsrTicksTotal -
+					       LoadStats.IsrTicksTotal) * 1000U) /
+					     Elapsed);
+	}
+	if (Irqs != 0U) {
+		LoadPtr->EventsPerIrq = ((Now.Events - LoadStats.Events) * 100U) /
+					Irqs;
+	}
+
+	LoadStats = Now;
+	LoadTicks = Ticks;
+}
+
+/****************************************************************************/
+/**
+* Sets the interrupt moderation interval. After each interrupt the event
+* buffer interrupt stays masked until the interval is over, endpoint events
+* arriving meanwhile are delivered together with the next interrupt.
+*
+* @param	InstancePtr is a pointer to the XUsbPsu instance.
+* @param	IntervalNs is the minimum time between two interrupts, 0
+*		disables moderation. It is limited to USB_IMOD_MAX_NS.
+*
+* @return	XST_SUCCESS.
+*
+* @note		The hold is ended by UsbPollService(), which must be called
+*		from the main loop. EP0 and device events end it at once, so
+*		setup packets wait at most one main loop pass. Works on cores
+*		without the DEV_IMOD timer such as the ZynqMP 2.90a.
+*
+*****************************************************************************/
+s32 UsbIntrModeration(struct XUsbPsu *InstancePtr, u32 IntervalNs)
+{
+	u32 Flags;
+
+	if (IntervalNs > USB_IMOD_MAX_NS) {
+		IntervalNs = USB_IMOD_MAX_NS;
+	}
+
+	Flags = UsbIrqSave();
+	ModerationTicks = ((u64)USB_TICKS_PER_SECOND * IntervalNs) /
+			  1000000000U;
+	ModerationOn = (IntervalNs != 0U) ? TRUE : FALSE;
+	if (ModerationOn == FALSE && ModerationHeld == TRUE) {
+		ModerationHeld = FALSE;
+		UsbEventIntrMask(InstancePtr, FALSE);
+	}
+	UsbIrqRestore(Flags);
+
+	return XST_SUCCESS;
+}
+
+/****************************************************************************/
+/**
+* Records the time from the interrupt that delivered the current event to
+* now.
+*
+* @param	Path is the measured path, USB_LATENCY_*.
+*
+* @return	None.
+*
+* @note		Called from the class and Chapter 9 code on the event path.
+*
+*****************************************************************************/
+USB_HOT_TEXT
+void UsbLatency_Mark(u32 Path)
+{
+	UsbLatency_Stats *LatPtr;
+	u32 Ticks;
+
+	if (Path >= USB_LATENCY_NUM_PATHS || EventTicks == 0U) {
+		return;
+	}
+
+	LatPtr = &Latency[Path];
+	Ticks = (u32)(UsbGetTicks() - EventTicks);
+	LatPtr->Count++;
+	LatPtr->TicksTotal += Ticks;
+	if (Ticks < LatPtr->TicksMin) {
+		LatPtr->TicksMin = Ticks;
+	}
+	if (Ticks > LatPtr->TicksMax) {
+		LatPtr->TicksMax = Ticks;
+	}
+}
+
+void UsbLatency_GetStats(u32 Path, UsbLatency_Stats *StatsPtr)
+{
+	u32 Flags;
+
+	*StatsPtr = (UsbLatency_Stats) {
+		0
+	};
+	if (Path >= USB_LATENCY_NUM_PATHS) {
+		return;
+	}
+
+	Flags = UsbIrqSave();
+	*StatsPtr = Latency[Path];
+	UsbIrqRestore(Flags);
+	if (StatsPtr->Count == 0U) {
+		StatsPtr->TicksMin = 0U;
+	}
+}
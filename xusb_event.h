@@ -0,0 +1,135 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_event.h
+ *
+ * This file contains declarations for the deferred event queue.
+ *
+ * With USB_DEFERRED_EVENTS the interrupt handler only moves driver events
+ * into a single-producer/single-consumer ring. Endpoint completions and
+ * setup packets are then processed to completion by UsbEventDispatch() in
+ * the main loop, so long class operations no longer hold off other USB
+ * interrupts. Without it the events are handled in the interrupt handler as
+ * before.
+ *
+ * With USB_HYBRID_POLL the interrupt handler switches to polled mode when
+ * one interrupt finds USB_POLL_ENTER_EVENTS or more events: the event
+ * buffer interrupt stays masked and UsbPollService() in the main loop
+ * drains the event buffer. Interrupts are enabled again once no event has
+ * arrived for USB_POLL_EXIT_IDLE_US.
+ *
+ * UsbIntrModeration() enables software interrupt moderation. After each
+ * interrupt the event buffer interrupt stays masked for the interval, so
+ * that endpoint events arriving meanwhile share the next interrupt.
+ * UsbPollService() releases the mask when the interval is over, or at once
+ * when an EP0 or device event is waiting, so control transfers and bus
+ * events are not delayed by more than one main loop pass. The ZynqMP core
+ * (2.90a) has no moderation timer, the same scheme works on every release.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_EVENT_H
+#define XUSB_EVENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xusb_wrapper.h"
+
+/************************** Constant Definitions ****************************/
+#ifndef USB_EVENT_RING_SLOTS
+#define USB_EVENT_RING_SLOTS		64U	/* Power of two */
+#endif
+
+/* Event types */
+#define USB_EVENT_EP_HANDLER		0U	/* SetEpHandler() completion */
+#define USB_EVENT_EP_CALLBACK		1U	/* Queued request completion */
+#define USB_EVENT_SETUP			2U	/* Setup packet for Chapter 9 */
+
+#ifndef USB_POLL_ENTER_EVENTS
+#define USB_POLL_ENTER_EVENTS		8U	/* Events per interrupt */
+#endif
+#ifndef USB_POLL_EXIT_IDLE_US
+#define USB_POLL_EXIT_IDLE_US		200U	/* Idle time before IRQ mode */
+#endif
+
+/* Event buffer entries, looked at by interrupt moderation */
+#define USB_EVT_DEVICE			0x01U	/* Device, not endpoint event */
+#define USB_EVT_EPNUM_MASK		0x3EU	/* Physical endpoint number */
+#define USB_EVT_EPNUM_SHIFT		1U
+#define USB_IMOD_MAX_NS			16000000U
+
+/* Paths timed from the interrupt that delivered their event */
+#define USB_LATENCY_SETUP_REPLY		0U	/* Setup packet to reply */
+#define USB_LATENCY_CBW_DATA		1U	/* CBW to data stage start */
+#define USB_LATENCY_NUM_PATHS		2U
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u32 IsrCount;		/* Interrupts handled */
+	u32 IsrTicksMax;	/* Longest interrupt handler run */
+	u64 IsrTicksTotal;
+	u32 Posted;		/* Events queued by the interrupt handler */
+	u32 Dispatched;		/* Events processed by UsbEventDispatch() */
+	u32 Inline;		/* Events handled in interrupt context */
+	u32 BacklogMax;		/* Highest number of queued events */
+	u32 DispatchTicksMax;	/* Longest time from post to processing */
+	u32 Events;		/* Controller events seen by interrupts */
+	u32 ModHolds;		/* Interrupts followed by a moderation hold */
+	u32 ModEarly;		/* Holds ended early by EP0 or device events */
+} UsbEvent_Stats;
+
+typedef struct {
+	u32 Count;
+	u32 TicksMin;
+	u32 TicksMax;
+	u64 TicksTotal;
+} UsbLatency_Stats;
+
+typedef struct {
+	u32 IrqPerSec;		/* Interrupt rate */
+	u32 EventsPerIrq;	/* Average events per interrupt, x100 */
+	u32 CpuPermille;	/* CPU time spent in the interrupt handler */
+} UsbEvent_Load;
+
+typedef struct {
+	u32 Polling;		/* TRUE while in polled mode */
+	u32 IrqTaken;		/* Interrupts handled */
+	u32 IrqEvents;		/* Events handled by interrupts */
+	u32 Polls;		/* UsbPollService() calls in polled mode */
+	u32 PolledEvents;	/* Events handled by polling */
+	u32 PollEnters;		/* Switches to polled mode */
+	u32 PollExits;		/* Switches back to interrupt mode */
+} UsbPoll_Stats;
+
+/************************** Function Prototypes ******************************/
+void UsbEvent_Init(void);
+void UsbIntrHandler(void *CallBackRef);
+void UsbEventEpHandler(void (*Handler)(void *, u32, u32), void *CallBackRef,
+		       u32 RequestedBytes, u32 BytesTxed);
+void UsbEventEpCallback(Usb_EpCallback Callback, void *Context,
+			u8 *BufferPtr, u32 RequestedBytes, u32 BytesTxed,
+			s32 Status);
+void UsbEventSetup(void (*Func)(struct Usb_DevData *, SetupPacket *),
+		   struct Usb_DevData *InstancePtr, SetupPacket *SetupData);
+u32 UsbEventDispatch(void);
+void UsbEvent_GetStats(UsbEvent_Stats *StatsPtr);
+void UsbEvent_GetLoad(UsbEvent_Load *LoadPtr);
+s32 UsbIntrModeration(struct XUsbPsu *InstancePtr, u32 IntervalNs);
+void UsbLatency_Mark(u32 Path);
+void UsbLatency_GetStats(u32 Path, UsbLatency_Stats *StatsPtr);
+void UsbPoll_SetConfig(u32 EnterEvents, u32 ExitIdleUs);
+u32 UsbPollService(struct XUsbPsu *InstancePtr);
+void UsbPoll_GetStats(UsbPoll_Stats *StatsPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_EVENT_H */
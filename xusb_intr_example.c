@@ -38,14 +38,32 @@
 #include <stdio.h>
 #include "xusb_ch9_storage.h"
 #include "xusb_class_storage.h"
+#ifdef USB_CCID
+#include "xusb_ch9_ccid.h"
+#include "xusb_class_ccid.h"
+#ifdef CCID_VIRTUAL_CARD
+#include "xusb_ccid_vcard.h"
+#endif
+#endif
 #include "xusb_wrapper.h"
+#include "xusb_event.h"
 #include "xil_exception.h"
+#ifdef VFLASH_DEDUP
+#include "xusb_storage_dedup.h"
+#endif
+#ifdef USB_OFFLOAD
+#include "xusb_offload.h"
+#endif
+#include "xusb_trace.h"
 
 #include "xparameters.h"
 
 #ifdef SDT
 #include "xinterrupt_wrap.h"
 #endif
+#if defined (USB_CCID) && defined (__aarch64__)
+#include "bspconfig.h"
+#endif
 
 #ifndef SDT
 #ifdef __MICROBLAZE__
@@ -61,6 +79,22 @@
 #define XUSBPSU_BASEADDRESS	XPAR_XUSBPSU_0_BASEADDR /* USB base address */
 #endif
 
+#if defined (USB_CCID) && defined (__aarch64__)
+/* Generic timer of UsbTimerArm(), for the CCID time extensions */
+#if (EL1_NONSECURE == 1)
+#define USB_TIMER_PPI		30U	/* Non-secure physical timer */
+#else
+#define USB_TIMER_PPI		29U	/* Secure physical timer */
+#endif
+#ifdef SDT
+/* As XSetupInterruptSystem() takes it: PPI, level triggered, number */
+#define USB_TIMER_INTR_ID	((1U << 20) | (4U << 12) | \
+				 (USB_TIMER_PPI - 16U))
+#else
+#define USB_TIMER_INTR_ID	USB_TIMER_PPI
+#endif
+#endif
+
 /************************** Constant Definitions ****************************/
 #define MEMORY_SIZE (64 * 1024)
 #ifdef __ICCARM__
@@ -71,7 +105,8 @@
 #endif
 u8 Buffer[MEMORY_SIZE];
 #else
-u8 Buffer[MEMORY_SIZE] ALIGNMENT_CACHELINE;
+/* DMA buffer pool for control replies and bounce buffers, kept in OCM */
+u8 Buffer[MEMORY_SIZE] ALIGNMENT_CACHELINE USB_HOT_BSS;
 #endif
 
 /**************************** Type Definitions *******************************/
@@ -79,10 +114,6 @@ u8 Buffer[MEMORY_SIZE] ALIGNMENT_CACHELINE;
 /***************** Macros (Inline Functions) Definitions *********************/
 
 /************************** Function Prototypes ******************************/
-void BulkOutHandler(void *CallBackRef, u32 RequestedBytes,
-		    u32 BytesTxed);
-void BulkInHandler(void *CallBackRef, u32 RequestedBytes,
-		   u32 BytesTxed);
 #ifndef SDT
 static s32 SetupInterruptSystem(struct XUsbPsu *InstancePtr, u16 IntcDeviceID,
 				u16 USB_INTR_ID, void *IntcPtr);
@@ -120,29 +151,59 @@ XScuGic	InterruptController;	/* Interrupt controller instance */
 #ifdef __ICCARM__
 #if defined (PLATFORM_ZYNQMP) || defined (versal)
 #pragma data_alignment = 64
-u8 VirtFlash[VFLASH_SIZE];
+u8 VirtFlash[VFLASH_BACKING_SIZE];
 #pragma data_alignment = 64
 USB_CBW CBW;
 #pragma data_alignment = 64
 USB_CSW CSW;
 #else
 #pragma data_alignment = 32
-u8 VirtFlash[VFLASH_SIZE];
+u8 VirtFlash[VFLASH_BACKING_SIZE];
 #pragma data_alignment = 32
 USB_CBW CBW;
 #pragma data_alignment = 32
 USB_CSW CSW;
 #endif
 #else
-u8 VirtFlash[VFLASH_SIZE] ALIGNMENT_CACHELINE;
-USB_CBW CBW ALIGNMENT_CACHELINE;
-USB_CSW CSW ALIGNMENT_CACHELINE;
+#if defined (PLATFORM_ZYNQMP) && defined (__aarch64__)
+/* Whole 2MB blocks of its own, see StorageDiskInit() and lscript.ld */
+u8 VirtFlash[VFLASH_BACKING_SIZE] __attribute__ ((section (".bss.usb_disk")))
+	__attribute__ ((aligned(0x200000)));
+#else
+u8 VirtFlash[VFLASH_BACKING_SIZE] ALIGNMENT_CACHELINE;
+#endif
+USB_CBW CBW ALIGNMENT_CACHELINE USB_HOT_BSS;
+USB_CSW CSW ALIGNMENT_CACHELINE USB_HOT_BSS;
 #endif
 
 u8 Phase;
-u32	rxBytesLeft;
-u8 *VirtFlashWritePointer = VirtFlash;
 
+#ifdef USB_CCID
+/* The smart card reader, in place of the mass storage device */
+static USBCH9_DATA ccid_data = {
+	.ch9_func = {
+		/* Set the chapter9 hooks */
+		.Usb_Ch9SetupDevDescReply =
+		Ccid_Ch9SetupDevDescReply,
+		.Usb_Ch9SetupCfgDescReply =
+		Ccid_Ch9SetupCfgDescReply,
+		.Usb_Ch9SetupBosDescReply =
+		Ccid_Ch9SetupBosDescReply,
+		.Usb_Ch9SetupStrDescReply =
+		Ccid_Ch9SetupStrDescReply,
+		.Usb_SetConfiguration =
+		Ccid_SetConfiguration,
+		.Usb_SetConfigurationApp =
+		Ccid_SetConfigurationApp,
+		/* hook the set interface handler */
+		.Usb_SetInterfaceHandler = NULL,
+		/* hook up CCID class handler */
+		.Usb_ClassReq = CcidClassReq,
+		.Usb_GetDescReply = NULL,
+	},
+	.data_ptr = (void *)NULL,
+};
+#else
 /* Initialize a DFU data structure */
 static USBCH9_DATA storage_data = {
 	.ch9_func = {
@@ -167,6 +228,7 @@ static USBCH9_DATA storage_data = {
 	},
 	.data_ptr = (void *)NULL,
 };
+#endif
 
 /****************************************************************************/
 /**
@@ -186,7 +248,20 @@ int main(void)
 {
 	s32 Status;
 
+#ifdef USB_OFFLOAD_WORKER_CORE
+	/* Worker image for another A53 core, the USB core owns the controller */
+	UsbOffload_WorkerMain(USB_OFFLOAD_WORKER_CORE - 1U);
+	return XST_FAILURE;
+#endif
+
+	/* Before anything of the USB interrupt path runs */
+	UsbOcmInit();
+
+#ifdef USB_CCID
+	xil_printf("CCID Gadget Start...\r\n");
+#else
 	xil_printf("Mass Storage Gadget Start...\r\n");
+#endif
 
 #ifdef SDT
 	struct XUsbPsu *InstancePtr = UsbInstance.PrivateData;
@@ -205,6 +280,47 @@ int main(void)
 	}
 
 	CacheInit();
+	UsbEvent_Init();
+#ifdef USB_LATENCY_TRACE
+	UsbTrace_Init();
+#endif
+#ifdef USB_CCID
+	CcidCacheRegister();
+#ifdef CCID_VIRTUAL_CARD
+	Ccid_SetIcc(CcidVCard_Init());
+#endif
+#else
+	StorageCacheRegister();
+	(void)StorageDiskInit();
+#endif
+
+#ifdef VFLASH_BENCH
+	xil_printf("Disk random 4KB reads: write-back %d/s, "
+		   "non-cacheable %d/s\r\n",
+		   StorageDiskBench(USB_CACHE_MAP_WRITEBACK, 100000U),
+		   StorageDiskBench(USB_CACHE_MAP_NONCACHEABLE, 100000U));
+#endif
+
+#ifdef USB_OFFLOAD
+	UsbOffload_Init(USB_OFFLOAD_WORKERS);
+#ifdef USB_OFFLOAD_BENCH
+	{
+		u32 Workers;
+
+		for (Workers = 0U; Workers <= USB_OFFLOAD_MAX_WORKERS;
+		     Workers++) {
+			xil_printf("Offload CRC32C, %d worker(s): %d KB/s\r\n",
+				   Workers, (u32)(UsbOffload_Benchmark(VirtFlash,
+					   VFLASH_BACKING_SIZE, 0x10000U,
+					   Workers) / 1024U));
+		}
+	}
+#endif
+#endif
+
+#ifdef VFLASH_DEDUP
+	VFlashDedup_Init(VirtFlash);
+#endif
 
 	/* We are passing the physical base address as the third argument
 	 * because the physical and virtual base address are the same in our
@@ -221,7 +337,11 @@ int main(void)
 	Set_Ch9Handler(UsbInstance.PrivateData, Ch9Handler);
 
 	/* Assign the data to usb driver */
+#ifdef USB_CCID
+	Set_DrvData(UsbInstance.PrivateData, &ccid_data);
+#else
 	Set_DrvData(UsbInstance.PrivateData, &storage_data);
+#endif
 
 	EpConfigure(UsbInstance.PrivateData, 1, USB_EP_DIR_OUT,
 		    USB_EP_TYPE_BULK);
@@ -234,14 +354,10 @@ int main(void)
 	}
 
 	/*
-	 * set endpoint handlers
-	 * BulkOutHandler - to be called when data is received
-	 * BulkInHandler -  to be called when data is sent
+	 * Bulk endpoint completions are handled per request by the storage
+	 * class, see StorageRecvCBW(), or by the CCID class, see
+	 * CcidRecvCommand().
 	 */
-	SetEpHandler(UsbInstance.PrivateData, 1, USB_EP_DIR_OUT,
-		     BulkOutHandler);
-	SetEpHandler(UsbInstance.PrivateData, 1, USB_EP_DIR_IN,
-		     BulkInHandler);
 
 	/* setup interrupts */
 #ifndef SDT
@@ -253,11 +369,16 @@ int main(void)
 		return XST_FAILURE;
 	}
 
+#ifdef USB_IMOD_INTERVAL_NS
+	/* Holds are released by UsbPollService() in the main loop */
+	(void)UsbIntrModeration(UsbInstance.PrivateData, USB_IMOD_INTERVAL_NS);
+#endif
+
 	/* Start the controller so that Host can see our device */
 	Usb_Start(UsbInstance.PrivateData);
 #else
 	Status = XSetupInterruptSystem(UsbInstance.PrivateData,
-				       &XUsbPsu_IntrHandler,
+				       &UsbIntrHandler,
 				       UsbConfigPtr->IntrId[INTRNAME_DWC3USB3],
 				       UsbConfigPtr->IntrParent,
 				       XINTERRUPT_DEFAULT_PRIORITY);
@@ -274,6 +395,15 @@ int main(void)
 	if (Status != XST_SUCCESS) {
 		return XST_FAILURE;
 	}
+#endif
+#ifdef USB_TIMER_INTR_ID
+	Status = XSetupInterruptSystem(NULL, &UsbTimerIntrHandler,
+				       USB_TIMER_INTR_ID,
+				       UsbConfigPtr->IntrParent,
+				       XINTERRUPT_DEFAULT_PRIORITY);
+	if (Status != XST_SUCCESS) {
+		return XST_FAILURE;
+	}
 #endif
 	/*
 	 * Enable interrupts for Reset, Disconnect, ConnectionDone, Link State
@@ -292,81 +422,33 @@ int main(void)
 		XUsbPsu_EnableIntr(UsbInstance.PrivateData,
 				   XUSBPSU_DEVTEN_HIBERNATIONREQEVTEN);
 #endif
+#ifdef USB_IMOD_INTERVAL_NS
+	/* Holds are released by UsbPollService() in the main loop */
+	(void)UsbIntrModeration(UsbInstance.PrivateData, USB_IMOD_INTERVAL_NS);
+#endif
+
 	/* Start the controller so that Host can see our device */
 	Usb_Start(UsbInstance.PrivateData);
 #endif
 
 	while (1) {
-		/* Rest is taken care by interrupts */
+		/*
+		 * Events are taken by interrupts, with USB_DEFERRED_EVENTS
+		 * the class processing runs here.
+		 */
+		UsbPollService(UsbInstance.PrivateData);
+		UsbEventDispatch();
+#ifdef USB_OFFLOAD
+		(void)UsbOffload_Poll();
+#endif
+#ifdef USB_CCID
+		(void)Ccid_Poll();
+#endif
 	}
 
 	return XST_SUCCESS;
 }
 
-/****************************************************************************/
-/**
-* This function is Bulk Out Endpoint handler/Callback called by driver when
-* data is received.
-*
-* @param	CallBackRef is pointer to Usb_DevData instance.
-* @param	RequestedBytes is number of bytes requested for reception.
-* @param	BytesTxed is actual number of bytes received from Host.
-*
-* @return	None
-*
-* @note		None.
-*
-*****************************************************************************/
-void BulkOutHandler(void *CallBackRef, u32 RequestedBytes,
-		    u32 BytesTxed)
-{
-	struct Usb_DevData *InstancePtr = (struct Usb_DevData *)CallBackRef;
-
-	if (Phase == USB_EP_STATE_COMMAND) {
-		ParseCBW(InstancePtr);
-	} else if (Phase == USB_EP_STATE_DATA_OUT) {
-		/* WRITE command */
-		switch (CBW.CBWCB[0]) {
-			case USB_RBC_WRITE:
-				VirtFlashWritePointer += BytesTxed;
-				rxBytesLeft -= BytesTxed;
-				break;
-			default:
-				break;
-		}
-		SendCSW(InstancePtr, 0);
-	}
-}
-
-/****************************************************************************/
-/**
-* This function is Bulk In Endpoint handler/Callback called by driver when
-* data is sent.
-*
-* @param	CallBackRef is pointer to Usb_DevData instance.
-* @param	RequestedBytes is number of bytes requested to send.
-* @param	BytesTxed is actual number of bytes sent to Host.
-*
-* @return	None
-*
-* @note		None.
-*
-*****************************************************************************/
-void BulkInHandler(void *CallBackRef, u32 RequestedBytes,
-		   u32 BytesTxed)
-{
-	struct Usb_DevData *InstancePtr = (struct Usb_DevData *)CallBackRef;
-
-	if (Phase == USB_EP_STATE_DATA_IN) {
-		/* Send the status */
-		SendCSW(InstancePtr, 0);
-	} else if (Phase == USB_EP_STATE_STATUS) {
-		Phase = USB_EP_STATE_COMMAND;
-		/* Receive next CBW */
-		EpBufferRecv(InstancePtr->PrivateData, 1, (u8 *)&CBW, sizeof(CBW));
-	}
-}
-
 #ifndef SDT
 /****************************************************************************/
 /**
@@ -418,7 +500,7 @@ static s32 SetupInterruptSystem(struct XUsbPsu *InstancePtr, u16 IntcDeviceID,
 	 * for the USB device occurs.
 	 */
 	Status = XIntc_Connect(IntcInstancePtr, USB_INTR_ID,
-			       (Xil_ExceptionHandler)XUsbPsu_IntrHandler,
+			       (Xil_ExceptionHandler)UsbIntrHandler,
 			       (void *) InstancePtr);
 	if (Status != XST_SUCCESS) {
 		return XST_FAILURE;
@@ -488,7 +570,7 @@ static s32 SetupInterruptSystem(struct XUsbPsu *InstancePtr, u16 IntcDeviceID,
 	 * Connect to the interrupt controller
 	 */
 	Status = XScuGic_Connect(IntcInstancePtr, USB_INTR_ID,
-				 (Xil_ExceptionHandler)XUsbPsu_IntrHandler,
+				 (Xil_ExceptionHandler)UsbIntrHandler,
 				 (void *)InstancePtr);
 	if (Status != XST_SUCCESS) {
 		return XST_FAILURE;
@@ -501,6 +583,19 @@ static s32 SetupInterruptSystem(struct XUsbPsu *InstancePtr, u16 IntcDeviceID,
 		return XST_FAILURE;
 	}
 #endif
+#ifdef USB_TIMER_INTR_ID
+	Status = XScuGic_Connect(IntcInstancePtr, USB_TIMER_INTR_ID,
+				 (Xil_ExceptionHandler)UsbTimerIntrHandler,
+				 NULL);
+	if (Status != XST_SUCCESS) {
+		return XST_FAILURE;
+	}
+#endif
+
+#ifdef USB_OFFLOAD
+	/* Keep the USB interrupt on this core, the others run workers */
+	XScuGic_InterruptMaptoCpu(IntcInstancePtr, XPAR_CPU_ID, USB_INTR_ID);
+#endif
 
 	/*
 	 * Enable the interrupt for the USB
@@ -509,6 +604,9 @@ static s32 SetupInterruptSystem(struct XUsbPsu *InstancePtr, u16 IntcDeviceID,
 #ifdef XUSBPSU_HIBERNATION_ENABLE
 	XScuGic_Enable(IntcInstancePtr, USB_WAKEUP_INTR_ID);
 #endif
+#ifdef USB_TIMER_INTR_ID
+	XScuGic_Enable(IntcInstancePtr, USB_TIMER_INTR_ID);
+#endif
 
 	/*
 	 * Enable interrupts for Reset, Disconnect, ConnectionDone, Link State
@@ -0,0 +1,581 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_offload.c
+ *
+ * This file contains the implementation of the multi-core job offload.
+ *
+ * The USB core is the only producer of the submission rings and the only
+ * consumer of the completion rings, each worker the opposite. The shared
+ * region is normal inner shareable memory, the A53 cluster keeps it coherent
+ * so no cache maintenance is needed on either side. Idle workers sleep in WFE
+ * and are woken by the SEV issued after a submission.
+ *
+ * The shared section is not loaded or cleared, after a warm reset it still
+ * holds the words of the previous boot. A worker therefore clears its Running
+ * word and the Magic word before waiting, UsbOffload_Init() clears every
+ * Running word before publishing Magic, and UsbOffload_Poll() publishes Magic
+ * again if a worker started after UsbOffload_Init() and cleared it.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <string.h>
+#include "xusb_offload.h"
+#include "xusb_ring.h"
+#include "xusb_wrapper.h"
+
+#ifdef USB_OFFLOAD
+
+#if defined (__aarch64__)
+#include <arm_acle.h>
+#elif defined (USB_HOST_SIM)
+#include <sched.h>
+#endif
+
+/************************** Constant Definitions *****************************/
+#define OFFLOAD_MAGIC		0x55534F46U	/* "USOF" */
+#define CRC32C_POLY		0x82F63B78U
+
+/**************************** Type Definitions *******************************/
+typedef struct {
+	volatile u32 Magic;	/* Written last by UsbOffload_Init() */
+	UsbRing Submit[USB_OFFLOAD_MAX_WORKERS];
+	UsbRing Done[USB_OFFLOAD_MAX_WORKERS];
+	UsbOffload_Job SubmitSlots[USB_OFFLOAD_MAX_WORKERS][USB_OFFLOAD_RING_SLOTS];
+	UsbOffload_Job DoneSlots[USB_OFFLOAD_MAX_WORKERS][USB_OFFLOAD_RING_SLOTS];
+	UsbOffload_WorkerStats Worker[USB_OFFLOAD_MAX_WORKERS];
+} UsbOffload_Shared;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#if defined (__aarch64__)
+#define OffloadWake()	__asm__ __volatile__("dsb ish\n\tsev" ::: "memory")
+#define OffloadSleep()	__asm__ __volatile__("wfe" ::: "memory")
+#elif defined (USB_HOST_SIM)
+/* Worker threads give their CPU to the firmware thread while idle */
+#define OffloadWake()
+#define OffloadSleep()	(void)sched_yield()
+#else
+#define OffloadWake()
+#define OffloadSleep()
+#endif
+
+/************************** Variable Definitions *****************************/
+static UsbOffload_Shared Shared __attribute__((section(".usb_shared"),
+					       aligned(64)));
+
+/* Per image, function pointers are not valid across images */
+static UsbOffload_Op OpTable[USB_OFFLOAD_NUM_OPS];
+
+static u32 ActiveWorkers;
+static u32 Initialized;
+static UsbOffload_Stats Stats;
+
+#if !defined (__aarch64__)
+static u32 Crc32cTable[256];
+#endif
+
+/*****************************************************************************/
+/**
+* Computes the CRC32C of a buffer. On AArch64 the ARMv8 CRC32 instructions
+* are used, other processors fall back to a table driven implementation.
+*
+* @param	Src is the data.
+* @param	Dst is not used.
+* @param	Length is the number of bytes.
+* @param	ResultPtr receives the CRC32C.
+*
+* @return	XST_SUCCESS.
+*
+* @note		None.
+*
+******************************************************************************/
+#if defined (__aarch64__)
+__attribute__((target("+crc")))
+static s32 OpCrc32c(const u8 *Src, u8 *Dst, u32 Length, u32 *ResultPtr)
+{
+	u32 Crc = 0xFFFFFFFFU;
+
+	(void)Dst;
+
+	while (Length != 0U && ((UINTPTR)Src & 7U) != 0U) {
+		Crc = __crc32cb(Crc, *Src++);
+		Length--;
+	}
+	for (; Length >= 8U; Length -= 8U, Src += 8) {
+		Crc = __crc32cd(Crc, *(const u64 *)Src);
+	}
+	while (Length-- != 0U) {
+		Crc = __crc32cb(Crc, *Src++);
+	}
+
+	*ResultPtr = ~Crc;
+	return XST_SUCCESS;
+}
+#else
+static s32 OpCrc32c(const u8 *Src, u8 *Dst, u32 Length, u32 *ResultPtr)
+{
+	u32 Crc = 0xFFFFFFFFU;
+
+	(void)Dst;
+
+	while (Length-- != 0U) {
+		Crc = Crc32cTable[(Crc ^ *Src++) & 0xFFU] ^ (Crc >> 8);
+	}
+
+	*ResultPtr = ~Crc;
+	return XST_SUCCESS;
+}
+#endif
+
+static s32 OpCopy(const u8 *Src, u8 *Dst, u32 Length, u32 *ResultPtr)
+{
+	memcpy(Dst, Src, Length);
+	*ResultPtr = 0U;
+
+	return XST_SUCCESS;
+}
+
+static s32 OpZeroCheck(const u8 *Src, u8 *Dst, u32 Length, u32 *ResultPtr)
+{
+	u32 Index;
+
+	(void)Dst;
+
+	*ResultPtr = FALSE;
+	for (Index = 0U; Index < Length; Index++) {
+		if (Src[Index] != 0U) {
+			return XST_SUCCESS;
+		}
+	}
+
+	*ResultPtr = TRUE;
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Sets up the operations built into every image.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void OffloadOpsInit(void)
+{
+#if !defined (__aarch64__)
+	u32 Index;
+	u32 Bit;
+
+	for (Index = 0U; Index < 256U; Index++) {
+		u32 Crc = Index;
+
+		for (Bit = 0U; Bit < 8U; Bit++) {
+			Crc = (Crc >> 1) ^ ((Crc & 1U) ? CRC32C_POLY : 0U);
+		}
+		Crc32cTable[Index] = Crc;
+	}
+#endif
+
+	OpTable[USB_OFFLOAD_OP_COPY] = OpCopy;
+	OpTable[USB_OFFLOAD_OP_CRC32C] = OpCrc32c;
+	OpTable[USB_OFFLOAD_OP_ZERO_CHECK] = OpZeroCheck;
+}
+
+/*****************************************************************************/
+/**
+* Runs one job.
+*
+* @param	JobPtr is the job, Status and Result are updated.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void OffloadRun(UsbOffload_Job *JobPtr)
+{
+	UsbOffload_Op Func = NULL;
+
+	if (JobPtr->Op < USB_OFFLOAD_NUM_OPS) {
+		Func = OpTable[JobPtr->Op];
+	}
+
+	if (Func == NULL) {
+		JobPtr->Status = XST_INVALID_PARAM;
+		JobPtr->Result = 0U;
+		return;
+	}
+
+	JobPtr->Status = Func((const u8 *)JobPtr->Src, (u8 *)JobPtr->Dst,
+			      JobPtr->Length, &JobPtr->Result);
+}
+
+/*****************************************************************************/
+/**
+* Hands a completed job back to its submitter.
+*
+* @param	JobPtr is the job.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void OffloadComplete(const UsbOffload_Job *JobPtr)
+{
+	UsbOffload_Done Done = (UsbOffload_Done)JobPtr->Done;
+	u32 Ticks = (u32)(UsbGetTicks() - JobPtr->SubmitTicks);
+
+	Stats.LatencyTicksTotal += Ticks;
+	if (Ticks > Stats.LatencyTicksMax) {
+		Stats.LatencyTicksMax = Ticks;
+	}
+
+	if (Done != NULL) {
+		Done((void *)JobPtr->Context, JobPtr->Result, JobPtr->Status);
+	}
+}
+
+/*****************************************************************************/
+/**
+* Sets up the shared rings. Called on the USB core before any worker job is
+* submitted, workers wait for it.
+*
+* @param	Workers is the number of worker cores jobs are spread over,
+*		0 runs every job inline.
+*
+* @return	None.
+*
+* @note		Worker images may be started before or after this call.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void UsbOffload_Init(u32 Workers)
+{
+	u32 Worker;
+
+	__atomic_store_n(&Shared.Magic, 0U, __ATOMIC_RELEASE);
+
+	for (Worker = 0U; Worker < USB_OFFLOAD_MAX_WORKERS; Worker++) {
+		/* Left over from before a warm reset */
+		__atomic_store_n(&Shared.Worker[Worker].Running, FALSE,
+				 __ATOMIC_RELEASE);
+		UsbRing_Init(&Shared.Submit[Worker], Shared.SubmitSlots[Worker],
+			     USB_OFFLOAD_RING_SLOTS, sizeof(UsbOffload_Job));
+		UsbRing_Init(&Shared.Done[Worker], Shared.DoneSlots[Worker],
+			     USB_OFFLOAD_RING_SLOTS, sizeof(UsbOffload_Job));
+	}
+
+	Stats = (UsbOffload_Stats) {
+		0
+	};
+	OffloadOpsInit();
+	UsbOffload_SetWorkers(Workers);
+	Initialized = TRUE;
+
+	__atomic_store_n(&Shared.Magic, OFFLOAD_MAGIC, __ATOMIC_RELEASE);
+	OffloadWake();
+}
+
+/*****************************************************************************/
+/**
+* Changes the number of worker cores new jobs are spread over. Jobs already
+* submitted still complete.
+*
+* @param	Workers is the number of worker cores, 0 to 3.
+*
+* @return	None.
+*
+* @note		Used to measure the scaling with the number of cores.
+*
+******************************************************************************/
+void UsbOffload_SetWorkers(u32 Workers)
+{
+	ActiveWorkers = (Workers > USB_OFFLOAD_MAX_WORKERS) ?
+			USB_OFFLOAD_MAX_WORKERS : Workers;
+}
+
+/*****************************************************************************/
+/**
+* Submits a job to the least loaded running worker.
+*
+* @param	Op is the operation, USB_OFFLOAD_OP_*.
+* @param	Src is the input buffer.
+* @param	Dst is the output buffer, if the operation has one.
+* @param	Length is the number of bytes at Src.
+* @param	Done is called from UsbOffload_Poll() on completion, may be
+*		NULL.
+* @param	Context is passed to Done.
+*
+* @return	XST_SUCCESS. Done is called before returning when the job
+*		ran inline.
+*
+* @note		Buffers must stay valid until Done is called. May be called
+*		from interrupt context.
+*
+******************************************************************************/
+s32 UsbOffload_Submit(u32 Op, const void *Src, void *Dst, u32 Length,
+		      UsbOffload_Done Done, void *Context)
+{
+	UsbOffload_Job Job;
+	u32 Best = USB_OFFLOAD_MAX_WORKERS;
+	u32 BestCount = USB_OFFLOAD_RING_SLOTS;
+	u32 Worker;
+	u32 Flags;
+
+	Job.Op = Op;
+	Job.Status = XST_SUCCESS;
+	Job.Result = 0U;
+	Job.Length = Length;
+	Job.Src = (UINTPTR)Src;
+	Job.Dst = (UINTPTR)Dst;
+	Job.Done = (UINTPTR)Done;
+	Job.Context = (UINTPTR)Context;
+	Job.SubmitTicks = UsbGetTicks();
+
+	Flags = UsbIrqSave();
+	for (Worker = 0U; Worker < ActiveWorkers; Worker++) {
+		u32 Count;
+
+		if (__atomic_load_n(&Shared.Worker[Worker].Running,
+				    __ATOMIC_ACQUIRE) != TRUE) {
+			continue;
+		}
+
+		Count = UsbRing_Count(&Shared.Submit[Worker]);
+		if (Count < BestCount) {
+			Best = Worker;
+			BestCount = Count;
+		}
+	}
+
+	if (Best != USB_OFFLOAD_MAX_WORKERS &&
+	    UsbRing_Put(&Shared.Submit[Best], &Job) == TRUE) {
+		Stats.Submitted++;
+		UsbIrqRestore(Flags);
+		OffloadWake();
+		return XST_SUCCESS;
+	}
+
+	/* No worker or all rings full, do it here */
+	Stats.Inline++;
+	UsbIrqRestore(Flags);
+
+	OffloadRun(&Job);
+	OffloadComplete(&Job);
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Collects completed jobs and calls their Done callbacks. Called from the
+* main loop of the USB core.
+*
+* @param	None.
+*
+* @return	Number of jobs collected.
+*
+* @note		Also lets in workers started after UsbOffload_Init().
+*
+******************************************************************************/
+u32 UsbOffload_Poll(void)
+{
+	UsbOffload_Job Job;
+	u32 Worker;
+	u32 Count = 0U;
+
+	if (Initialized == TRUE &&
+	    __atomic_load_n(&Shared.Magic, __ATOMIC_ACQUIRE) != OFFLOAD_MAGIC) {
+		__atomic_store_n(&Shared.Magic, OFFLOAD_MAGIC, __ATOMIC_RELEASE);
+		OffloadWake();
+	}
+
+	for (Worker = 0U; Worker < USB_OFFLOAD_MAX_WORKERS; Worker++) {
+		while (UsbRing_Get(&Shared.Done[Worker], &Job) == TRUE) {
+			Stats.Completed++;
+			OffloadComplete(&Job);
+			Count++;
+		}
+	}
+
+	return Count;
+}
+
+/*****************************************************************************/
+/**
+* Returns the offload statistics, including the counters kept by the
+* workers.
+*
+* @param	StatsPtr is filled with the statistics.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void UsbOffload_GetStats(UsbOffload_Stats *StatsPtr)
+{
+	*StatsPtr = Stats;
+	memcpy(StatsPtr->Worker, Shared.Worker, sizeof(Shared.Worker));
+}
+
+static void BenchDone(void *Context, u32 Result, s32 Status)
+{
+	(void)Result;
+	(void)Status;
+
+	(*(u32 *)Context)++;
+}
+
+/*****************************************************************************/
+/**
+* Measures the CRC32C throughput with a given number of worker cores.
+*
+* @param	BufferPtr is the data to checksum.
+* @param	Length is the number of bytes at BufferPtr.
+* @param	JobSize is the number of bytes per job.
+* @param	Workers is the number of worker cores to use, 0 measures the
+*		USB core alone.
+*
+* @return	Throughput in bytes per second.
+*
+* @note		Run it before the controller is started, it competes with
+*		USB jobs otherwise. The previous number of workers is kept.
+*
+******************************************************************************/
+u64 UsbOffload_Benchmark(u8 *BufferPtr, u32 Length, u32 JobSize, u32 Workers)
+{
+	u32 Saved = ActiveWorkers;
+	u32 Jobs = 0U;
+	u32 Done = 0U;
+	u32 Offset;
+	u64 Start;
+	u64 Ticks;
+
+	if (JobSize == 0U || Length == 0U) {
+		return 0U;
+	}
+
+	UsbOffload_SetWorkers(Workers);
+
+	Start = UsbGetTicks();
+	for (Offset = 0U; Offset < Length; Offset += JobSize) {
+		u32 Size = ((Length - Offset) < JobSize) ? (Length - Offset) :
+			   JobSize;
+
+		(void)UsbOffload_Submit(USB_OFFLOAD_OP_CRC32C,
+					BufferPtr + Offset, NULL, Size,
+					BenchDone, &Done);
+		Jobs++;
+		(void)UsbOffload_Poll();
+	}
+	while (Done != Jobs) {
+		(void)UsbOffload_Poll();
+	}
+	Ticks = UsbGetTicks() - Start;
+
+	UsbOffload_SetWorkers(Saved);
+
+	if (Ticks == 0U) {
+		return 0U;
+	}
+
+	return ((u64)Length * USB_TICKS_PER_SECOND) / Ticks;
+}
+
+/*****************************************************************************/
+/**
+* Registers an operation. Must be done in the worker images and, for jobs
+* that may run inline, in the USB core image.
+*
+* @param	Op is USB_OFFLOAD_OP_USER or higher.
+* @param	Func is the implementation.
+*
+* @return	XST_SUCCESS, or XST_INVALID_PARAM for a built-in or out of range
+*		operation.
+*
+* @note		Call after UsbOffload_Init() on the USB core, before
+*		UsbOffload_WorkerMain() on a worker.
+*
+******************************************************************************/
+s32 UsbOffload_SetOp(u32 Op, UsbOffload_Op Func)
+{
+	if (Op < USB_OFFLOAD_OP_USER || Op >= USB_OFFLOAD_NUM_OPS) {
+		return XST_INVALID_PARAM;
+	}
+
+	OpTable[Op] = Func;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Main loop of a worker core. Waits for the USB core to set up the rings and
+* then runs the jobs submitted to this worker.
+*
+* @param	Worker is the worker number, core number - 1.
+*
+* @return	Only if Worker is out of range.
+*
+* @note		Magic is cleared first, a value left in the shared section by
+*		the previous boot must not start the worker before the rings
+*		are set up again.
+*
+******************************************************************************/
+void UsbOffload_WorkerMain(u32 Worker)
+{
+	UsbOffload_WorkerStats *WStats;
+	UsbOffload_Job Job;
+
+	if (Worker >= USB_OFFLOAD_MAX_WORKERS) {
+		return;
+	}
+
+	OffloadOpsInit();
+	WStats = &Shared.Worker[Worker];
+
+	__atomic_store_n(&WStats->Running, FALSE, __ATOMIC_RELEASE);
+	__atomic_store_n(&Shared.Magic, 0U, __ATOMIC_RELEASE);
+
+	while (__atomic_load_n(&Shared.Magic, __ATOMIC_ACQUIRE) !=
+	       OFFLOAD_MAGIC) {
+		OffloadSleep();
+	}
+	__atomic_store_n(&WStats->Running, TRUE, __ATOMIC_RELEASE);
+
+	while (1) {
+		u64 Start;
+		u32 Count = UsbRing_Count(&Shared.Submit[Worker]);
+
+		if (Count > WStats->BacklogMax) {
+			WStats->BacklogMax = Count;
+		}
+
+		if (UsbRing_Get(&Shared.Submit[Worker], &Job) != TRUE) {
+			OffloadSleep();
+			continue;
+		}
+
+		Start = UsbGetTicks();
+		OffloadRun(&Job);
+		WStats->BusyTicks += UsbGetTicks() - Start;
+		WStats->Bytes += Job.Length;
+		WStats->Jobs++;
+
+		/* The USB core drains completions from its main loop */
+		while (UsbRing_Put(&Shared.Done[Worker], &Job) != TRUE) {
+		}
+	}
+}
+
+#endif /* USB_OFFLOAD */
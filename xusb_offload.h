@@ -0,0 +1,117 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_offload.h
+ *
+ * This file contains declarations for offloading backend work from the USB
+ * core to the other Cortex-A53 cores.
+ *
+ * The core running the USB controller, the protocol state machines and the
+ * interrupt handler submits jobs (copy, CRC32C, zero check or an operation
+ * registered by the worker image) to worker cores. Every worker has a
+ * submission ring and a completion ring, both single-producer/single-consumer
+ * rings in the .usb_shared section. That section is the only content of the
+ * psu_ocm_shared region, so it has the same address in every image.
+ *
+ * Workers are separate images built from the same sources with
+ * USB_OFFLOAD_WORKER_CORE set to their core number (1 to 3) and linked with
+ * --defsym=_USB_IMAGE=<core>, which gives them their own DDR and OCM ranges,
+ * see lscript.ld. They never touch the controller. Completions are collected by UsbOffload_Poll() on the USB
+ * core. Jobs run inline when no worker is running or all rings are full.
+ *
+ * The offload is enabled by defining USB_OFFLOAD.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_OFFLOAD_H
+#define XUSB_OFFLOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_OFFLOAD_MAX_WORKERS		3U	/* Cores 1 to 3 */
+
+#ifndef USB_OFFLOAD_RING_SLOTS
+#define USB_OFFLOAD_RING_SLOTS		32U	/* Power of two */
+#endif
+
+#ifndef USB_OFFLOAD_WORKERS
+#define USB_OFFLOAD_WORKERS		USB_OFFLOAD_MAX_WORKERS
+#endif
+
+/* Job operations */
+#define USB_OFFLOAD_OP_COPY		0U	/* Dst = Src, Result unused */
+#define USB_OFFLOAD_OP_CRC32C		1U	/* Result = CRC32C of Src */
+#define USB_OFFLOAD_OP_ZERO_CHECK	2U	/* Result = TRUE if Src is zero */
+#define USB_OFFLOAD_OP_USER		8U	/* First UsbOffload_SetOp() op */
+#define USB_OFFLOAD_NUM_OPS		16U
+
+/**************************** Type Definitions ******************************/
+typedef struct UsbOffload_Job UsbOffload_Job;
+
+/* Called on the USB core from UsbOffload_Poll() */
+typedef void (*UsbOffload_Done)(void *Context, u32 Result, s32 Status);
+
+/* Worker side implementation of an operation */
+typedef s32 (*UsbOffload_Op)(const u8 *Src, u8 *Dst, u32 Length,
+			     u32 *ResultPtr);
+
+struct UsbOffload_Job {
+	u32 Op;
+	s32 Status;		/* Set by the worker */
+	u32 Result;		/* Set by the worker */
+	u32 Length;
+	UINTPTR Src;
+	UINTPTR Dst;
+	UINTPTR Done;		/* Opaque to the worker */
+	UINTPTR Context;	/* Opaque to the worker */
+	u64 SubmitTicks;
+};
+
+typedef struct {
+	u32 Running;		/* TRUE once the worker image has started */
+	u32 Jobs;		/* Jobs completed */
+	u64 Bytes;		/* Bytes processed */
+	u64 BusyTicks;		/* Time spent running jobs */
+	u32 BacklogMax;		/* Highest submission ring fill */
+} UsbOffload_WorkerStats;
+
+typedef struct {
+	u32 Submitted;		/* Jobs handed to workers */
+	u32 Completed;		/* Worker jobs collected by UsbOffload_Poll() */
+	u32 Inline;		/* Jobs run on the USB core */
+	u32 LatencyTicksMax;	/* Longest time from submission to collection */
+	u64 LatencyTicksTotal;
+	UsbOffload_WorkerStats Worker[USB_OFFLOAD_MAX_WORKERS];
+} UsbOffload_Stats;
+
+/************************** Function Prototypes ******************************/
+/* USB core */
+void UsbOffload_Init(u32 Workers);
+void UsbOffload_SetWorkers(u32 Workers);
+s32 UsbOffload_Submit(u32 Op, const void *Src, void *Dst, u32 Length,
+		      UsbOffload_Done Done, void *Context);
+u32 UsbOffload_Poll(void);
+void UsbOffload_GetStats(UsbOffload_Stats *StatsPtr);
+u64 UsbOffload_Benchmark(u8 *BufferPtr, u32 Length, u32 JobSize,
+			 u32 Workers);
+
+/* Worker cores */
+s32 UsbOffload_SetOp(u32 Op, UsbOffload_Op Func);
+void UsbOffload_WorkerMain(u32 Worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_OFFLOAD_H */
@@ -0,0 +1,94 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_ring.h
+ *
+ * This file contains a lock-free single-producer/single-consumer ring of
+ * fixed size entries.
+ *
+ * The producer only writes Head and the consumer only writes Tail, so one
+ * side may run in interrupt context or on another core without locking.
+ * Head and Tail are free running counters, the number of slots must be a
+ * power of two.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_RING_H
+#define XUSB_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+#include <string.h>
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	volatile u32 Head;	/* Next slot written by the producer */
+	volatile u32 Tail;	/* Next slot read by the consumer */
+	u32 Slots;		/* Power of two */
+	u32 EntrySize;
+	u8 *Storage;		/* Slots * EntrySize bytes */
+} UsbRing;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static inline void UsbRing_Init(UsbRing *RingPtr, void *Storage, u32 Slots,
+				u32 EntrySize)
+{
+	RingPtr->Head = 0U;
+	RingPtr->Tail = 0U;
+	RingPtr->Slots = Slots;
+	RingPtr->EntrySize = EntrySize;
+	RingPtr->Storage = (u8 *)Storage;
+}
+
+static inline u32 UsbRing_Count(const UsbRing *RingPtr)
+{
+	return __atomic_load_n(&RingPtr->Head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&RingPtr->Tail, __ATOMIC_ACQUIRE);
+}
+
+/* Producer side, returns FALSE when the ring is full */
+static inline u32 UsbRing_Put(UsbRing *RingPtr, const void *Entry)
+{
+	u32 Head = RingPtr->Head;
+
+	if (Head - __atomic_load_n(&RingPtr->Tail, __ATOMIC_ACQUIRE) ==
+	    RingPtr->Slots) {
+		return FALSE;
+	}
+
+	memcpy(RingPtr->Storage + (Head & (RingPtr->Slots - 1U)) *
+	       RingPtr->EntrySize, Entry, RingPtr->EntrySize);
+	__atomic_store_n(&RingPtr->Head, Head + 1U, __ATOMIC_RELEASE);
+
+	return TRUE;
+}
+
+/* Consumer side, returns FALSE when the ring is empty */
+static inline u32 UsbRing_Get(UsbRing *RingPtr, void *Entry)
+{
+	u32 Tail = RingPtr->Tail;
+
+	if (__atomic_load_n(&RingPtr->Head, __ATOMIC_ACQUIRE) == Tail) {
+		return FALSE;
+	}
+
+	memcpy(Entry, RingPtr->Storage + (Tail & (RingPtr->Slots - 1U)) *
+	       RingPtr->EntrySize, RingPtr->EntrySize);
+	__atomic_store_n(&RingPtr->Tail, Tail + 1U, __ATOMIC_RELEASE);
+
+	return TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_RING_H */
@@ -0,0 +1,695 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_storage_dedup.c
+ *
+ * This file contains the implementation of the deduplicating virtual flash
+ * backend used by the Mass Storage class when VFLASH_DEDUP is defined.
+ *
+ * Each logical chunk maps to a physical chunk index or VFLASH_DEDUP_NONE for
+ * chunks that were never written or were written with zeros. Physical chunks
+ * are chained per hash bucket for lookup and chained on a free list when not
+ * in use, both through PhysNext[].
+ *
+ * With USB_OFFLOAD, VFlashDedup_WriteAsync() hands the CRC32C of every whole
+ * chunk of a write to the worker cores as USB_OFFLOAD_OP_CRC32C jobs. The
+ * chunks are committed on the USB core once all hashes are back, so the
+ * hash table and the maps are only ever touched by one core.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <string.h>
+#include "xusb_storage_dedup.h"
+#include "xusb_wrapper.h"
+#ifdef USB_OFFLOAD
+#include "xusb_offload.h"
+#endif
+
+#ifdef VFLASH_DEDUP
+
+#if defined (__aarch64__)
+#include <arm_acle.h>
+#endif
+
+/************************** Constant Definitions *****************************/
+#define CRC32C_POLY		0x82F63B78U
+
+/* Whole chunks of one VFlashDedup_WriteAsync() hashed by offload jobs */
+#define DEDUP_ASYNC_CHUNKS	(VFLASH_DEDUP_WINDOW_SIZE / \
+				 VFLASH_DEDUP_CHUNK_SIZE)
+
+/**************************** Type Definitions *******************************/
+#ifdef USB_OFFLOAD
+typedef struct {
+	u32 Offset;
+	const u8 *BufferPtr;
+	u32 Length;
+	VFlashDedup_Done Done;
+	void *Context;
+	u32 Pending;		/* Hash jobs outstanding, plus one while queuing */
+	u32 HashFailed;		/* A job failed, hash inline instead */
+	u32 Hash[DEDUP_ASYNC_CHUNKS];
+} DedupAsync;
+#endif
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define ChunkPtr(Idx)	(&Pool[(u32)(Idx) * VFLASH_DEDUP_CHUNK_SIZE])
+#define HashBucket(Hash)	((Hash) & (VFLASH_DEDUP_HASH_BUCKETS - 1U))
+
+/************************** Variable Definitions *****************************/
+static u8 *Pool;
+
+static u32 LogicalMap[VFLASH_DEDUP_NUM_CHUNKS];
+static u32 PhysHash[VFLASH_DEDUP_POOL_CHUNKS];
+static u32 PhysNext[VFLASH_DEDUP_POOL_CHUNKS];
+static u32 PhysRef[VFLASH_DEDUP_POOL_CHUNKS];
+static u32 HashHead[VFLASH_DEDUP_HASH_BUCKETS];
+static u32 FreeHead;
+
+#if !defined (__aarch64__)
+static u32 Crc32cTable[256];
+#endif
+
+/* Read-modify-write buffer for writes not covering a whole chunk */
+#ifdef __ICCARM__
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
+#else
+#pragma data_alignment = 32
+#endif
+static u8 Scratch[VFLASH_DEDUP_CHUNK_SIZE];
+#else
+static u8 Scratch[VFLASH_DEDUP_CHUNK_SIZE] ALIGNMENT_CACHELINE;
+#endif
+
+/* Contents of the chunks never written, for VFlashDedup_ReadV() */
+#ifdef __ICCARM__
+#if defined (PLATFORM_ZYNQMP) || defined (versal)
+#pragma data_alignment = 64
+#else
+#pragma data_alignment = 32
+#endif
+static u8 ZeroChunk[VFLASH_DEDUP_CHUNK_SIZE];
+#else
+static u8 ZeroChunk[VFLASH_DEDUP_CHUNK_SIZE] ALIGNMENT_CACHELINE;
+#endif
+
+static VFlashDedup_Stats Stats;
+
+#ifdef USB_OFFLOAD
+static DedupAsync Async;
+#endif
+
+/*****************************************************************************/
+/**
+* Computes the CRC32C of one chunk. On AArch64 the ARMv8 CRC32 instructions
+* are used, other processors fall back to a table driven implementation.
+*
+* @param	Data is a pointer to VFLASH_DEDUP_CHUNK_SIZE bytes.
+*
+* @return	CRC32C of the chunk.
+*
+* @note		None.
+*
+******************************************************************************/
+#if defined (__aarch64__)
+__attribute__((target("+crc")))
+static u32 ChunkHash(const u8 *Data)
+{
+	const u64 *Word = (const u64 *)Data;
+	u32 Crc = 0xFFFFFFFFU;
+	u32 Index;
+
+	for (Index = 0; Index < VFLASH_DEDUP_CHUNK_SIZE / 8; Index += 4) {
+		Crc = __crc32cd(Crc, Word[Index]);
+		Crc = __crc32cd(Crc, Word[Index + 1]);
+		Crc = __crc32cd(Crc, Word[Index + 2]);
+		Crc = __crc32cd(Crc, Word[Index + 3]);
+	}
+
+	return ~Crc;
+}
+#else
+static u32 ChunkHash(const u8 *Data)
+{
+	u32 Crc = 0xFFFFFFFFU;
+	u32 Index;
+
+	for (Index = 0; Index < VFLASH_DEDUP_CHUNK_SIZE; Index++) {
+		Crc = Crc32cTable[(Crc ^ Data[Index]) & 0xFF] ^ (Crc >> 8);
+	}
+
+	return ~Crc;
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Checks whether a chunk only contains zeros.
+*
+* @param	Data is a pointer to VFLASH_DEDUP_CHUNK_SIZE bytes.
+*
+* @return	TRUE if all bytes are zero, FALSE otherwise.
+*
+* @note		None.
+*
+******************************************************************************/
+static u32 ChunkIsZero(const u8 *Data)
+{
+	const u64 *Word = (const u64 *)Data;
+	u32 Index;
+
+	for (Index = 0; Index < VFLASH_DEDUP_CHUNK_SIZE / 8; Index++) {
+		if (Word[Index] != 0U) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void HashInsert(u32 Phys)
+{
+	u32 Bucket = HashBucket(PhysHash[Phys]);
+
+	PhysNext[Phys] = HashHead[Bucket];
+	HashHead[Bucket] = Phys;
+}
+
+static void HashRemove(u32 Phys)
+{
+	u32 *Link = &HashHead[HashBucket(PhysHash[Phys])];
+
+	while (*Link != VFLASH_DEDUP_NONE) {
+		if (*Link == Phys) {
+			*Link = PhysNext[Phys];
+			return;
+		}
+		Link = &PhysNext[*Link];
+	}
+}
+
+static u32 HashLookup(u32 Hash, const u8 *Data)
+{
+	u32 Phys = HashHead[HashBucket(Hash)];
+
+	while (Phys != VFLASH_DEDUP_NONE) {
+		if (PhysHash[Phys] == Hash &&
+		    memcmp(ChunkPtr(Phys), Data, VFLASH_DEDUP_CHUNK_SIZE) == 0) {
+			return Phys;
+		}
+		Phys = PhysNext[Phys];
+	}
+
+	return VFLASH_DEDUP_NONE;
+}
+
+static u32 PhysAlloc(void)
+{
+	u32 Phys = FreeHead;
+
+	if (Phys != VFLASH_DEDUP_NONE) {
+		FreeHead = PhysNext[Phys];
+		PhysRef[Phys] = 1U;
+		Stats.PhysicalChunks++;
+	}
+
+	return Phys;
+}
+
+/*****************************************************************************/
+/**
+* Drops the reference a logical chunk holds on its physical chunk and returns
+* the physical chunk to the free list when it is no longer shared.
+*
+* @param	Logical is the logical chunk index.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+static void LogicalRelease(u32 Logical)
+{
+	u32 Phys = LogicalMap[Logical];
+
+	if (Phys == VFLASH_DEDUP_NONE) {
+		return;
+	}
+
+	LogicalMap[Logical] = VFLASH_DEDUP_NONE;
+	Stats.LogicalChunks--;
+
+	if (--PhysRef[Phys] == 0U) {
+		HashRemove(Phys);
+		PhysNext[Phys] = FreeHead;
+		FreeHead = Phys;
+		Stats.PhysicalChunks--;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Commits the new contents of one whole logical chunk.
+*
+* @param	Logical is the logical chunk index.
+* @param	Data is a pointer to VFLASH_DEDUP_CHUNK_SIZE bytes.
+* @param	HashPtr is the CRC32C of the chunk, or NULL to compute it here.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the physical pool is exhausted.
+*
+* @note		None.
+*
+******************************************************************************/
+static s32 ChunkCommit(u32 Logical, const u8 *Data, const u32 *HashPtr)
+{
+	u32 Old = LogicalMap[Logical];
+	u32 Hash;
+	u32 Phys;
+
+	if (ChunkIsZero(Data) == TRUE) {
+		LogicalRelease(Logical);
+		Stats.ZeroChunks++;
+		return XST_SUCCESS;
+	}
+
+	Hash = (HashPtr != NULL) ? *HashPtr : ChunkHash(Data);
+	Phys = HashLookup(Hash, Data);
+	if (Phys != VFLASH_DEDUP_NONE) {
+		if (Phys != Old) {
+			PhysRef[Phys]++;
+			LogicalRelease(Logical);
+			LogicalMap[Logical] = Phys;
+			Stats.LogicalChunks++;
+			Stats.DedupHits++;
+		}
+		return XST_SUCCESS;
+	}
+
+	if (Old != VFLASH_DEDUP_NONE && PhysRef[Old] == 1U) {
+		/* Exclusively owned, rewrite in place */
+		HashRemove(Old);
+		memcpy(ChunkPtr(Old), Data, VFLASH_DEDUP_CHUNK_SIZE);
+		PhysHash[Old] = Hash;
+		HashInsert(Old);
+		return XST_SUCCESS;
+	}
+
+	/* Unmapped or shared: copy-on-write into a fresh chunk */
+	Phys = PhysAlloc();
+	if (Phys == VFLASH_DEDUP_NONE) {
+		Stats.PoolExhausted++;
+		return XST_FAILURE;
+	}
+
+	memcpy(ChunkPtr(Phys), Data, VFLASH_DEDUP_CHUNK_SIZE);
+	PhysHash[Phys] = Hash;
+	HashInsert(Phys);
+
+	if (Old != VFLASH_DEDUP_NONE) {
+		Stats.CowCopies++;
+	}
+	LogicalRelease(Logical);
+	LogicalMap[Logical] = Phys;
+	Stats.LogicalChunks++;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Initializes the deduplicating backend. All logical chunks read back as
+* zeros afterwards.
+*
+* @param	PoolPtr is the physical chunk pool of VFLASH_DEDUP_POOL_SIZE
+*		bytes.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void VFlashDedup_Init(u8 *PoolPtr)
+{
+	u32 Index;
+
+	Pool = PoolPtr;
+
+	for (Index = 0; Index < VFLASH_DEDUP_NUM_CHUNKS; Index++) {
+		LogicalMap[Index] = VFLASH_DEDUP_NONE;
+	}
+
+	for (Index = 0; Index < VFLASH_DEDUP_HASH_BUCKETS; Index++) {
+		HashHead[Index] = VFLASH_DEDUP_NONE;
+	}
+
+	for (Index = 0; Index < VFLASH_DEDUP_POOL_CHUNKS; Index++) {
+		PhysRef[Index] = 0U;
+		PhysNext[Index] = Index + 1U;
+	}
+	PhysNext[VFLASH_DEDUP_POOL_CHUNKS - 1U] = VFLASH_DEDUP_NONE;
+	FreeHead = 0U;
+
+#if !defined (__aarch64__)
+	for (Index = 0; Index < 256U; Index++) {
+		u32 Crc = Index;
+		u8 Bit;
+
+		for (Bit = 0; Bit < 8U; Bit++) {
+			Crc = (Crc & 1U) ? (Crc >> 1) ^ CRC32C_POLY : Crc >> 1;
+		}
+		Crc32cTable[Index] = Crc;
+	}
+#endif
+
+	memset(&Stats, 0, sizeof(Stats));
+	Stats.PoolChunks = VFLASH_DEDUP_POOL_CHUNKS;
+}
+
+/*****************************************************************************/
+/**
+* Writes data to the logical disk. Partial chunks are merged with their
+* current contents before being committed.
+*
+* @param	Offset is the byte offset on the logical disk.
+* @param	BufferPtr is the data to write.
+* @param	Length is the number of bytes to write.
+* @param	Hashes holds the CRC32C of each whole chunk of the write in
+*		order, or NULL to compute them here.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the physical pool is exhausted.
+*
+* @note		None.
+*
+******************************************************************************/
+static s32 DedupWrite(u32 Offset, const u8 *BufferPtr, u32 Length,
+		      const u32 *Hashes)
+{
+	u64 Start = UsbGetTicks();
+	s32 Status = XST_SUCCESS;
+
+	if (Offset > VFLASH_SIZE || Length > VFLASH_SIZE - Offset) {
+		return XST_FAILURE;
+	}
+
+	while (Length > 0U && Status == XST_SUCCESS) {
+		u32 Logical = Offset / VFLASH_DEDUP_CHUNK_SIZE;
+		u32 InChunk = Offset % VFLASH_DEDUP_CHUNK_SIZE;
+		u32 Count = VFLASH_DEDUP_CHUNK_SIZE - InChunk;
+
+		if (Count > Length) {
+			Count = Length;
+		}
+
+		if (Count == VFLASH_DEDUP_CHUNK_SIZE) {
+			Status = ChunkCommit(Logical, BufferPtr, Hashes);
+			if (Hashes != NULL) {
+				Hashes++;
+			}
+		} else {
+			VFlashDedup_Read(Logical * VFLASH_DEDUP_CHUNK_SIZE, Scratch,
+					 VFLASH_DEDUP_CHUNK_SIZE);
+			memcpy(&Scratch[InChunk], BufferPtr, Count);
+			Status = ChunkCommit(Logical, Scratch, NULL);
+		}
+
+		Offset += Count;
+		BufferPtr += Count;
+		Length -= Count;
+		Stats.BytesWritten += Count;
+	}
+
+	Stats.CommitTicks += UsbGetTicks() - Start;
+
+	return Status;
+}
+
+/*****************************************************************************/
+/**
+* Writes data to the logical disk. Partial chunks are merged with their
+* current contents before being committed.
+*
+* @param	Offset is the byte offset on the logical disk.
+* @param	BufferPtr is the data to write.
+* @param	Length is the number of bytes to write.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the physical pool is exhausted.
+*
+* @note		None.
+*
+******************************************************************************/
+s32 VFlashDedup_Write(u32 Offset, const u8 *BufferPtr, u32 Length)
+{
+	return DedupWrite(Offset, BufferPtr, Length, NULL);
+}
+
+#ifdef USB_OFFLOAD
+/*****************************************************************************/
+/**
+* Drops one reference on the pending write and commits it when all chunk
+* hashes are back.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Runs on the USB core, from UsbOffload_Poll() or from
+*		VFlashDedup_WriteAsync() when the jobs ran inline.
+*
+******************************************************************************/
+static void DedupAsyncRelease(void)
+{
+	VFlashDedup_Done Done;
+	void *Context;
+	s32 Status;
+
+	if (--Async.Pending != 0U) {
+		return;
+	}
+
+	Status = DedupWrite(Async.Offset, Async.BufferPtr, Async.Length,
+			    (Async.HashFailed == FALSE) ? Async.Hash : NULL);
+
+	/* Done may start the next write */
+	Done = Async.Done;
+	Context = Async.Context;
+	Done(Context, Status);
+}
+
+static void DedupHashDone(void *Context, u32 Result, s32 Status)
+{
+	if (Status == XST_SUCCESS) {
+		*(u32 *)Context = Result;
+	} else {
+		Async.HashFailed = TRUE;
+	}
+
+	DedupAsyncRelease();
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Writes data to the logical disk and reports completion through a
+* callback. With USB_OFFLOAD the whole chunks are hashed by the worker
+* cores and committed once all hashes are back.
+*
+* @param	Offset is the byte offset on the logical disk.
+* @param	BufferPtr is the data to write, it must stay unchanged until
+*		Done is called.
+* @param	Length is the number of bytes to write.
+* @param	Done is called with the status of the write.
+* @param	Context is passed to Done.
+*
+* @return	XST_SUCCESS if Done will be or has been called, or
+*		XST_DEVICE_BUSY if a write is still pending.
+*
+* @note		Done runs from UsbOffload_Poll() when workers hashed the
+*		chunks, else before this function returns. Writes with more
+*		than VFLASH_DEDUP_WINDOW_SIZE bytes of whole chunks are done
+*		inline.
+*
+******************************************************************************/
+s32 VFlashDedup_WriteAsync(u32 Offset, const u8 *BufferPtr, u32 Length,
+			   VFlashDedup_Done Done, void *Context)
+{
+#ifdef USB_OFFLOAD
+	u32 Head = (VFLASH_DEDUP_CHUNK_SIZE - (Offset % VFLASH_DEDUP_CHUNK_SIZE)) %
+		   VFLASH_DEDUP_CHUNK_SIZE;
+	u32 Chunks = (Length > Head) ? (Length - Head) / VFLASH_DEDUP_CHUNK_SIZE :
+		     0U;
+	u32 Index;
+
+	if (Async.Pending != 0U) {
+		return XST_DEVICE_BUSY;
+	}
+
+	if (Chunks != 0U && Chunks <= DEDUP_ASYNC_CHUNKS) {
+		Async.Offset = Offset;
+		Async.BufferPtr = BufferPtr;
+		Async.Length = Length;
+		Async.Done = Done;
+		Async.Context = Context;
+		Async.HashFailed = FALSE;
+		Async.Pending = Chunks + 1U;
+
+		for (Index = 0U; Index < Chunks; Index++) {
+			(void)UsbOffload_Submit(USB_OFFLOAD_OP_CRC32C, BufferPtr +
+						Head + Index * VFLASH_DEDUP_CHUNK_SIZE,
+						NULL, VFLASH_DEDUP_CHUNK_SIZE,
+						DedupHashDone, &Async.Hash[Index]);
+		}
+		Stats.HashJobs += Chunks;
+
+		DedupAsyncRelease();
+		return XST_SUCCESS;
+	}
+#endif
+
+	Done(Context, DedupWrite(Offset, BufferPtr, Length, NULL));
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Reads data from the logical disk.
+*
+* @param	Offset is the byte offset on the logical disk.
+* @param	BufferPtr is the destination buffer.
+* @param	Length is the number of bytes to read.
+*
+* @return	None.
+*
+* @note		Ranges beyond the end of the disk are not read.
+*
+******************************************************************************/
+void VFlashDedup_Read(u32 Offset, u8 *BufferPtr, u32 Length)
+{
+	if (Offset > VFLASH_SIZE || Length > VFLASH_SIZE - Offset) {
+		return;
+	}
+
+	while (Length > 0U) {
+		u32 Phys = LogicalMap[Offset / VFLASH_DEDUP_CHUNK_SIZE];
+		u32 InChunk = Offset % VFLASH_DEDUP_CHUNK_SIZE;
+		u32 Count = VFLASH_DEDUP_CHUNK_SIZE - InChunk;
+
+		if (Count > Length) {
+			Count = Length;
+		}
+
+		if (Phys == VFLASH_DEDUP_NONE) {
+			memset(BufferPtr, 0, Count);
+		} else {
+			memcpy(BufferPtr, ChunkPtr(Phys) + InChunk, Count);
+		}
+
+		Offset += Count;
+		BufferPtr += Count;
+		Length -= Count;
+	}
+}
+
+/*****************************************************************************/
+/**
+* Maps a range of the logical disk onto the physical chunks holding it, for
+* a gathered send with EpBufferSendV(). Physically consecutive chunks share
+* one segment, chunks never written point to a zero chunk.
+*
+* @param	Offset is the byte offset on the logical disk.
+* @param	Length is the number of bytes to map.
+* @param	Vec receives the segments.
+* @param	MaxVec is the number of entries of Vec.
+* @param	Granule is the unit of a partial mapping, the max packet
+*		size, so that only the end of the range gives a short packet.
+* @param	CountPtr receives the number of segments used.
+*
+* @return	Number of bytes mapped, a multiple of Granule less than Length
+*		when MaxVec segments do not cover the range. 0 for a range
+*		beyond the end of the disk.
+*
+* @note		The segments stay valid until the next write to the disk.
+*
+******************************************************************************/
+u32 VFlashDedup_ReadV(u32 Offset, u32 Length, Usb_IoVec *Vec, u32 MaxVec,
+		      u32 Granule, u32 *CountPtr)
+{
+	u32 Mapped = 0U;
+	u32 Count = 0U;
+	u32 Trim;
+
+	*CountPtr = 0U;
+	if (Offset > VFLASH_SIZE || Length > VFLASH_SIZE - Offset) {
+		return 0U;
+	}
+
+	while (Mapped < Length) {
+		u32 Phys = LogicalMap[Offset / VFLASH_DEDUP_CHUNK_SIZE];
+		u32 InChunk = Offset % VFLASH_DEDUP_CHUNK_SIZE;
+		u32 Chunk = VFLASH_DEDUP_CHUNK_SIZE - InChunk;
+		u8 *Base;
+
+		if (Chunk > Length - Mapped) {
+			Chunk = Length - Mapped;
+		}
+		Base = (Phys == VFLASH_DEDUP_NONE) ? &ZeroChunk[InChunk] :
+		       ChunkPtr(Phys) + InChunk;
+
+		if (Count != 0U &&
+		    Vec[Count - 1U].Base + Vec[Count - 1U].Len == Base) {
+			Vec[Count - 1U].Len += Chunk;
+		} else if (Count < MaxVec) {
+			Vec[Count].Base = Base;
+			Vec[Count].Len = Chunk;
+			Count++;
+		} else {
+			break;
+		}
+
+		Offset += Chunk;
+		Mapped += Chunk;
+	}
+
+	Trim = (Mapped < Length) ? Mapped % Granule : 0U;
+	Mapped -= Trim;
+	while (Trim != 0U) {
+		if (Vec[Count - 1U].Len > Trim) {
+			Vec[Count - 1U].Len -= Trim;
+			Trim = 0U;
+		} else {
+			Trim -= Vec[Count - 1U].Len;
+			Count--;
+		}
+	}
+
+	Stats.BytesGathered += Mapped;
+	*CountPtr = Count;
+
+	return Mapped;
+}
+
+/*****************************************************************************/
+/**
+* Returns a snapshot of the backend statistics. The memory saved compared to
+* a flat disk is (LogicalChunks - PhysicalChunks) * VFLASH_DEDUP_CHUNK_SIZE.
+*
+* @param	StatsPtr is filled with the current statistics.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+void VFlashDedup_GetStats(VFlashDedup_Stats *StatsPtr)
+{
+	*StatsPtr = Stats;
+}
+
+#endif /* VFLASH_DEDUP */
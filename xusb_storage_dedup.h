@@ -0,0 +1,87 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_storage_dedup.h
+ *
+ * This file contains definitions for the optional block-level deduplicating
+ * backend of the Mass Storage virtual flash disk.
+ *
+ * The logical disk is split into VFLASH_DEDUP_CHUNK_SIZE chunks. Every
+ * written chunk is hashed (CRC32C) and chunks with identical contents share
+ * one reference counted physical chunk in the VirtFlash pool. Overwriting a
+ * shared chunk allocates a new physical chunk (copy-on-write) and all-zero
+ * chunks are not stored at all.
+ *
+ * VFlashDedup_ReadV() maps a read onto the physical chunks, so that READ
+ * data is gathered from the pool by EpBufferSendV() instead of being copied
+ * into a window first.
+ *
+ * VFlashDedup_WriteAsync() lets the worker cores of xusb_offload.h compute
+ * the chunk hashes when USB_OFFLOAD is defined.
+ *
+ * The backend is enabled by defining VFLASH_DEDUP.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_STORAGE_DEDUP_H
+#define XUSB_STORAGE_DEDUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files *********************************/
+#include "xil_types.h"
+#include "xstatus.h"
+#include "xusb_class_storage.h"
+#include "xusb_wrapper.h"
+
+/************************** Constant Definitions *****************************/
+#define VFLASH_DEDUP_CHUNK_SIZE		0x1000
+#define VFLASH_DEDUP_NUM_CHUNKS		(VFLASH_SIZE / VFLASH_DEDUP_CHUNK_SIZE)
+#define VFLASH_DEDUP_POOL_CHUNKS	(VFLASH_DEDUP_POOL_SIZE / \
+					 VFLASH_DEDUP_CHUNK_SIZE)
+#define VFLASH_DEDUP_HASH_BUCKETS	(VFLASH_DEDUP_POOL_CHUNKS / 4)
+
+/* Staging window used for the data phase of READ/WRITE commands */
+#define VFLASH_DEDUP_WINDOW_SIZE	0x10000
+
+#define VFLASH_DEDUP_NONE		0xFFFFFFFFU
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u32 LogicalChunks;	/* Logical chunks holding non-zero data */
+	u32 PhysicalChunks;	/* Physical chunks in use */
+	u32 PoolChunks;		/* Physical chunks available in the pool */
+	u32 DedupHits;		/* Chunk writes satisfied by a shared chunk */
+	u32 CowCopies;		/* Writes that broke sharing of a chunk */
+	u32 ZeroChunks;		/* All-zero chunk writes (not stored) */
+	u32 PoolExhausted;	/* Chunk writes rejected for lack of space */
+	u64 BytesWritten;	/* Payload bytes committed */
+	u64 CommitTicks;	/* Timer ticks spent hashing and committing */
+	u32 HashJobs;		/* Chunk hashes handed to the offload */
+	u64 BytesGathered;	/* Read bytes sent from the pool in place */
+} VFlashDedup_Stats;
+
+/* Completion of VFlashDedup_WriteAsync() */
+typedef void (*VFlashDedup_Done)(void *Context, s32 Status);
+
+/************************** Function Prototypes ******************************/
+void VFlashDedup_Init(u8 *PoolPtr);
+s32 VFlashDedup_Write(u32 Offset, const u8 *BufferPtr, u32 Length);
+s32 VFlashDedup_WriteAsync(u32 Offset, const u8 *BufferPtr, u32 Length,
+			   VFlashDedup_Done Done, void *Context);
+void VFlashDedup_Read(u32 Offset, u8 *BufferPtr, u32 Length);
+u32 VFlashDedup_ReadV(u32 Offset, u32 Length, Usb_IoVec *Vec, u32 MaxVec,
+		      u32 Granule, u32 *CountPtr);
+void VFlashDedup_GetStats(VFlashDedup_Stats *StatsPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XUSB_STORAGE_DEDUP_H */
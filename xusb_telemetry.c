@@ -0,0 +1,529 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_telemetry.c
+ *
+ * This file contains the implementation of the telemetry vendor requests.
+ *
+ * A snapshot gathers the counters of the wrapper, the event layer, the cache
+ * and buffer pool and the storage class into one block. It runs only on
+ * USB_TELEMETRY_REQ_SNAPSHOT, so pages read afterwards are consistent with
+ * each other and the counters themselves stay plain increments.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include <string.h>
+#include "xusb_telemetry.h"
+#include "xusb_wrapper.h"
+#include "xusb_event.h"
+#include "xusb_cache.h"
+#include "xusb_dma_pool.h"
+#include "xusb_trace.h"
+#ifdef VFLASH_DEDUP
+#include "xusb_storage_dedup.h"
+#endif
+
+#ifdef USB_TELEMETRY
+
+/************************** Constant Definitions *****************************/
+
+/**************************** Type Definitions *******************************/
+/* Block under construction */
+typedef struct {
+	u32 Offset;
+	u32 SectionOffset;
+	u32 SectionCount;
+} TelemetryWriter;
+
+/************************** Variable Definitions *****************************/
+u32 UsbTelemetry_ScsiCount[256];
+
+static u8 Block[USB_TELEMETRY_MAX_SIZE] ALIGNMENT_CACHELINE;
+static u32 BlockSize;
+static u32 Sequence;
+static u32 VendorRequests;
+
+/* Reply to USB_TELEMETRY_REQ_SNAPSHOT */
+static UsbTelemetry_Info Info ALIGNMENT_CACHELINE;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#define TELEMETRY_ALIGN(x)	(((x) + 7U) & ~7U)
+
+/*****************************************************************************/
+/**
+* Starts a section of the block.
+*
+* @param	WriterPtr is the block under construction.
+* @param	Id is the section identifier.
+* @param	Version is the layout version of the section.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the block is full.
+*
+* @note		None.
+*
+******************************************************************************/
+static s32 SectionBegin(TelemetryWriter *WriterPtr, u16 Id, u16 Version)
+{
+	UsbTelemetry_Section Section;
+
+	if (WriterPtr->Offset + sizeof(Section) > USB_TELEMETRY_MAX_SIZE) {
+		return XST_FAILURE;
+	}
+
+	Section.Id = Id;
+	Section.Version = Version;
+	Section.Size = 0U;
+	WriterPtr->SectionOffset = WriterPtr->Offset;
+	memcpy(&Block[WriterPtr->Offset], &Section, sizeof(Section));
+	WriterPtr->Offset += sizeof(Section);
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Appends data to the current section.
+*
+* @param	WriterPtr is the block under construction.
+* @param	DataPtr is the data.
+* @param	Length is the number of bytes.
+*
+* @return	XST_SUCCESS, or XST_FAILURE if the block is full.
+*
+* @note		None.
+*
+******************************************************************************/
+static s32 SectionAdd(TelemetryWriter *WriterPtr, const void *DataPtr,
+		      u32 Length)
+{
+	if (WriterPtr->Offset + Length > USB_TELEMETRY_MAX_SIZE) {
+		return XST_FAILURE;
+	}
+
+	memcpy(&Block[WriterPtr->Offset], DataPtr, Length);
+	WriterPtr->Offset += Length;
+
+	return XST_SUCCESS;
+}
+
+/*****************************************************************************/
+/**
+* Ends the current section, its size is patched into its header and the
+* payload is padded to 8 bytes.
+*
+* @param	WriterPtr is the block under construction.
+* @param	Status is the result of the SectionBegin() and SectionAdd() calls.
+*
+* @return	None.
+*
+* @note		A section that did not fit is dropped.
+*
+******************************************************************************/
+static void SectionEnd(TelemetryWriter *WriterPtr, s32 Status)
+{
+	UsbTelemetry_Section *SectionPtr;
+	u32 End;
+
+	if (Status != XST_SUCCESS) {
+		WriterPtr->Offset = WriterPtr->SectionOffset;
+		return;
+	}
+
+	SectionPtr = (UsbTelemetry_Section *)&Block[WriterPtr->SectionOffset];
+	SectionPtr->Size = WriterPtr->Offset - WriterPtr->SectionOffset -
+			   sizeof(UsbTelemetry_Section);
+
+	End = TELEMETRY_ALIGN(WriterPtr->Offset);
+	if (End > USB_TELEMETRY_MAX_SIZE) {
+		End = USB_TELEMETRY_MAX_SIZE;
+	}
+	memset(&Block[WriterPtr->Offset], 0, End - WriterPtr->Offset);
+	WriterPtr->Offset = End;
+	WriterPtr->SectionCount++;
+}
+
+static void AddDevice(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Device Device;
+	s32 Status;
+
+	Device.Resets = UsbGetResetCount();
+	Device.VendorRequests = VendorRequests;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_DEVICE, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Device, sizeof(Device));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddEndpoints(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Endpoint Endpoint;
+	Usb_EpQueueStats Stats;
+	u32 Count = 0U;
+	u32 CountOffset;
+	u8 Ep;
+	u8 Dir;
+	s32 Status;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_ENDPOINTS, 1U);
+	CountOffset = WriterPtr->Offset;
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Count, sizeof(Count));
+	}
+
+	for (Ep = 0U; Ep < XUSBPSU_ENDPOINTS_NUM / 2U; Ep++) {
+		for (Dir = USB_EP_DIR_OUT; Dir <= USB_EP_DIR_IN; Dir++) {
+			if (Status != XST_SUCCESS) {
+				break;
+			}
+
+			memset(&Stats, 0, sizeof(Stats));
+			EpQueueGetStats(Ep, Dir, &Stats);
+			if (Stats.Queued == 0U && Stats.Stalls == 0U) {
+				continue;
+			}
+
+			memset(&Endpoint, 0, sizeof(Endpoint));
+			Endpoint.Ep = Ep;
+			Endpoint.Dir = Dir;
+			Endpoint.Queued = Stats.Queued;
+			Endpoint.Completed = Stats.Completed;
+			Endpoint.Failed = Stats.Failed;
+			Endpoint.QueueFull = Stats.QueueFull;
+			Endpoint.MaxDepth = Stats.MaxDepth;
+			Endpoint.Stalls = Stats.Stalls;
+			Endpoint.Bytes = Stats.Bytes;
+			Endpoint.BusyTicks = Stats.BusyTicks;
+			Endpoint.IdleTicks = Stats.IdleTicks;
+			Status = SectionAdd(WriterPtr, &Endpoint, sizeof(Endpoint));
+			Count++;
+		}
+	}
+
+	if (Status == XST_SUCCESS) {
+		memcpy(&Block[CountOffset], &Count, sizeof(Count));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddEvents(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Events Events;
+	UsbEvent_Stats EventStats;
+	UsbPoll_Stats PollStats;
+	s32 Status;
+
+	UsbEvent_GetStats(&EventStats);
+	UsbPoll_GetStats(&PollStats);
+
+	Events.IsrCount = EventStats.IsrCount;
+	Events.IsrTicksMax = EventStats.IsrTicksMax;
+	Events.IsrTicksTotal = EventStats.IsrTicksTotal;
+	Events.Posted = EventStats.Posted;
+	Events.Dispatched = EventStats.Dispatched;
+	Events.Inline = EventStats.Inline;
+	Events.BacklogMax = EventStats.BacklogMax;
+	Events.DispatchTicksMax = EventStats.DispatchTicksMax;
+	Events.Events = EventStats.Events;
+	Events.Polls = PollStats.Polls;
+	Events.PolledEvents = PollStats.PolledEvents;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_EVENTS, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Events, sizeof(Events));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddCache(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Cache Cache;
+	UsbCache_Stats Stats;
+	s32 Status;
+
+	UsbCache_GetStats(&Stats);
+	Cache.BytesFlushed = Stats.BytesFlushed;
+	Cache.BytesInvalidated = Stats.BytesInvalidated;
+	Cache.BytesSkipped = Stats.BytesSkipped;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_CACHE, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Cache, sizeof(Cache));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddPool(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_PoolClass Class;
+	UsbPool_Stats Stats;
+	u32 Count = USB_POOL_NUM_CLASSES;
+	u32 Index;
+	s32 Status;
+
+	UsbPool_GetStats(&Stats);
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_POOL, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Count, sizeof(Count));
+	}
+	for (Index = 0U; Index < Count && Status == XST_SUCCESS; Index++) {
+		Class.BlockSize = Stats.Class[Index].BlockSize;
+		Class.Blocks = Stats.Class[Index].Blocks;
+		Class.InUse = Stats.Class[Index].InUse;
+		Class.HighWater = Stats.Class[Index].HighWater;
+		Class.Allocs = Stats.Class[Index].Allocs;
+		Class.Fallbacks = Stats.Class[Index].Fallbacks;
+		Class.Failures = Stats.Class[Index].Failures;
+		Class.Reserved = 0U;
+		Status = SectionAdd(WriterPtr, &Class, sizeof(Class));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddScsi(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Opcode Opcode;
+	u32 Count = 0U;
+	u32 CountOffset;
+	u32 Index;
+	s32 Status;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_SCSI, 1U);
+	CountOffset = WriterPtr->Offset;
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Count, sizeof(Count));
+	}
+	for (Index = 0U; Index < 256U && Status == XST_SUCCESS; Index++) {
+		if (UsbTelemetry_ScsiCount[Index] == 0U) {
+			continue;
+		}
+
+		memset(&Opcode, 0, sizeof(Opcode));
+		Opcode.Opcode = (u8)Index;
+		Opcode.Count = UsbTelemetry_ScsiCount[Index];
+		Status = SectionAdd(WriterPtr, &Opcode, sizeof(Opcode));
+		Count++;
+	}
+
+	if (Status == XST_SUCCESS) {
+		memcpy(&Block[CountOffset], &Count, sizeof(Count));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+static void AddLatency(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Latency Latency;
+	UsbLatency_Stats Stats;
+	u32 Count = USB_LATENCY_NUM_PATHS;
+	u32 Path;
+	s32 Status;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_LATENCY, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Count, sizeof(Count));
+	}
+	for (Path = 0U; Path < Count && Status == XST_SUCCESS; Path++) {
+		UsbLatency_GetStats(Path, &Stats);
+		Latency.Path = Path;
+		Latency.Count = Stats.Count;
+		Latency.TicksMin = Stats.TicksMin;
+		Latency.TicksMax = Stats.TicksMax;
+		Latency.TicksTotal = Stats.TicksTotal;
+		Status = SectionAdd(WriterPtr, &Latency, sizeof(Latency));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+
+#ifdef USB_LATENCY_TRACE
+static void AddTrace(TelemetryWriter *WriterPtr)
+{
+	const UsbTrace_Table *TablePtr = UsbTrace_Get();
+	UsbTelemetry_Trace Trace;
+	u32 CountOffset;
+	u32 Index;
+	s32 Status;
+
+	Trace.CyclesPerSecond = TablePtr->CyclesPerSecond;
+	Trace.HookCycles = TablePtr->HookCycles;
+	Trace.Dropped = TablePtr->Dropped;
+	Trace.Count = 0U;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_TRACE, 1U);
+	CountOffset = WriterPtr->Offset;
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Trace, sizeof(Trace));
+	}
+	for (Index = 0U; Index < USB_TRACE_SLOTS && Status == XST_SUCCESS;
+	     Index++) {
+		if (TablePtr->Entry[Index].Key == USB_TRACE_KEY_NONE) {
+			continue;
+		}
+
+		Status = SectionAdd(WriterPtr, &TablePtr->Entry[Index],
+				    sizeof(UsbTrace_Entry));
+		Trace.Count++;
+	}
+
+	if (Status == XST_SUCCESS) {
+		memcpy(&Block[CountOffset], &Trace, sizeof(Trace));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+#endif
+
+#ifdef VFLASH_DEDUP
+static void AddDedup(TelemetryWriter *WriterPtr)
+{
+	UsbTelemetry_Dedup Dedup;
+	VFlashDedup_Stats Stats;
+	s32 Status;
+
+	VFlashDedup_GetStats(&Stats);
+	Dedup.LogicalChunks = Stats.LogicalChunks;
+	Dedup.PhysicalChunks = Stats.PhysicalChunks;
+	Dedup.PoolChunks = Stats.PoolChunks;
+	Dedup.DedupHits = Stats.DedupHits;
+	Dedup.CowCopies = Stats.CowCopies;
+	Dedup.ZeroChunks = Stats.ZeroChunks;
+	Dedup.PoolExhausted = Stats.PoolExhausted;
+	Dedup.Reserved = 0U;
+	Dedup.BytesWritten = Stats.BytesWritten;
+
+	Status = SectionBegin(WriterPtr, USB_TELEMETRY_SEC_DEDUP, 1U);
+	if (Status == XST_SUCCESS) {
+		Status = SectionAdd(WriterPtr, &Dedup, sizeof(Dedup));
+	}
+	SectionEnd(WriterPtr, Status);
+}
+#endif
+
+/*****************************************************************************/
+/**
+* Gathers the counters into the telemetry block.
+*
+* @param	None.
+*
+* @return	Size of the block in bytes.
+*
+* @note		Sections that do not fit in USB_TELEMETRY_MAX_SIZE are left
+*		out.
+*
+******************************************************************************/
+u32 UsbTelemetry_Snapshot(void)
+{
+	TelemetryWriter Writer;
+	UsbTelemetry_Header Header;
+
+	Writer.Offset = sizeof(Header);
+	Writer.SectionOffset = Writer.Offset;
+	Writer.SectionCount = 0U;
+
+	AddDevice(&Writer);
+	AddEndpoints(&Writer);
+	AddEvents(&Writer);
+	AddCache(&Writer);
+	AddPool(&Writer);
+	AddScsi(&Writer);
+	AddLatency(&Writer);
+#ifdef USB_LATENCY_TRACE
+	AddTrace(&Writer);
+#endif
+#ifdef VFLASH_DEDUP
+	AddDedup(&Writer);
+#endif
+
+	Header.Magic = USB_TELEMETRY_MAGIC;
+	Header.Version = USB_TELEMETRY_VERSION;
+	Header.HeaderSize = sizeof(Header);
+	Header.TotalSize = Writer.Offset;
+	Header.SectionCount = Writer.SectionCount;
+	Header.Timestamp = UsbGetTicks();
+	Header.TicksPerSecond = USB_TICKS_PER_SECOND;
+	Header.Sequence = ++Sequence;
+	memcpy(Block, &Header, sizeof(Header));
+
+	BlockSize = Writer.Offset;
+	return BlockSize;
+}
+
+/*****************************************************************************/
+/**
+* Returns the block of the last snapshot.
+*
+* @param	None.
+*
+* @return	Pointer to the block.
+*
+* @note		None.
+*
+******************************************************************************/
+const u8 *UsbTelemetry_Block(void)
+{
+	return Block;
+}
+
+/*****************************************************************************/
+/**
+* Handles a vendor request on endpoint 0.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	Request is bRequest of the setup packet.
+* @param	Index is wIndex of the setup packet.
+* @param	Length is wLength of the setup packet.
+*
+* @return	XST_SUCCESS if the reply was queued, XST_FAILURE if the request
+*		is not supported and endpoint 0 must be stalled.
+*
+* @note		None.
+*
+******************************************************************************/
+s32 UsbTelemetry_VendorReq(void *InstancePtr, u8 Request, u16 Index,
+			   u16 Length)
+{
+	u32 Offset;
+	u32 ReplyLen;
+
+	switch (Request) {
+		case USB_TELEMETRY_REQ_SNAPSHOT:
+			Info.TotalSize = UsbTelemetry_Snapshot();
+			Info.Version = USB_TELEMETRY_VERSION;
+			Info.PageSize = USB_TELEMETRY_PAGE_SIZE;
+			ReplyLen = (Length < sizeof(Info)) ? Length : sizeof(Info);
+			VendorRequests++;
+			return EpBufferSend(InstancePtr, 0U, (u8 *)&Info, ReplyLen);
+
+		case USB_TELEMETRY_REQ_READ:
+			if (BlockSize == 0U) {
+				(void)UsbTelemetry_Snapshot();
+			}
+
+			Offset = (u32)Index * USB_TELEMETRY_PAGE_SIZE;
+			if (Offset >= BlockSize) {
+				return EpBufferSend(InstancePtr, 0U, Block, 0U);
+			}
+
+			ReplyLen = BlockSize - Offset;
+			if (ReplyLen > USB_TELEMETRY_PAGE_SIZE) {
+				ReplyLen = USB_TELEMETRY_PAGE_SIZE;
+			}
+			if (ReplyLen > Length) {
+				ReplyLen = Length;
+			}
+			VendorRequests++;
+			return EpBufferSend(InstancePtr, 0U, &Block[Offset], ReplyLen);
+
+		default:
+			return XST_FAILURE;
+	}
+}
+
+#endif /* USB_TELEMETRY */
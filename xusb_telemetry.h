@@ -0,0 +1,190 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_telemetry.h
+ *
+ * This file contains the vendor request interface that returns the device
+ * counters to the host, and the layout of the block it returns.
+ *
+ * USB_TELEMETRY_REQ_SNAPSHOT copies the counters into a static block and
+ * replies with a UsbTelemetry_Info. The block is then read in pages with
+ * USB_TELEMETRY_REQ_READ, wIndex selecting the page. Counters are only read
+ * when a snapshot is taken, the data path pays for a few increments.
+ *
+ * The block starts with a UsbTelemetry_Header followed by sections, each a
+ * UsbTelemetry_Section and a payload padded to 8 bytes. Unknown sections are
+ * skipped by their size, a section changes layout only with its version.
+ * All fields are little endian. This header depends on xil_types.h only so
+ * that host tools can decode the block with it.
+ *
+ * The interface is enabled by defining USB_TELEMETRY.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_TELEMETRY_H
+#define XUSB_TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_TELEMETRY_MAGIC		0x54425355U	/* "USBT" */
+#define USB_TELEMETRY_VERSION		1U
+
+#ifndef USB_TELEMETRY_MAX_SIZE
+#define USB_TELEMETRY_MAX_SIZE		0x3000U
+#endif
+#define USB_TELEMETRY_PAGE_SIZE		512U
+
+/* Vendor requests, device to host */
+#define USB_TELEMETRY_REQ_SNAPSHOT	0x01U	/* Reply UsbTelemetry_Info */
+#define USB_TELEMETRY_REQ_READ		0x02U	/* wIndex = page */
+
+/* Section identifiers */
+#define USB_TELEMETRY_SEC_DEVICE	1U	/* UsbTelemetry_Device */
+#define USB_TELEMETRY_SEC_ENDPOINTS	2U	/* Count, UsbTelemetry_Endpoint[] */
+#define USB_TELEMETRY_SEC_EVENTS	3U	/* UsbTelemetry_Events */
+#define USB_TELEMETRY_SEC_CACHE		4U	/* UsbTelemetry_Cache */
+#define USB_TELEMETRY_SEC_POOL		5U	/* Count, UsbTelemetry_PoolClass[] */
+#define USB_TELEMETRY_SEC_SCSI		6U	/* Count, UsbTelemetry_Opcode[] */
+#define USB_TELEMETRY_SEC_LATENCY	7U	/* Count, UsbTelemetry_Latency[] */
+#define USB_TELEMETRY_SEC_TRACE		8U	/* UsbTelemetry_Trace, entries */
+#define USB_TELEMETRY_SEC_DEDUP		9U	/* UsbTelemetry_Dedup */
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u32 TotalSize;		/* Bytes in the block */
+	u16 Version;		/* USB_TELEMETRY_VERSION */
+	u16 PageSize;		/* Bytes per USB_TELEMETRY_REQ_READ page */
+} UsbTelemetry_Info;
+
+typedef struct {
+	u32 Magic;
+	u16 Version;
+	u16 HeaderSize;		/* Offset of the first section */
+	u32 TotalSize;
+	u32 SectionCount;
+	u64 Timestamp;		/* UsbGetTicks() at the snapshot */
+	u32 TicksPerSecond;
+	u32 Sequence;		/* Snapshots taken since reset */
+} UsbTelemetry_Header;
+
+typedef struct {
+	u16 Id;
+	u16 Version;
+	u32 Size;		/* Payload bytes, padding excluded */
+} UsbTelemetry_Section;
+
+typedef struct {
+	u32 Resets;		/* Bus resets */
+	u32 VendorRequests;	/* Telemetry requests served */
+} UsbTelemetry_Device;
+
+typedef struct {
+	u8 Ep;
+	u8 Dir;
+	u16 Reserved;
+	u32 Queued;
+	u32 Completed;
+	u32 Failed;
+	u32 QueueFull;
+	u32 MaxDepth;
+	u32 Stalls;
+	u32 Reserved2;
+	u64 Bytes;
+	u64 BusyTicks;
+	u64 IdleTicks;
+} UsbTelemetry_Endpoint;
+
+typedef struct {
+	u32 IsrCount;
+	u32 IsrTicksMax;
+	u64 IsrTicksTotal;
+	u32 Posted;
+	u32 Dispatched;
+	u32 Inline;
+	u32 BacklogMax;
+	u32 DispatchTicksMax;
+	u32 Events;
+	u32 Polls;
+	u32 PolledEvents;
+} UsbTelemetry_Events;
+
+typedef struct {
+	u64 BytesFlushed;
+	u64 BytesInvalidated;
+	u64 BytesSkipped;	/* DMA bytes served without maintenance */
+} UsbTelemetry_Cache;
+
+typedef struct {
+	u32 BlockSize;
+	u32 Blocks;
+	u32 InUse;
+	u32 HighWater;
+	u32 Allocs;
+	u32 Fallbacks;
+	u32 Failures;
+	u32 Reserved;
+} UsbTelemetry_PoolClass;
+
+typedef struct {
+	u8 Opcode;
+	u8 Reserved[3];
+	u32 Count;
+} UsbTelemetry_Opcode;
+
+typedef struct {
+	u32 Path;
+	u32 Count;
+	u32 TicksMin;
+	u32 TicksMax;
+	u64 TicksTotal;
+} UsbTelemetry_Latency;
+
+/* Followed by Count UsbTrace_Entry of xusb_trace.h */
+typedef struct {
+	u32 CyclesPerSecond;
+	u32 HookCycles;
+	u32 Dropped;
+	u32 Count;
+} UsbTelemetry_Trace;
+
+typedef struct {
+	u32 LogicalChunks;
+	u32 PhysicalChunks;
+	u32 PoolChunks;
+	u32 DedupHits;
+	u32 CowCopies;
+	u32 ZeroChunks;
+	u32 PoolExhausted;
+	u32 Reserved;
+	u64 BytesWritten;
+} UsbTelemetry_Dedup;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#ifdef USB_TELEMETRY
+extern u32 UsbTelemetry_ScsiCount[256];
+#define USB_TELEMETRY_SCSI(Opcode)	(UsbTelemetry_ScsiCount[(Opcode)]++)
+#else
+#define USB_TELEMETRY_SCSI(Opcode)
+#endif
+
+/************************** Function Prototypes ******************************/
+u32 UsbTelemetry_Snapshot(void);
+const u8 *UsbTelemetry_Block(void);
+s32 UsbTelemetry_VendorReq(void *InstancePtr, u8 Request, u16 Index,
+			   u16 Length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_TELEMETRY_H */
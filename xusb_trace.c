@@ -0,0 +1,291 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_trace.c
+ *
+ * This file contains the implementation of the command latency histograms.
+ *
+ * A trace point costs a counter read and, at the end of a command, a slot
+ * lookup and four histogram increments. The cost is measured at
+ * initialization and reported in the table so the overhead at a given
+ * command rate can be checked from the host.
+ *
+ *****************************************************************************/
+
+/***************************** Include Files *********************************/
+#include "xusb_trace.h"
+#include "xusb_wrapper.h"
+
+#ifdef USB_LATENCY_TRACE
+
+/************************** Constant Definitions *****************************/
+#define TRACE_CALIBRATION_RUNS	64U
+
+#ifndef USB_TRACE_CPU_HZ
+#ifdef XPAR_CPU_CORTEXA53_0_CPU_CLK_FREQ_HZ
+#define USB_TRACE_CPU_HZ	XPAR_CPU_CORTEXA53_0_CPU_CLK_FREQ_HZ
+#else
+#define USB_TRACE_CPU_HZ	1200000000U
+#endif
+#endif
+
+/**************************** Type Definitions *******************************/
+/* Time stamps of the command in flight */
+typedef struct {
+	u16 Key;
+	u64 Cbw;
+	u64 DataStart;		/* 0 without data stage */
+	u64 DataEnd;
+} UsbTrace_Command;
+
+/************************** Variable Definitions *****************************/
+static UsbTrace_Table Table;
+static UsbTrace_Command Command;
+static UsbTrace_Command Control;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+static inline u64 TraceNow(void)
+{
+#if defined (__aarch64__) && !defined (USB_HOST_SIM)
+	u64 Cycles;
+
+	__asm__ __volatile__("mrs %0, pmccntr_el0" : "=r" (Cycles));
+	return Cycles;
+#else
+	return UsbGetTicks();
+#endif
+}
+
+static inline u32 TraceBucket(u64 Cycles)
+{
+	if (Cycles >= ((u64)1U << (USB_TRACE_BUCKETS - 1U))) {
+		return USB_TRACE_BUCKETS - 1U;
+	}
+
+	return 31U - (u32)__builtin_clz((u32)Cycles | 1U);
+}
+
+/*****************************************************************************/
+/**
+* Returns the slot of a key, a free slot is claimed for a new key.
+*
+* @param	Key is the SCSI opcode or control request key.
+*
+* @return	Pointer to the slot, or NULL if all slots are taken.
+*
+* @note		None.
+*
+******************************************************************************/
+static UsbTrace_Entry *TraceSlot(u16 Key)
+{
+	u32 Index;
+
+	for (Index = 0U; Index < USB_TRACE_SLOTS; Index++) {
+		UsbTrace_Entry *EntryPtr = &Table.Entry[Index];
+
+		if (EntryPtr->Key == Key) {
+			return EntryPtr;
+		}
+		if (EntryPtr->Key == USB_TRACE_KEY_NONE) {
+			EntryPtr->Key = Key;
+			return EntryPtr;
+		}
+	}
+
+	Table.Dropped++;
+	return NULL;
+}
+
+/*****************************************************************************/
+/**
+* Starts the cycle counter, clears the histograms and measures the cost of
+* a trace point.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Call before the controller is started.
+*
+******************************************************************************/
+USB_COLD_TEXT
+void UsbTrace_Init(void)
+{
+	u32 Index;
+	u64 Start;
+
+#if defined (__aarch64__) && !defined (USB_HOST_SIM)
+	u64 Pmcr;
+
+	__asm__ __volatile__("mrs %0, pmcr_el0" : "=r" (Pmcr));
+	__asm__ __volatile__("msr pmcr_el0, %0" : : "r" (Pmcr | 1U));
+	__asm__ __volatile__("msr pmcntenset_el0, %0" : : "r" ((u64)1U << 31));
+	__asm__ __volatile__("isb" : : : "memory");
+	Table.CyclesPerSecond = USB_TRACE_CPU_HZ;
+#else
+	Table.CyclesPerSecond = USB_TICKS_PER_SECOND;
+#endif
+
+	for (Index = 0U; Index < USB_TRACE_SLOTS; Index++) {
+		Table.Entry[Index].Key = USB_TRACE_KEY_NONE;
+	}
+
+	/* A command has four trace points */
+	Start = TraceNow();
+	for (Index = 0U; Index < TRACE_CALIBRATION_RUNS; Index++) {
+		UsbTrace_Cbw(0xFFU);
+		UsbTrace_Point(USB_TRACE_DATA_START);
+		UsbTrace_Point(USB_TRACE_DATA_END);
+		UsbTrace_Point(USB_TRACE_CSW_DONE);
+	}
+	Table.HookCycles = (u32)((TraceNow() - Start) /
+				 (TRACE_CALIBRATION_RUNS * 4U));
+
+	for (Index = 0U; Index < USB_TRACE_SLOTS; Index++) {
+		Table.Entry[Index] = (UsbTrace_Entry) {
+			0
+		};
+		Table.Entry[Index].Key = USB_TRACE_KEY_NONE;
+	}
+	Table.Dropped = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Marks the arrival of a CBW.
+*
+* @param	Opcode is the SCSI operation code of the command.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+void UsbTrace_Cbw(u8 Opcode)
+{
+	Command.Cbw = TraceNow();
+	Command.Key = Opcode;
+	Command.DataStart = 0U;
+	Command.DataEnd = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Marks a point of the command in flight. The histograms are updated when
+* the CSW has been sent.
+*
+* @param	Point is USB_TRACE_DATA_START, USB_TRACE_DATA_END or
+*		USB_TRACE_CSW_DONE.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+void UsbTrace_Point(u32 Point)
+{
+	u64 Now = TraceNow();
+	UsbTrace_Entry *EntryPtr;
+	u64 CmdEnd;
+
+	switch (Point) {
+		case USB_TRACE_DATA_START:
+			Command.DataStart = Now;
+			return;
+		case USB_TRACE_DATA_END:
+			Command.DataEnd = Now;
+			return;
+		case USB_TRACE_CSW_DONE:
+			break;
+		default:
+			return;
+	}
+
+	if (Command.Cbw == 0U || Command.DataEnd == 0U) {
+		return;
+	}
+
+	EntryPtr = TraceSlot(Command.Key);
+	if (EntryPtr != NULL) {
+		CmdEnd = (Command.DataStart != 0U) ? Command.DataStart :
+			 Command.DataEnd;
+
+		EntryPtr->Count++;
+		EntryPtr->Hist[USB_TRACE_SPAN_COMMAND]
+		[TraceBucket(CmdEnd - Command.Cbw)]++;
+		if (Command.DataStart != 0U) {
+			EntryPtr->Hist[USB_TRACE_SPAN_DATA]
+			[TraceBucket(Command.DataEnd - Command.DataStart)]++;
+		}
+		EntryPtr->Hist[USB_TRACE_SPAN_STATUS]
+		[TraceBucket(Now - Command.DataEnd)]++;
+		EntryPtr->Hist[USB_TRACE_SPAN_TOTAL]
+		[TraceBucket(Now - Command.Cbw)]++;
+	}
+
+	Command.Cbw = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Marks the start and the end of a control request.
+*
+* @param	RequestType is bmRequestType of the setup packet.
+* @param	Request is bRequest of the setup packet.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+void UsbTrace_Setup(u8 RequestType, u8 Request)
+{
+	Control.Key = (u16)(USB_TRACE_KEY_CONTROL |
+			    ((u16)(RequestType & 0x60U) << 3) | Request);
+	Control.Cbw = TraceNow();
+}
+
+USB_HOT_TEXT
+void UsbTrace_SetupDone(void)
+{
+	UsbTrace_Entry *EntryPtr;
+
+	if (Control.Cbw == 0U) {
+		return;
+	}
+
+	EntryPtr = TraceSlot(Control.Key);
+	if (EntryPtr != NULL) {
+		EntryPtr->Count++;
+		EntryPtr->Hist[USB_TRACE_SPAN_TOTAL]
+		[TraceBucket(TraceNow() - Control.Cbw)]++;
+	}
+
+	Control.Cbw = 0U;
+}
+
+/*****************************************************************************/
+/**
+* Returns the histogram table. It is updated in place, readers may see a
+* command half accounted.
+*
+* @param	None.
+*
+* @return	Pointer to the table.
+*
+* @note		None.
+*
+******************************************************************************/
+const UsbTrace_Table *UsbTrace_Get(void)
+{
+	return &Table;
+}
+
+#endif /* USB_LATENCY_TRACE */
@@ -0,0 +1,97 @@
+/******************************************************************************
+* SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+/*****************************************************************************/
+/**
+ *
+ * @file xusb_trace.h
+ *
+ * This file contains declarations for the command latency histograms.
+ *
+ * The bulk-only transport marks the CBW, the start and end of the data stage
+ * and the completion of the CSW, Ch9Handler() marks the start and end of
+ * each control request. The spans between the marks are added to log2
+ * histograms kept per SCSI opcode and per control request. Time stamps come
+ * from the PMU cycle counter on AArch64 and from UsbGetTicks() elsewhere.
+ *
+ * The tracing is enabled by defining USB_LATENCY_TRACE, the USB_TRACE_*
+ * macros expand to nothing otherwise.
+ *
+ *****************************************************************************/
+
+#ifndef XUSB_TRACE_H
+#define XUSB_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************** Include Files ********************************/
+#include "xil_types.h"
+
+/************************** Constant Definitions ****************************/
+#define USB_TRACE_BUCKETS		32U	/* Bucket n: 2^n to 2^(n+1)-1 */
+
+#ifndef USB_TRACE_SLOTS
+#define USB_TRACE_SLOTS			16U	/* Distinct opcodes/requests */
+#endif
+
+/* Spans of a command */
+#define USB_TRACE_SPAN_COMMAND		0U	/* CBW to data stage or CSW */
+#define USB_TRACE_SPAN_DATA		1U	/* Data stage */
+#define USB_TRACE_SPAN_STATUS		2U	/* Data stage end to CSW done */
+#define USB_TRACE_SPAN_TOTAL		3U	/* CBW to CSW done, control */
+#define USB_TRACE_NUM_SPANS		4U
+
+/* Trace points of a command */
+#define USB_TRACE_DATA_START		0U
+#define USB_TRACE_DATA_END		1U
+#define USB_TRACE_CSW_DONE		2U
+
+/* Keys of control requests, SCSI opcodes use the opcode */
+#define USB_TRACE_KEY_CONTROL		0x1000U	/* | type << 8 | bRequest */
+#define USB_TRACE_KEY_NONE		0xFFFFU
+
+/**************************** Type Definitions ******************************/
+typedef struct {
+	u16 Key;
+	u16 Reserved;
+	u32 Count;
+	u32 Hist[USB_TRACE_NUM_SPANS][USB_TRACE_BUCKETS];
+} UsbTrace_Entry;
+
+typedef struct {
+	u32 CyclesPerSecond;	/* Time stamp resolution */
+	u32 HookCycles;		/* Cost of one trace point */
+	u32 Dropped;		/* Commands without a free slot */
+	u32 Reserved;
+	UsbTrace_Entry Entry[USB_TRACE_SLOTS];
+} UsbTrace_Table;
+
+/***************** Macros (Inline Functions) Definitions *********************/
+#ifdef USB_LATENCY_TRACE
+#define USB_TRACE_CBW(Opcode)		UsbTrace_Cbw(Opcode)
+#define USB_TRACE_POINT(Point)		UsbTrace_Point(Point)
+#define USB_TRACE_SETUP(Type, Request)	UsbTrace_Setup(Type, Request)
+#define USB_TRACE_SETUP_DONE()		UsbTrace_SetupDone()
+#else
+#define USB_TRACE_CBW(Opcode)
+#define USB_TRACE_POINT(Point)
+#define USB_TRACE_SETUP(Type, Request)
+#define USB_TRACE_SETUP_DONE()
+#endif
+
+/************************** Function Prototypes ******************************/
+void UsbTrace_Init(void);
+void UsbTrace_Cbw(u8 Opcode);
+void UsbTrace_Point(u32 Point);
+void UsbTrace_Setup(u8 RequestType, u8 Request);
+void UsbTrace_SetupDone(void);
+const UsbTrace_Table *UsbTrace_Get(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XUSB_TRACE_H */
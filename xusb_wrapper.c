@@ -32,10 +32,90 @@
 
 /***************************** Include Files *********************************/
 #include "xusb_wrapper.h"
+#include "xusb_cache.h"
+#include "xusb_dma_pool.h"
+#include "xusb_event.h"
+#include "xil_cache.h"
+#include <string.h>
+#ifdef __MICROBLAZE__
+#include "mb_interface.h"
+#endif
+#if defined (__aarch64__) && !defined (USB_HOST_SIM)
+#include "bspconfig.h"
+#endif
+
+/************************** Constant Definitions *****************************/
+/*
+ * Queue entry flag: the entry and the following one form a single USB
+ * transfer, a short packet ends the whole chain.
+ */
+#define EP_QUEUE_CHAIN		0x01U
+
+/**************************** Type Definitions *******************************/
+/* State of one vectored transfer, allocated from the DMA buffer pool */
+typedef struct {
+	Usb_EpCallback Callback;
+	void *Context;
+	u32 Requested;
+	u32 Txed;
+	u32 Pending;		/* Queue entries not completed yet */
+} EpVecXfer;
+
+/* Bounce piece of a vectored transfer */
+typedef struct {
+	EpVecXfer *XferPtr;
+	u8 *Bounce;
+} EpVecBounce;
+
+typedef struct {
+	u8 *BufferPtr;
+	u32 Length;
+	Usb_EpCallback Callback;
+	void *Context;
+	u32 Flags;
+} EpQueueEntry;
+
+/* Software request queue of one physical endpoint */
+typedef struct {
+	EpQueueEntry Entry[USB_EP_QUEUE_DEPTH];
+	u32 Head;		/* Entry owned by the controller */
+	u32 Count;		/* Pending entries including the head */
+	void *InstancePtr;
+	u64 StartTicks;
+	u64 DoneTicks;
+	Usb_EpQueueStats Stats;
+} EpQueue;
 
 /************************** Variable Definitions *****************************/
 
+#ifdef USB_CACHE_MANAGED
+/* TRBs, event buffer and setup packet live in non-cacheable memory */
+struct XUsbPsu PrivateData __attribute__ ((section (".usb_noncache")))
+	__attribute__ ((aligned(64)));
+
+/* Receive buffers of EpBufferRecv() per physical endpoint */
+static u8 *EpRecvBuffer[XUSBPSU_ENDPOINTS_NUM];
+#else
 struct XUsbPsu PrivateData;
+#endif
+
+#ifdef USB_DEFERRED_EVENTS
+static void (*Ch9Func)(struct Usb_DevData *, SetupPacket *);
+#endif
+
+/* Reset handler set by Set_RstHandler(), resets are counted regardless */
+static void (*RstFunc)(struct Usb_DevData *);
+static u32 ResetCount;
+
+/* Completion handlers set by SetEpHandler() per physical endpoint */
+static void (*EpUserHandler[XUSBPSU_ENDPOINTS_NUM])(void *, u32, u32)
+	USB_HOT_BSS;
+
+static EpQueue Queue[XUSBPSU_ENDPOINTS_NUM] USB_HOT_BSS;
+
+/* Handler of the timer interrupt set by UsbTimerSetHandler() */
+static Usb_TimerHandler TimerFunc;
+static void *TimerContext;
 
 /************************** Function Prototypes ******************************/
 #ifndef SDT
@@ -50,31 +130,296 @@ Usb_Config *LookupConfig(UINTPTR BaseAddress)
 }
 #endif
 
-void CacheInit(void)
+/*****************************************************************************/
+/**
+* Hands a buffer to the driver without any cache maintenance.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	PhyEpNum is the physical endpoint number.
+* @param	BufferPtr is the buffer.
+* @param	Length is the length of the buffer.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static s32 EpStart(void *InstancePtr, u32 PhyEpNum, u8 *BufferPtr, u32 Length)
+{
+	if ((PhyEpNum & 1U) == USB_EP_DIR_IN) {
+		return XUsbPsu_EpBufferSend((struct XUsbPsu *)InstancePtr,
+					    (u8)(PhyEpNum >> 1), BufferPtr, Length);
+	}
+
+	return XUsbPsu_EpBufferRecv((struct XUsbPsu *)InstancePtr,
+				    (u8)(PhyEpNum >> 1), BufferPtr, Length);
+}
+
+/*****************************************************************************/
+/**
+* Starts the head request of a queue. Requests the driver refuses are
+* completed with XST_FAILURE and the next one is tried.
+*
+* @param	QueuePtr is the queue.
+* @param	PhyEpNum is the physical endpoint number.
+*
+* @return	None.
+*
+* @note		Called with interrupts disabled or from the interrupt handler.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static void EpQueueStart(EpQueue *QueuePtr, u32 PhyEpNum)
+{
+	while (QueuePtr->Count != 0U) {
+		EpQueueEntry *EntryPtr = &QueuePtr->Entry[QueuePtr->Head];
+		u64 Now = UsbGetTicks();
+
+		if (QueuePtr->DoneTicks != 0U) {
+			QueuePtr->Stats.IdleTicks += Now - QueuePtr->DoneTicks;
+			QueuePtr->DoneTicks = 0U;
+		}
+		QueuePtr->StartTicks = Now;
+
+		if (EpStart(QueuePtr->InstancePtr, PhyEpNum, EntryPtr->BufferPtr,
+			    EntryPtr->Length) == XST_SUCCESS) {
+			return;
+		}
+
+		QueuePtr->Head = (QueuePtr->Head + 1U) % USB_EP_QUEUE_DEPTH;
+		QueuePtr->Count--;
+		QueuePtr->Stats.Failed++;
+		UsbEventEpCallback(EntryPtr->Callback, EntryPtr->Context,
+				   EntryPtr->BufferPtr, EntryPtr->Length, 0U,
+				   XST_FAILURE);
+	}
+}
+
+/*****************************************************************************/
+/**
+* Completes the head request of a queue. The next request is handed to the
+* controller before the callback runs so the endpoint does not sit idle
+* while the class processes the data.
+*
+* @param	QueuePtr is the queue.
+* @param	PhyEpNum is the physical endpoint number.
+* @param	BytesTxed is the number of bytes transferred.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static void EpQueueComplete(EpQueue *QueuePtr, u32 PhyEpNum, u32 BytesTxed)
 {
+	EpQueueEntry Done = QueuePtr->Entry[QueuePtr->Head];
+	u64 Now = UsbGetTicks();
+
+	QueuePtr->Stats.BusyTicks += Now - QueuePtr->StartTicks;
+	QueuePtr->Stats.Completed++;
+	QueuePtr->Stats.Bytes += BytesTxed;
+	QueuePtr->DoneTicks = Now;
+
+	QueuePtr->Head = (QueuePtr->Head + 1U) % USB_EP_QUEUE_DEPTH;
+	QueuePtr->Count--;
 
+	if ((Done.Flags & EP_QUEUE_CHAIN) != 0U && BytesTxed < Done.Length) {
+		/* Short packet, the rest of the chain gets no data */
+		u32 Flags;
+
+		do {
+			EpQueueEntry *EntryPtr = &QueuePtr->Entry[QueuePtr->Head];
+
+			Flags = EntryPtr->Flags;
+			QueuePtr->Head = (QueuePtr->Head + 1U) % USB_EP_QUEUE_DEPTH;
+			QueuePtr->Count--;
+			UsbEventEpCallback(EntryPtr->Callback, EntryPtr->Context,
+					   EntryPtr->BufferPtr, EntryPtr->Length, 0U,
+					   XST_SUCCESS);
+		} while ((Flags & EP_QUEUE_CHAIN) != 0U && QueuePtr->Count != 0U);
+	}
+
+	EpQueueStart(QueuePtr, PhyEpNum);
+
+#ifdef USB_CACHE_MANAGED
+	if ((PhyEpNum & 1U) == USB_EP_DIR_OUT) {
+		UsbCache_FromDeviceDone(Done.BufferPtr, BytesTxed);
+	}
+#endif
+
+	UsbEventEpCallback(Done.Callback, Done.Context, Done.BufferPtr,
+			   Done.Length, BytesTxed, XST_SUCCESS);
+}
+
+/*****************************************************************************/
+/**
+* Completion trampoline installed for every endpoint. Serves the request
+* queue when it is in use, otherwise finishes the cache maintenance of a
+* receive buffer before calling the class handler.
+*
+* @param	PhyEpNum is the physical endpoint number.
+* @param	CallBackRef is the driver callback reference.
+* @param	RequestedBytes is the number of bytes requested.
+* @param	BytesTxed is the number of bytes transferred.
+*
+* @return	None.
+*
+* @note		None.
+*
+******************************************************************************/
+USB_HOT_TEXT
+static void EpComplete(u32 PhyEpNum, void *CallBackRef,
+		       u32 RequestedBytes, u32 BytesTxed)
+{
+	if (Queue[PhyEpNum].Count != 0U) {
+		EpQueueComplete(&Queue[PhyEpNum], PhyEpNum, BytesTxed);
+		return;
+	}
+
+#ifdef USB_CACHE_MANAGED
+	if ((PhyEpNum & 1U) == USB_EP_DIR_OUT && EpRecvBuffer[PhyEpNum] != NULL) {
+		UsbCache_FromDeviceDone(EpRecvBuffer[PhyEpNum], BytesTxed);
+	}
+#endif
+
+	if (EpUserHandler[PhyEpNum] != NULL) {
+		UsbEventEpHandler(EpUserHandler[PhyEpNum], CallBackRef,
+				  RequestedBytes, BytesTxed);
+	}
+}
+
+#define EP_TRAMPOLINE(n)						\
+USB_HOT_TEXT								\
+static void EpComplete##n(void *CallBackRef, u32 RequestedBytes,	\
+			  u32 BytesTxed)				\
+{									\
+	EpComplete(n, CallBackRef, RequestedBytes, BytesTxed);		\
+}
+
+EP_TRAMPOLINE(0)
+EP_TRAMPOLINE(1)
+EP_TRAMPOLINE(2)
+EP_TRAMPOLINE(3)
+EP_TRAMPOLINE(4)
+EP_TRAMPOLINE(5)
+EP_TRAMPOLINE(6)
+EP_TRAMPOLINE(7)
+EP_TRAMPOLINE(8)
+EP_TRAMPOLINE(9)
+EP_TRAMPOLINE(10)
+EP_TRAMPOLINE(11)
+
+static void (*const EpTrampoline[XUSBPSU_ENDPOINTS_NUM])(void *, u32, u32) = {
+	EpComplete0, EpComplete1, EpComplete2, EpComplete3,
+	EpComplete4, EpComplete5, EpComplete6, EpComplete7,
+	EpComplete8, EpComplete9, EpComplete10, EpComplete11,
+};
+
+#ifdef USB_DEFERRED_EVENTS
+static void Ch9Deferred(struct Usb_DevData *InstancePtr, SetupPacket *SetupData)
+{
+	UsbEventSetup(Ch9Func, InstancePtr, SetupData);
+}
+#endif
+
+static void RstCounted(struct Usb_DevData *InstancePtr)
+{
+	ResetCount++;
+	if (RstFunc != NULL) {
+		RstFunc(InstancePtr);
+	}
+}
+
+/****************************************************************************/
+/**
+* Copies the code and data placed in OCM by USB_HOT_TEXT, USB_HOT_DATA and
+* USB_HOT_BSS from their load address in DDR. Called first thing in main(),
+* nothing in these sections may run before.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Does nothing where OCM placement is not supported.
+*
+*****************************************************************************/
+USB_COLD_TEXT
+void UsbOcmInit(void)
+{
+#ifdef USB_OCM_HOT
+	extern u8 __ocm_text_start[], __ocm_text_end[], __ocm_text_load[];
+	extern u8 __ocm_data_start[], __ocm_data_end[], __ocm_data_load[];
+	extern u8 __ocm_bss_start[], __ocm_bss_end[];
+	u32 TextSize = (u32)(__ocm_text_end - __ocm_text_start);
+
+	memcpy(__ocm_text_start, __ocm_text_load, TextSize);
+	memcpy(__ocm_data_start, __ocm_data_load,
+	       (u32)(__ocm_data_end - __ocm_data_start));
+	memset(__ocm_bss_start, 0, (u32)(__ocm_bss_end - __ocm_bss_start));
+
+	/* Make the copied code visible to instruction fetch */
+	Xil_DCacheFlushRange((INTPTR)__ocm_text_start, TextSize);
+	Xil_ICacheInvalidateRange((INTPTR)__ocm_text_start, TextSize);
+#endif
+}
+
+void CacheInit(void)
+{
+	UsbCache_Init();
 }
 
+USB_COLD_TEXT
 s32 CfgInitialize(struct Usb_DevData *InstancePtr,
 		  Usb_Config *ConfigPtr, u32 BaseAddress)
 {
+	s32 Status;
+
+#ifdef USB_CACHE_MANAGED
+	/* .usb_noncache is not cleared by the startup code */
+	memset(&PrivateData, 0, sizeof(PrivateData));
+#endif
 	PrivateData.AppData = InstancePtr;
 	InstancePtr->PrivateData = (void *)&PrivateData;
 
-	return XUsbPsu_CfgInitialize((struct XUsbPsu *)InstancePtr->PrivateData,
-				     ConfigPtr, BaseAddress);
+#if defined (USB_CACHE_MANAGED) || defined (USB_CACHE_HW_COHERENT)
+	/*
+	 * Driver structures are either non-cacheable or snooped, data
+	 * buffers are maintained by the wrappers or by the hardware.
+	 */
+	ConfigPtr->IsCacheCoherent = 1U;
+#endif
+
+	Status = XUsbPsu_CfgInitialize((struct XUsbPsu *)InstancePtr->PrivateData,
+				       ConfigPtr, BaseAddress);
+	if (Status == XST_SUCCESS) {
+		XUsbPsu_set_rsthandler(&PrivateData, RstCounted);
+	}
+
+	return Status;
 }
 
 void Set_Ch9Handler(
 	void *InstancePtr,
 	void (*func)(struct Usb_DevData *, SetupPacket *))
 {
+#ifdef USB_DEFERRED_EVENTS
+	/*
+	 * Setup packets are handled from the main loop, the controller NAKs
+	 * the data and status stages until the reply is queued.
+	 */
+	Ch9Func = func;
+	XUsbPsu_set_ch9handler((struct XUsbPsu *)InstancePtr, Ch9Deferred);
+#else
 	XUsbPsu_set_ch9handler((struct XUsbPsu *)InstancePtr, func);
+#endif
 }
 
 void Set_RstHandler(void *InstancePtr, void (*func)(struct Usb_DevData *))
 {
-	XUsbPsu_set_rsthandler((struct XUsbPsu *)InstancePtr, func);
+	RstFunc = func;
+	XUsbPsu_set_rsthandler((struct XUsbPsu *)InstancePtr, RstCounted);
 }
 
 void Set_Disconnect(void *InstancePtr, void (*func)(struct Usb_DevData *))
@@ -90,18 +435,35 @@ void EpConfigure(void *UsbInstance, u8 EndpointNo, u8 dir, u32 Type)
 	(void)Type;
 }
 
+/****************************************************************************/
+/**
+* Builds the DMA buffer pool in the memory provided by the application.
+*
+* @param	UsbInstance is a private member of Usb_DevData instance.
+* @param	MemPtr is the memory for the pool, cache line aligned.
+* @param	memSize is the size of the memory.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		Buffers are then obtained with UsbPool_Alloc().
+*
+*****************************************************************************/
+USB_COLD_TEXT
 s32 ConfigureDevice(void *UsbInstance, u8 *MemPtr, u32 memSize)
 {
 	(void)UsbInstance;
-	(void)MemPtr;
-	(void)memSize;
-	return XST_SUCCESS;
+
+	return UsbPool_Init(MemPtr, memSize);
 }
 
 void SetEpHandler(void *InstancePtr, u8 Epnum,
 		  u8 Dir, void (*Handler)(void *, u32, u32))
 {
-	XUsbPsu_SetEpHandler((struct XUsbPsu *)InstancePtr, Epnum, Dir, Handler);
+	u32 PhyEpNum = PhysicalEp(Epnum, Dir);
+
+	EpUserHandler[PhyEpNum] = Handler;
+	XUsbPsu_SetEpHandler((struct XUsbPsu *)InstancePtr, Epnum, Dir,
+			     EpTrampoline[PhyEpNum]);
 }
 
 s32 Usb_Start(void *InstancePtr)
@@ -129,26 +491,56 @@ void EpClearStall(void *InstancePtr, u8 Epnum, u8 Dir)
 	XUsbPsu_EpClearStall((struct XUsbPsu *)InstancePtr, Epnum, Dir);
 }
 
+USB_HOT_TEXT
 s32 EpBufferSend(void *InstancePtr, u8 UsbEp,
 		 u8 *BufferPtr, u32 BufferLen)
 {
-	if (UsbEp == 0 && BufferLen == 0) {
-		return XST_SUCCESS;
-	} else
-		return XUsbPsu_EpBufferSend((struct XUsbPsu *)InstancePtr,
-					    UsbEp, BufferPtr, BufferLen);
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Batch Batch;
+#endif
 
+	if (UsbEp == 0) {
+		UsbLatency_Mark(USB_LATENCY_SETUP_REPLY);
+		if (BufferLen == 0) {
+			return XST_SUCCESS;
+		}
+	}
+
+#ifdef USB_CACHE_MANAGED
+	UsbCache_BatchInit(&Batch);
+	UsbCache_ToDevice(&Batch, BufferPtr, BufferLen);
+	UsbCache_BatchSync(&Batch);
+#endif
+
+	return EpStart(InstancePtr, PhysicalEp(UsbEp, USB_EP_DIR_IN),
+		       BufferPtr, BufferLen);
 }
 
+USB_HOT_TEXT
 s32 EpBufferRecv(void *InstancePtr, u8 UsbEp,
 		 u8 *BufferPtr, u32 Length)
 {
-	return XUsbPsu_EpBufferRecv((struct XUsbPsu *)InstancePtr, UsbEp,
-				    BufferPtr, Length);
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Batch Batch;
+
+	UsbCache_BatchInit(&Batch);
+	UsbCache_FromDevice(&Batch, BufferPtr, Length);
+	UsbCache_BatchSync(&Batch);
+	EpRecvBuffer[PhysicalEp(UsbEp, USB_EP_DIR_OUT)] = BufferPtr;
+#endif
+
+	return EpStart(InstancePtr, PhysicalEp(UsbEp, USB_EP_DIR_OUT),
+		       BufferPtr, Length);
 }
 
 void EpSetStall(void *InstancePtr, u8 Epnum, u8 Dir)
 {
+	u32 PhyEpNum = PhysicalEp(Epnum, Dir);
+
+	if (PhyEpNum < XUSBPSU_ENDPOINTS_NUM) {
+		Queue[PhyEpNum].Stats.Stalls++;
+	}
+
 	if (!Epnum) {
 		XUsbPsu_Ep0StallRestart((struct XUsbPsu *)InstancePtr);
 	} else  {
@@ -348,3 +740,747 @@ void StreamOff(void *InstancePtr, u8 EpNum, u8 Dir)
 {
 	StopTransfer((struct XUsbPsu *)InstancePtr, EpNum, Dir);
 }
+
+/****************************************************************************/
+/**
+* Returns a free running time stamp in USB_TICKS_PER_SECOND units.
+*
+* @param	None.
+*
+* @return	Current time stamp.
+*
+* @note		None.
+*
+*****************************************************************************/
+u64 UsbGetTicks(void)
+{
+	XTime Now;
+
+	XTime_GetTime(&Now);
+	return (u64)Now;
+}
+
+/****************************************************************************/
+/**
+* Disables interrupts on the calling core.
+*
+* @param	None.
+*
+* @return	Previous interrupt state for UsbIrqRestore().
+*
+* @note		May be nested and called from the interrupt handler.
+*
+*****************************************************************************/
+u32 UsbIrqSave(void)
+{
+	u32 Flags;
+
+#if defined (USB_HOST_SIM)
+	/* The simulation delivers interrupts from the same thread */
+	Flags = 0U;
+#elif defined (__aarch64__)
+	u64 Daif;
+
+	__asm__ __volatile__("mrs %0, daif\n\tmsr daifset, #2"
+			     : "=r" (Daif) : : "memory");
+	Flags = (u32)Daif;
+#elif defined (__MICROBLAZE__)
+	Flags = mfmsr();
+	microblaze_disable_interrupts();
+#else
+	__asm__ __volatile__("mrs %0, cpsr\n\tcpsid i"
+			     : "=r" (Flags) : : "memory");
+#endif
+
+	return Flags;
+}
+
+/****************************************************************************/
+/**
+* Restores the interrupt state saved by UsbIrqSave().
+*
+* @param	Flags is the value returned by UsbIrqSave().
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+void UsbIrqRestore(u32 Flags)
+{
+#if defined (USB_HOST_SIM)
+	(void)Flags;
+#elif defined (__aarch64__)
+	__asm__ __volatile__("msr daif, %0" : : "r" ((u64)Flags) : "memory");
+#elif defined (__MICROBLAZE__)
+	if ((Flags & 0x2U) != 0U) {
+		microblaze_enable_interrupts();
+	}
+#else
+	if ((Flags & 0x80U) == 0U) {
+		__asm__ __volatile__("cpsie i" : : : "memory");
+	}
+#endif
+}
+
+/****************************************************************************/
+/**
+* Sets the handler of the timer interrupt. The timer is the comparator of
+* the generic timer of the calling core, whose counter UsbGetTicks() reads.
+* UsbTimerIntrHandler() has to be connected to its interrupt: PPI 29 at
+* EL3, PPI 30 at non-secure EL1.
+*
+* @param	Handler is called in interrupt context when the deadline
+*		given to UsbTimerArm() has passed.
+* @param	Context is passed to the handler.
+*
+* @return	XST_SUCCESS, or XST_NO_FEATURE if the processor has no timer
+*		for it and the caller has to check its deadlines by polling.
+*
+* @note		None.
+*
+*****************************************************************************/
+s32 UsbTimerSetHandler(Usb_TimerHandler Handler, void *Context)
+{
+#if defined (USB_HOST_SIM) || defined (__aarch64__)
+	TimerFunc = Handler;
+	TimerContext = Context;
+
+	return XST_SUCCESS;
+#else
+	(void)Handler;
+	(void)Context;
+
+	return XST_NO_FEATURE;
+#endif
+}
+
+/****************************************************************************/
+/**
+* Arms the timer. A deadline armed before is replaced.
+*
+* @param	Deadline is the UsbGetTicks() time stamp the handler runs at,
+*		at once if it has already passed.
+*
+* @return	None.
+*
+* @note		May be called from the timer handler to run it again.
+*
+*****************************************************************************/
+void UsbTimerArm(u64 Deadline)
+{
+#if defined (USB_HOST_SIM)
+	UsbSim_TimerSet(Deadline, TRUE);
+#elif defined (__aarch64__) && (EL1_NONSECURE == 1)
+	__asm__ __volatile__("msr cntp_cval_el0, %0\n\t"
+			     "msr cntp_ctl_el0, %1\n\tisb"
+			     : : "r" (Deadline), "r" ((u64)1U) : "memory");
+#elif defined (__aarch64__)
+	__asm__ __volatile__("msr cntps_cval_el1, %0\n\t"
+			     "msr cntps_ctl_el1, %1\n\tisb"
+			     : : "r" (Deadline), "r" ((u64)1U) : "memory");
+#else
+	(void)Deadline;
+#endif
+}
+
+/****************************************************************************/
+/**
+* Disarms the timer.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+void UsbTimerCancel(void)
+{
+#if defined (USB_HOST_SIM)
+	UsbSim_TimerSet(0U, FALSE);
+#elif defined (__aarch64__) && (EL1_NONSECURE == 1)
+	__asm__ __volatile__("msr cntp_ctl_el0, xzr\n\tisb" : : : "memory");
+#elif defined (__aarch64__)
+	__asm__ __volatile__("msr cntps_ctl_el1, xzr\n\tisb" : : : "memory");
+#endif
+}
+
+/****************************************************************************/
+/**
+* Interrupt handler of the timer. The timer is disarmed, which clears the
+* level interrupt, before the handler set by UsbTimerSetHandler() runs.
+*
+* @param	CallBackRef is not used.
+*
+* @return	None.
+*
+* @note		Connect it to the timer interrupt, see UsbTimerSetHandler().
+*
+*****************************************************************************/
+void UsbTimerIntrHandler(void *CallBackRef)
+{
+	(void)CallBackRef;
+
+	UsbTimerCancel();
+	if (TimerFunc != NULL) {
+		TimerFunc(TimerContext);
+	}
+}
+
+/****************************************************************************/
+/**
+* Queues a request on an endpoint. The queue keeps up to USB_EP_QUEUE_DEPTH
+* requests and hands the next one to the controller from the completion
+* interrupt of the previous one.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	UsbEp is the endpoint number, endpoint zero is not supported.
+* @param	Dir is USB_EP_DIR_IN or USB_EP_DIR_OUT.
+* @param	BufferPtr is the buffer.
+* @param	Length is the length of the buffer.
+* @param	Callback is called in interrupt context when the request is
+*		done.
+* @param	Context is passed to Callback.
+* @param	EntryFlags is 0 or EP_QUEUE_CHAIN.
+*
+* @return	XST_SUCCESS, XST_FAILURE if the queue is full or the driver
+*		refused the request, XST_INVALID_PARAM for bad arguments.
+*
+* @note		Completion handlers set with SetEpHandler() are not called
+*		for queued requests.
+*
+*****************************************************************************/
+static s32 EpQueueAdd(void *InstancePtr, u8 UsbEp, u8 Dir, u8 *BufferPtr,
+		      u32 Length, Usb_EpCallback Callback, void *Context,
+		      u32 EntryFlags)
+{
+	u32 PhyEpNum = PhysicalEp(UsbEp, Dir);
+	EpQueue *QueuePtr = &Queue[PhyEpNum];
+	EpQueueEntry *EntryPtr;
+	s32 Status = XST_SUCCESS;
+	u32 Flags;
+#ifdef USB_CACHE_MANAGED
+	UsbCache_Batch Batch;
+#endif
+
+	if (UsbEp == 0U || PhyEpNum >= XUSBPSU_ENDPOINTS_NUM ||
+	    Callback == NULL) {
+		return XST_INVALID_PARAM;
+	}
+
+#ifdef USB_CACHE_MANAGED
+	UsbCache_BatchInit(&Batch);
+	if (Dir == USB_EP_DIR_IN) {
+		UsbCache_ToDevice(&Batch, BufferPtr, Length);
+	} else {
+		UsbCache_FromDevice(&Batch, BufferPtr, Length);
+	}
+	UsbCache_BatchSync(&Batch);
+#endif
+
+	Flags = UsbIrqSave();
+
+	if (QueuePtr->Count == USB_EP_QUEUE_DEPTH) {
+		QueuePtr->Stats.QueueFull++;
+		UsbIrqRestore(Flags);
+		return XST_FAILURE;
+	}
+
+	if (QueuePtr->Count == 0U) {
+		XUsbPsu_SetEpHandler((struct XUsbPsu *)InstancePtr, UsbEp, Dir,
+				     EpTrampoline[PhyEpNum]);
+		QueuePtr->InstancePtr = InstancePtr;
+		if (QueuePtr->DoneTicks != 0U) {
+			QueuePtr->Stats.IdleTicks += UsbGetTicks() -
+						     QueuePtr->DoneTicks;
+			QueuePtr->DoneTicks = 0U;
+		}
+		QueuePtr->StartTicks = UsbGetTicks();
+		Status = EpStart(InstancePtr, PhyEpNum, BufferPtr, Length);
+	}
+
+	if (Status == XST_SUCCESS) {
+		EntryPtr = &QueuePtr->Entry[(QueuePtr->Head + QueuePtr->Count) %
+					    USB_EP_QUEUE_DEPTH];
+		EntryPtr->BufferPtr = BufferPtr;
+		EntryPtr->Length = Length;
+		EntryPtr->Callback = Callback;
+		EntryPtr->Context = Context;
+		EntryPtr->Flags = EntryFlags;
+		QueuePtr->Count++;
+		QueuePtr->Stats.Queued++;
+		if (QueuePtr->Count > QueuePtr->Stats.MaxDepth) {
+			QueuePtr->Stats.MaxDepth = QueuePtr->Count;
+		}
+	}
+
+	UsbIrqRestore(Flags);
+
+	return Status;
+}
+
+s32 EpQueueSend(void *InstancePtr, u8 UsbEp, u8 *BufferPtr, u32 BufferLen,
+		Usb_EpCallback Callback, void *Context)
+{
+	return EpQueueAdd(InstancePtr, UsbEp, USB_EP_DIR_IN, BufferPtr,
+			  BufferLen, Callback, Context, 0U);
+}
+
+s32 EpQueueRecv(void *InstancePtr, u8 UsbEp, u8 *BufferPtr, u32 Length,
+		Usb_EpCallback Callback, void *Context)
+{
+	return EpQueueAdd(InstancePtr, UsbEp, USB_EP_DIR_OUT, BufferPtr,
+			  Length, Callback, Context, 0U);
+}
+
+USB_HOT_TEXT
+static void EpRequestDone(void *Context, u8 *BufferPtr, u32 RequestedBytes,
+			  u32 BytesTxed, s32 Status)
+{
+	Usb_EpRequest *RequestPtr = (Usb_EpRequest *)Context;
+
+	(void)BufferPtr;
+	(void)RequestedBytes;
+
+	RequestPtr->Actual = BytesTxed;
+	RequestPtr->Status = Status;
+	if (RequestPtr->Complete != NULL) {
+		RequestPtr->Complete(RequestPtr);
+	}
+}
+
+/****************************************************************************/
+/**
+* Submits an endpoint request. The request object carries its own
+* completion callback and context, so several independent requests can be
+* in flight on the same or different endpoints.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	UsbEp is the endpoint number, endpoint zero is not supported.
+* @param	Dir is USB_EP_DIR_IN or USB_EP_DIR_OUT.
+* @param	RequestPtr is the request, it must stay valid until completion.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		Complete is called in interrupt context, it may submit the
+*		same request again.
+*
+*****************************************************************************/
+s32 EpRequestSubmit(void *InstancePtr, u8 UsbEp, u8 Dir,
+		    Usb_EpRequest *RequestPtr)
+{
+	s32 Status;
+
+	RequestPtr->Status = XST_DEVICE_BUSY;
+	RequestPtr->Actual = 0U;
+
+	Status = EpQueueAdd(InstancePtr, UsbEp, Dir, RequestPtr->BufferPtr,
+			    RequestPtr->Length, EpRequestDone, RequestPtr, 0U);
+	if (Status != XST_SUCCESS) {
+		RequestPtr->Status = Status;
+	}
+
+	return Status;
+}
+
+/****************************************************************************/
+/**
+* Stops an endpoint and completes all its queued requests with XST_FAILURE.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	UsbEp is the endpoint number.
+* @param	Dir is USB_EP_DIR_IN or USB_EP_DIR_OUT.
+*
+* @return	None.
+*
+* @note		Used on reset, disconnect and class level aborts.
+*
+*****************************************************************************/
+void EpQueueFlush(void *InstancePtr, u8 UsbEp, u8 Dir)
+{
+	u32 PhyEpNum = PhysicalEp(UsbEp, Dir);
+	EpQueue *QueuePtr = &Queue[PhyEpNum];
+	EpQueueEntry Done;
+	u32 Flags;
+
+	if (PhyEpNum >= XUSBPSU_ENDPOINTS_NUM) {
+		return;
+	}
+
+	Flags = UsbIrqSave();
+	if (QueuePtr->Count != 0U) {
+		StopTransfer(InstancePtr, UsbEp, Dir);
+	}
+
+	while (QueuePtr->Count != 0U) {
+		Done = QueuePtr->Entry[QueuePtr->Head];
+		QueuePtr->Head = (QueuePtr->Head + 1U) % USB_EP_QUEUE_DEPTH;
+		QueuePtr->Count--;
+		QueuePtr->Stats.Failed++;
+		Done.Callback(Done.Context, Done.BufferPtr, Done.Length, 0U,
+			      XST_FAILURE);
+	}
+	QueuePtr->DoneTicks = 0U;
+	UsbIrqRestore(Flags);
+}
+
+/****************************************************************************/
+/**
+* Returns the number of requests pending on an endpoint.
+*
+* @param	UsbEp is the endpoint number.
+* @param	Dir is USB_EP_DIR_IN or USB_EP_DIR_OUT.
+*
+* @return	Number of pending requests.
+*
+* @note		None.
+*
+*****************************************************************************/
+u32 EpQueuePending(u8 UsbEp, u8 Dir)
+{
+	u32 PhyEpNum = PhysicalEp(UsbEp, Dir);
+
+	if (PhyEpNum >= XUSBPSU_ENDPOINTS_NUM) {
+		return 0U;
+	}
+
+	return Queue[PhyEpNum].Count;
+}
+
+/****************************************************************************/
+/**
+* Returns the request queue statistics of an endpoint. Throughput is
+* Bytes * USB_TICKS_PER_SECOND / BusyTicks.
+*
+* @param	UsbEp is the endpoint number.
+* @param	Dir is USB_EP_DIR_IN or USB_EP_DIR_OUT.
+* @param	StatsPtr is filled with the statistics.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+void EpQueueGetStats(u8 UsbEp, u8 Dir, Usb_EpQueueStats *StatsPtr)
+{
+	u32 PhyEpNum = PhysicalEp(UsbEp, Dir);
+	u32 Flags;
+
+	if (PhyEpNum >= XUSBPSU_ENDPOINTS_NUM) {
+		return;
+	}
+
+	Flags = UsbIrqSave();
+	*StatsPtr = Queue[PhyEpNum].Stats;
+	UsbIrqRestore(Flags);
+}
+
+/****************************************************************************/
+/**
+* Returns the number of bus resets since initialization.
+*
+* @param	None.
+*
+* @return	Reset count.
+*
+* @note		None.
+*
+*****************************************************************************/
+u32 UsbGetResetCount(void)
+{
+	return ResetCount;
+}
+
+/****************************************************************************/
+/**
+* Gathers the segments of a vector into a bounce buffer.
+*
+* @param	Vec is the segment array.
+* @param	Count is the number of segments.
+* @param	Seg is the first segment.
+* @param	Off is the offset in the first segment.
+* @param	Buffer is the bounce buffer.
+* @param	Length is the number of bytes to copy.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+static void EpVecCopy(const Usb_IoVec *Vec, u32 Count, u32 Seg, u32 Off,
+		      u8 *Buffer, u32 Length)
+{
+	while (Length != 0U && Seg < Count) {
+		u32 Chunk = Vec[Seg].Len - Off;
+
+		if (Chunk > Length) {
+			Chunk = Length;
+		}
+		memcpy(Buffer, Vec[Seg].Base + Off, Chunk);
+		Buffer += Chunk;
+		Length -= Chunk;
+		Off += Chunk;
+		if (Off == Vec[Seg].Len) {
+			Seg++;
+			Off = 0U;
+		}
+	}
+}
+
+/****************************************************************************/
+/**
+* Splits the next piece off a vector. Runs of whole max packets are sent
+* straight from the segment, anything that would end a packet early inside
+* the transfer is coalesced into one max packet bounce buffer.
+*
+* @param	Vec is the segment array.
+* @param	Count is the number of segments.
+* @param	Seg is the current segment, advanced past the piece.
+* @param	Off is the offset in the current segment, advanced past the piece.
+* @param	Left is the number of bytes left in the vector, reduced by the
+*		piece length.
+* @param	MaxPacket is the endpoint max packet size.
+* @param	Bounce is set to TRUE if the piece needs a bounce buffer.
+*
+* @return	Length of the piece, 0 when the vector is done.
+*
+* @note		None.
+*
+*****************************************************************************/
+static u32 EpVecNextPiece(const Usb_IoVec *Vec, u32 Count, u32 *Seg,
+			  u32 *Off, u32 *Left, u32 MaxPacket, u32 *Bounce)
+{
+	u32 Avail;
+	u32 Length;
+
+	while (*Seg < Count && *Off == Vec[*Seg].Len) {
+		(*Seg)++;
+		*Off = 0U;
+	}
+	if (*Seg == Count || *Left == 0U) {
+		return 0U;
+	}
+
+	Avail = Vec[*Seg].Len - *Off;
+	Length = (Avail == *Left) ? Avail : Avail - (Avail % MaxPacket);
+
+	if (Length != 0U) {
+		*Bounce = FALSE;
+		*Off += Length;
+		*Left -= Length;
+		return Length;
+	}
+
+	/* Gather up to one max packet across the segment boundary */
+	Length = (*Left < MaxPacket) ? *Left : MaxPacket;
+	*Bounce = TRUE;
+	*Left -= Length;
+	Avail = Length;
+	while (Avail != 0U) {
+		u32 Chunk = Vec[*Seg].Len - *Off;
+
+		if (Chunk > Avail) {
+			Chunk = Avail;
+		}
+		Avail -= Chunk;
+		*Off += Chunk;
+		if (*Off == Vec[*Seg].Len && Avail != 0U) {
+			(*Seg)++;
+			*Off = 0U;
+		}
+	}
+
+	return Length;
+}
+
+static void EpVecPieceDone(EpVecXfer *XferPtr, u32 BytesTxed, s32 Status)
+{
+	XferPtr->Txed += BytesTxed;
+	if (Status != XST_SUCCESS) {
+		XferPtr->Requested = 0U;
+	}
+
+	if (--XferPtr->Pending == 0U) {
+		EpVecXfer Done = *XferPtr;
+
+		UsbPool_Free(XferPtr);
+		Done.Callback(Done.Context, NULL, Done.Requested, Done.Txed,
+			      Done.Requested != 0U ? XST_SUCCESS : XST_FAILURE);
+	}
+}
+
+static void EpVecDirectDone(void *Context, u8 *BufferPtr,
+			    u32 RequestedBytes, u32 BytesTxed, s32 Status)
+{
+	(void)BufferPtr;
+	(void)RequestedBytes;
+
+	EpVecPieceDone((EpVecXfer *)Context, BytesTxed, Status);
+}
+
+static void EpVecBounceDone(void *Context, u8 *BufferPtr,
+			    u32 RequestedBytes, u32 BytesTxed, s32 Status)
+{
+	EpVecBounce *BouncePtr = (EpVecBounce *)Context;
+	EpVecXfer *XferPtr = BouncePtr->XferPtr;
+
+	(void)BufferPtr;
+	(void)RequestedBytes;
+
+	UsbPool_Free(BouncePtr->Bounce);
+	UsbPool_Free(BouncePtr);
+	EpVecPieceDone(XferPtr, BytesTxed, Status);
+}
+
+/****************************************************************************/
+/**
+* Sends a transfer gathered from several buffers without copying them into
+* one contiguous buffer.
+*
+* @param	InstancePtr is a private member of Usb_DevData instance.
+* @param	UsbEp is the endpoint number, endpoint zero is not supported.
+* @param	Vec is the segment array, it must stay valid until completion.
+* @param	Count is the number of segments.
+* @param	Callback is called once for the whole transfer with a NULL
+*		buffer pointer.
+* @param	Context is passed to Callback.
+*
+* @return	XST_SUCCESS else XST_FAILURE
+*
+* @note		Segments that are a multiple of the max packet size go out
+*		in place. A shorter segment inside the transfer is merged with
+*		the following data through one max packet bounce buffer, so
+*		the host never sees an early short packet. A short header in
+*		front of the payload, such as the 10 byte CCID header, is
+*		therefore still copied together with the first max packet of
+*		payload. XUsbPsu_EpBufferSend() programs a single TRB per
+*		request and the driver has no interface to chain TRBs of one
+*		transfer, the copy is bounded to one max packet per short
+*		segment instead.
+*
+*****************************************************************************/
+s32 EpBufferSendV(void *InstancePtr, u8 UsbEp, const Usb_IoVec *Vec,
+		  u32 Count, Usb_EpCallback Callback, void *Context)
+{
+	u32 PhyEpNum = PhysicalEp(UsbEp, USB_EP_DIR_IN);
+	EpVecXfer *XferPtr;
+	u32 MaxPacket;
+	u32 Total = 0U;
+	u32 Pieces = 0U;
+	u32 Seg = 0U;
+	u32 Off = 0U;
+	u32 Left;
+	u32 Length;
+	u32 Bounce;
+	u32 Flags;
+	s32 Status = XST_SUCCESS;
+
+	if (UsbEp == 0U || PhyEpNum >= XUSBPSU_ENDPOINTS_NUM ||
+	    Callback == NULL || Vec == NULL) {
+		return XST_INVALID_PARAM;
+	}
+
+	MaxPacket = ((struct XUsbPsu *)InstancePtr)->eps[PhyEpNum].MaxSize;
+	if (MaxPacket == 0U) {
+		return XST_FAILURE;
+	}
+
+	for (Seg = 0U; Seg < Count; Seg++) {
+		Total += Vec[Seg].Len;
+	}
+
+	/* Count the pieces first, the whole chain must fit in the queue */
+	Seg = 0U;
+	Left = Total;
+	while (EpVecNextPiece(Vec, Count, &Seg, &Off, &Left, MaxPacket,
+			      &Bounce) != 0U) {
+		Pieces++;
+	}
+	if (Pieces == 0U) {
+		/* Zero length transfer */
+		return EpQueueSend(InstancePtr, UsbEp, NULL, 0U, Callback,
+				   Context);
+	}
+
+	XferPtr = UsbPool_Alloc(sizeof(EpVecXfer));
+	if (XferPtr == NULL) {
+		return XST_FAILURE;
+	}
+	XferPtr->Callback = Callback;
+	XferPtr->Context = Context;
+	XferPtr->Requested = Total;
+	XferPtr->Txed = 0U;
+	XferPtr->Pending = Pieces;
+
+	Flags = UsbIrqSave();
+
+	if (USB_EP_QUEUE_DEPTH - Queue[PhyEpNum].Count < Pieces) {
+		Queue[PhyEpNum].Stats.QueueFull++;
+		UsbIrqRestore(Flags);
+		UsbPool_Free(XferPtr);
+		return XST_FAILURE;
+	}
+
+	Seg = 0U;
+	Off = 0U;
+	Left = Total;
+	while (Status == XST_SUCCESS && Pieces != 0U) {
+		u32 PieceSeg = Seg;
+		u32 PieceOff = Off;
+		u32 EntryFlags = (Pieces > 1U) ? EP_QUEUE_CHAIN : 0U;
+
+		while (PieceSeg < Count && PieceOff == Vec[PieceSeg].Len) {
+			PieceSeg++;
+			PieceOff = 0U;
+		}
+		Length = EpVecNextPiece(Vec, Count, &Seg, &Off, &Left, MaxPacket,
+					&Bounce);
+
+		if (Bounce == FALSE) {
+			Status = EpQueueAdd(InstancePtr, UsbEp, USB_EP_DIR_IN,
+					    Vec[PieceSeg].Base + PieceOff, Length,
+					    EpVecDirectDone, XferPtr, EntryFlags);
+		} else {
+			EpVecBounce *BouncePtr = UsbPool_Alloc(sizeof(EpVecBounce));
+			u8 *Buffer = UsbPool_Alloc(MaxPacket);
+
+			if (BouncePtr == NULL || Buffer == NULL) {
+				UsbPool_Free(BouncePtr);
+				UsbPool_Free(Buffer);
+				Status = XST_FAILURE;
+				break;
+			}
+			BouncePtr->XferPtr = XferPtr;
+			BouncePtr->Bounce = Buffer;
+			EpVecCopy(Vec, Count, PieceSeg, PieceOff, Buffer,
+				  Length);
+			Status = EpQueueAdd(InstancePtr, UsbEp, USB_EP_DIR_IN,
+					    Buffer, Length, EpVecBounceDone,
+					    BouncePtr, EntryFlags);
+			if (Status != XST_SUCCESS) {
+				UsbPool_Free(BouncePtr);
+				UsbPool_Free(Buffer);
+			}
+		}
+		if (Status == XST_SUCCESS) {
+			Pieces--;
+		}
+	}
+
+	if (Status != XST_SUCCESS) {
+		if (Pieces == XferPtr->Pending) {
+			/* Nothing queued */
+			UsbIrqRestore(Flags);
+			UsbPool_Free(XferPtr);
+			return Status;
+		}
+		/* Queued pieces complete the transfer as failed */
+		XferPtr->Requested = 0U;
+		XferPtr->Pending -= Pieces;
+	}
+
+	UsbIrqRestore(Flags);
+
+	return Status;
+}
@@ -38,6 +38,7 @@ extern "C" {
 
 /***************************** Include Files ********************************/
 #include "xusbpsu.h"
+#include "xiltimer.h"
 
 /************************** Constant Definitions ****************************/
 #define USB_DEVICE_ID		XPAR_XUSBPSU_0_DEVICE_ID
@@ -107,6 +108,33 @@ extern "C" {
 #define	USB_TEST_PACKET			XUSBPSU_TEST_PACKET
 #define	USB_TEST_FORCE_ENABLE	XUSBPSU_TEST_FORCE_ENABLE
 
+/* Requests that can be queued per endpoint with EpQueueSend/EpQueueRecv */
+#ifndef USB_EP_QUEUE_DEPTH
+#define USB_EP_QUEUE_DEPTH		8U
+#endif
+
+/* Resolution of the time stamps returned by UsbGetTicks() */
+#define USB_TICKS_PER_SECOND	COUNTS_PER_SECOND
+
+/*
+ * Interrupt path code and small control buffers are placed in OCM on the
+ * ZynqMP A53, see lscript.ld. UsbOcmInit() copies them there. Elsewhere hot
+ * code is grouped in .text.hot and cold code in .text.unlikely.
+ */
+#if defined (PLATFORM_ZYNQMP) && defined (__aarch64__)
+#define USB_OCM_HOT
+#define USB_HOT_TEXT	__attribute__ ((hot, section (".ocm_text")))
+#define USB_HOT_DATA	__attribute__ ((section (".ocm_data")))
+#define USB_HOT_BSS	__attribute__ ((section (".bss.ocm")))
+#else
+#define USB_HOT_TEXT	__attribute__ ((hot))
+#define USB_HOT_DATA
+#define USB_HOT_BSS
+#endif
+
+/* Initialization and error paths, optimized for size */
+#define USB_COLD_TEXT	__attribute__ ((cold))
+
 /* TODO: If we enable this macro, reconnection is failed with 2017.3 */
 #define USB_LPM_MODE			XUSBPSU_LPM_MODE
 
@@ -116,6 +144,48 @@ extern "C" {
 #define PhysicalEp(epnum, direction)	(((epnum) << 1 ) | (direction))
 
 /**************************** Type Definitions ******************************/
+/*
+ * Completion callback of a queued request. Status is XST_SUCCESS, or
+ * XST_FAILURE when the request was flushed or could not be started.
+ */
+typedef void (*Usb_EpCallback)(void *Context, u8 *BufferPtr,
+			       u32 RequestedBytes, u32 BytesTxed, s32 Status);
+
+/*
+ * Endpoint request. The submitter fills BufferPtr, Length, Complete and
+ * Context, the wrapper fills Status and Actual before calling Complete.
+ * Status is XST_DEVICE_BUSY while the request is in flight.
+ */
+typedef struct Usb_EpRequest Usb_EpRequest;
+struct Usb_EpRequest {
+	u8 *BufferPtr;
+	u32 Length;
+	void (*Complete)(Usb_EpRequest *RequestPtr);
+	void *Context;
+	s32 Status;
+	u32 Actual;
+};
+
+/* Handler of the timer armed with UsbTimerArm(), runs in interrupt context */
+typedef void (*Usb_TimerHandler)(void *Context);
+
+/* One segment of a vectored transfer */
+typedef struct {
+	u8 *Base;
+	u32 Len;
+} Usb_IoVec;
+
+typedef struct {
+	u32 Queued;		/* Requests accepted */
+	u32 Completed;		/* Requests completed successfully */
+	u32 Failed;		/* Requests flushed or failed to start */
+	u32 QueueFull;		/* Requests rejected, queue full */
+	u32 MaxDepth;		/* Highest number of pending requests */
+	u32 Stalls;		/* EpSetStall() calls */
+	u64 Bytes;		/* Bytes transferred */
+	u64 BusyTicks;		/* Time a request was owned by the controller */
+	u64 IdleTicks;		/* Time between a completion and the next start */
+} Usb_EpQueueStats;
 
 /************************** Variable Definitions *****************************/
 
@@ -168,6 +238,26 @@ void SetEpInterval(void *InstancePtr, u8 UsbEpNum, u8 Dir, u32 Interval);
 void StopTransfer(void *InstancePtr, u8 EpNum, u8 Dir);
 s32 StreamOn(void *InstancePtr, u8 EpNum, u8 Dir, u8 *BufferPtr);
 void StreamOff(void *InstancePtr, u8 EpNum, u8 Dir);
+void UsbOcmInit(void);
+u64 UsbGetTicks(void);
+u32 UsbIrqSave(void);
+void UsbIrqRestore(u32 Flags);
+s32 UsbTimerSetHandler(Usb_TimerHandler Handler, void *Context);
+void UsbTimerArm(u64 Deadline);
+void UsbTimerCancel(void);
+void UsbTimerIntrHandler(void *CallBackRef);
+s32 EpQueueSend(void *InstancePtr, u8 UsbEp, u8 *BufferPtr, u32 BufferLen,
+		Usb_EpCallback Callback, void *Context);
+s32 EpQueueRecv(void *InstancePtr, u8 UsbEp, u8 *BufferPtr, u32 Length,
+		Usb_EpCallback Callback, void *Context);
+void EpQueueFlush(void *InstancePtr, u8 UsbEp, u8 Dir);
+u32 EpQueuePending(u8 UsbEp, u8 Dir);
+void EpQueueGetStats(u8 UsbEp, u8 Dir, Usb_EpQueueStats *StatsPtr);
+u32 UsbGetResetCount(void);
+s32 EpRequestSubmit(void *InstancePtr, u8 UsbEp, u8 Dir,
+		    Usb_EpRequest *RequestPtr);
+s32 EpBufferSendV(void *InstancePtr, u8 UsbEp, const Usb_IoVec *Vec,
+		  u32 Count, Usb_EpCallback Callback, void *Context);
 
 #ifdef __cplusplus
 }